@@ -0,0 +1,121 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       included by the benchmarks in bench/
+// File:        bench.h
+// Description: This file contains the helpers the benchmarks share to time
+//              work and report results. Results print as "name key=value"
+//              lines, or with BENCH_FORMAT=json as one JSON object per line,
+//              which bench/run.sh collects into a single report.
+
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+// Where results go; benchmarks that need stdout for something else can
+// point it at another stream before the first result
+static FILE* benchOutput = NULL;
+static int benchFields = 0;
+
+static inline uint64_t bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline bool bench_json(void) {
+    const char* format = getenv("BENCH_FORMAT");
+    return format != NULL && strcmp(format, "json") == 0;
+}
+
+static inline FILE* bench_output(void) {
+    return benchOutput != NULL ? benchOutput : stdout;
+}
+
+// Strings written into JSON are names and labels the benchmarks choose, so
+// only quotes and backslashes need escaping
+static inline void bench_print_string(const char* text) {
+    FILE* out = bench_output();
+    fputc('"', out);
+    for (; *text != '\0'; text++) {
+        if (*text == '"' || *text == '\\')
+            fputc('\\', out);
+        fputc(*text, out);
+    }
+    fputc('"', out);
+}
+
+static inline void bench_separator(const char* key) {
+    FILE* out = bench_output();
+    if (bench_json()) {
+        fputc(benchFields++ > 0 ? ',' : '{', out);
+        bench_print_string(key);
+        fputc(':', out);
+    } else {
+        fprintf(out, "%s%s=", benchFields++ > 0 ? " " : "", key);
+    }
+}
+
+// Start a result; the name tells apart the cases of one benchmark
+static inline void bench_begin(const char* name) {
+    benchFields = 0;
+    if (bench_json()) {
+        bench_separator("name");
+        bench_print_string(name);
+    } else {
+        fprintf(bench_output(), "%-14s", name);
+        benchFields++;
+    }
+}
+
+static inline void bench_label(const char* key, const char* value) {
+    bench_separator(key);
+    if (bench_json())
+        bench_print_string(value);
+    else
+        fprintf(bench_output(), "%s", value);
+}
+
+static inline void bench_field(const char* key, double value) {
+    bench_separator(key);
+    // JSON has no infinities or NaN
+    if (bench_json() && !isfinite(value))
+        fprintf(bench_output(), "null");
+    else if (value > -1e15 && value < 1e15 && value == (double)(long long)value)
+        fprintf(bench_output(), "%.0f", value);
+    else
+        fprintf(bench_output(), "%.6g", value);
+}
+
+static inline void bench_end(void) {
+    fprintf(bench_output(), bench_json() ? "}\n" : "\n");
+    fflush(bench_output());
+}
+
+static inline int bench_compare_uint32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Sort samples and add the usual percentiles as fields, keyed with unit
+static inline void bench_percentiles(uint32_t* samples, size_t count, const char* unit) {
+    if (count == 0)
+        return;
+    qsort(samples, count, sizeof(uint32_t), bench_compare_uint32);
+    static const struct { const char* name; int permille; } points[] = {
+        { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p99.9", 999 },
+    };
+    char key[32];
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+        snprintf(key, sizeof(key), "%s_%s", points[i].name, unit);
+        bench_field(key, samples[count * points[i].permille / 1000]);
+    }
+    snprintf(key, sizeof(key), "max_%s", unit);
+    bench_field(key, samples[count - 1]);
+}
@@ -0,0 +1,244 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/compress.c src/compress.c src/protocol.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o compress
+// File:        compress.c
+// Description: This file contains a benchmark for frame compression on
+//              repetitive chat and log traffic. It reports the compression
+//              ratio and the time added per frame to send and receive,
+//              with frames compressed on their own and against the earlier
+//              frames on the connection, next to sending them as they are.
+//              Every block and frame is first checked to come back exactly
+//              as it went in, and the benchmark fails if one does not.
+//              Usage: compress [frames]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/protocol.h"
+#include "../src/compress.h"
+#include "bench.h"
+
+static char* senders[] = { "alice", "bob", "carol", "dave" };
+static char* words[] = {
+    "the", "deploy", "is", "done", "can", "you", "check", "build", "on",
+    "staging", "looks", "good", "to", "me", "I", "will", "merge", "it",
+    "after", "lunch", "tests", "are", "green", "again", "thanks", "for",
+    "review", "meeting", "moved", "tomorrow", "at", "ten",
+};
+static const char* levels[] = { "INFO", "INFO", "INFO", "WARN", "ERROR" };
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Short conversational messages built from a small vocabulary
+static void chat_line(String* content, int i) {
+    int count = 4 + rand() % 16;
+    for (int w = 0; w < count; w++) {
+        if (w > 0)
+            string_append_char(content, ' ');
+        string_append_static(content, words[rand() % (sizeof(words) / sizeof(words[0]))]);
+    }
+    (void)i;
+}
+
+// A pasted excerpt of a service log
+static void log_lines(String* content, int i) {
+    char line[128];
+    for (int l = 0; l < 8; l++) {
+        int n = i * 8 + l;
+        snprintf(line, sizeof(line), "2026-10-17T12:%02d:%02d.%03dZ %s api request id=%d path=/v1/messages status=200 took=%dms\n",
+            n / 3600 % 60, n / 60 % 60, n % 1000, levels[rand() % 5], 100000 + n, rand() % 250);
+        string_append_static(content, line);
+    }
+}
+
+// Encode every frame up front so only compression is timed
+static void build_frames(Buffer* frames, size_t* offsets, int count, void (*content)(String*, int)) {
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        MsgFrame frame = {
+            .type = FRAME_MSG,
+            .sender = string_new_static(senders[i % 4]),
+            .content = string_new(0),
+        };
+        content(&frame.content, i);
+        offsets[i] = frames->length;
+        protocol_frame_encode(frames, (Frame*)&frame);
+        string_free(&frame.content);
+    }
+    offsets[count] = frames->length;
+}
+
+// Fill a block with runs of random bytes, of a few letters, of one repeated
+// byte and of copies of earlier blocks, so matches of every length, within
+// the block and reaching back into the window or past it, all occur
+static void random_block(uint8_t* block, size_t length, const uint8_t* past, size_t pastLength) {
+    size_t filled = 0;
+    while (filled < length) {
+        size_t run = 1 + rand() % 300;
+        if (run > length - filled)
+            run = length - filled;
+        int kind = rand() % 4;
+        if (kind == 3 && pastLength < run)
+            kind = 0;
+        for (size_t i = 0; i < run; i++) {
+            switch (kind) {
+                case 0: block[filled + i] = rand(); break;
+                case 1: block[filled + i] = 'a' + rand() % 3; break;
+                case 2: block[filled + i] = run; break;
+            }
+        }
+        if (kind == 3)
+            memcpy(block + filled, past + rand() % (pastLength - run + 1), run);
+        filled += run;
+    }
+}
+
+// Round trip random blocks through a connection's two ends, kept in the
+// window and standalone in random order, over many times the window, and
+// stop at the first one that does not come back as it went in
+static void check_blocks(int count) {
+    const size_t maxLength = 8192, pastCapacity = 4 * COMPRESS_WINDOW;
+    CompressStream sender, receiver;
+    compress_stream_init(&sender, true);
+    compress_stream_init(&receiver, false);
+    uint8_t* block = malloc(maxLength);
+    uint8_t* compressed = malloc(compress_bound(maxLength));
+    uint8_t* past = malloc(pastCapacity);
+    size_t pastLength = 0;
+    srand(2);
+    for (int i = 0; i < count; i++) {
+        size_t length = rand() % 8 == 0 ? rand() % 16 : rand() % maxLength;
+        bool keep = rand() % 4 != 0;
+        random_block(block, length, past, pastLength);
+        size_t size = compress_block(&sender, keep, block, length, compressed);
+        const uint8_t* raw = decompress_block(&receiver, keep, compressed, size, length);
+        if (raw == NULL || memcmp(raw, block, length) != 0) {
+            fprintf(stderr, "block %d (%zu bytes, %s) did not round trip\n", i, length, keep ? "kept" : "standalone");
+            exit(1);
+        }
+        if (pastLength + length > pastCapacity)
+            pastLength = 0;
+        memcpy(past + pastLength, block, length);
+        pastLength += length;
+    }
+    free(block);
+    free(compressed);
+    free(past);
+    compress_stream_free(&sender);
+    compress_stream_free(&receiver);
+}
+
+// Decode the frames sent in a run once more, untimed, and check each one
+// encodes back to the frame that was sent
+static void check_frames(const char* workload, const char* mode, Buffer* wire, Buffer* frames, size_t* offsets) {
+    CompressStream receiver;
+    compress_stream_init(&receiver, false);
+    Buffer encoded;
+    buffer_init(&encoded, 0);
+    size_t offset = 0;
+    for (int i = 0; offset < wire->length; i++) {
+        Frame* frame;
+        int result = protocol_frame_decode_stream(wire->data + offset, wire->length - offset, PROTOCOL_VERSION, &receiver, &frame);
+        if (result <= 0 || frame == NULL) {
+            fprintf(stderr, "%s %s: decode failed at frame %d\n", workload, mode, i);
+            exit(1);
+        }
+        buffer_clear(&encoded);
+        protocol_frame_encode(&encoded, frame);
+        protocol_frame_free(frame);
+        size_t length = offsets[i + 1] - offsets[i];
+        if (encoded.length != length || memcmp(encoded.data, frames->data + offsets[i], length) != 0) {
+            fprintf(stderr, "%s %s: frame %d did not round trip\n", workload, mode, i);
+            exit(1);
+        }
+        offset += result;
+    }
+    buffer_free(&encoded);
+    compress_stream_free(&receiver);
+}
+
+static void run(const char* workload, const char* mode, Buffer* frames, size_t* offsets, int count) {
+    bool compress = strcmp(mode, "raw") != 0;
+    bool streaming = strcmp(mode, "streaming") == 0;
+    CompressStream sender, receiver;
+    compress_stream_init(&sender, true);
+    compress_stream_init(&receiver, false);
+    Buffer wire;
+    buffer_init(&wire, 0);
+
+    uint64_t start = now_nanos();
+    for (int i = 0; i < count; i++) {
+        const uint8_t* frame = frames->data + offsets[i];
+        size_t length = offsets[i + 1] - offsets[i];
+        if (compress)
+            protocol_frames_compress(&wire, frame, length, &sender, streaming);
+        else
+            buffer_append(&wire, frame, length);
+    }
+    uint64_t encodeTime = now_nanos() - start;
+
+    start = now_nanos();
+    size_t offset = 0;
+    int decoded = 0;
+    while (offset < wire.length) {
+        Frame* frame;
+        int result = protocol_frame_decode_stream(wire.data + offset, wire.length - offset, PROTOCOL_VERSION, &receiver, &frame);
+        if (result <= 0 || frame == NULL) {
+            fprintf(stderr, "decode failed at frame %d\n", decoded);
+            exit(1);
+        }
+        protocol_frame_free(frame);
+        offset += result;
+        decoded++;
+    }
+    uint64_t decodeTime = now_nanos() - start;
+    check_frames(workload, mode, &wire, frames, offsets);
+
+    bench_begin(workload);
+    bench_label("mode", mode);
+    bench_field("bytes/frame", (double)wire.length / count);
+    bench_field("ratio", (double)frames->length / wire.length);
+    bench_field("send_ns/frame", (double)encodeTime / count);
+    bench_field("recv_ns/frame", (double)decodeTime / count);
+    bench_end();
+
+    buffer_free(&wire);
+    compress_stream_free(&sender);
+    compress_stream_free(&receiver);
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 200000;
+    const char* modes[] = { "raw", "stateless", "streaming" };
+    struct {
+        const char* name;
+        void (*content)(String*, int);
+    } workloads[] = {
+        { "chat", chat_line },
+        { "log", log_lines },
+    };
+
+    check_blocks(20000);
+    size_t* offsets = malloc((count + 1) * sizeof(size_t));
+    for (int w = 0; w < 2; w++) {
+        Buffer frames;
+        buffer_init(&frames, 0);
+        build_frames(&frames, offsets, count, workloads[w].content);
+        for (int m = 0; m < 3; m++)
+            run(workloads[w].name, modes[m], &frames, offsets, count);
+        buffer_free(&frames);
+    }
+    free(offsets);
+    return 0;
+}
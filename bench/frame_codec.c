@@ -0,0 +1,245 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/frame_codec.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o frame_codec
+// File:        frame_codec.c
+// Description: This file contains a benchmark of message frame throughput:
+//              encoding and decoding in memory, then writing frames with
+//              protocol_frame_write_msg and reading them back with
+//              protocol_frame_read over a socketpair and loopback TCP.
+//              Frames written by the original encoder are checked to
+//              decode and encode back the same in version 1 first.
+//              Usage: frame_codec [frames]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/ringbuffer.h"
+#include "../src/protocol.h"
+#include "bench.h"
+
+typedef struct {
+    int socketfd;
+    int frames;
+    MsgFrame* frame;
+} Writer;
+
+// An ident, a message with two attachments and a ping, as written by the
+// original field-by-field encoder that version 1 peers run
+static const uint8_t version1Frames[] = {
+    // Ident from alice
+    0x00, 0x05, 'a', 'l', 'i', 'c', 'e',
+    // "hi there" with notes.txt (1234 bytes) and disk.img (4000000000 bytes)
+    0x01, 0x00, 0x08, 0x02,
+    0x09, 'n', 'o', 't', 'e', 's', '.', 't', 'x', 't', 0x00, 0x00, 0x04, 0xd2,
+    0x08, 'd', 'i', 's', 'k', '.', 'i', 'm', 'g', 0xee, 0x6b, 0x28, 0x00,
+    'h', 'i', ' ', 't', 'h', 'e', 'r', 'e',
+    // Ping last active at 1700000000
+    0x02, 0x65, 0x53, 0xf1, 0x00,
+};
+
+static void check_failed(const char* what) {
+    fprintf(stderr, "version 1: %s\n", what);
+    exit(1);
+}
+
+// Decode the original encoder's frames as a version 1 peer's, then check
+// that encoding them for version 1, directly and by converting version 2
+// frames, gives back its bytes. Idents are only decoded, since newer ones
+// carry the version after the name.
+static void check_version1(void) {
+    const size_t identLength = 7;
+    Frame* frames[3];
+    size_t offset = 0;
+    for (int i = 0; i < 3; i++) {
+        int result = protocol_frame_decode_version(version1Frames + offset, sizeof(version1Frames) - offset, 1, &frames[i]);
+        if (result <= 0)
+            check_failed("frame did not decode");
+        offset += result;
+    }
+    IdentFrame* ident = (IdentFrame*)frames[0];
+    MsgFrame* msg = (MsgFrame*)frames[1];
+    PingFrame* ping = (PingFrame*)frames[2];
+    if (offset != sizeof(version1Frames)
+        || ident->type != FRAME_IDENT || strcmp(string_data(&ident->name), "alice") != 0 || ident->version != 1
+        || msg->type != FRAME_MSG || strcmp(string_data(&msg->content), "hi there") != 0 || msg->sender.length != 0
+        || msg->attachmentCount != 2 || strcmp(string_data(&msg->attachmentNames[1]), "disk.img") != 0
+        || msg->attachmentSizes[0] != 1234 || msg->attachmentSizes[1] != 4000000000u
+        || ping->type != FRAME_PING || ping->lastActive != 1700000000u)
+        check_failed("frames decoded wrong");
+
+    // The sender only exists in version 2, so it is left out
+    string_free(&msg->sender);
+    msg->sender = string_new_static("bob");
+    Buffer encoded, version2, converted;
+    buffer_init(&encoded, 64);
+    buffer_init(&version2, 64);
+    buffer_init(&converted, 64);
+    for (int i = 1; i < 3; i++) {
+        protocol_frame_encode_version(&encoded, frames[i], 1);
+        protocol_frame_encode(&version2, frames[i]);
+    }
+    protocol_frames_convert(&converted, version2.data, version2.length, 1);
+    const uint8_t* expected = version1Frames + identLength;
+    size_t expectedLength = sizeof(version1Frames) - identLength;
+    if (encoded.length != expectedLength || memcmp(encoded.data, expected, expectedLength) != 0)
+        check_failed("frames encoded differently");
+    if (converted.length != expectedLength || memcmp(converted.data, expected, expectedLength) != 0)
+        check_failed("frames converted differently");
+
+    // A file too large to announce keeps the message from version 1 peers
+    msg->attachmentSizes[1] = 5000000000ull;
+    buffer_clear(&encoded);
+    buffer_clear(&version2);
+    buffer_clear(&converted);
+    protocol_frame_encode(&version2, (Frame*)msg);
+    if (protocol_frame_encode_version(&encoded, (Frame*)msg, 1) == 0
+        || protocol_frames_convert(&converted, version2.data, version2.length, 1) < 0 || converted.length != 0)
+        check_failed("message with a 5 GB attachment was not left out");
+
+    for (int i = 0; i < 3; i++)
+        protocol_frame_free(frames[i]);
+    buffer_free(&encoded);
+    buffer_free(&version2);
+    buffer_free(&converted);
+}
+
+static void* write_frames(void* arg) {
+    Writer* writer = arg;
+    Buffer buffer;
+    buffer_init(&buffer, 512);
+    for (int i = 0; i < writer->frames; i++) {
+        if (protocol_frame_write_msg(writer->socketfd, &buffer, writer->frame) < 0)
+            break;
+    }
+    buffer_free(&buffer);
+    shutdown(writer->socketfd, SHUT_WR);
+    return NULL;
+}
+
+static void report(const char* name, int contentSize, int frames, size_t frameBytes, uint64_t elapsed) {
+    bench_begin(name);
+    bench_field("content_bytes", contentSize);
+    bench_field("frames", frames);
+    bench_field("ns/frame", (double)elapsed / frames);
+    bench_field("frames/s", frames / (elapsed / 1e9));
+    bench_field("MB/s", (double)frameBytes * frames / (elapsed / 1e9) / 1e6);
+    bench_end();
+}
+
+// Encode into one buffer and decode it back, without any syscalls
+static void run_memory(MsgFrame* frame, int contentSize, int frames) {
+    Buffer buffer;
+    buffer_init(&buffer, 512);
+    uint64_t start = bench_now();
+    for (int i = 0; i < frames; i++) {
+        buffer_clear(&buffer);
+        protocol_frame_encode(&buffer, (Frame*)frame);
+    }
+    report("encode", contentSize, frames, buffer.length, bench_now() - start);
+
+    start = bench_now();
+    for (int i = 0; i < frames; i++) {
+        Frame* decoded;
+        if (protocol_frame_decode_version(buffer.data, buffer.length, PROTOCOL_VERSION, &decoded) <= 0) {
+            fprintf(stderr, "decode failed\n");
+            exit(1);
+        }
+        protocol_frame_free(decoded);
+    }
+    report("decode", contentSize, frames, buffer.length, bench_now() - start);
+    buffer_free(&buffer);
+}
+
+// One thread writes frames while this one reads them, so the time covers
+// both ends and the socket between them
+static void run_socket(const char* name, int sockets[2], MsgFrame* frame, int contentSize, int frames) {
+    Buffer sample;
+    buffer_init(&sample, 512);
+    protocol_frame_encode(&sample, (Frame*)frame);
+
+    RingBuffer ring;
+    ringbuffer_init(&ring, PROTOCOL_READ_BUFFER_SIZE);
+    Writer writer = { sockets[0], frames, frame };
+    pthread_t thread;
+    uint64_t start = bench_now();
+    pthread_create(&thread, NULL, write_frames, &writer);
+    int received = 0;
+    Frame* decoded;
+    while (received < frames && protocol_frame_read(sockets[1], &ring, &decoded) == 0) {
+        protocol_frame_free(decoded);
+        received++;
+    }
+    uint64_t elapsed = bench_now() - start;
+    pthread_join(thread, NULL);
+    if (received != frames)
+        fprintf(stderr, "%s: received %d of %d frames\n", name, received, frames);
+    report(name, contentSize, received, sample.length, elapsed);
+
+    ringbuffer_free(&ring);
+    buffer_free(&sample);
+    close(sockets[0]);
+    close(sockets[1]);
+}
+
+static int tcp_pair(int sockets[2]) {
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = 0 };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenfd, 1) < 0
+        || getsockname(listenfd, (struct sockaddr*)&addr, &length) < 0) {
+        perror("listen");
+        return -1;
+    }
+    sockets[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(sockets[0], (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return -1;
+    }
+    sockets[1] = accept(listenfd, NULL, NULL);
+    close(listenfd);
+    // As the app sets it, so each frame leaves on its own
+    int enable = 1;
+    setsockopt(sockets[0], IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return sockets[1] < 0 ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 1000000;
+    static const int contentSizes[] = { 16, 256, 4096 };
+    check_version1();
+
+    for (size_t i = 0; i < sizeof(contentSizes) / sizeof(contentSizes[0]); i++) {
+        int contentSize = contentSizes[i];
+        char* content = malloc(contentSize + 1);
+        memset(content, 'x', contentSize);
+        content[contentSize] = '\0';
+        MsgFrame frame = {
+            .type = FRAME_MSG,
+            .sender = string_new_static("alice"),
+            .content = string_new_borrowed(content, contentSize),
+            .attachmentCount = 0,
+        };
+
+        run_memory(&frame, contentSize, frames);
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == 0)
+            run_socket("socketpair", sockets, &frame, contentSize, frames);
+        if (tcp_pair(sockets) == 0)
+            run_socket("tcp", sockets, &frame, contentSize, frames);
+        free(content);
+    }
+    return 0;
+}
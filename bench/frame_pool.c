@@ -0,0 +1,186 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/frame_pool.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o frame_pool
+// File:        frame_pool.c
+// Description: This file contains a benchmark decoding and freeing ping,
+//              pong and chat frames with attachments, reporting the mallocs
+//              per frame once the per-thread frame pools are warm and the
+//              time per frame against allocating every frame and array.
+//              Usage: frame_pool [frames]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/protocol.h"
+#include "bench.h"
+
+extern void* __libc_malloc(size_t size);
+
+static unsigned long allocations = 0;
+
+// Interpose malloc so allocations made anywhere in src/ are counted, not
+// only the ones the pool reports
+void* malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+typedef struct {
+    Buffer* wire;
+    size_t* offsets;
+    int count;
+    int frames;
+} Worker;
+
+// Keeps the compiler from pairing up and eliding the baseline's mallocs
+static void* volatile sink;
+
+static void allocate(size_t size) {
+    sink = malloc(size);
+    free(sink);
+}
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Decode as before frames were pooled: on top of the decode itself, one
+// malloc for the frame and one per attachment array
+static void decode_malloc(const uint8_t* data, size_t length, StringArena* arena) {
+    Frame* frame;
+    protocol_frame_decode_arena(data, length, PROTOCOL_VERSION, NULL, arena, &frame);
+    allocate(frame->type == FRAME_MSG ? sizeof(MsgFrame) : sizeof(PingFrame));
+    if (frame->type == FRAME_MSG && ((MsgFrame*)frame)->attachmentCount > 0) {
+        uint8_t count = ((MsgFrame*)frame)->attachmentCount;
+        allocate(sizeof(String) * count);
+        allocate(sizeof(uint64_t) * count);
+        allocate(sizeof(uint32_t) * count);
+    }
+    protocol_frame_free(frame);
+}
+
+static void* decode_loop(void* arg) {
+    Worker* worker = arg;
+    StringArena arena;
+    string_arena_init(&arena);
+    for (int i = 0; i < worker->frames; i++) {
+        int index = i % worker->count;
+        Frame* frame;
+        protocol_frame_decode_arena(worker->wire->data + worker->offsets[index], worker->offsets[index + 1] - worker->offsets[index], PROTOCOL_VERSION, NULL, &arena, &frame);
+        protocol_frame_free(frame);
+        string_arena_reset(&arena);
+    }
+    string_arena_free(&arena);
+    return NULL;
+}
+
+static void run_threads(const char* name, Worker* worker, int threads) {
+    pthread_t ids[8];
+    unsigned long start = allocations;
+    uint64_t pooled = protocol_frame_allocations();
+    uint64_t startTime = now_nanos();
+    for (int i = 0; i < threads; i++)
+        pthread_create(&ids[i], NULL, decode_loop, worker);
+    for (int i = 0; i < threads; i++)
+        pthread_join(ids[i], NULL);
+    uint64_t elapsed = now_nanos() - startTime;
+    double frames = (double)worker->frames * threads;
+    bench_begin(name);
+    bench_field("threads", threads);
+    bench_field("mallocs/frame", (allocations - start) / frames);
+    bench_field("pool_misses", protocol_frame_allocations() - pooled);
+    bench_field("ns/frame", elapsed / frames);
+    bench_end();
+}
+
+static void report_single(const char* name, unsigned long mallocs, uint64_t elapsed, int frames) {
+    bench_begin(name);
+    bench_field("threads", 1);
+    bench_field("mallocs/frame", (double)mallocs / frames);
+    bench_field("ns/frame", (double)elapsed / frames);
+    bench_end();
+}
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 4000000;
+
+    // A mix of traffic: pings and pongs, plain messages and messages with
+    // one and five attachments
+    Buffer wire;
+    buffer_init(&wire, 0);
+    size_t offsets[6] = { 0 };
+    PingFrame ping = { .type = FRAME_PING, .lastActive = 12345 };
+    PongFrame pong = { .type = FRAME_PONG, .lastActive = 12345 };
+    protocol_frame_encode(&wire, (Frame*)&ping);
+    offsets[1] = wire.length;
+    protocol_frame_encode(&wire, (Frame*)&pong);
+    offsets[2] = wire.length;
+    String names[5];
+    uint64_t sizes[5];
+    uint32_t ids[5];
+    for (int i = 0; i < 5; i++) {
+        names[i] = string_new_static("report.pdf");
+        sizes[i] = 1 << 20;
+        ids[i] = i;
+    }
+    uint8_t counts[3] = { 0, 1, 5 };
+    for (int i = 0; i < 3; i++) {
+        MsgFrame message = {
+            .type = FRAME_MSG,
+            .sender = string_new_static("alexandria.m"),
+            .content = string_new_static("can you check the build on staging before I merge it after lunch?"),
+            .attachmentCount = counts[i],
+            .attachmentNames = names,
+            .attachmentSizes = sizes,
+            .attachmentIds = ids,
+        };
+        protocol_frame_encode(&wire, (Frame*)&message);
+        offsets[3 + i] = wire.length;
+    }
+
+    // Warm the pool so the steady state is measured
+    Worker worker = { .wire = &wire, .offsets = offsets, .count = 5, .frames = frames };
+    StringArena arena;
+    string_arena_init(&arena);
+    for (int i = 0; i < 1000; i++) {
+        Frame* frame;
+        protocol_frame_decode_arena(wire.data + offsets[i % 5], offsets[i % 5 + 1] - offsets[i % 5], PROTOCOL_VERSION, NULL, &arena, &frame);
+        protocol_frame_free(frame);
+        string_arena_reset(&arena);
+    }
+
+    unsigned long start = allocations;
+    uint64_t startTime = now_nanos();
+    for (int i = 0; i < frames; i++) {
+        decode_malloc(wire.data + offsets[i % 5], offsets[i % 5 + 1] - offsets[i % 5], &arena);
+        string_arena_reset(&arena);
+    }
+    report_single("malloc", allocations - start, now_nanos() - startTime, frames);
+
+    start = allocations;
+    startTime = now_nanos();
+    for (int i = 0; i < frames; i++) {
+        Frame* frame;
+        protocol_frame_decode_arena(wire.data + offsets[i % 5], offsets[i % 5 + 1] - offsets[i % 5], PROTOCOL_VERSION, NULL, &arena, &frame);
+        protocol_frame_free(frame);
+        string_arena_reset(&arena);
+    }
+    report_single("pooled", allocations - start, now_nanos() - startTime, frames);
+
+    // Fresh threads start with empty pools: only their first frames miss
+    run_threads("pooled", &worker, 4);
+
+    string_arena_free(&arena);
+    buffer_free(&wire);
+    return 0;
+}
@@ -0,0 +1,146 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/frame_write.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o frame_write
+// File:        frame_write.c
+// Description: This file contains a benchmark comparing the buffered frame
+//              writer against the original field-by-field writer, counting
+//              write syscalls and measuring throughput over a socketpair.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/protocol.h"
+#include "bench.h"
+
+#define FRAME_COUNT 200000
+#define ATTACHMENT_COUNT 5
+
+static unsigned long writeCalls = 0;
+
+// Interpose write so calls made from protocol.c are counted as well
+ssize_t write(int fd, const void* data, size_t length) {
+    writeCalls++;
+    return syscall(SYS_write, fd, data, length);
+}
+
+// The original encoder, one write per field
+static int legacy_write_uint16(int socket, uint16_t value) {
+    uint16_t raw = htons(value);
+    return write(socket, &raw, 2) == 2 ? 0 : -1;
+}
+
+static int legacy_write_uint32(int socket, uint32_t value) {
+    uint32_t raw = htonl(value);
+    return write(socket, &raw, 4) == 4 ? 0 : -1;
+}
+
+static int legacy_write_msg(int socket, MsgFrame* frame) {
+    uint8_t type = FRAME_MSG;
+    if (write(socket, &type, 1) != 1)
+        return -1;
+    uint16_t contentLength = frame->content.length;
+    if (legacy_write_uint16(socket, contentLength) < 0)
+        return -1;
+    uint8_t attachmentCount = frame->attachmentCount;
+    if (write(socket, &attachmentCount, 1) != 1)
+        return -1;
+    for (uint8_t i = 0; i < attachmentCount; i++) {
+        uint8_t attachmentNameLength = frame->attachmentNames[i].length;
+        if (write(socket, &attachmentNameLength, 1) != 1)
+            return -1;
+        if (write(socket, string_data(&frame->attachmentNames[i]), attachmentNameLength) != attachmentNameLength)
+            return -1;
+        if (legacy_write_uint32(socket, frame->attachmentSizes[i]) < 0)
+            return -1;
+    }
+    if (write(socket, string_data(&frame->content), contentLength) != contentLength)
+        return -1;
+    return 0;
+}
+
+static void* drain_loop(void* arg) {
+    int socket = *(int*)arg;
+    char buffer[65536];
+    while (read(socket, buffer, sizeof(buffer)) > 0);
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(const char* name, bool buffered, MsgFrame* frame) {
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    pthread_t drainThread;
+    pthread_create(&drainThread, NULL, drain_loop, &sockets[1]);
+
+    Buffer buffer;
+    buffer_init(&buffer, 512);
+    unsigned long callsBefore = writeCalls;
+    double start = now_seconds();
+    for (int i = 0; i < FRAME_COUNT; i++) {
+        int result = buffered
+            ? protocol_frame_write_msg(sockets[0], &buffer, frame)
+            : legacy_write_msg(sockets[0], frame);
+        if (result < 0) {
+            perror("write");
+            exit(1);
+        }
+    }
+    double elapsed = now_seconds() - start;
+    unsigned long calls = writeCalls - callsBefore;
+
+    close(sockets[0]);
+    pthread_join(drainThread, NULL);
+    close(sockets[1]);
+    buffer_free(&buffer);
+
+    bench_begin(name);
+    bench_field("frames", FRAME_COUNT);
+    bench_field("syscalls/frame", (double)calls / FRAME_COUNT);
+    bench_field("frames/s", FRAME_COUNT / elapsed);
+    bench_end();
+}
+
+int main(void) {
+    String names[ATTACHMENT_COUNT];
+    uint64_t sizes[ATTACHMENT_COUNT];
+    uint32_t ids[ATTACHMENT_COUNT];
+    for (int i = 0; i < ATTACHMENT_COUNT; i++) {
+        names[i] = string_new_static("attachment.txt");
+        sizes[i] = 1024 * (i + 1);
+        ids[i] = i;
+    }
+
+    MsgFrame frame = {
+        .type = FRAME_MSG,
+        .sender = string_new_static(""),
+        .content = string_new_static("The quick brown fox jumps over the lazy dog"),
+        .attachmentCount = ATTACHMENT_COUNT,
+        .attachmentNames = names,
+        .attachmentSizes = sizes,
+        .attachmentIds = ids,
+    };
+
+    run("legacy", false, &frame);
+    run("buffered", true, &frame);
+    return 0;
+}
@@ -0,0 +1,104 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/history.c src/history.c src/string.c -lm -o history
+// File:        history.c
+// Description: This file contains a microbenchmark appending millions of
+//              messages to the chunked History and to a per-message malloc
+//              baseline, and reports ns/append and resident bytes/message.
+//              Usage: history [messages] [history MB]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/string.h"
+#include "../src/history.h"
+#include "bench.h"
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long resident_bytes(void) {
+    long size, resident;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file == NULL || fscanf(file, "%ld %ld", &size, &resident) != 2)
+        resident = 0;
+    if (file != NULL)
+        fclose(file);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void report(const char* name, size_t count, uint64_t elapsed, long before, size_t retained) {
+    bench_begin(name);
+    bench_field("appends", count);
+    bench_field("ns/append", (double)elapsed / count);
+    bench_field("retained", retained);
+    bench_field("bytes/message", retained > 0 ? (double)(resident_bytes() - before) / retained : 0);
+    bench_end();
+}
+
+// One allocation per message plus a doubling pointer array, as the
+// history was stored before
+static void run_malloc(size_t count, Message* sample) {
+    long before = resident_bytes();
+    Message** messages = NULL;
+    size_t capacity = 0;
+    uint64_t start = now_nanos();
+    for (size_t i = 0; i < count; i++) {
+        if (i == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 16;
+            messages = realloc(messages, capacity * sizeof(Message*));
+        }
+        Message* message = malloc(sizeof(Message));
+        message->isOutgoing = false;
+        message->sender = string_copy(&sample->sender);
+        message->content = string_copy(&sample->content);
+        message->attachments = NULL;
+        message->attachmentCount = 0;
+        messages[i] = message;
+    }
+    report("malloc", count, now_nanos() - start, before, count);
+
+    for (size_t i = 0; i < count; i++) {
+        string_free(&messages[i]->sender);
+        string_free(&messages[i]->content);
+        free(messages[i]);
+    }
+    free(messages);
+}
+
+static void run_history(size_t count, size_t maxBytes, Message* sample) {
+    long before = resident_bytes();
+    History history;
+    history_init(&history, maxBytes);
+    uint64_t start = now_nanos();
+    for (size_t i = 0; i < count; i++)
+        history_append(&history, sample);
+    report("history", count, now_nanos() - start, before, history_end(&history) - history_first(&history));
+    history_free(&history);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 10000000;
+    size_t megabytes = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+
+    Message sample = {
+        .isOutgoing = false,
+        .sender = string_new_static("alice"),
+        .content = string_new_static("hey, are we still on for the project meeting later?"),
+        .attachments = NULL,
+        .attachmentCount = 0,
+    };
+    // The history runs first so freed baseline memory is not reused by it
+    run_history(count, megabytes * 1024 * 1024, &sample);
+    run_malloc(count, &sample);
+    return 0;
+}
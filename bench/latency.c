@@ -0,0 +1,233 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/latency.c src/app.c src/scrollback.c src/server.c src/rooms.c src/backlog.c src/servergroup.c src/uring.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c src/sendqueue.c src/outbox.c src/history.c src/messagelog.c src/transfer.c src/timerwheel.c src/linkstats.c -lm -lpthread -o latency
+// File:        latency.c
+// Description: This file contains a benchmark of end-to-end message
+//              latency: two headless apps connected through a server in
+//              the same process, from chat_app_send on one to the message
+//              callback on the other, with and without the batch window.
+//              It first checks that a sender that reconnects after posting
+//              is not shown its own messages again.
+//              Usage: latency [messages]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "../src/string.h"
+#include "../src/server.h"
+#include "../src/app.h"
+#include "bench.h"
+
+// Messages sent back to back without waiting in the burst runs
+#define BURST_SIZE 32
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int connected;
+    uint64_t received;
+    uint32_t* latencies;
+    uint64_t capacity;
+} Probe;
+
+static Probe probe = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0, NULL, 0 };
+
+static void on_update(ChatApp* app, int parts, void* data) {
+    bool* connected = data;
+    if (!*connected && app->status != DISCONNECTED) {
+        *connected = true;
+        pthread_mutex_lock(&probe.mutex);
+        probe.connected++;
+        pthread_cond_broadcast(&probe.cond);
+        pthread_mutex_unlock(&probe.mutex);
+    }
+}
+
+// Messages carry their send time, so latency is taken as they arrive.
+// Notices, such as those for a reconnect, are shown under "*".
+static void on_message(ChatApp* app, Message* message, void* data) {
+    if (message->isOutgoing || strcmp(string_data(&message->sender), "*") == 0)
+        return;
+    uint64_t sent = strtoull(string_data(&message->content), NULL, 10);
+    uint64_t latency = (bench_now() - sent) / 1000;
+    pthread_mutex_lock(&probe.mutex);
+    if (probe.received < probe.capacity)
+        probe.latencies[probe.received] = latency < UINT32_MAX ? latency : UINT32_MAX;
+    probe.received++;
+    pthread_cond_broadcast(&probe.cond);
+    pthread_mutex_unlock(&probe.mutex);
+}
+
+static void wait_received(uint64_t count) {
+    pthread_mutex_lock(&probe.mutex);
+    while (probe.received < count)
+        pthread_cond_wait(&probe.cond, &probe.mutex);
+    pthread_mutex_unlock(&probe.mutex);
+}
+
+static ChatApp* start_app(char* name, uint16_t port, uint32_t batchWindow, bool* connected) {
+    ChatApp* app = malloc(sizeof(ChatApp));
+    ChatConfig config = {
+        .name = string_new_static(name),
+        .isServer = false,
+        .downloadDir = "/tmp",
+        .historyBytes = 16 * 1024 * 1024,
+        .logDir = NULL,
+        .logSync = LOG_SYNC_NONE,
+        .compress = false,
+        .batchWindow = batchWindow,
+        .batchFrames = SEND_QUEUE_MAX_IOV,
+        .noDelay = true,
+        .cork = true,
+        .replayMessages = 0,
+    };
+    chat_app_init(app, &config);
+    app->callbacks = (ChatAppCallbacks){ .onUpdate = on_update, .onMessage = on_message };
+    app->callbackData = connected;
+    if (chat_app_connect(app, "127.0.0.1", port) != 0 || chat_app_start(app) != 0) {
+        fprintf(stderr, "could not connect\n");
+        exit(1);
+    }
+    return app;
+}
+
+static void run(uint16_t port, const char* mode, int burst, uint32_t batchWindow, int messages) {
+    bool senderConnected = false;
+    bool receiverConnected = false;
+    pthread_mutex_lock(&probe.mutex);
+    probe.connected = 0;
+    probe.received = 0;
+    pthread_mutex_unlock(&probe.mutex);
+    ChatApp* sender = start_app("sender", port, batchWindow, &senderConnected);
+    ChatApp* receiver = start_app("receiver", port, batchWindow, &receiverConnected);
+    pthread_mutex_lock(&probe.mutex);
+    while (probe.connected < 2)
+        pthread_cond_wait(&probe.cond, &probe.mutex);
+    pthread_mutex_unlock(&probe.mutex);
+
+    uint64_t start = bench_now();
+    for (int i = 0; i < messages; i += burst) {
+        for (int j = 0; j < burst && i + j < messages; j++) {
+            char content[32];
+            snprintf(content, sizeof(content), "%llu", (unsigned long long)bench_now());
+            String text = string_new_borrowed(content, strlen(content));
+            while (!chat_app_send(sender, &text))
+                wait_received(probe.received + 1);
+        }
+        wait_received(i + burst < messages ? i + burst : messages);
+    }
+    uint64_t elapsed = bench_now() - start;
+
+    bench_begin(mode);
+    bench_field("batch_window_us", batchWindow);
+    bench_field("messages", messages);
+    bench_field("messages/s", messages / (elapsed / 1e9));
+    bench_percentiles(probe.latencies, probe.received < probe.capacity ? probe.received : probe.capacity, "us");
+    bench_end();
+
+    chat_app_stop(sender);
+    chat_app_stop(receiver);
+    chat_app_destroy(sender);
+    chat_app_destroy(receiver);
+}
+
+// Wait for an app to be on a connection after the given one, and for the
+// server to have answered its ident there
+static void wait_reconnected(ChatApp* app, int connection) {
+    while (true) {
+        pthread_mutex_lock(&app->stateMutex);
+        bool back = app->connection > connection && app->status != DISCONNECTED;
+        pthread_mutex_unlock(&app->stateMutex);
+        if (back)
+            return;
+        usleep(1000);
+    }
+}
+
+// Post, drop the sender's connection and post again. Every message has to
+// reach the receiver once, and the sender, which resumes from the last
+// message it received, must not be sent back its own from before the drop.
+static void check_reconnect(uint16_t port, int messages) {
+    bool senderConnected = false;
+    bool receiverConnected = false;
+    pthread_mutex_lock(&probe.mutex);
+    probe.connected = 0;
+    probe.received = 0;
+    pthread_mutex_unlock(&probe.mutex);
+    ChatApp* sender = start_app("sender", port, 0, &senderConnected);
+    ChatApp* receiver = start_app("receiver", port, 0, &receiverConnected);
+    pthread_mutex_lock(&probe.mutex);
+    while (probe.connected < 2)
+        pthread_cond_wait(&probe.cond, &probe.mutex);
+    pthread_mutex_unlock(&probe.mutex);
+
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < messages; i++) {
+            char content[32];
+            snprintf(content, sizeof(content), "%llu", (unsigned long long)bench_now());
+            String text = string_new_borrowed(content, strlen(content));
+            while (!chat_app_send(sender, &text))
+                wait_received(probe.received + 1);
+        }
+        wait_received((uint64_t)(round + 1) * messages);
+        if (round > 0)
+            break;
+        pthread_mutex_lock(&sender->stateMutex);
+        int connection = sender->connection;
+        shutdown(sender->socketfd, SHUT_RDWR);
+        pthread_mutex_unlock(&sender->stateMutex);
+        wait_reconnected(sender, connection);
+    }
+    // Give anything sent twice time to arrive
+    usleep(200 * 1000);
+    pthread_mutex_lock(&probe.mutex);
+    uint64_t received = probe.received;
+    pthread_mutex_unlock(&probe.mutex);
+    if (received != 2 * (uint64_t)messages) {
+        fprintf(stderr, "reconnect: %llu messages shown for %d sent\n", (unsigned long long)received, 2 * messages);
+        exit(1);
+    }
+
+    chat_app_stop(sender);
+    chat_app_stop(receiver);
+    chat_app_destroy(sender);
+    chat_app_destroy(receiver);
+}
+
+static void* server_thread(void* arg) {
+    chat_server_run(arg);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int messages = argc > 1 ? atoi(argv[1]) : 5000;
+    probe.capacity = messages;
+    probe.latencies = malloc(sizeof(uint32_t) * messages);
+
+    ChatServer server;
+    if (chat_server_init(&server, string_new_static("server"), 0, false) != 0)
+        return 1;
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_thread, &server);
+
+    check_reconnect(server.port, 100);
+
+    // Sequential sends wait for each message to arrive, so each one follows
+    // the last write closely and is held for the rest of the batch window.
+    // Without it, a write goes out as soon as the outbox is empty.
+    run(server.port, "sequential", 1, 0, messages);
+    run(server.port, "sequential", 1, 1000, messages);
+    run(server.port, "burst", BURST_SIZE, 0, messages);
+    run(server.port, "burst", BURST_SIZE, 1000, messages);
+
+    chat_server_stop(&server);
+    pthread_join(thread, NULL);
+    return 0;
+}
@@ -0,0 +1,102 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/message_log.c src/messagelog.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o message_log
+// File:        message_log.c
+// Description: This file contains a benchmark for the persistent message
+//              log. It appends millions of messages under each sync policy,
+//              then reopens the log and times replaying one screen of the
+//              newest messages.
+//              Usage: message_log [messages] [directory]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../src/string.h"
+#include "../src/protocol.h"
+#include "../src/messagelog.h"
+#include "bench.h"
+
+#define SCREEN_ROWS 50
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void remove_log(const char* directory) {
+    char command[4200];
+    snprintf(command, sizeof(command), "rm -rf '%s'", directory);
+    system(command);
+}
+
+static void append(const char* name, const char* directory, LogSyncPolicy policy, size_t count) {
+    MessageLog log;
+    if (message_log_open(&log, directory, policy) < 0) {
+        perror("open");
+        exit(1);
+    }
+    char content[64];
+    MsgFrame frame = {
+        .type = FRAME_MSG,
+        .sender = string_new_static("alice"),
+        .attachmentCount = 0,
+    };
+    uint64_t start = now_nanos();
+    for (size_t i = 0; i < count; i++) {
+        snprintf(content, sizeof(content), "message number %zu of the benchmark", i);
+        frame.content = string_new_static(content);
+        message_log_append(&log, &frame);
+    }
+    uint64_t elapsed = now_nanos() - start;
+    message_log_close(&log);
+    bench_begin(name);
+    bench_field("appends", count);
+    bench_field("ns/append", (double)elapsed / count);
+    bench_end();
+}
+
+// Reopen the log and decode the newest screen of messages, as the app
+// does on startup
+static void replay(const char* directory) {
+    uint64_t start = now_nanos();
+    MessageLog log;
+    message_log_open(&log, directory, LOG_SYNC_NONE);
+    LogCursor cursor = message_log_end(&log);
+    int count = 0;
+    while (count < SCREEN_ROWS && message_log_prev(&log, &cursor))
+        count++;
+    for (int i = 0; i < count; i++) {
+        MsgFrame* frame;
+        if (message_log_read(&log, &cursor, &frame) == 0)
+            protocol_frame_free((Frame*)frame);
+        message_log_next(&log, &cursor);
+    }
+    uint64_t elapsed = now_nanos() - start;
+    bench_begin("replay");
+    bench_field("segments", log.segmentCount);
+    bench_field("rows", count);
+    bench_field("open+decode_ms", elapsed / 1e6);
+    bench_end();
+    message_log_close(&log);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], NULL, 10) : 2000000;
+    const char* directory = argc > 2 ? argv[2] : "/tmp/mychat-log-bench";
+
+    remove_log(directory);
+    append("none", directory, LOG_SYNC_NONE, count);
+    append("interval", directory, LOG_SYNC_INTERVAL, count);
+    // Syncing every append is bounded by the disk, so fewer are timed
+    append("always", directory, LOG_SYNC_ALWAYS, count < 1000 ? count : 1000);
+    replay(directory);
+    remove_log(directory);
+    return 0;
+}
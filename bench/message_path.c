@@ -0,0 +1,147 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/message_path.c src/protocol.c src/compress.c src/history.c src/sendqueue.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o message_path
+// File:        message_path.c
+// Description: This file contains a benchmark counting the allocations and
+//              time spent per chat message on the way out (input line to
+//              queued encoded frame) and on the way in (received bytes to
+//              history), copying strings at each step as the app used to
+//              and handing them over as it does now.
+//              Usage: message_path [messages]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/sendqueue.h"
+#include "../src/protocol.h"
+#include "../src/history.h"
+#include "bench.h"
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* data, size_t size);
+
+static unsigned long allocations = 0;
+
+// Interpose the allocator so calls made from src/ are counted as well
+void* malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* data, size_t size) {
+    allocations++;
+    return __libc_realloc(data, size);
+}
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char* name, unsigned long count, uint64_t elapsed, int messages) {
+    bench_begin(name);
+    bench_field("allocations/message", (double)count / messages);
+    bench_field("ns/message", (double)elapsed / messages);
+    bench_end();
+}
+
+// Input line to queued frame: copy the line into a heap frame, encode into a
+// scratch buffer and copy that into the shared frame
+static EncodedFrame* send_copying(String* line, String* name) {
+    MsgFrame* frame = (MsgFrame*)protocol_frame_new(FRAME_MSG);
+    frame->sender = string_copy(name);
+    frame->content = string_copy(line);
+    frame->attachmentCount = 0;
+    frame->attachmentNames = NULL;
+    frame->attachmentSizes = NULL;
+    frame->attachmentIds = NULL;
+    Buffer buffer;
+    buffer_init(&buffer, 0);
+    protocol_frame_encode(&buffer, (Frame*)frame);
+    EncodedFrame* encoded = encoded_frame_new(buffer.data, buffer.length);
+    buffer_free(&buffer);
+    protocol_frame_free((Frame*)frame);
+    return encoded;
+}
+
+// The frame borrows the line and is encoded straight into the shared frame
+static EncodedFrame* send_handoff(String* line, String* name) {
+    MsgFrame frame = {
+        .type = FRAME_MSG,
+        .sender = string_view(name),
+        .content = string_view(line),
+    };
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    protocol_frame_encode(&buffer, (Frame*)&frame);
+    return encoded_frame_finish(&buffer);
+}
+
+static void receive(History* history, const uint8_t* data, size_t length, StringArena* arena) {
+    Frame* frame;
+    protocol_frame_decode_arena(data, length, PROTOCOL_VERSION, NULL, arena, &frame);
+    MsgFrame* msgFrame = (MsgFrame*)frame;
+    Message message = {
+        .isOutgoing = false,
+        .sender = msgFrame->sender,
+        .content = msgFrame->content,
+    };
+    history_append(history, &message);
+    protocol_frame_free(frame);
+    if (arena != NULL)
+        string_arena_reset(arena);
+}
+
+int main(int argc, char** argv) {
+    int messages = argc > 1 ? atoi(argv[1]) : 2000000;
+    String name = string_new(0);
+    string_append_static(&name, "alexandria.m");
+    String line = string_new(0);
+    string_append_static(&line, "can you check the build on staging before I merge it after lunch?");
+
+    for (int handoff = 0; handoff < 2; handoff++) {
+        unsigned long start = allocations;
+        uint64_t startTime = now_nanos();
+        for (int i = 0; i < messages; i++) {
+            EncodedFrame* encoded = handoff ? send_handoff(&line, &name) : send_copying(&line, &name);
+            encoded_frame_release(encoded);
+        }
+        report(handoff ? "send-handoff" : "send-copying", allocations - start, now_nanos() - startTime, messages);
+    }
+
+    Buffer wire;
+    buffer_init(&wire, 0);
+    MsgFrame frame = { .type = FRAME_MSG, .sender = name, .content = line };
+    protocol_frame_encode(&wire, (Frame*)&frame);
+    for (int handoff = 0; handoff < 2; handoff++) {
+        History history;
+        history_init(&history, 64 * 1024 * 1024);
+        StringArena arena;
+        string_arena_init(&arena);
+        unsigned long start = allocations;
+        uint64_t startTime = now_nanos();
+        for (int i = 0; i < messages; i++)
+            receive(&history, wire.data, wire.length, handoff ? &arena : NULL);
+        report(handoff ? "recv-arena" : "recv-copying", allocations - start, now_nanos() - startTime, messages);
+        string_arena_free(&arena);
+        history_free(&history);
+    }
+    buffer_free(&wire);
+    string_free(&line);
+    string_free(&name);
+    return 0;
+}
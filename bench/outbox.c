@@ -0,0 +1,163 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/outbox.c src/outbox.c src/sendqueue.c src/buffer.c src/metrics.c -lpthread -o outbox
+// File:        outbox.c
+// Description: This file contains a contention benchmark for sending from
+//              several threads at once. It compares the enqueue latency of
+//              the lock-free Outbox drained by a writer thread against
+//              taking a mutex and writing to the socket directly.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "../src/sendqueue.h"
+#include "../src/outbox.h"
+#include "bench.h"
+
+#define FRAMES_PER_PRODUCER 200000
+#define FRAME_SIZE 64
+
+typedef struct {
+    bool lockFree;
+    Outbox* outbox;
+    pthread_mutex_t* mutex;
+    int socketfd;
+    EncodedFrame* frame;
+    uint32_t* latencies;
+} Producer;
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* produce(void* arg) {
+    Producer* producer = arg;
+    for (int i = 0; i < FRAMES_PER_PRODUCER; i++) {
+        uint64_t start = now_nanos();
+        if (producer->lockFree) {
+            // Retry if the writer falls a high-water mark behind
+            while (!outbox_push(producer->outbox, producer->frame));
+        } else {
+            pthread_mutex_lock(producer->mutex);
+            write(producer->socketfd, producer->frame->data, producer->frame->length);
+            pthread_mutex_unlock(producer->mutex);
+        }
+        producer->latencies[i] = now_nanos() - start;
+    }
+    return NULL;
+}
+
+typedef struct {
+    Outbox* outbox;
+    int socketfd;
+    bool stopped;
+} Writer;
+
+// Same draining as the app's writer thread
+static void* write_loop(void* arg) {
+    Writer* writer = arg;
+    SendQueue queue;
+    send_queue_init(&queue);
+    while (!__atomic_load_n(&writer->stopped, __ATOMIC_ACQUIRE)) {
+        EncodedFrame* frame;
+        while (queue.count < SEND_QUEUE_MAX_IOV && (frame = outbox_pop(writer->outbox)) != NULL) {
+            send_queue_push(&queue, frame);
+            encoded_frame_release(frame);
+        }
+        if (send_queue_empty(&queue)) {
+            outbox_wait(writer->outbox);
+            continue;
+        }
+        size_t bytes = queue.bytes;
+        send_queue_flush(&queue, writer->socketfd);
+        outbox_sent(writer->outbox, bytes);
+    }
+    send_queue_free(&queue);
+    return NULL;
+}
+
+// Stands in for the peer, reading everything that is sent
+static void* drain_loop(void* arg) {
+    int socketfd = *(int*)arg;
+    static char buffer[1 << 16];
+    while (read(socketfd, buffer, sizeof(buffer)) > 0);
+    return NULL;
+}
+
+static void run(bool lockFree, int producerCount) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    pthread_t drainThread, writerThread;
+    pthread_create(&drainThread, NULL, drain_loop, &fds[1]);
+
+    Outbox outbox;
+    outbox_init(&outbox, OUTBOX_HIGH_WATER);
+    Writer writer = { .outbox = &outbox, .socketfd = fds[0], .stopped = false };
+    if (lockFree)
+        pthread_create(&writerThread, NULL, write_loop, &writer);
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+    EncodedFrame* frame = encoded_frame_alloc(FRAME_SIZE);
+    memset(frame->data, 'x', FRAME_SIZE);
+    size_t total = (size_t)producerCount * FRAMES_PER_PRODUCER;
+    uint32_t* latencies = malloc(sizeof(uint32_t) * total);
+    Producer* producers = malloc(sizeof(Producer) * producerCount);
+    pthread_t* threads = malloc(sizeof(pthread_t) * producerCount);
+
+    uint64_t start = now_nanos();
+    for (int i = 0; i < producerCount; i++) {
+        producers[i] = (Producer){
+            .lockFree = lockFree,
+            .outbox = &outbox,
+            .mutex = &mutex,
+            .socketfd = fds[0],
+            .frame = frame,
+            .latencies = latencies + (size_t)i * FRAMES_PER_PRODUCER,
+        };
+        pthread_create(&threads[i], NULL, produce, &producers[i]);
+    }
+    for (int i = 0; i < producerCount; i++)
+        pthread_join(threads[i], NULL);
+    double elapsed = (now_nanos() - start) / 1e9;
+
+    if (lockFree) {
+        __atomic_store_n(&writer.stopped, true, __ATOMIC_RELEASE);
+        outbox_wake(&outbox);
+        pthread_join(writerThread, NULL);
+    }
+    shutdown(fds[0], SHUT_WR);
+    pthread_join(drainThread, NULL);
+
+    bench_begin(lockFree ? "outbox" : "mutex");
+    bench_field("producers", producerCount);
+    bench_field("enqueues/s", total / elapsed);
+    bench_percentiles(latencies, total, "ns");
+    bench_end();
+
+    outbox_free(&outbox);
+    encoded_frame_release(frame);
+    close(fds[0]);
+    close(fds[1]);
+    free(latencies);
+    free(producers);
+    free(threads);
+}
+
+int main(void) {
+    int counts[] = { 1, 2, 4, 8 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        run(false, counts[i]);
+        run(true, counts[i]);
+    }
+    return 0;
+}
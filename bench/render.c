@@ -0,0 +1,103 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/render.c src/tui.c src/app.c src/scrollback.c src/server.c src/rooms.c src/backlog.c src/servergroup.c src/uring.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c src/sendqueue.c src/outbox.c src/history.c src/messagelog.c src/transfer.c src/timerwheel.c src/linkstats.c -lncurses -lm -lpthread -o render
+// File:        render.c
+// Description: This file contains a benchmark of TUI render cost as the
+//              history grows: drawing one new message, and redrawing the
+//              whole screen, with 1k to 1M messages in the history. The
+//              screen is drawn to /dev/null at 120x50.
+//              Usage: render [renders]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../src/string.h"
+#include "../src/history.h"
+#include "../src/app.h"
+#include "../src/tui.h"
+#include "bench.h"
+
+static void append(ChatApp* app, size_t index) {
+    char content[64];
+    snprintf(content, sizeof(content), "message %zu of the render benchmark", index);
+    Message message = {
+        .isOutgoing = index % 2 == 0,
+        .sender = string_new_static("alice"),
+        .content = string_new_borrowed(content, strlen(content)),
+        .attachments = NULL,
+        .attachmentCount = 0,
+    };
+    history_append(&app->history, &message);
+}
+
+static void report(const char* name, size_t messages, int renders, uint64_t elapsed) {
+    bench_begin(name);
+    bench_field("history", messages);
+    bench_field("ns/render", (double)elapsed / renders);
+    bench_end();
+}
+
+int main(int argc, char** argv) {
+    int renders = argc > 1 ? atoi(argv[1]) : 2000;
+    static const size_t sizes[] = { 1000, 10000, 100000, 1000000 };
+
+    // ncurses draws to stdout, so results go to a copy of it
+    benchOutput = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    setenv("TERM", "xterm", 0);
+    setenv("LINES", "50", 1);
+    setenv("COLUMNS", "120", 1);
+
+    Tui tui;
+    tui_init(&tui);
+    ChatApp* app = malloc(sizeof(ChatApp));
+    ChatConfig config = {
+        .name = string_new_static("bench"),
+        .isServer = false,
+        .downloadDir = "/tmp",
+        .historyBytes = (size_t)512 * 1024 * 1024,
+        .logDir = NULL,
+        .replayMessages = 0,
+    };
+    chat_app_init(app, &config);
+    tui_attach(&tui, app);
+    chat_app_render(app);
+
+    size_t count = 0;
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        while (count < sizes[i])
+            append(app, count++);
+        chat_app_invalidate(app, RENDER_ALL);
+        chat_app_render(app);
+
+        // A message arrives and is drawn, as the receive thread does
+        uint64_t start = bench_now();
+        for (int j = 0; j < renders; j++) {
+            append(app, count++);
+            chat_app_invalidate(app, RENDER_STATUS);
+            chat_app_render(app);
+        }
+        report("append", sizes[i], renders, bench_now() - start);
+
+        // The whole screen, as after a resize
+        start = bench_now();
+        for (int j = 0; j < renders; j++) {
+            chat_app_invalidate(app, RENDER_ALL);
+            chat_app_render(app);
+        }
+        report("redraw", sizes[i], renders, bench_now() - start);
+    }
+
+    tui_free(&tui);
+    chat_app_destroy(app);
+    chat_app_free(app);
+    return 0;
+}
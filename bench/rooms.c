@@ -0,0 +1,123 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/rooms.c src/rooms.c src/string.c src/buffer.c src/metrics.c -lm -lpthread -o rooms
+// File:        rooms.c
+// Description: This file contains a benchmark of the room index with 100k
+//              members in one room among a larger crowd of clients: joining
+//              and leaving in random order, and finding a message's
+//              recipients by walking the room's member array against
+//              scanning every client's room bitmap.
+//              Usage: rooms [members] [clients]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "../src/string.h"
+#include "../src/rooms.h"
+#include "bench.h"
+
+// Stands in for the server's client, about as big, so walks touch memory
+// the way fan-outs do
+struct ChatClient {
+    RoomSet rooms;
+    uint64_t queued;
+    char state[512];
+};
+
+#define BENCH_OTHER_ROOMS 64
+#define BENCH_JOINED 4
+
+static void report(const char* name, const char* operation, uint64_t elapsed, int count) {
+    bench_begin(name);
+    bench_label("operation", operation);
+    bench_field("count", count);
+    bench_field("ns/op", (double)elapsed / count);
+    bench_end();
+}
+
+static void shuffle(int* order, int count) {
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+}
+
+int main(int argc, char** argv) {
+    int members = argc > 1 ? atoi(argv[1]) : 100000;
+    int clients = argc > 2 ? atoi(argv[2]) : 4 * members;
+    if (clients < members)
+        clients = members;
+
+    struct ChatClient* crowd = calloc(clients, sizeof(struct ChatClient));
+    int* order = malloc(sizeof(int) * clients);
+    srand(1);
+    for (int i = 0; i < clients; i++) {
+        room_set_init(&crowd[i].rooms);
+        order[i] = i;
+    }
+    shuffle(order, clients);
+
+    RoomIndex index;
+    room_index_init(&index);
+    String big = string_new_static("lobby");
+    String names[BENCH_OTHER_ROOMS];
+    char nameData[BENCH_OTHER_ROOMS][16];
+    for (int i = 0; i < BENCH_OTHER_ROOMS; i++) {
+        snprintf(nameData[i], sizeof(nameData[i]), "room%d", i);
+        names[i] = string_new_static(nameData[i]);
+    }
+
+    // Everyone is in a few small rooms; the first members of the shuffled
+    // crowd are also in the big one
+    for (int i = 0; i < clients; i++) {
+        for (int j = 0; j < BENCH_JOINED; j++)
+            room_index_join(&index, &crowd[i], &crowd[i].rooms, &names[rand() % BENCH_OTHER_ROOMS]);
+    }
+    uint64_t start = bench_now();
+    for (int i = 0; i < members; i++)
+        room_index_join(&index, &crowd[order[i]], &crowd[order[i]].rooms, &big);
+    report("join", "index", bench_now() - start, members);
+
+    // Recipients of one message to the big room, found both ways
+    Room* room = room_index_find(&index, &big);
+    int id = room - index.rooms;
+    int rounds = 20;
+    start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        room = room_index_find(&index, &big);
+        for (int i = 0; i < room->memberCount; i++)
+            room->members[i]->queued++;
+    }
+    report("fan_out", "member_array", bench_now() - start, rounds * members);
+    start = bench_now();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < clients; i++) {
+            if (room_set_has(&crowd[i].rooms, id))
+                crowd[i].queued++;
+        }
+    }
+    report("fan_out", "scan_bitmaps", bench_now() - start, rounds * members);
+
+    shuffle(order, members);
+    start = bench_now();
+    for (int i = 0; i < members; i++)
+        room_index_leave(&index, &crowd[order[i]].rooms, &big);
+    report("leave", "index", bench_now() - start, members);
+
+    uint64_t queued = 0;
+    for (int i = 0; i < clients; i++) {
+        queued += crowd[i].queued;
+        room_set_free(&crowd[i].rooms);
+    }
+    if (queued != 2ull * rounds * members)
+        fprintf(stderr, "delivered %llu, expected %llu\n", (unsigned long long)queued, 2ull * rounds * members);
+    room_index_free(&index);
+    free(order);
+    free(crowd);
+    return 0;
+}
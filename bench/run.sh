@@ -0,0 +1,70 @@
+#!/bin/sh
+# Class:       CS 4390 - Computer Networks
+# Assignment:  Chat Application Project
+# Author:      Juan Llamas
+# File:        run.sh
+# Description: Builds the benchmarks from the build line in each file's
+#              header and runs them, writing one JSON report with every
+#              result tagged by benchmark, plus the revision and machine it
+#              ran on, so runs can be compared across versions.
+#              Usage: bench/run.sh [-o FILE] [NAME[:ARGS]...]
+#              NAME is a file in bench/ without .c, ARGS are passed to it
+#              with commas for spaces, e.g. history:1000000 latency:2000.
+#              All benchmarks run with their defaults when none are named.
+#              The run stops at the first benchmark that fails.
+#              CC and CFLAGS override the compiler and add flags.
+
+set -e
+cd "$(dirname "$0")/.."
+
+output=
+if [ "$1" = "-o" ]; then
+    output=$2
+    shift 2
+fi
+if [ $# -eq 0 ]; then
+    set -- $(ls bench/*.c | sed 's|bench/||; s|\.c$||')
+fi
+
+buildDir=${TMPDIR:-/tmp}/mychat-bench
+mkdir -p "$buildDir"
+results=$buildDir/results.json
+: > "$results"
+
+for spec in "$@"; do
+    name=${spec%%:*}
+    args=
+    case "$spec" in
+        *:*) args=$(echo "${spec#*:}" | tr ',' ' ') ;;
+    esac
+    build=$(sed -n 's|^// Build: *gcc ||p' "bench/$name.c")
+    if [ -z "$build" ]; then
+        echo "bench/$name.c: no build line" >&2
+        exit 1
+    fi
+    echo "building $name" >&2
+    ${CC:-gcc} $CFLAGS $(echo "$build" | sed "s|-o $name\$|-o $buildDir/$name|")
+    echo "running $name $args" >&2
+    # Through a file so a benchmark that fails its own checks stops the run
+    (cd "$buildDir" && BENCH_FORMAT=json "./$name" $args) > "$buildDir/$name.out"
+    sed -n "s|^{|{\"bench\":\"$name\",|p" "$buildDir/$name.out" >> "$results"
+done
+
+revision=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+if [ -n "$(git status --porcelain -- src bench 2>/dev/null)" ]; then
+    revision=$revision-dirty
+fi
+cpu=$(sed -n 's/^model name[^:]*: *//p' /proc/cpuinfo 2>/dev/null | head -n 1 | tr -d '"\\')
+
+report() {
+    printf '{"revision":"%s","date":"%s","host":"%s","cpu":"%s","cpus":%s,"results":[\n' \
+        "$revision" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" "$(uname -srm)" "$cpu" "$(nproc)"
+    sed '$!s/$/,/' "$results"
+    printf ']}\n'
+}
+
+if [ -n "$output" ]; then
+    report > "$output"
+else
+    report
+fi
@@ -0,0 +1,484 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/server_io.c src/server.c src/rooms.c src/backlog.c src/servergroup.c src/uring.c src/outbox.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c src/sendqueue.c src/timerwheel.c src/linkstats.c -lm -lpthread -o server_io
+// File:        server_io.c
+// Description: This file contains a benchmark of the server's I/O backends
+//              under fan-out load: epoll, io_uring, and as a baseline a
+//              blocking thread-per-connection server written here. Each
+//              server runs in a child process so the clients and the
+//              server have a descriptor limit each, and its CPU time is
+//              measured on its own. With -s the event loops run as that
+//              many shards on the port, and the load comes from as many
+//              threads, to see how throughput scales with cores.
+//              Usage: server_io [-s shards] [clients...] (default 1000 10000)
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/protocol.h"
+#include "../src/server.h"
+#include "../src/servergroup.h"
+#include "bench.h"
+
+#define TARGET_DELIVERIES 2000000
+#define IN_FLIGHT_WINDOW 64
+#define CLIENT_BUFFER_SIZE 16384
+// The blocking server needs a thread per client, so they get small stacks
+#define BLOCKING_STACK_SIZE (64 * 1024)
+
+typedef enum {
+    BACKEND_BLOCKING,
+    BACKEND_EPOLL,
+    BACKEND_URING,
+} Backend;
+
+static const char* backendNames[] = { "blocking", "epoll", "uring" };
+
+// Shared with the server process
+typedef struct {
+    int joined;
+    // Backend the server actually ran, after any fallback
+    int backend;
+} SharedState;
+
+static SharedState* shared;
+static int shardCount = 1;
+
+typedef struct {
+    int socketfd;
+    uint8_t data[CLIENT_BUFFER_SIZE];
+    size_t length;
+} LoadClient;
+
+// A client of the blocking server. Writers from other connections' threads
+// take its mutex so frames never interleave.
+typedef struct {
+    int socketfd;
+    bool identified;
+    pthread_mutex_t writeMutex;
+} BlockingClient;
+
+static BlockingClient** blockingClients = NULL;
+static int blockingCount = 0;
+static int blockingCapacity = 0;
+static pthread_rwlock_t blockingLock = PTHREAD_RWLOCK_INITIALIZER;
+
+static bool write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+// Encode each message once and write it to every other client in turn
+static void blocking_fan_out(BlockingClient* origin, Frame* frame, Buffer* encoded) {
+    buffer_clear(encoded);
+    protocol_frame_encode(encoded, frame);
+    pthread_rwlock_rdlock(&blockingLock);
+    for (int i = 0; i < blockingCount; i++) {
+        BlockingClient* client = blockingClients[i];
+        if (client == origin || !client->identified)
+            continue;
+        pthread_mutex_lock(&client->writeMutex);
+        write_all(client->socketfd, encoded->data, encoded->length);
+        pthread_mutex_unlock(&client->writeMutex);
+    }
+    pthread_rwlock_unlock(&blockingLock);
+}
+
+static void* blocking_client_thread(void* arg) {
+    BlockingClient* client = arg;
+    uint8_t data[CLIENT_BUFFER_SIZE];
+    size_t length = 0;
+    Buffer encoded;
+    buffer_init(&encoded, 512);
+    while (true) {
+        ssize_t received = recv(client->socketfd, data + length, sizeof(data) - length, 0);
+        if (received <= 0)
+            break;
+        length += received;
+        size_t offset = 0;
+        Frame* frame;
+        int result;
+        while ((result = protocol_frame_decode(data + offset, length - offset, &frame)) > 0) {
+            offset += result;
+            if (frame == NULL)
+                continue;
+            if (frame->type == FRAME_IDENT && !client->identified) {
+                client->identified = true;
+                __atomic_add_fetch(&shared->joined, 1, __ATOMIC_RELEASE);
+            } else if (frame->type == FRAME_MSG && client->identified) {
+                blocking_fan_out(client, frame, &encoded);
+            }
+            protocol_frame_free(frame);
+        }
+        memmove(data, data + offset, length - offset);
+        length -= offset;
+    }
+
+    pthread_rwlock_wrlock(&blockingLock);
+    for (int i = 0; i < blockingCount; i++) {
+        if (blockingClients[i] == client) {
+            blockingClients[i] = blockingClients[--blockingCount];
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&blockingLock);
+    close(client->socketfd);
+    pthread_mutex_destroy(&client->writeMutex);
+    free(client);
+    buffer_free(&encoded);
+    return NULL;
+}
+
+static void blocking_serve(int listenfd) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BLOCKING_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (true) {
+        int socketfd = accept4(listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (socketfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            return;
+        }
+        int enable = 1;
+        setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        BlockingClient* client = malloc(sizeof(BlockingClient));
+        client->socketfd = socketfd;
+        client->identified = false;
+        pthread_mutex_init(&client->writeMutex, NULL);
+
+        pthread_rwlock_wrlock(&blockingLock);
+        if (blockingCount == blockingCapacity) {
+            blockingCapacity = blockingCapacity > 0 ? blockingCapacity * 2 : 16;
+            blockingClients = realloc(blockingClients, blockingCapacity * sizeof(BlockingClient*));
+        }
+        blockingClients[blockingCount++] = client;
+        pthread_rwlock_unlock(&blockingLock);
+
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, blocking_client_thread, client) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+}
+
+static void on_join(ServerGroup* group, String* name, void* data) {
+    __atomic_add_fetch(&shared->joined, 1, __ATOMIC_RELEASE);
+}
+
+// The blocking server exits when the parent closes the control pipe
+static void* control_thread(void* arg) {
+    int controlfd = (int)(intptr_t)arg;
+    char byte;
+    while (read(controlfd, &byte, 1) > 0)
+        ;
+    _exit(0);
+}
+
+static void serve_blocking(int portfd, int controlfd) {
+    int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) } };
+    socklen_t addrSize = sizeof(addr);
+    if (bind(listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listenfd, SOMAXCONN) < 0) {
+        perror("listen");
+        _exit(1);
+    }
+    getsockname(listenfd, (struct sockaddr*)&addr, &addrSize);
+    uint16_t port = ntohs(addr.sin_port);
+    shared->backend = BACKEND_BLOCKING;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, control_thread, (void*)(intptr_t)controlfd);
+    if (write(portfd, &port, sizeof(port)) != sizeof(port))
+        _exit(1);
+    close(portfd);
+    blocking_serve(listenfd);
+    _exit(1);
+}
+
+// Run a server in this process until the control pipe closes, reporting
+// the port it listens on through portfd
+static void serve(Backend backend, int portfd, int controlfd) {
+    if (backend == BACKEND_BLOCKING)
+        serve_blocking(portfd, controlfd);
+
+    ServerGroup group;
+    if (server_group_init(&group, string_new_static("host"), 0, shardCount) != 0)
+        _exit(1);
+    for (int i = 0; i < group.shardCount; i++) {
+        group.shards[i].io = backend == BACKEND_URING ? SERVER_IO_URING : SERVER_IO_EPOLL;
+        group.shards[i].noDelay = true;
+    }
+    group.callbacks.onJoin = on_join;
+    if (server_group_start(&group) != 0)
+        _exit(1);
+    if (write(portfd, &group.port, sizeof(group.port)) != sizeof(group.port))
+        _exit(1);
+    close(portfd);
+
+    char byte;
+    while (read(controlfd, &byte, 1) > 0)
+        ;
+    server_group_stop(&group);
+    shared->backend = group.shards[0].io == SERVER_IO_URING ? BACKEND_URING : BACKEND_EPOLL;
+    server_group_free(&group);
+    _exit(0);
+}
+
+static int connect_client(uint16_t port) {
+    int socketfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) },
+    };
+    if (connect(socketfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int enable = 1;
+    setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    return socketfd;
+}
+
+static double cpu_seconds(struct rusage* usage) {
+    return usage->ru_utime.tv_sec + usage->ru_stime.tv_sec + (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1e6;
+}
+
+// One thread of the load: it sends its share of the messages from its own
+// clients and times what arrives on them. The window of messages in flight
+// is shared by all threads.
+typedef struct {
+    LoadClient* clients;
+    int clientCount;
+    int totalClients;
+    uint64_t messageCount;
+    uint64_t expected;
+    uint64_t* sent;
+    uint64_t* delivered;
+    uint32_t* latencies;
+    uint64_t latencyCount;
+    pthread_t thread;
+} LoadThread;
+
+static void* load_thread(void* arg) {
+    LoadThread* load = arg;
+    int epollfd = epoll_create1(EPOLL_CLOEXEC);
+    for (int i = 0; i < load->clientCount; i++) {
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = &load->clients[i] };
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, load->clients[i].socketfd, &event);
+    }
+    Buffer buffer;
+    buffer_init(&buffer, 512);
+    uint64_t recipients = load->totalClients - 1;
+    uint64_t sent = 0;
+
+    struct epoll_event events[256];
+    while (__atomic_load_n(load->delivered, __ATOMIC_RELAXED) < load->expected) {
+        // Keep a bounded number of messages in flight so latency measures
+        // the server rather than an ever-growing queue
+        while (sent < load->messageCount
+            && __atomic_load_n(load->sent, __ATOMIC_RELAXED) - __atomic_load_n(load->delivered, __ATOMIC_RELAXED) / recipients < IN_FLIGHT_WINDOW) {
+            char content[32];
+            snprintf(content, sizeof(content), "%llu", (unsigned long long)bench_now());
+            MsgFrame frame = {
+                .type = FRAME_MSG,
+                .sender = string_new_static(""),
+                .content = string_new_static(content),
+                .attachmentCount = 0,
+            };
+            protocol_frame_write_msg(load->clients[sent % load->clientCount].socketfd, &buffer, &frame);
+            sent++;
+            __atomic_add_fetch(load->sent, 1, __ATOMIC_RELAXED);
+        }
+
+        int eventCount = epoll_wait(epollfd, events, 256, 10);
+        uint64_t delivered = 0;
+        for (int i = 0; i < eventCount; i++) {
+            LoadClient* client = events[i].data.ptr;
+            ssize_t received = recv(client->socketfd, client->data + client->length, CLIENT_BUFFER_SIZE - client->length, 0);
+            if (received <= 0) {
+                fprintf(stderr, "client disconnected\n");
+                exit(1);
+            }
+            client->length += received;
+            size_t offset = 0;
+            Frame* frame;
+            int result;
+            while ((result = protocol_frame_decode(client->data + offset, client->length - offset, &frame)) > 0) {
+                offset += result;
+                if (frame == NULL)
+                    continue;
+                if (frame->type == FRAME_MSG && load->latencyCount < load->expected) {
+                    uint64_t sentAt = strtoull(string_data(&((MsgFrame*)frame)->content), NULL, 10);
+                    load->latencies[load->latencyCount++] = (bench_now() - sentAt) / 1000;
+                    delivered++;
+                }
+                protocol_frame_free(frame);
+            }
+            memmove(client->data, client->data + offset, client->length - offset);
+            client->length -= offset;
+        }
+        __atomic_add_fetch(load->delivered, delivered, __ATOMIC_RELAXED);
+    }
+    close(epollfd);
+    buffer_free(&buffer);
+    return NULL;
+}
+
+static void run(Backend backend, int clientCount) {
+    int portPipe[2];
+    int controlPipe[2];
+    if (pipe2(portPipe, O_CLOEXEC) < 0 || pipe2(controlPipe, O_CLOEXEC) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    shared->joined = 0;
+    shared->backend = backend;
+    struct rusage before;
+    getrusage(RUSAGE_CHILDREN, &before);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(portPipe[0]);
+        close(controlPipe[1]);
+        serve(backend, portPipe[1], controlPipe[0]);
+    }
+    close(portPipe[1]);
+    close(controlPipe[0]);
+    uint16_t port;
+    if (read(portPipe[0], &port, sizeof(port)) != sizeof(port)) {
+        fprintf(stderr, "%s server failed to start\n", backendNames[backend]);
+        exit(1);
+    }
+    close(portPipe[0]);
+
+    LoadClient* clients = malloc(sizeof(LoadClient) * clientCount);
+    Buffer buffer;
+    buffer_init(&buffer, 512);
+    for (int i = 0; i < clientCount; i++) {
+        clients[i].socketfd = connect_client(port);
+        clients[i].length = 0;
+        IdentFrame ident = {
+            .type = FRAME_IDENT,
+            .name = string_new_static("bench"),
+            .version = PROTOCOL_VERSION,
+            .capabilities = 0,
+        };
+        protocol_frame_write_ident(clients[i].socketfd, &buffer, &ident);
+    }
+    while (__atomic_load_n(&shared->joined, __ATOMIC_ACQUIRE) < clientCount)
+        usleep(1000);
+
+    uint64_t messageCount = TARGET_DELIVERIES / (clientCount - 1);
+    if (messageCount < IN_FLIGHT_WINDOW)
+        messageCount = IN_FLIGHT_WINDOW;
+    uint64_t expected = messageCount * (clientCount - 1);
+    uint64_t sent = 0;
+    uint64_t delivered = 0;
+    int threadCount = shardCount < clientCount / 2 ? shardCount : clientCount / 2;
+    LoadThread* loads = calloc(threadCount, sizeof(LoadThread));
+
+    uint64_t start = bench_now();
+    for (int i = 0; i < threadCount; i++) {
+        LoadThread* load = &loads[i];
+        int first = (int)((int64_t)clientCount * i / threadCount);
+        load->clients = &clients[first];
+        load->clientCount = (int)((int64_t)clientCount * (i + 1) / threadCount) - first;
+        load->totalClients = clientCount;
+        load->messageCount = messageCount * (i + 1) / threadCount - messageCount * i / threadCount;
+        load->expected = expected;
+        load->sent = &sent;
+        load->delivered = &delivered;
+        load->latencies = malloc(sizeof(uint32_t) * expected);
+        pthread_create(&load->thread, NULL, load_thread, load);
+    }
+    for (int i = 0; i < threadCount; i++)
+        pthread_join(loads[i].thread, NULL);
+    double elapsed = (bench_now() - start) / 1e9;
+    uint32_t* latencies = malloc(sizeof(uint32_t) * expected);
+    uint64_t latencyCount = 0;
+    for (int i = 0; i < threadCount; i++) {
+        memcpy(latencies + latencyCount, loads[i].latencies, loads[i].latencyCount * sizeof(uint32_t));
+        latencyCount += loads[i].latencyCount;
+        free(loads[i].latencies);
+    }
+    free(loads);
+
+    for (int i = 0; i < clientCount; i++)
+        close(clients[i].socketfd);
+    close(controlPipe[1]);
+    waitpid(pid, NULL, 0);
+    struct rusage after;
+    getrusage(RUSAGE_CHILDREN, &after);
+    double cpu = cpu_seconds(&after) - cpu_seconds(&before);
+
+    bench_begin(backendNames[backend]);
+    if (shared->backend != (int)backend)
+        bench_label("fallback", backendNames[shared->backend]);
+    bench_field("shards", backend == BACKEND_BLOCKING ? 1 : shardCount);
+    bench_field("clients", clientCount);
+    bench_field("messages", messageCount);
+    bench_field("deliveries/s", expected / elapsed);
+    // CPU time of the whole server process, setup and teardown included
+    bench_field("server_cpu_s", cpu);
+    bench_field("cpu_ns/delivery", cpu * 1e9 / expected);
+    bench_percentiles(latencies, latencyCount, "us");
+    bench_end();
+
+    free(latencies);
+    free(clients);
+    buffer_free(&buffer);
+}
+
+int main(int argc, char** argv) {
+    signal(SIGPIPE, SIG_IGN);
+    shared = mmap(NULL, sizeof(SharedState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-s") == 0) {
+        shardCount = atoi(argv[2]) > 0 ? atoi(argv[2]) : 1;
+        first = 3;
+    }
+    int defaults[] = { 1000, 10000 };
+    int countCount = argc > first ? argc - first : 2;
+    for (int i = 0; i < countCount; i++) {
+        int clientCount = argc > first ? atoi(argv[first + i]) : defaults[i];
+        if (clientCount < 2)
+            continue;
+        for (Backend backend = BACKEND_BLOCKING; backend <= BACKEND_URING; backend++)
+            run(backend, clientCount);
+    }
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/server_load.c src/server.c src/rooms.c src/backlog.c src/uring.c src/outbox.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c src/sendqueue.c src/timerwheel.c src/linkstats.c -lm -lpthread -o server_load
+// File:        server_load.c
+// Description: This file contains a load generator for the multi-client
+//              server. It connects a growing number of clients over
+//              loopback and reports delivered messages/sec and the p99
+//              delivery latency of the fan-out.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/ringbuffer.h"
+#include "../src/protocol.h"
+#include "../src/server.h"
+#include "bench.h"
+
+#define TARGET_DELIVERIES 2000000
+#define IN_FLIGHT_WINDOW 64
+
+typedef struct {
+    int socketfd;
+    RingBuffer inBuffer;
+} LoadClient;
+
+static int joinedCount = 0;
+static uint64_t deliveredCount = 0;
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void on_join(ChatServer* server, ChatClient* client, void* data) {
+    __atomic_add_fetch(&joinedCount, 1, __ATOMIC_RELEASE);
+}
+
+static void* server_thread(void* arg) {
+    chat_server_run(arg);
+    return NULL;
+}
+
+static int connect_client(uint16_t port) {
+    int socketfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) },
+    };
+    if (connect(socketfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    return socketfd;
+}
+
+static void run(ChatServer* server, int clientCount) {
+    LoadClient* clients = malloc(sizeof(LoadClient) * clientCount);
+    int epollfd = epoll_create1(0);
+    Buffer buffer;
+    buffer_init(&buffer, 512);
+
+    __atomic_store_n(&joinedCount, 0, __ATOMIC_RELEASE);
+    for (int i = 0; i < clientCount; i++) {
+        clients[i].socketfd = connect_client(server->port);
+        ringbuffer_init(&clients[i].inBuffer, PROTOCOL_READ_BUFFER_SIZE);
+        IdentFrame ident = {
+            .type = FRAME_IDENT,
+            .name = string_new_static("bench"),
+            .version = PROTOCOL_VERSION,
+            .capabilities = 0,
+        };
+        protocol_frame_write_ident(clients[i].socketfd, &buffer, &ident);
+        struct epoll_event event = { .events = EPOLLIN, .data.ptr = &clients[i] };
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, clients[i].socketfd, &event);
+    }
+    while (__atomic_load_n(&joinedCount, __ATOMIC_ACQUIRE) < clientCount)
+        usleep(1000);
+
+    uint64_t messageCount = TARGET_DELIVERIES / (clientCount - 1);
+    uint64_t expected = messageCount * (clientCount - 1);
+    uint32_t* latencies = malloc(sizeof(uint32_t) * expected);
+    uint64_t sent = 0;
+    deliveredCount = 0;
+
+    struct epoll_event events[256];
+    uint64_t start = now_nanos();
+    while (deliveredCount < expected) {
+        // Keep a bounded number of messages in flight so latency measures
+        // the server rather than an ever-growing queue
+        while (sent < messageCount && sent - deliveredCount / (clientCount - 1) < IN_FLIGHT_WINDOW) {
+            char content[32];
+            snprintf(content, sizeof(content), "%llu", (unsigned long long)now_nanos());
+            MsgFrame frame = {
+                .type = FRAME_MSG,
+                .sender = string_new_static(""),
+                .content = string_new_static(content),
+                .attachmentCount = 0,
+            };
+            protocol_frame_write_msg(clients[sent % clientCount].socketfd, &buffer, &frame);
+            sent++;
+        }
+
+        int eventCount = epoll_wait(epollfd, events, 256, 1000);
+        for (int i = 0; i < eventCount; i++) {
+            LoadClient* client = events[i].data.ptr;
+            if (ringbuffer_fill(&client->inBuffer, client->socketfd) <= 0) {
+                fprintf(stderr, "client disconnected\n");
+                exit(1);
+            }
+            Frame* frame;
+            int result;
+            while ((result = protocol_frame_decode(ringbuffer_read_ptr(&client->inBuffer), ringbuffer_used(&client->inBuffer), &frame)) > 0) {
+                ringbuffer_consume(&client->inBuffer, result);
+                if (frame == NULL)
+                    continue;
+                if (frame->type == FRAME_MSG && deliveredCount < expected) {
+                    uint64_t sentAt = strtoull(string_data(&((MsgFrame*)frame)->content), NULL, 10);
+                    latencies[deliveredCount++] = (now_nanos() - sentAt) / 1000;
+                }
+                protocol_frame_free(frame);
+            }
+        }
+    }
+    double elapsed = (now_nanos() - start) / 1e9;
+
+    bench_begin("fanout");
+    bench_field("clients", clientCount);
+    bench_field("messages", messageCount);
+    bench_field("deliveries/s", expected / elapsed);
+    bench_percentiles(latencies, expected, "us");
+    bench_end();
+
+    for (int i = 0; i < clientCount; i++) {
+        close(clients[i].socketfd);
+        ringbuffer_free(&clients[i].inBuffer);
+    }
+    // Give the server a moment to reap the closed connections
+    usleep(100000);
+    close(epollfd);
+    free(latencies);
+    free(clients);
+    buffer_free(&buffer);
+}
+
+int main(int argc, char** argv) {
+    ChatServer server;
+    if (chat_server_init(&server, string_new_static("host"), 0, false) != 0)
+        return 1;
+    server.callbacks.onJoin = on_join;
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, server_thread, &server);
+
+    int counts[] = { 2, 10, 100, 1000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+        run(&server, counts[i]);
+
+    chat_server_stop(&server);
+    pthread_join(thread, NULL);
+    chat_server_free(&server);
+    return 0;
+}
@@ -0,0 +1,185 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/string.c src/string.c -lm -o string
+// File:        string.c
+// Description: This file contains a benchmark for the String type. It
+//              measures copy/free of names and messages, building a line
+//              one char at a time, and copying a frame's strings into an
+//              arena, against the original always-allocating String.
+//              Usage: string [iterations]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../src/string.h"
+#include "bench.h"
+
+// The original String: always on the heap, grown with floating-point math.
+// Kept out of line, as it was when it lived in its own file.
+#define LEGACY __attribute__((noinline))
+
+typedef struct {
+    char* data;
+    int length;
+    int allocated;
+} LegacyString;
+
+LEGACY static void legacy_init(LegacyString* string, int initialSize) {
+    string->length = 0;
+    string->allocated = (initialSize > 0 ? initialSize : 0) + 1;
+    string->data = malloc(string->allocated);
+    string->data[0] = '\0';
+}
+
+LEGACY static void legacy_grow(LegacyString* string, int additionalSize) {
+    int newSize = string->length + additionalSize + 1;
+    if (newSize > string->allocated) {
+        int oldSize = string->allocated;
+        string->allocated = (int)pow(2, ceil(log2(newSize)));
+        if (oldSize > 0)
+            string->data = realloc(string->data, string->allocated);
+        else
+            string->data = malloc(string->allocated);
+    }
+}
+
+LEGACY static void legacy_append(LegacyString* string, const char* data, int length) {
+    legacy_grow(string, length);
+    memcpy(string->data + string->length, data, length);
+    string->length += length;
+    string->data[string->length] = '\0';
+}
+
+LEGACY static void legacy_append_char(LegacyString* string, char c) {
+    legacy_grow(string, 1);
+    string->data[string->length++] = c;
+    string->data[string->length] = '\0';
+}
+
+LEGACY static LegacyString legacy_copy(LegacyString* string) {
+    LegacyString copy;
+    legacy_init(&copy, string->length);
+    legacy_append(&copy, string->data, string->length);
+    return copy;
+}
+
+LEGACY static void legacy_free(LegacyString* string) {
+    if (string->allocated > 0)
+        free(string->data);
+}
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char* name, uint64_t legacy, uint64_t current, int iterations) {
+    bench_begin(name);
+    bench_field("legacy_ns/op", (double)legacy / iterations);
+    bench_field("string_ns/op", (double)current / iterations);
+    bench_field("speedup", (double)legacy / current);
+    bench_end();
+}
+
+// Copy and free a string the way frames and messages are copied
+static void bench_copy(const char* name, char* text, int iterations) {
+    volatile int sink = 0;
+    LegacyString legacySource;
+    legacy_init(&legacySource, 0);
+    legacy_append(&legacySource, text, strlen(text));
+    uint64_t start = now_nanos();
+    for (int i = 0; i < iterations; i++) {
+        LegacyString copy = legacy_copy(&legacySource);
+        sink += copy.data[0];
+        legacy_free(&copy);
+    }
+    uint64_t legacy = now_nanos() - start;
+    legacy_free(&legacySource);
+
+    String source = string_new_static(text);
+    start = now_nanos();
+    for (int i = 0; i < iterations; i++) {
+        String copy = string_copy(&source);
+        sink += string_data(&copy)[0];
+        string_free(&copy);
+    }
+    report(name, legacy, now_nanos() - start, iterations);
+}
+
+// Type a line one char at a time, as the input buffer does
+static void bench_append(int iterations, int lineLength) {
+    volatile int sink = 0;
+    uint64_t start = now_nanos();
+    for (int i = 0; i < iterations; i++) {
+        LegacyString line;
+        legacy_init(&line, 0);
+        for (int c = 0; c < lineLength; c++)
+            legacy_append_char(&line, 'a' + c % 26);
+        sink += line.length;
+        legacy_free(&line);
+    }
+    uint64_t legacy = now_nanos() - start;
+
+    start = now_nanos();
+    for (int i = 0; i < iterations; i++) {
+        String line = string_new(0);
+        for (int c = 0; c < lineLength; c++)
+            string_append_char(&line, 'a' + c % 26);
+        sink += line.length;
+        string_free(&line);
+    }
+    report("append-line", legacy, now_nanos() - start, iterations);
+}
+
+// Decode the strings of one message frame and release them together
+static void bench_arena(char* sender, char* content, int iterations) {
+    volatile int sink = 0;
+    int senderLength = strlen(sender), contentLength = strlen(content);
+    uint64_t start = now_nanos();
+    for (int i = 0; i < iterations; i++) {
+        LegacyString strings[2];
+        legacy_init(&strings[0], senderLength);
+        legacy_append(&strings[0], sender, senderLength);
+        legacy_init(&strings[1], contentLength);
+        legacy_append(&strings[1], content, contentLength);
+        sink += strings[0].length + strings[1].length;
+        legacy_free(&strings[0]);
+        legacy_free(&strings[1]);
+    }
+    uint64_t legacy = now_nanos() - start;
+
+    StringArena arena;
+    string_arena_init(&arena);
+    start = now_nanos();
+    for (int i = 0; i < iterations; i++) {
+        String strings[2] = {
+            string_new_arena(&arena, sender, senderLength),
+            string_new_arena(&arena, content, contentLength),
+        };
+        sink += strings[0].length + strings[1].length;
+        // Released in bulk after every read of 32 frames
+        if (i % 32 == 31)
+            string_arena_reset(&arena);
+    }
+    report("arena-frame", legacy, now_nanos() - start, iterations);
+    string_arena_free(&arena);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 10000000;
+    bench_begin("layout");
+    bench_field("sizeof", sizeof(String));
+    bench_field("inline", STRING_INLINE_SIZE - 1);
+    bench_end();
+    bench_copy("copy-name", "alice", iterations);
+    bench_copy("copy-message", "can you check the build on staging before I merge it after lunch?", iterations);
+    bench_append(iterations / 10, 64);
+    bench_arena("alice", "can you check the build on staging before I merge it after lunch?", iterations);
+    return 0;
+}
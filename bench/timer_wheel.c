@@ -0,0 +1,351 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/timer_wheel.c src/timerwheel.c -o timer_wheel
+// File:        timer_wheel.c
+// Description: This file contains a benchmark keeping 100k connection
+//              timers live in the timer wheel: scheduling, rescheduling as
+//              traffic arrives, cancelling, and expiring them as the clock
+//              advances one millisecond at a time, against a binary heap.
+//              It first runs random operations on the wheel and the heap
+//              side by side, and fails if a timer fires early, late, out of
+//              order or more than once.
+//              Usage: timer_wheel [timers]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "../src/timerwheel.h"
+#include "bench.h"
+
+// Heap entries point back at their timer's index so it can be moved
+typedef struct {
+    uint64_t deadline;
+    int id;
+} HeapEntry;
+
+typedef struct {
+    HeapEntry* entries;
+    int* positions;
+    int count;
+} Heap;
+
+static uint64_t fired = 0;
+
+static uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void report(const char* name, const char* operation, uint64_t elapsed, int count) {
+    bench_begin(name);
+    bench_label("operation", operation);
+    bench_field("count", count);
+    bench_field("ns/op", (double)elapsed / count);
+    bench_end();
+}
+
+static void on_expire(Timer* timer, void* data) {
+    fired++;
+}
+
+static void heap_swap(Heap* heap, int a, int b) {
+    HeapEntry entry = heap->entries[a];
+    heap->entries[a] = heap->entries[b];
+    heap->entries[b] = entry;
+    heap->positions[heap->entries[a].id] = a;
+    heap->positions[heap->entries[b].id] = b;
+}
+
+static void heap_fix(Heap* heap, int index) {
+    while (index > 0 && heap->entries[(index - 1) / 2].deadline > heap->entries[index].deadline) {
+        heap_swap(heap, index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+    while (true) {
+        int smallest = index;
+        for (int child = 2 * index + 1; child <= 2 * index + 2 && child < heap->count; child++) {
+            if (heap->entries[child].deadline < heap->entries[smallest].deadline)
+                smallest = child;
+        }
+        if (smallest == index)
+            return;
+        heap_swap(heap, index, smallest);
+        index = smallest;
+    }
+}
+
+static void heap_push(Heap* heap, int id, uint64_t deadline) {
+    heap->entries[heap->count] = (HeapEntry){ deadline, id };
+    heap->positions[id] = heap->count;
+    heap_fix(heap, heap->count++);
+}
+
+static void heap_remove(Heap* heap, int id) {
+    int index = heap->positions[id];
+    heap_swap(heap, index, --heap->count);
+    if (index < heap->count)
+        heap_fix(heap, index);
+}
+
+// State of the check, which the expiry callback needs to reach
+static struct {
+    TimerWheel* wheel;
+    Timer* timers;
+    int count;
+    Heap heap;
+    // Time the running advance goes up to, and the deadline of the last
+    // timer it fired
+    uint64_t now;
+    uint64_t lastFired;
+    int fired;
+} check;
+
+static void check_fail(const char* what, int id) {
+    fprintf(stderr, "timer wheel: %s (timer %d, now %llu)\n", what, id, (unsigned long long)check.now);
+    exit(1);
+}
+
+// Deadlines from now: within a tick or a level, just around where levels
+// meet, far out and past the top level's range, and some already passed
+static uint64_t check_deadline(void) {
+    uint64_t now = check.wheel->current;
+    switch (rand() % 6) {
+        case 0: return now + rand() % TIMER_WHEEL_SLOTS;
+        case 1: return now + rand() % 4096;
+        case 2: return now + ((uint64_t)1 << (TIMER_WHEEL_BITS * (1 + rand() % TIMER_WHEEL_LEVELS))) - 2 + rand() % 4;
+        case 3: return now + rand() % (1 << 22);
+        case 4: return now + ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) + rand() % (1 << 26);
+        default: return now - rand() % 100;
+    }
+}
+
+// Schedule on both; a deadline that already passed is due on the next tick
+static void check_schedule(int id, uint64_t deadline) {
+    timer_wheel_schedule(check.wheel, &check.timers[id], deadline);
+    uint64_t due = deadline > check.wheel->current ? deadline : check.wheel->current;
+    if (check.heap.positions[id] >= 0) {
+        check.heap.entries[check.heap.positions[id]].deadline = due;
+        heap_fix(&check.heap, check.heap.positions[id]);
+    } else {
+        heap_push(&check.heap, id, due);
+    }
+}
+
+static void check_cancel(int id) {
+    timer_wheel_cancel(check.wheel, &check.timers[id]);
+    if (check.heap.positions[id] >= 0) {
+        heap_remove(&check.heap, id);
+        check.heap.positions[id] = -1;
+    }
+}
+
+// Callbacks may reschedule their own timer or cancel another one
+static void on_check_expire(Timer* timer, void* data) {
+    int id = timer - check.timers;
+    int position = check.heap.positions[id];
+    if (position < 0)
+        check_fail("fired while not scheduled", id);
+    uint64_t deadline = check.heap.entries[position].deadline;
+    if (deadline > check.now)
+        check_fail("fired early", id);
+    if (deadline < check.lastFired)
+        check_fail("fired out of order", id);
+    check.lastFired = deadline;
+    heap_remove(&check.heap, id);
+    check.heap.positions[id] = -1;
+    check.fired++;
+    switch (rand() % 8) {
+        case 0: check_schedule(id, check_deadline()); break;
+        case 1: check_cancel(rand() % check.count); break;
+    }
+}
+
+// Advance to now, after checking that sleeping for the timeout asked for
+// first would not have made any timer late
+static void check_advance(uint64_t now) {
+    long timeout = timer_wheel_timeout(check.wheel, check.now);
+    if ((timeout < 0) != (check.heap.count == 0))
+        check_fail("timeout disagrees with the timers scheduled", -1);
+    if (timeout >= 0 && check.heap.entries[0].deadline < check.now + timeout)
+        check_fail("timeout sleeps past a deadline", check.heap.entries[0].id);
+    check.now = now;
+    check.lastFired = 0;
+    check.fired = 0;
+    int count = timer_wheel_advance(check.wheel, now);
+    if (count != check.fired)
+        check_fail("advance miscounted the timers it fired", -1);
+    // Deadlines that passed are due on the tick after it, no later
+    if (check.wheel->current != now + 1)
+        check_fail("wheel clock is not one tick past the advance", -1);
+    if (check.heap.count > 0 && check.heap.entries[0].deadline <= now)
+        check_fail("not fired by its deadline", check.heap.entries[0].id);
+    if (check.wheel->count != check.heap.count)
+        check_fail("wheel lost count of its timers", -1);
+}
+
+// Run random schedules, cancels and advances on the wheel and a heap side
+// by side. Every timer must fire exactly once, in the first advance that
+// reaches its deadline, in deadline order.
+static void check_against_heap(int count, int operations) {
+    check.wheel = malloc(sizeof(TimerWheel));
+    check.timers = malloc(sizeof(Timer) * count);
+    check.count = count;
+    check.heap = (Heap){
+        .entries = malloc(sizeof(HeapEntry) * count),
+        .positions = malloc(sizeof(int) * count),
+        .count = 0,
+    };
+    check.now = 1000000;
+    timer_wheel_init(check.wheel, check.now);
+    for (int i = 0; i < count; i++) {
+        timer_init(&check.timers[i], on_check_expire, NULL);
+        check.heap.positions[i] = -1;
+    }
+
+    srand(2);
+    for (int i = 0; i < operations; i++) {
+        int kind = rand() % 10;
+        if (kind < 4) {
+            check_schedule(rand() % count, check_deadline());
+        } else if (kind < 5) {
+            check_cancel(rand() % count);
+        } else {
+            // By a tick, a few, as far as the timeout says like an event
+            // loop would, and rarely by hours
+            long timeout = timer_wheel_timeout(check.wheel, check.now);
+            int step = rand() % 100;
+            uint64_t by = step < 40 ? 1
+                : step < 70 ? rand() % 100
+                : step < 99 || rand() % 10 != 0 ? (timeout > 0 ? timeout : 1)
+                : rand() % (1 << 25);
+            check_advance(check.now + by);
+        }
+    }
+    for (int i = 0; i < count; i++)
+        check_cancel(i);
+    if (check.wheel->count != 0)
+        check_fail("timers left after cancelling every one", -1);
+    free(check.wheel);
+    free(check.timers);
+    free(check.heap.entries);
+    free(check.heap.positions);
+}
+
+static void run_wheel(int count, uint64_t* deadlines, int* order) {
+    Timer* timers = malloc(sizeof(Timer) * count);
+    TimerWheel* wheel = malloc(sizeof(TimerWheel));
+    uint64_t now = 1000000;
+    timer_wheel_init(wheel, now);
+    for (int i = 0; i < count; i++)
+        timer_init(&timers[i], on_expire, NULL);
+
+    uint64_t start = now_nanos();
+    for (int i = 0; i < count; i++)
+        timer_wheel_schedule(wheel, &timers[i], now + deadlines[i]);
+    report("wheel", "schedule", now_nanos() - start, count);
+
+    // Traffic on a connection pushes its timeout back
+    start = now_nanos();
+    for (int i = 0; i < count; i++)
+        timer_wheel_schedule(wheel, &timers[order[i]], now + deadlines[i] + 1000);
+    report("wheel", "reschedule", now_nanos() - start, count);
+
+    start = now_nanos();
+    for (int i = 0; i < count / 2; i++)
+        timer_wheel_cancel(wheel, &timers[order[i]]);
+    report("wheel", "cancel", now_nanos() - start, count / 2);
+
+    // Expire the rest a millisecond at a time, asking for the next timeout
+    // on every pass like an event loop would
+    fired = 0;
+    int live = wheel->count;
+    long passes = 0;
+    start = now_nanos();
+    while (wheel->count > 0) {
+        long timeout = timer_wheel_timeout(wheel, now);
+        now += timeout > 0 ? timeout : 1;
+        timer_wheel_advance(wheel, now);
+        passes++;
+    }
+    uint64_t elapsed = now_nanos() - start;
+    report("wheel", "expire", elapsed, live);
+    bench_begin("wheel");
+    bench_field("passes", passes);
+    bench_field("fired", fired);
+    bench_end();
+    free(wheel);
+    free(timers);
+}
+
+static void run_heap(int count, uint64_t* deadlines, int* order) {
+    Heap heap = {
+        .entries = malloc(sizeof(HeapEntry) * count),
+        .positions = malloc(sizeof(int) * count),
+        .count = 0,
+    };
+    uint64_t now = 1000000;
+
+    uint64_t start = now_nanos();
+    for (int i = 0; i < count; i++)
+        heap_push(&heap, i, now + deadlines[i]);
+    report("heap", "schedule", now_nanos() - start, count);
+
+    start = now_nanos();
+    for (int i = 0; i < count; i++) {
+        int id = order[i];
+        heap.entries[heap.positions[id]].deadline = now + deadlines[i] + 1000;
+        heap_fix(&heap, heap.positions[id]);
+    }
+    report("heap", "reschedule", now_nanos() - start, count);
+
+    start = now_nanos();
+    for (int i = 0; i < count / 2; i++)
+        heap_remove(&heap, order[i]);
+    report("heap", "cancel", now_nanos() - start, count / 2);
+
+    int live = heap.count;
+    start = now_nanos();
+    while (heap.count > 0) {
+        now = heap.entries[0].deadline;
+        while (heap.count > 0 && heap.entries[0].deadline <= now) {
+            heap_remove(&heap, heap.entries[0].id);
+            fired++;
+        }
+    }
+    report("heap", "expire", now_nanos() - start, live);
+    free(heap.entries);
+    free(heap.positions);
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    check_against_heap(1000, 200000);
+
+    // Deadlines spread like connection timeouts: mostly within a minute,
+    // some pings a few seconds out, a few hours-long ones
+    uint64_t* deadlines = malloc(sizeof(uint64_t) * count);
+    int* order = malloc(sizeof(int) * count);
+    srand(1);
+    for (int i = 0; i < count; i++) {
+        int kind = rand() % 10;
+        deadlines[i] = kind < 3 ? 2000 + rand() % 100 : kind < 9 ? rand() % 60000 : rand() % (6 * 3600 * 1000);
+        order[i] = i;
+    }
+    for (int i = count - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int swap = order[i];
+        order[i] = order[j];
+        order[j] = swap;
+    }
+
+    run_wheel(count, deadlines, order);
+    run_heap(count, deadlines, order);
+    free(order);
+    free(deadlines);
+    return 0;
+}
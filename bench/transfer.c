@@ -0,0 +1,158 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -O2 bench/transfer.c src/transfer.c src/protocol.c src/compress.c src/string.c src/buffer.c src/metrics.c src/ringbuffer.c -lm -lpthread -o transfer
+// File:        transfer.c
+// Description: This file contains a benchmark streaming a multi-GB
+//              attachment to a loopback peer, with sendfile and with a
+//              read-into-buffer baseline, and reports the throughput.
+//              Usage: transfer [size in GB] [download dir]
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "../src/string.h"
+#include "../src/buffer.h"
+#include "../src/ringbuffer.h"
+#include "../src/protocol.h"
+#include "../src/transfer.h"
+#include "bench.h"
+
+typedef struct {
+    int socketfd;
+    uint64_t size;
+    char* directory;
+} Receiver;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* receive_loop(void* arg) {
+    Receiver* receiver = arg;
+    RingBuffer ring;
+    ringbuffer_init(&ring, PROTOCOL_READ_BUFFER_SIZE);
+    TransferReceiver downloads;
+    transfer_receiver_init(&downloads, string_new_static(receiver->directory));
+
+    String name = string_new_static("bench.bin");
+    String path;
+    transfer_receiver_begin(&downloads, 0, &name, receiver->size, &path);
+
+    uint64_t received = 0;
+    Frame* frame;
+    while (received < receiver->size && protocol_frame_read(receiver->socketfd, &ring, &frame) == 0) {
+        if (frame->type == FRAME_DATA) {
+            transfer_receiver_write(&downloads, (DataFrame*)frame);
+            received += ((DataFrame*)frame)->length;
+        }
+        protocol_frame_free(frame);
+    }
+
+    unlink(string_data(&path));
+    string_free(&path);
+    transfer_receiver_free(&downloads);
+    ringbuffer_free(&ring);
+    return NULL;
+}
+
+static void run(const char* name, bool zeroCopy, const char* path, uint64_t size, char* directory) {
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr = { .s_addr = htonl(INADDR_LOOPBACK) },
+    };
+    socklen_t addrSize = sizeof(addr);
+    bind(listenfd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(listenfd, 1);
+    getsockname(listenfd, (struct sockaddr*)&addr, &addrSize);
+
+    int senderfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(senderfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    Receiver receiver = {
+        .socketfd = accept(listenfd, NULL, NULL),
+        .size = size,
+        .directory = directory,
+    };
+    pthread_t thread;
+    pthread_create(&thread, NULL, receive_loop, &receiver);
+
+    TransferSender sender;
+    transfer_sender_init(&sender);
+    OutgoingTransfer transfer;
+    if (transfer_sender_open(&sender, path, &transfer) < 0) {
+        perror("open");
+        exit(1);
+    }
+
+    Buffer buffer;
+    buffer_init(&buffer, 0);
+    double start = now_seconds();
+    while (transfer.offset < transfer.size) {
+        int result;
+        if (zeroCopy) {
+            result = transfer_send_chunk(senderfd, &sender.header, PROTOCOL_VERSION, &transfer);
+        } else {
+            result = transfer_read_chunk(&buffer, PROTOCOL_VERSION, &transfer);
+            if (result == 0)
+                result = buffer_flush(&buffer, senderfd);
+        }
+        if (result < 0) {
+            perror("send");
+            exit(1);
+        }
+    }
+    pthread_join(thread, NULL);
+    double elapsed = now_seconds() - start;
+
+    bench_begin(name);
+    bench_field("bytes", size);
+    bench_field("MB/s", size / elapsed / 1e6);
+    bench_end();
+
+    transfer_close(&transfer);
+    transfer_sender_free(&sender);
+    buffer_free(&buffer);
+    close(senderfd);
+    close(receiver.socketfd);
+    close(listenfd);
+}
+
+int main(int argc, char** argv) {
+    double gigabytes = argc > 1 ? atof(argv[1]) : 2;
+    char* directory = argc > 2 ? argv[2] : "/tmp";
+    uint64_t size = gigabytes * 1e9;
+
+    // A sparse file keeps the source in the page cache without disk reads
+    char path[] = "/tmp/mychat-transfer-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || ftruncate(fd, size) < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+
+    // Read the source once so both runs start from a warm page cache
+    static char chunk[1 << 20];
+    for (off_t offset = 0; pread(fd, chunk, sizeof(chunk), offset) > 0; offset += sizeof(chunk));
+    close(fd);
+
+    run("buffered", false, path, size, directory);
+    run("sendfile", true, path, size, directory);
+    unlink(path);
+    return 0;
+}
@@ -4,35 +4,27 @@
 // Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
 // File:        app.c
 // Description: This file contains the implementation for the
-//              application logic and TUI rendering.
+//              application logic shared by every front end.
 
 #define _GNU_SOURCE 1
 #include <stdio.h>
-#include <ncurses.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <argp.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include "string.h"
 #include "protocol.h"
 #include "app.h"
-
-void message_free(Message* message) {
-    string_free(&message->content);
-    for (int i = 0; i < message->attachmentCount; i++)
-        string_free(&message->attachments[i]);
-    free(message->attachments);
-    free(message);
-}
+#include "metrics.h"
 
 void chat_app_destroy(ChatApp* app) {
-    delwin(app->statusWindow);
-    delwin(app->messageWindow);
-    delwin(app->inputWindow);
-    endwin();
-
     if (app->socketfd >= 0)
         close(app->socketfd);
 }
@@ -41,157 +33,1022 @@ void chat_app_free(ChatApp* app) {
     string_free(&app->name);
     string_free(&app->peerName);
     string_free(&app->peerAddr);
-    string_free(&app->sendBuffer);
-    for (int i = 0; i < app->messageCount; i++)
-        message_free(app->messages[i]);
-    free(app->messages);
-    pthread_mutex_destroy(&app->sendMutex);
+    string_free(&app->room);
+    for (int i = 0; i < app->roomCount; i++)
+        string_free(&app->rooms[i]);
+    free(app->rooms);
+    buffer_free(&app->outBuffer);
+    ringbuffer_free(&app->inBuffer);
+    history_free(&app->history);
+    scrollback_free(&app->scrollback);
+    if (app->log != NULL) {
+        message_log_close(app->log);
+        free(app->log);
+    }
+    if (app->server != NULL) {
+        server_group_free(app->server);
+        free(app->server);
+    }
+    transfer_sender_free(&app->transfers);
+    transfer_receiver_free(&app->downloads);
+    buffer_free(&app->transferBuffer);
+    compress_stream_free(&app->recvStream);
+    string_arena_free(&app->arena);
+    outbox_free(&app->outbox);
     pthread_mutex_destroy(&app->stateMutex);
+    pthread_cond_destroy(&app->reconnected);
     free(app);
 }
 
-void chat_app_init(ChatApp* app, String name, bool isServer) {
-    initscr();
+// Load the newest messages from the end of the log, as many as the front
+// end can show. Older records stay mapped and are never decoded.
+static void chat_app_replay_log(ChatApp* app, int limit) {
+    LogCursor cursor = message_log_end(app->log);
+    int count = 0;
+    while (count < limit && message_log_prev(app->log, &cursor))
+        count++;
+    for (int i = 0; i < count; i++) {
+        MsgFrame* frame;
+        if (message_log_read(app->log, &cursor, &frame) == 0) {
+            Message message = {
+                .isOutgoing = false,
+                .sender = frame->sender,
+                .content = frame->content,
+                .attachments = frame->attachmentNames,
+                .attachmentCount = frame->attachmentCount,
+            };
+            history_append(&app->history, &message);
+            protocol_frame_free((Frame*)frame);
+        }
+        message_log_next(app->log, &cursor);
+    }
+}
 
-    start_color();
-    // status text green background
-    init_pair(1, COLOR_BLACK, COLOR_GREEN);
-    // status text red background
-    init_pair(2, COLOR_BLACK, COLOR_RED);
-    // status text yellow background
-    init_pair(3, COLOR_BLACK, COLOR_YELLOW);
+// Pick a session that no other client is likely to have, never 0
+static uint64_t chat_app_new_session(void) {
+    uint64_t session = 0;
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (read(fd, &session, sizeof(session)) != sizeof(session))
+            session = 0;
+        close(fd);
+    }
+    if (session == 0)
+        session = link_now() ^ (uint64_t)getpid() << 32;
+    return session != 0 ? session : 1;
+}
 
-    app->name = name;
+void chat_app_init(ChatApp* app, ChatConfig* config) {
+    app->name = config->name;
     app->peerName = string_new_static("");
     app->peerAddr = string_new_static("");
+    app->room = string_new_static("");
+    app->rooms = NULL;
+    app->roomCount = 0;
+    app->lastSeq = 0;
+    app->ackedSeq = 0;
+    app->session = chat_app_new_session();
+    app->lost = false;
+    app->parked = false;
+    app->connection = 0;
+    pthread_cond_init(&app->reconnected, NULL);
+    app->reconnectDelay = RECONNECT_MIN_DELAY;
     app->status = DISCONNECTED;
-    app->messages = NULL;
-    app->messageCount = 0;
-    app->statusWindow = newwin(1, 0, 0, 0);
-    app->messageWindow = newwin(0, 0, 1, 0);
-    app->inputWindow = newwin(1, 0, LINES - 1, 0);
+    history_init(&app->history, config->historyBytes);
+    scrollback_init(&app->scrollback);
+    app->scroll = 0;
+    app->viewRows = 0;
+    app->log = NULL;
+    if (config->logDir != NULL) {
+        app->log = malloc(sizeof(MessageLog));
+        if (message_log_open(app->log, config->logDir, config->logSync) == 0) {
+            chat_app_replay_log(app, config->replayMessages);
+        } else {
+            free(app->log);
+            app->log = NULL;
+        }
+    }
+    app->dirty = RENDER_ALL;
     app->socketfd = -1;
-    app->isServer = isServer;
-    app->peerLastActive = 0;
+    app->version = 1;
+    app->compress = config->compress;
+    app->batchWindow = config->batchWindow;
+    app->batchFrames = config->batchFrames > 0 ? config->batchFrames : 1;
+    app->noDelay = config->noDelay;
+    app->cork = config->cork;
+    app->serverIo = config->serverIo;
+    app->serverShards = config->serverShards;
+    app->compressed = false;
+    compress_stream_init(&app->recvStream, false);
+    string_arena_init(&app->arena);
+    app->server = NULL;
+    app->clientCount = 0;
+    app->isServer = config->isServer;
     app->lastActive = time(NULL);
-    string_init(&app->sendBuffer, 0);
+    app->lastInput = link_now();
+    app->peerLastInput = 0;
+    link_stats_init(&app->link);
+    buffer_init(&app->outBuffer, 512);
+    ringbuffer_init(&app->inBuffer, PROTOCOL_READ_BUFFER_SIZE);
     pthread_mutex_init(&app->stateMutex, NULL);
-    pthread_mutex_init(&app->sendMutex, NULL);
+    outbox_init(&app->outbox, OUTBOX_HIGH_WATER);
+    transfer_sender_init(&app->transfers);
+    transfer_receiver_init(&app->downloads, string_new_static(config->downloadDir));
+    buffer_init(&app->transferBuffer, 0);
+    app->callbacks = (ChatAppCallbacks){ 0 };
+    app->callbackData = NULL;
+}
 
-    scrollok(app->messageWindow, TRUE);
-    wrefresh(app->statusWindow);
-    wrefresh(app->messageWindow);
-    wrefresh(app->inputWindow);
+// Mark parts of the state as changed for the next render
+void chat_app_invalidate(ChatApp* app, int parts) {
+    __atomic_fetch_or(&app->dirty, parts, __ATOMIC_RELAXED);
 }
 
+// Hand what changed since the last render to the front end
 void chat_app_render(ChatApp* app) {
     // Prevent state changes while rendering
-    pthread_mutex_lock(&app->stateMutex);
-
-    werase(app->statusWindow);
-    werase(app->messageWindow);
-    werase(app->inputWindow);
-    switch (app->status) {
-        case DISCONNECTED:
-            wbkgd(app->statusWindow, COLOR_PAIR(2));
-            break;
-        case CONNECTED:
-            wbkgd(app->statusWindow, COLOR_PAIR(1));
-            break;
-        case IDLE:
-            wbkgd(app->statusWindow, COLOR_PAIR(3));
-            break;
-    }
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    uint64_t start = metrics_now();
+
+    int dirty = __atomic_exchange_n(&app->dirty, 0, __ATOMIC_RELAXED);
+    if (app->callbacks.onUpdate != NULL)
+        app->callbacks.onUpdate(app, dirty, app->callbackData);
+    metrics_record(METRIC_RENDER_TIME, metrics_now() - start);
+
+    pthread_mutex_unlock(&app->stateMutex);
+}
 
-    char* statusString = app->status == DISCONNECTED
-        ? "Disconnected"
-        : app->status == CONNECTED
-        ? "Connected" 
-        : "Idle";
+// Name a message is shown under
+String* chat_app_message_sender(ChatApp* app, Message* message) {
+    return message->isOutgoing
+        ? &app->name
+        : message->sender.length > 0
+        ? &message->sender
+        : &app->peerName;
+}
+
+// Persist a message as the frame it would be shown from, under the sender
+// it was resolved to so it reads the same when replayed. The attachment
+// sizes and transfer ids are those the message was sent or received with.
+static void chat_app_log_message(ChatApp* app, Message* message, String* sender, uint64_t* sizes, uint32_t* ids) {
+    MsgFrame frame = {
+        .type = FRAME_MSG,
+        .sender = *sender,
+        .content = message->content,
+        .attachmentCount = message->attachmentCount,
+        .attachmentNames = message->attachments,
+        .attachmentSizes = sizes,
+        .attachmentIds = ids,
+    };
+    message_log_append(app->log, &frame);
+}
+
+// Copy a message into the history, and into the log when persist is set
+// along with the size and id of each attachment. The caller keeps
+// ownership of the message and its strings.
+static void chat_app_add_message(ChatApp* app, Message* message, uint64_t* sizes, uint32_t* ids, bool persist) {
+    persist = persist && app->log != NULL;
+    String sender = string_new_static("");
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    history_append(&app->history, message);
+    // A view scrolled back stays on the messages it shows
+    if (app->scroll > 0)
+        app->scroll++;
+    if (persist)
+        sender = string_copy(chat_app_message_sender(app, message));
+    pthread_mutex_unlock(&app->stateMutex);
+    // Outside the lock so a slow disk does not hold up the other threads
+    if (persist)
+        chat_app_log_message(app, message, &sender, sizes, ids);
+    string_free(&sender);
+    // Outside the lock so the front end can send in reply
+    if (app->callbacks.onMessage != NULL)
+        app->callbacks.onMessage(app, message, app->callbackData);
+}
+
+void chat_app_append_message(ChatApp* app, Message* message, uint64_t* sizes, uint32_t* ids) {
+    chat_app_add_message(app, message, sizes, ids, true);
+}
+
+// Show a local notice in the message history. Notices are not logged, so
+// they are not replayed as chat on the next start.
+static void chat_app_append_notice(ChatApp* app, char* text, char* detail) {
+    Message message = {
+        .isOutgoing = false,
+        .sender = string_new_static("*"),
+        .content = string_new(0),
+        .attachments = NULL,
+        .attachmentCount = 0,
+    };
+    string_append_static(&message.content, text);
+    string_append_static(&message.content, detail);
+    chat_app_add_message(app, &message, NULL, NULL, false);
+    string_free(&message.content);
+}
 
-    int padding = COLS - strlen(statusString) - app->peerAddr.length;
-    wprintw(app->statusWindow, "%s", statusString);
-    for (int i = 0; i < padding; i++) wprintw(app->statusWindow, " ");
-    wprintw(app->statusWindow, "%s\n", app->peerAddr.data);
-    for (int i = 0; i < app->messageCount; i++) {
-        Message* message = app->messages[i];
-        wprintw(app->messageWindow, "%s: %s\n", message->isOutgoing ? app->name.data : app->peerName.data, message->content.data);
-        for (int j = 0; j < message->attachmentCount; j++)
-            wprintw(app->messageWindow, "Attachment: %s\n", message->attachments[j].data);
+// Queue a frame without waiting for the socket. Returns false when the
+// connection is too far behind to take it.
+static bool chat_app_send_frame(ChatApp* app, Frame* frame) {
+    if (app->isServer) {
+        server_group_broadcast(app->server, frame);
+        return true;
+    }
+    // Encoded into a buffer of its own since any thread may be sending,
+    // which is then handed to the outbox as it is
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    protocol_frame_encode_version(&buffer, frame, __atomic_load_n(&app->version, __ATOMIC_ACQUIRE));
+    EncodedFrame* encoded = encoded_frame_finish(&buffer);
+    metrics_frame_out(frame->type, encoded->length);
+    bool queued = outbox_push(&app->outbox, encoded);
+    encoded_frame_release(encoded);
+    return queued;
+}
+
+// Announce a file in a message, then hand it to the transfer thread which
+// streams it in chunks between other frames
+static void chat_app_send_attachment(ChatApp* app, char* path) {
+    if (!app->isServer && __atomic_load_n(&app->version, __ATOMIC_ACQUIRE) < 2) {
+        chat_app_append_notice(app, "The server does not support attachments", "");
+        return;
+    }
+    OutgoingTransfer transfer;
+    if (transfer_sender_open(&app->transfers, path, &transfer) < 0) {
+        chat_app_append_notice(app, "Cannot attach ", path);
+        return;
     }
+    if (app->isServer)
+        transfer.id = server_group_next_transfer_id(app->server);
+
+    char* baseName = strrchr(path, '/');
+    baseName = baseName != NULL ? baseName + 1 : path;
+    String name = string_new_static(baseName);
+
+    MsgFrame frame = {
+        .type = FRAME_MSG,
+        .sender = app->isServer ? string_view(&app->name) : string_new_static(""),
+        .content = string_new_static(""),
+        .attachmentCount = 1,
+        .attachmentNames = &name,
+        .attachmentSizes = &transfer.size,
+        .attachmentIds = &transfer.id,
+        .room = string_view(&app->room),
+    };
+    bool queued = chat_app_send_frame(app, (Frame*)&frame);
 
-    if (app->sendBuffer.length > COLS - 2) {
-        wprintw(app->inputWindow, "..%s", app->sendBuffer.data + app->sendBuffer.length - (COLS - 4));
+    if (!queued) {
+        transfer_close(&transfer);
+        chat_app_append_notice(app, "Connection is backed up, not sent: ", path);
+        return;
+    }
+    if (transfer.size > 0) {
+        transfer_sender_queue(&app->transfers, &transfer);
+        if (!app->isServer)
+            outbox_wake(&app->outbox);
     } else {
-        wprintw(app->inputWindow, "> %s", app->sendBuffer.data);
+        transfer_close(&transfer);
     }
-    
 
-    wrefresh(app->statusWindow);
-    wrefresh(app->messageWindow);
-    wrefresh(app->inputWindow);
+    String attachment = string_new_static(path);
+    Message message = {
+        .isOutgoing = true,
+        .sender = string_new_static(""),
+        .content = string_new_static(""),
+        .attachments = &attachment,
+        .attachmentCount = 1,
+    };
+    chat_app_append_message(app, &message, &transfer.size, &transfer.id);
+}
+
+static void chat_app_set_room(ChatApp* app, String room) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    string_free(&app->room);
+    app->room = room;
+    pthread_mutex_unlock(&app->stateMutex);
+}
 
+// Add a room to the ones joined again after a reconnect, or remove it
+static void chat_app_track_room(ChatApp* app, String* room, bool joined) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    int index = -1;
+    for (int i = 0; i < app->roomCount; i++) {
+        if (app->rooms[i].length == room->length && memcmp(string_data(&app->rooms[i]), string_data(room), room->length) == 0)
+            index = i;
+    }
+    if (joined && index < 0) {
+        app->rooms = realloc(app->rooms, (app->roomCount + 1) * sizeof(String));
+        app->rooms[app->roomCount++] = string_copy(room);
+    } else if (!joined && index >= 0) {
+        string_free(&app->rooms[index]);
+        app->rooms[index] = app->rooms[--app->roomCount];
+    }
     pthread_mutex_unlock(&app->stateMutex);
 }
 
-void chat_app_append_message(ChatApp* app, Message* message) {
-    pthread_mutex_lock(&app->stateMutex);
-    if (app->messageCount > 0)
-        app->messages = realloc(app->messages, app->messageCount * 2 * sizeof(Message*));
+// Join a room and post to it from now on. The server keeps the client in
+// the rooms it joined before, so their messages keep arriving. The host
+// sees every room and only switches where its messages go.
+static void chat_app_join(ChatApp* app, char* name) {
+    String room = string_new_static(name);
+    if (!room_index_valid_name(&room)) {
+        chat_app_append_notice(app, "Not a valid room name: ", name);
+        return;
+    }
+    if (!app->isServer) {
+        if (__atomic_load_n(&app->version, __ATOMIC_ACQUIRE) < 2) {
+            chat_app_append_notice(app, "The server does not support rooms", "");
+            return;
+        }
+        RoomFrame frame = { .type = FRAME_JOIN, .room = room };
+        if (!chat_app_send_frame(app, (Frame*)&frame)) {
+            chat_app_append_notice(app, "Connection is backed up, not joined: ", name);
+            return;
+        }
+        chat_app_track_room(app, &room, true);
+    }
+    chat_app_set_room(app, string_copy(&room));
+    chat_app_append_notice(app, "Posting to #", name);
+}
+
+// Leave a room, the current one when no name is given, and post to
+// everyone again if it was the current one
+static void chat_app_leave(ChatApp* app, char* name) {
+    String room = name != NULL ? string_new_static(name) : string_view(&app->room);
+    if (room.length == 0) {
+        chat_app_append_notice(app, "Not in a room", "");
+        return;
+    }
+    if (!app->isServer) {
+        RoomFrame frame = { .type = FRAME_LEAVE, .room = room };
+        if (!chat_app_send_frame(app, (Frame*)&frame)) {
+            chat_app_append_notice(app, "Connection is backed up, not left: ", string_data(&room));
+            return;
+        }
+        chat_app_track_room(app, &room, false);
+    }
+    chat_app_append_notice(app, "Left #", string_data(&room));
+    if (room.length == app->room.length && memcmp(string_data(&room), string_data(&app->room), room.length) == 0)
+        chat_app_set_room(app, string_new_static(""));
+}
+
+// Send a line of input as a message, or run a command: "/attach PATH" to
+// send a file, "/join ROOM" and "/leave [ROOM]". Returns false when the
+// message could not be queued, in which case the caller may keep the text
+// to send it again.
+bool chat_app_send(ChatApp* app, String* text) {
+    if (strncmp(string_data(text), "/attach ", 8) == 0) {
+        chat_app_send_attachment(app, string_data(text) + 8);
+        return true;
+    }
+    if (strncmp(string_data(text), "/join ", 6) == 0) {
+        chat_app_join(app, string_data(text) + 6);
+        return true;
+    }
+    if (strcmp(string_data(text), "/leave") == 0 || strncmp(string_data(text), "/leave ", 7) == 0) {
+        chat_app_leave(app, text->length > 7 ? string_data(text) + 7 : NULL);
+        return true;
+    }
+
+    // The frame only borrows the text; it is encoded before returning
+    MsgFrame frame = {
+        .type = FRAME_MSG,
+        .sender = app->isServer ? string_view(&app->name) : string_new_static(""),
+        .content = string_view(text),
+        .attachmentCount = 0,
+        .attachmentNames = NULL,
+        .attachmentSizes = NULL,
+        .attachmentIds = NULL,
+        .room = string_view(&app->room),
+    };
+    bool queued = chat_app_send_frame(app, (Frame*)&frame);
+
+    if (!queued) {
+        chat_app_append_notice(app, "Connection is backed up, message not sent", "");
+        return false;
+    }
+
+    Message message = {
+        .isOutgoing = true,
+        .sender = string_new_static(""),
+        .content = *text,
+        .attachments = NULL,
+        .attachmentCount = 0,
+    };
+    chat_app_append_message(app, &message, NULL, NULL);
+    return true;
+}
+
+// Name a received message is shown under, with the room it was posted to
+static String chat_app_shown_sender(String* sender, MsgFrame* frame) {
+    if (frame->room.length == 0)
+        return string_view(sender);
+    String shown = string_copy(sender);
+    string_append_static(&shown, " #");
+    string_append(&shown, &frame->room);
+    return shown;
+}
+
+// Add a received message to the history and start receiving its
+// attachments into the download directory. Messages posted to a room are
+// shown with it after the sender. Version 1 servers only announce
+// attachments, so those are shown by name.
+static void chat_app_receive_message(ChatApp* app, String* sender, MsgFrame* frame) {
+    String shown = chat_app_shown_sender(sender, frame);
+    String attachments[frame->attachmentCount > 0 ? frame->attachmentCount : 1];
+    bool announced = !app->isServer && __atomic_load_n(&app->version, __ATOMIC_ACQUIRE) < 2;
+    for (int i = 0; i < frame->attachmentCount; i++) {
+        if (announced) {
+            attachments[i] = string_copy(&frame->attachmentNames[i]);
+            string_append_static(&attachments[i], " (not sent)");
+        } else if (transfer_receiver_begin(&app->downloads, frame->attachmentIds[i], &frame->attachmentNames[i], frame->attachmentSizes[i], &attachments[i]) < 0) {
+            string_free(&attachments[i]);
+            attachments[i] = string_copy(&frame->attachmentNames[i]);
+            string_append_static(&attachments[i], " (could not be saved)");
+        }
+    }
+    Message message = {
+        .isOutgoing = false,
+        .sender = shown,
+        .content = frame->content,
+        .attachments = attachments,
+        .attachmentCount = frame->attachmentCount,
+    };
+    chat_app_append_message(app, &message, frame->attachmentSizes, frame->attachmentIds);
+    for (int i = 0; i < frame->attachmentCount; i++)
+        string_free(&attachments[i]);
+    string_free(&shown);
+}
+
+// Put a transfer back in the queue if it has more to send
+static void chat_app_requeue_transfer(ChatApp* app, OutgoingTransfer* transfer, int result) {
+    if (result == 0 && transfer->offset < transfer->size)
+        transfer_sender_queue(&app->transfers, transfer);
     else
-        app->messages = malloc(sizeof(Message*));
-    app->messages[app->messageCount++] = message;
+        transfer_close(transfer);
+}
+
+// Stream queued attachments to every client one chunk at a time when
+// hosting. Chunks are fanned out to every client, so each has to be read
+// once into memory rather than sent from the file per socket.
+void chat_app_transfer_loop(ChatApp* app) {
+    OutgoingTransfer transfer;
+    while (transfer_sender_next(&app->transfers, &transfer)) {
+        int result = transfer_read_chunk(&app->transferBuffer, PROTOCOL_VERSION, &transfer);
+        if (result == 0)
+            server_group_broadcast_bytes(app->server, app->transferBuffer.data, app->transferBuffer.length);
+        chat_app_requeue_transfer(app, &transfer, result);
+    }
+}
+
+// Send the next chunk of an attachment. Compressed chunks have to pass
+// through memory, so sendfile is only used on uncompressed connections.
+static int chat_app_send_chunk(ChatApp* app, CompressStream* stream, Buffer* compressed, OutgoingTransfer* transfer) {
+    uint8_t version = __atomic_load_n(&app->version, __ATOMIC_ACQUIRE);
+    if (!__atomic_load_n(&app->compressed, __ATOMIC_ACQUIRE))
+        return transfer_send_chunk(app->socketfd, &app->transfers.header, version, transfer);
+    if (transfer_read_chunk(&app->transferBuffer, version, transfer) < 0)
+        return -1;
+    buffer_clear(compressed);
+    protocol_frames_compress(compressed, app->transferBuffer.data, app->transferBuffer.length, stream, true);
+    return buffer_flush(compressed, app->socketfd);
+}
+
+static uint64_t now_micros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void chat_app_set_cork(ChatApp* app, bool cork) {
+    int value = cork;
+    setsockopt(app->socketfd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+
+// Milliseconds since the local user last typed, as sent in pings and pongs
+static uint32_t chat_app_idle_millis(ChatApp* app, uint64_t now) {
+    uint64_t lastInput = __atomic_load_n(&app->lastInput, __ATOMIC_RELAXED);
+    uint64_t idle = now > lastInput ? (now - lastInput) / 1000000 : 0;
+    return idle < UINT32_MAX ? idle : UINT32_MAX;
+}
+
+// Mark the peer idle once its last input is IDLE_TIMEOUT seconds old on
+// the local monotonic clock. Runs on the writer thread, which owns the
+// timer wheel.
+static void chat_app_idle_timeout(Timer* timer, void* data) {
+    ChatApp* app = data;
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    int64_t remaining = (int64_t)(app->peerLastInput + IDLE_TIMEOUT * 1000000000ull - link_now());
+    bool change = remaining < 0 && app->status == CONNECTED;
+    if (change)
+        app->status = IDLE;
+    pthread_mutex_unlock(&app->stateMutex);
+
+    // Check again when the last input would turn stale, or every interval
+    // while the peer stays idle
+    uint64_t delay = remaining < 0 ? IDLE_CHECK_INTERVAL * 1000 : remaining / 1000000 + 1;
+    timer_wheel_schedule(&app->timers, timer, timer_now() + delay);
+    if (change) {
+        chat_app_invalidate(app, RENDER_STATUS);
+        chat_app_render(app);
+    }
+}
+
+static bool chat_app_lost(ChatApp* app) {
+    return __atomic_load_n(&app->lost, __ATOMIC_ACQUIRE);
+}
+
+// Ping the server so round trips are measured from this side too. Dropped
+// like pongs when the connection is backed up, and skipped while it is
+// down.
+static void chat_app_ping(Timer* timer, void* data) {
+    ChatApp* app = data;
+    uint64_t now = link_now();
+    PingFrame pingFrame = {
+        .type = FRAME_PING,
+        .lastActive = app->lastActive,
+        .idle = chat_app_idle_millis(app, now),
+        .sent = now,
+    };
+    if (!chat_app_lost(app))
+        chat_app_send_frame(app, (Frame*)&pingFrame);
+    timer_wheel_schedule(&app->timers, timer, timer->deadline + PING_INTERVAL * 1000);
+}
+
+// Ack the last message received when it changed since the last ack. Acks
+// are cumulative, so one covers every message before it.
+static void chat_app_ack(Timer* timer, void* data) {
+    ChatApp* app = data;
+    uint64_t seq = __atomic_load_n(&app->lastSeq, __ATOMIC_RELAXED);
+    if (seq > app->ackedSeq && !chat_app_lost(app) && __atomic_load_n(&app->version, __ATOMIC_ACQUIRE) >= 2) {
+        AckFrame ackFrame = { .type = FRAME_ACK, .seq = seq };
+        if (chat_app_send_frame(app, (Frame*)&ackFrame))
+            app->ackedSeq = seq;
+    }
+    timer_wheel_schedule(&app->timers, timer, timer_now() + ACK_INTERVAL);
+}
+
+// Mark the connection lost, once however many threads notice it fail, and
+// wake the writer thread to reconnect. The socket is only shut down here,
+// so neither thread can be left on a number that was reused. Attempts that
+// fail before the server answered are not announced again.
+static void chat_app_lose_connection(ChatApp* app, int connection) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    bool first = connection == app->connection && !app->lost;
+    bool announce = first && app->status != DISCONNECTED;
+    if (first) {
+        __atomic_store_n(&app->lost, true, __ATOMIC_RELEASE);
+        app->status = DISCONNECTED;
+        shutdown(app->socketfd, SHUT_RDWR);
+        outbox_wake(&app->outbox);
+    }
     pthread_mutex_unlock(&app->stateMutex);
+    if (!announce)
+        return;
+    chat_app_append_notice(app, "Connection lost, reconnecting", "");
+    chat_app_invalidate(app, RENDER_STATUS);
+    chat_app_render(app);
 }
 
-void chat_app_send_message_buffer(ChatApp* app) {
-    pthread_mutex_lock(&app->sendMutex);
-    MsgFrame* frame = (MsgFrame*)protocol_frame_new(FRAME_MSG);
-    frame->content = string_copy(&app->sendBuffer);
-    frame->attachmentCount = 0;
-    frame->attachmentNames = NULL;
-    frame->attachmentSizes = NULL;
-    protocol_frame_write_msg(app->socketfd, frame);
-    protocol_frame_free((Frame*)frame);
-    pthread_mutex_unlock(&app->sendMutex);
+// Open a connection to the server, giving up after RECONNECT_TIMEOUT.
+// Returns the socket or -1.
+static int chat_app_dial(ChatApp* app) {
+    int socketfd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socketfd < 0)
+        return -1;
+    struct timeval timeout = { RECONNECT_TIMEOUT, 0 };
+    setsockopt(socketfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (connect(socketfd, (struct sockaddr*)&app->serverAddr, sizeof(app->serverAddr)) < 0) {
+        close(socketfd);
+        return -1;
+    }
+    // Writes block for as long as they need again once connected
+    timeout.tv_sec = 0;
+    setsockopt(socketfd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (app->noDelay) {
+        int enable = 1;
+        setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+    return socketfd;
+}
+
+// Introduce ourselves on a new connection with the last message received,
+// so the server replays only what came after it, and join our rooms again
+// right after. The ident says how many joins follow, so the server waits
+// for them before replaying.
+static int chat_app_send_ident(ChatApp* app, int socketfd) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    // Rooms are only joined on version 2 servers
+    uint8_t version = __atomic_load_n(&app->version, __ATOMIC_ACQUIRE);
+    int rooms = version >= 2 ? app->roomCount : 0;
+    if (rooms > UINT16_MAX)
+        rooms = UINT16_MAX;
+    IdentFrame identFrame = {
+        .type = FRAME_IDENT,
+        .name = string_view(&app->name),
+        .version = PROTOCOL_VERSION,
+        .capabilities = app->compress ? PROTOCOL_CAP_COMPRESSION : 0,
+        .seq = __atomic_load_n(&app->lastSeq, __ATOMIC_RELAXED),
+        .session = app->session,
+        .rooms = rooms,
+    };
+    buffer_clear(&app->outBuffer);
+    protocol_frame_encode(&app->outBuffer, (Frame*)&identFrame);
+    for (int i = 0; i < rooms; i++) {
+        RoomFrame joinFrame = { .type = FRAME_JOIN, .room = app->rooms[i] };
+        protocol_frame_encode_version(&app->outBuffer, (Frame*)&joinFrame, version);
+    }
+    pthread_mutex_unlock(&app->stateMutex);
+    return buffer_flush(&app->outBuffer, socketfd);
+}
 
-    Message* message = malloc(sizeof(Message));
-    message->isOutgoing = true;
-    message->content = string_copy(&app->sendBuffer);
-    message->attachments = NULL;
-    message->attachmentCount = 0;
-    chat_app_append_message(app, message);
-    string_clear(&app->sendBuffer);
+// Delay before the next attempt to reconnect, doubling each time up to the
+// maximum. Up to half of it is taken off at random, so clients dropped
+// together do not all come back at once.
+static uint64_t chat_app_backoff(ChatApp* app) {
+    uint64_t delay = __atomic_load_n(&app->reconnectDelay, __ATOMIC_RELAXED);
+    __atomic_store_n(&app->reconnectDelay, delay * 2 < RECONNECT_MAX_DELAY ? delay * 2 : RECONNECT_MAX_DELAY, __ATOMIC_RELAXED);
+    return delay - rand() % (delay / 2 + 1);
 }
 
+// Dial the server again once the receive thread has let go of the lost
+// socket, backing off between failed attempts
+static void chat_app_reconnect(Timer* timer, void* data) {
+    ChatApp* app = data;
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    bool parked = app->parked;
+    pthread_mutex_unlock(&app->stateMutex);
+    int socketfd = parked ? chat_app_dial(app) : -1;
+    if (socketfd >= 0 && chat_app_send_ident(app, socketfd) < 0) {
+        close(socketfd);
+        socketfd = -1;
+    }
+    if (socketfd < 0) {
+        timer_wheel_schedule(&app->timers, timer, timer_now() + (parked ? chat_app_backoff(app) : 1));
+        return;
+    }
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    close(app->socketfd);
+    app->socketfd = socketfd;
+    app->connection++;
+    __atomic_store_n(&app->lost, false, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&app->reconnected);
+    pthread_mutex_unlock(&app->stateMutex);
+}
+
+// Run due timers and return how long the writer may sleep for them, in
+// microseconds, or -1 when none is scheduled
+static long chat_app_run_timers(ChatApp* app) {
+    uint64_t now = timer_now();
+    timer_wheel_advance(&app->timers, now);
+    long timeout = timer_wheel_timeout(&app->timers, now);
+    return timeout < 0 ? -1 : timeout * 1000;
+}
+
+// Forget everything tied to a lost connection: frames on their way to it,
+// the compression window and attachments being sent, whose chunks the
+// server could not match on a new connection. Frames still in the outbox
+// wait for the next one.
+static void chat_app_writer_reset(ChatApp* app, SendQueue* queue, CompressStream* stream, size_t* bytes) {
+    send_queue_free(queue);
+    send_queue_init(queue);
+    outbox_sent(&app->outbox, *bytes);
+    *bytes = 0;
+    compress_stream_free(stream);
+    compress_stream_init(stream, true);
+    __atomic_store_n(&app->compressed, false, __ATOMIC_RELEASE);
+    app->ackedSeq = 0;
+    OutgoingTransfer transfer;
+    while (transfer_sender_poll(&app->transfers, &transfer))
+        transfer_close(&transfer);
+}
+
+// The only thread that writes to the socket when connected as a client.
+// Queued frames go out first, batched into one writev; attachment chunks
+// are only sent when no frame is waiting, so chat frames wait for at most
+// one chunk. Frames that follow closely on the last write are held for the
+// rest of the batch window so a burst leaves in a few large writes, while
+// an isolated message is written at once. When the connection is lost the
+// writer only runs its timers until one of them reconnects.
+void chat_app_writer_loop(ChatApp* app) {
+    SendQueue queue;
+    send_queue_init(&queue);
+    CompressStream stream;
+    compress_stream_init(&stream, true);
+    Buffer compressed;
+    buffer_init(&compressed, 0);
+    // The outbox counts frames as they were queued, before compression
+    size_t bytes = 0;
+    uint64_t lastWrite = 0;
+    bool corked = false;
+    timer_wheel_init(&app->timers, timer_now());
+    timer_init(&app->idleTimer, chat_app_idle_timeout, app);
+    timer_wheel_schedule(&app->timers, &app->idleTimer, timer_now() + IDLE_CHECK_INTERVAL * 1000);
+    timer_init(&app->pingTimer, chat_app_ping, app);
+    timer_wheel_schedule(&app->timers, &app->pingTimer, timer_now() + PING_INTERVAL * 1000);
+    timer_init(&app->ackTimer, chat_app_ack, app);
+    timer_wheel_schedule(&app->timers, &app->ackTimer, timer_now() + ACK_INTERVAL);
+    timer_init(&app->reconnectTimer, chat_app_reconnect, app);
+    // Connection whose loss was last handled; only this thread replaces it
+    int handled = -1;
+    while (true) {
+        if (chat_app_lost(app)) {
+            if (handled != app->connection) {
+                chat_app_writer_reset(app, &queue, &stream, &bytes);
+                corked = false;
+                timer_wheel_schedule(&app->timers, &app->reconnectTimer, timer_now() + chat_app_backoff(app));
+                handled = app->connection;
+            }
+            long timerWait = chat_app_run_timers(app);
+            if (chat_app_lost(app) && handled == app->connection && !outbox_pause_for(&app->outbox, timerWait))
+                break;
+            continue;
+        }
+        long timerWait = chat_app_run_timers(app);
+        EncodedFrame* frame;
+        while ((int)queue.count < app->batchFrames && (frame = outbox_pop(&app->outbox)) != NULL) {
+            bytes += frame->length;
+            if (__atomic_load_n(&app->compressed, __ATOMIC_ACQUIRE)) {
+                buffer_clear(&compressed);
+                protocol_frames_compress(&compressed, frame->data, frame->length, &stream, true);
+                encoded_frame_release(frame);
+                frame = encoded_frame_new(compressed.data, compressed.length);
+            }
+            send_queue_push(&queue, frame);
+            encoded_frame_release(frame);
+        }
+        if (!send_queue_empty(&queue)) {
+            uint64_t now = now_micros();
+            if ((int)queue.count < app->batchFrames && now < lastWrite + app->batchWindow) {
+                long wait = lastWrite + app->batchWindow - now;
+                if (!outbox_wait_for(&app->outbox, timerWait >= 0 && timerWait < wait ? timerWait : wait))
+                    break;
+                continue;
+            }
+            if (send_queue_flush(&queue, app->socketfd) < 0) {
+                chat_app_lose_connection(app, app->connection);
+                continue;
+            }
+            // Uncorking pushes the frames out behind any partial chunk
+            if (corked) {
+                chat_app_set_cork(app, false);
+                corked = false;
+            }
+            outbox_sent(&app->outbox, bytes);
+            bytes = 0;
+            lastWrite = now;
+            continue;
+        }
+
+        OutgoingTransfer transfer;
+        if (transfer_sender_poll(&app->transfers, &transfer)) {
+            if (app->cork && !corked) {
+                chat_app_set_cork(app, true);
+                corked = true;
+            }
+            int result = chat_app_send_chunk(app, &stream, &compressed, &transfer);
+            chat_app_requeue_transfer(app, &transfer, result);
+            continue;
+        }
+        if (corked) {
+            chat_app_set_cork(app, false);
+            corked = false;
+        }
+        if (!outbox_wait_for(&app->outbox, timerWait))
+            break;
+    }
+    buffer_free(&compressed);
+    compress_stream_free(&stream);
+    send_queue_free(&queue);
+}
+
+static void chat_app_export_link_stats(LinkStats* stats) {
+    metrics_set(METRIC_RTT, stats->rtt / 1e9);
+    metrics_set(METRIC_JITTER, stats->jitter / 1e9);
+    metrics_set(METRIC_SKEW, stats->skew);
+}
+
+// Answer a ping, echoing its send time. Dropped if the connection is
+// backed up; the next ping gets another chance.
+static void chat_app_send_pong(ChatApp* app, PingFrame* pingFrame) {
+    uint64_t now = link_now();
+    PongFrame pongFrame = {
+        .type = FRAME_PONG,
+        .lastActive = app->lastActive,
+        .idle = chat_app_idle_millis(app, now),
+        .sent = now,
+        .echo = pingFrame->sent,
+    };
+    chat_app_send_frame(app, (Frame*)&pongFrame);
+}
+
+// Record the peer's last input from a ping or pong on the local clock, and
+// the round trip when a pong answers one of our pings. Coming back from
+// idle shows right away; going idle is noticed by the idle timer.
+static void chat_app_peer_active(ChatApp* app, PingFrame* frame) {
+    uint64_t now = link_now();
+    uint64_t idle = frame->sent != 0
+        ? frame->idle * 1000000ull
+        // Version 1 peers only send their wall clock
+        : (uint64_t)(time(NULL) > frame->lastActive ? time(NULL) - frame->lastActive : 0) * 1000000000ull;
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    app->peerLastInput = now > idle ? now - idle : 0;
+    bool change = app->status == IDLE && idle <= IDLE_TIMEOUT * 1000000000ull;
+    if (change)
+        app->status = CONNECTED;
+    if (frame->type == FRAME_PONG && frame->echo != 0) {
+        link_stats_sample(&app->link, frame->echo, frame->sent, now);
+        chat_app_export_link_stats(&app->link);
+        change = true;
+    }
+    pthread_mutex_unlock(&app->stateMutex);
+
+    if (change) {
+        chat_app_invalidate(app, RENDER_STATUS);
+        chat_app_render(app);
+    }
+}
+
+// Messages of the session the view can scroll back through
+static size_t chat_app_local_count(ChatApp* app) {
+    return history_end(&app->history) - history_first(&app->history);
+}
+
+// Ask the server for a page the view needs but does not have, one at a
+// time. Messages before the session are only fetched once scrolled to.
+static void chat_app_fetch_history(ChatApp* app) {
+    if (app->isServer)
+        return;
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    size_t local = chat_app_local_count(app);
+    size_t top = app->scroll + app->viewRows;
+    uint64_t before;
+    bool missing = top > local && app->status != DISCONNECTED
+        && scrollback_request(&app->scrollback, app->scroll > local ? app->scroll - local : 0, top - local, &before);
+    pthread_mutex_unlock(&app->stateMutex);
+    if (!missing)
+        return;
+    HistoryRequestFrame request = {
+        .type = FRAME_HISTORY_REQUEST,
+        .before = before,
+        .count = SCROLLBACK_PAGE_MESSAGES,
+    };
+    if (!chat_app_send_frame(app, (Frame*)&request)) {
+        metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+        scrollback_cancel(&app->scrollback);
+        pthread_mutex_unlock(&app->stateMutex);
+    }
+}
+
+// Keep a page of messages from before the session that the view asked for
+static void chat_app_receive_page(ChatApp* app, HistoryPageFrame* frame) {
+    int count = frame->count;
+    Message messages[count > 0 ? count : 1];
+    for (int i = 0; i < count; i++) {
+        MsgFrame* msgFrame = frame->messages[i];
+        messages[i] = (Message){
+            .isOutgoing = false,
+            .sender = chat_app_shown_sender(&msgFrame->sender, msgFrame),
+            .content = msgFrame->content,
+            .attachments = msgFrame->attachmentNames,
+            .attachmentCount = msgFrame->attachmentCount,
+        };
+    }
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    scrollback_add(&app->scrollback, frame->before, count > 0 ? frame->messages[0]->seq : 0, messages, count);
+    pthread_mutex_unlock(&app->stateMutex);
+    for (int i = 0; i < count; i++)
+        string_free(&messages[i].sender);
+    chat_app_invalidate(app, RENDER_MESSAGES);
+    // The view may reach into the page after it
+    chat_app_fetch_history(app);
+}
+
+// Move the view back by delta messages, or forward for a negative delta,
+// for a front end showing rows of them. Until the server has nothing
+// older, the view may go back past the messages known so far, which are
+// then fetched.
+void chat_app_scroll(ChatApp* app, long delta, int rows) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    size_t total = chat_app_local_count(app) + scrollback_known(&app->scrollback);
+    size_t limit = !scrollback_complete(&app->scrollback) ? total : total > (size_t)rows ? total - rows : 0;
+    long scroll = (long)app->scroll + delta;
+    app->scroll = scroll < 0 ? 0 : (size_t)scroll < limit ? (size_t)scroll : limit;
+    app->viewRows = rows;
+    pthread_mutex_unlock(&app->stateMutex);
+    chat_app_invalidate(app, RENDER_MESSAGES);
+    chat_app_fetch_history(app);
+}
+
+// Fill rows with the messages in a view scrolled back, oldest first: those
+// of the session from the history, then those before it from the fetched
+// pages. Messages whose page has not arrived are left out. Called with the
+// state locked.
+int chat_app_view(ChatApp* app, Message** rows, int maxRows) {
+    size_t local = chat_app_local_count(app);
+    size_t end = history_end(&app->history);
+    int count = 0;
+    for (size_t offset = app->scroll + maxRows; offset-- > app->scroll;) {
+        Message* message = offset < local
+            ? history_get(&app->history, end - 1 - offset)
+            : scrollback_get(&app->scrollback, offset - local);
+        if (message != NULL)
+            rows[count++] = message;
+    }
+    return count;
+}
+
+// Copy the connection's round trip estimates
+void chat_app_link_stats(ChatApp* app, LinkStats* stats) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    *stats = app->link;
+    pthread_mutex_unlock(&app->stateMutex);
+}
+
+static void chat_app_unlock(void* mutex) {
+    pthread_mutex_unlock(mutex);
+}
+
+// Park the receive thread after its connection failed until the writer
+// thread has a new one, and start over on it. Returns the new socket.
+static int chat_app_await_connection(ChatApp* app, int* connection) {
+    chat_app_lose_connection(app, *connection);
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    app->parked = true;
+    pthread_cleanup_push(chat_app_unlock, &app->stateMutex);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    while (app->connection == *connection)
+        pthread_cond_wait(&app->reconnected, &app->stateMutex);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_cleanup_pop(0);
+    app->parked = false;
+    *connection = app->connection;
+    int socketfd = app->socketfd;
+    pthread_mutex_unlock(&app->stateMutex);
+    ringbuffer_consume(&app->inBuffer, ringbuffer_used(&app->inBuffer));
+    compress_stream_free(&app->recvStream);
+    compress_stream_init(&app->recvStream, false);
+    return socketfd;
+}
+
+// Messages are numbered by the server; one numbered no higher than the
+// last received was already shown, replayed after a reconnect while it was
+// also on its way through the server
+static bool chat_app_duplicate(ChatApp* app, MsgFrame* frame) {
+    if (frame->seq == 0)
+        return false;
+    if (frame->seq <= app->lastSeq)
+        return true;
+    __atomic_store_n(&app->lastSeq, frame->seq, __ATOMIC_RELAXED);
+    return false;
+}
+
+// Only cancelled while waiting for a frame or a connection, never while
+// holding a lock to handle one
 void chat_app_recv_loop(ChatApp* app) {
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    int connection = app->connection;
+    int socketfd = app->socketfd;
+    pthread_mutex_unlock(&app->stateMutex);
     while (true) {
-        Frame* frame = protocol_frame_new(FRAME_IDENT);
-        if (protocol_frame_read(app->socketfd, &frame) < 0) {
-            protocol_frame_free(frame);
-            chat_app_destroy(app);
-            chat_app_free(app);
-            fprintf(stderr, "Connection closed\n");
-            exit(1);
+        Frame* frame;
+        // Strings are decoded into the arena, which is cleared once the frame
+        // has been handled; the history keeps its own copy
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        int result = protocol_frame_read_arena(socketfd, &app->inBuffer, app->version, &app->recvStream, &app->arena, &frame);
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+        if (result < 0) {
+            socketfd = chat_app_await_connection(app, &connection);
+            continue;
         }
 
         switch (frame->type) {
             case FRAME_IDENT: {
                 IdentFrame* identFrame = (IdentFrame*)frame;
-                pthread_mutex_lock(&app->stateMutex);
+                // A new session starts from the server's last message
+                bool fresh = app->lastSeq == 0;
+                if (fresh)
+                    __atomic_store_n(&app->lastSeq, identFrame->seq, __ATOMIC_RELAXED);
+                // Only a server that answered ends the backoff
+                __atomic_store_n(&app->reconnectDelay, RECONNECT_MIN_DELAY, __ATOMIC_RELAXED);
+                if (connection > 0)
+                    chat_app_append_notice(app, "Reconnected to ", string_data(&identFrame->name));
+                metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
                 string_free(&app->peerName);
                 app->peerName = string_copy(&identFrame->name);
+                // Frames after the server's ident are in the agreed version
+                uint8_t version = identFrame->version < PROTOCOL_VERSION ? identFrame->version : PROTOCOL_VERSION;
+                __atomic_store_n(&app->version, version, __ATOMIC_RELEASE);
+                __atomic_store_n(&app->compressed, app->compress && version >= 2 && (identFrame->capabilities & PROTOCOL_CAP_COMPRESSION), __ATOMIC_RELEASE);
                 app->status = CONNECTED;
+                // Anything older is fetched from this server when scrolled
+                // back to; a page asked for on a lost connection never comes
+                if (fresh)
+                    scrollback_reset(&app->scrollback, version >= 2 ? identFrame->seq + 1 : 0);
+                else
+                    scrollback_cancel(&app->scrollback);
                 pthread_mutex_unlock(&app->stateMutex);
-                
-                if (app->isServer) {
-                    pthread_mutex_lock(&app->sendMutex);
-                    IdentFrame* responseIdentFrame = (IdentFrame*)protocol_frame_new(FRAME_IDENT);
-                    responseIdentFrame->name = string_copy(&app->name);
-                    protocol_frame_write_ident(app->socketfd, responseIdentFrame);
-                    protocol_frame_free((Frame*)responseIdentFrame);
-                    pthread_mutex_unlock(&app->sendMutex);
-                }
+                chat_app_invalidate(app, RENDER_STATUS);
 
                 // User is connected, render the UI
                 chat_app_render(app);
@@ -199,112 +1056,109 @@ void chat_app_recv_loop(ChatApp* app) {
             }
             case FRAME_MSG: {
                 MsgFrame* msgFrame = (MsgFrame*)frame;
-                Message* message = malloc(sizeof(Message));
-                message->isOutgoing = false;
-                message->content = string_copy(&msgFrame->content);
-                message->attachments = malloc(sizeof(String) * msgFrame->attachmentCount);
-                message->attachmentCount = msgFrame->attachmentCount;
-                for (int i = 0; i < msgFrame->attachmentCount; i++) {
-                    message->attachments[i] = string_new(0);
-                }
-                chat_app_append_message(app, message);
+                if (chat_app_duplicate(app, msgFrame))
+                    break;
+                chat_app_receive_message(app, &msgFrame->sender, msgFrame);
                 // Message received, render the UI
                 chat_app_render(app);
                 break;
             }
-            case FRAME_PING: {
-                PingFrame* pingFrame = (PingFrame*)frame;
-                pthread_mutex_lock(&app->stateMutex);
-                app->peerLastActive = pingFrame->lastActive;
-                pthread_mutex_unlock(&app->stateMutex);
-
-                pthread_mutex_lock(&app->sendMutex);
-                PongFrame* pongFrame = (PongFrame*)protocol_frame_new(FRAME_PONG);
-                pongFrame->lastActive = app->lastActive;
-                protocol_frame_write_pong(app->socketfd, pongFrame);
-                protocol_frame_free((Frame*)pongFrame);
-                pthread_mutex_unlock(&app->sendMutex);
+            case FRAME_HISTORY_PAGE:
+                chat_app_receive_page(app, (HistoryPageFrame*)frame);
+                chat_app_render(app);
                 break;
-            }
-            case FRAME_PONG: {
-                PongFrame* pongFrame = (PongFrame*)frame;
-                pthread_mutex_lock(&app->stateMutex);
-                app->peerLastActive = pongFrame->lastActive;
-                pthread_mutex_unlock(&app->stateMutex);
+            case FRAME_DATA:
+                transfer_receiver_write(&app->downloads, (DataFrame*)frame);
+                break;
+            case FRAME_PING:
+                chat_app_peer_active(app, (PingFrame*)frame);
+                chat_app_send_pong(app, (PingFrame*)frame);
+                break;
+            case FRAME_PONG:
+                chat_app_peer_active(app, (PongFrame*)frame);
+                break;
+            case FRAME_JOIN:
+            case FRAME_LEAVE:
+            case FRAME_ACK:
+            case FRAME_HISTORY_REQUEST:
+                // Only sent by clients
                 break;
-            }
         }
 
         protocol_frame_free(frame);
+        string_arena_reset(&app->arena);
     }
 }
 
-void chat_app_check_idle_loop(ChatApp* app) {
-    while (true) {
-        sleep(IDLE_CHECK_INTERVAL);
-        bool change;
-        if (time(NULL) - app->peerLastActive > IDLE_TIMEOUT) {
-            pthread_mutex_lock(&app->stateMutex);
-            change = app->status == CONNECTED;
-            if (change)
-                app->status = IDLE;
-            pthread_mutex_unlock(&app->stateMutex);
-        } else {
-            pthread_mutex_lock(&app->stateMutex);
-            change = app->status == IDLE;
-            if (change)
-                app->status = CONNECTED;
-            pthread_mutex_unlock(&app->stateMutex);
-        }
-
-        if (change) {
-            chat_app_render(app);
-        }
+// Refresh the host's status line from the number of identified clients
+static void chat_app_update_client_count(ChatApp* app, int delta) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    app->clientCount += delta;
+    app->status = app->clientCount > 0 ? CONNECTED : DISCONNECTED;
+    char* countString;
+    if (asprintf(&countString, "%d client%s on port %hu", app->clientCount, app->clientCount == 1 ? "" : "s", app->server->port) != -1) {
+        string_free(&app->peerAddr);
+        app->peerAddr = string_new(0);
+        string_append_static(&app->peerAddr, countString);
+        free(countString);
     }
+    pthread_mutex_unlock(&app->stateMutex);
+    chat_app_invalidate(app, RENDER_STATUS);
 }
 
-int chat_app_connect_server(ChatApp* app, uint16_t port) {
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("socket");
-        return 1;
-    }
+static void chat_app_on_join(ServerGroup* group, String* name, void* data) {
+    ChatApp* app = data;
+    chat_app_update_client_count(app, 1);
+    chat_app_render(app);
+}
 
-    struct sockaddr_in addr = {
-        .sin_family = AF_INET,
-        .sin_port = htons(port),
-        .sin_addr = {
-            .s_addr = INADDR_ANY
-        }
-    };
+static void chat_app_on_link_stats(ServerGroup* group, LinkStats* summary, void* data) {
+    ChatApp* app = data;
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    app->link = *summary;
+    pthread_mutex_unlock(&app->stateMutex);
+    chat_app_export_link_stats(summary);
+    chat_app_invalidate(app, RENDER_STATUS);
+    chat_app_render(app);
+}
 
-    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        return 1;
-    }
+static void chat_app_on_leave(ServerGroup* group, String* name, void* data) {
+    ChatApp* app = data;
+    chat_app_update_client_count(app, -1);
+    chat_app_render(app);
+}
 
-    if (listen(sockfd, 1) < 0) {
-        perror("listen");
-        return 1;
-    }
+static void chat_app_on_message(ServerGroup* group, MsgFrame* frame, void* data) {
+    ChatApp* app = data;
+    chat_app_receive_message(app, &frame->sender, frame);
+    chat_app_render(app);
+}
 
-    struct sockaddr_in clientAddr;
-    socklen_t clientAddrSize = sizeof(clientAddr);
-    app->socketfd = accept(sockfd, (struct sockaddr *)&clientAddr, &clientAddrSize);
-    if (app->socketfd < 0) {
-        perror("accept");
-        return 1;
-    }
+static void chat_app_on_data(ServerGroup* group, DataFrame* frame, void* data) {
+    ChatApp* app = data;
+    transfer_receiver_write(&app->downloads, frame);
+}
 
-    char* portString;
-    char* clientAddrString = inet_ntoa(clientAddr.sin_addr);
-    string_append_static(&app->peerAddr, clientAddrString);
-    string_append_char(&app->peerAddr, ':');
-    if (asprintf(&portString, "%hu", port) != -1) {
-        string_append_static(&app->peerAddr, portString);
-        free(portString);
+int chat_app_connect_server(ChatApp* app, uint16_t port) {
+    app->server = malloc(sizeof(ServerGroup));
+    if (server_group_init(app->server, app->name, port, app->serverShards) != 0)
+        return 1;
+    for (int i = 0; i < app->server->shardCount; i++) {
+        ChatServer* shard = &app->server->shards[i];
+        shard->compress = app->compress;
+        shard->noDelay = app->noDelay;
+        shard->io = app->serverIo;
     }
 
+    app->server->callbacks = (ServerGroupCallbacks){
+        .onJoin = chat_app_on_join,
+        .onLeave = chat_app_on_leave,
+        .onMessage = chat_app_on_message,
+        .onData = chat_app_on_data,
+        .onLinkStats = chat_app_on_link_stats,
+    };
+    app->server->callbackData = app;
+    chat_app_update_client_count(app, 0);
     return 0;
 }
 
@@ -317,33 +1171,23 @@ int chat_app_connect_client(ChatApp* app, char* address, uint16_t port) {
         free(portString);
     }
 
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("socket");
-        return 1;
-    }
-
-    struct sockaddr_in addr = {
+    app->serverAddr = (struct sockaddr_in){
         .sin_family = AF_INET,
         .sin_port = htons(port)
     };
 
-    if (inet_pton(AF_INET, address, &addr.sin_addr) <= 0) {
+    if (inet_pton(AF_INET, address, &app->serverAddr.sin_addr) <= 0) {
         perror("inet_pton");
         return 1;
     }
 
-    if (connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    // Only the first connection has to succeed; later ones are retried
+    app->socketfd = chat_app_dial(app);
+    if (app->socketfd < 0) {
         perror("connect");
         return 1;
     }
-
-    app->socketfd = sockfd;
-
-    IdentFrame* identFrame = (IdentFrame*)protocol_frame_new(FRAME_IDENT);
-    identFrame->name = app->name;
-    protocol_frame_write_ident(app->socketfd, identFrame);
-    protocol_frame_free((Frame*)identFrame);
+    chat_app_send_ident(app, app->socketfd);
     return 0;
 }
 
@@ -353,59 +1197,47 @@ int chat_app_connect(ChatApp* app, char* address, uint16_t port) {
         : chat_app_connect_client(app, address, port);
 }
 
-void chat_app_ping_loop(ChatApp* app) {
-    while (true) {
-        pthread_mutex_lock(&app->sendMutex);
-        PingFrame* frame = (PingFrame*)protocol_frame_new(FRAME_PING);
-        // TODO: Use correct timestamp
-        frame->lastActive = app->lastActive;
-        protocol_frame_write_ping(app->socketfd, frame);
-        protocol_frame_free((Frame*)frame);
-        pthread_mutex_unlock(&app->sendMutex);
-        sleep(PING_INTERVAL);
+// Start the threads that move frames: the receive and writer threads when
+// connected as a client, the server's shards and the transfer thread when
+// hosting. The calling thread is left to the front end.
+int chat_app_start(ChatApp* app) {
+    void* (*transferLoop)(void*) = app->isServer
+        ? (void* (*)(void*))chat_app_transfer_loop
+        : (void* (*)(void*))chat_app_writer_loop;
+    if (app->isServer) {
+        if (server_group_start(app->server) != 0)
+            return 1;
+    } else {
+        if (pthread_create(&app->recvThread, NULL, (void* (*)(void*))chat_app_recv_loop, app) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
     }
-}
 
-int chat_app_run(ChatApp* app) {
-    pthread_t recvThread, checkIdleThread, pingThread;
-    if (pthread_create(&recvThread, NULL, (void* (*)(void*))chat_app_recv_loop, app) != 0) {
+    if (pthread_create(&app->transferThread, NULL, transferLoop, app) != 0) {
         perror("pthread_create");
         return 1;
     }
+    return 0;
+}
 
-    if (pthread_create(&checkIdleThread, NULL,  (void* (*)(void*))chat_app_check_idle_loop, app) != 0) {
-        perror("pthread_create");
-        return 1;
-    }
+// Record local input, shown to the peer as activity
+void chat_app_input(ChatApp* app) {
+    app->lastActive = time(NULL);
+    __atomic_store_n(&app->lastInput, link_now(), __ATOMIC_RELAXED);
+    if (app->server != NULL)
+        server_group_input(app->server, app->lastActive, app->lastInput);
+}
 
+void chat_app_stop(ChatApp* app) {
+    transfer_sender_stop(&app->transfers);
+    if (!app->isServer)
+        outbox_close(&app->outbox);
+    pthread_join(app->transferThread, NULL);
     if (app->isServer) {
-        if (pthread_create(&pingThread, NULL, (void* (*)(void*))chat_app_ping_loop, app) != 0) {
-            perror("pthread_create");
-            return 1;
-        }
-    }
-
-    // Main loop
-    while (true) {
-        chat_app_render(app);
-        int ch = wgetch(app->inputWindow);
-        app->lastActive = time(NULL);
-        if (ch == 27) // ESC
-            break;
-        else if (ch == 10) { // ENTER
-            if (app->status == DISCONNECTED)
-                continue;
-            chat_app_send_message_buffer(app);
-        } else if (ch == 127) { // BACKSPACE
-            if (app->sendBuffer.length > 0)
-                string_pop_char(&app->sendBuffer);
-        } else {
-            string_append_char(&app->sendBuffer, ch);
-        }
+        server_group_stop(app->server);
+    } else {
+        pthread_cancel(app->recvThread);
+        pthread_join(app->recvThread, NULL);
     }
-
-    pthread_cancel(recvThread);
-    pthread_cancel(checkIdleThread);
-    if (app->isServer)
-        pthread_cancel(pingThread);
 }
@@ -3,52 +3,189 @@
 // Author:      Juan Llamas
 // Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
 // File:        app.h
-// Description: This file contains the definitions for the ChatApp.
+// Description: This file contains the definitions for the ChatApp, the
+//              networking and protocol core. Front ends, the TUI or the
+//              headless line I/O, drive it through callbacks.
 
 #pragma once
 #include <stdint.h>
 #include <pthread.h>
-#include <ncurses.h>
+#include <netinet/in.h>
+#include "buffer.h"
+#include "ringbuffer.h"
+#include "server.h"
+#include "servergroup.h"
+#include "transfer.h"
+#include "outbox.h"
+#include "history.h"
+#include "scrollback.h"
+#include "messagelog.h"
+#include "timerwheel.h"
+#include "linkstats.h"
 
 #define IDLE_CHECK_INTERVAL 1
 #define IDLE_TIMEOUT 10
 #define PING_INTERVAL 2
+// Milliseconds between acks of the messages received, sent only when
+// there is something new to ack
+#define ACK_INTERVAL 200
+// Milliseconds before trying to reconnect after the connection was lost,
+// doubling after every failed attempt up to the maximum
+#define RECONNECT_MIN_DELAY 250
+#define RECONNECT_MAX_DELAY 30000
+// Seconds a connection attempt may take
+#define RECONNECT_TIMEOUT 5
+
+// Parts of the state that changed since the front end last rendered
+#define RENDER_STATUS 1
+#define RENDER_INPUT 2
+// Everything shown from the history has to be redrawn
+#define RENDER_MESSAGES 4
+#define RENDER_ALL (RENDER_STATUS | RENDER_INPUT | RENDER_MESSAGES)
 
 typedef struct {
-    bool isOutgoing;
-    String content;
-    String* attachments;
-    int attachmentCount;
-} Message;
+    String name;
+    bool isServer;
+    // Directory received attachments are saved to
+    char* downloadDir;
+    // Message history kept in memory before the oldest is dropped
+    size_t historyBytes;
+    // Directory messages are persisted to, or NULL to keep them in memory only
+    char* logDir;
+    LogSyncPolicy logSync;
+    // Offer frame compression in the ident exchange
+    bool compress;
+    // Frames sent within this many microseconds of the last write are held
+    // back to go out together, up to batchFrames at a time. With 0, frames
+    // are written as soon as the outbox is empty.
+    uint32_t batchWindow;
+    int batchFrames;
+    // Disable Nagle's algorithm, and cork the socket while attachments are
+    // streamed so chunks leave in full segments
+    bool noDelay;
+    bool cork;
+    // How the server loops wait for sockets when hosting, and how many run
+    // side by side on the port, one thread each
+    ServerIo serverIo;
+    int serverShards;
+    // Newest messages of the log loaded into the history on startup
+    int replayMessages;
+} ChatConfig;
 
-void message_free(Message* message);
+typedef struct ChatApp ChatApp;
 
+// Hooks for the front end. They may be called from any of the app's
+// threads and must not block on the front end's own input.
 typedef struct {
+    // State changed; parts holds the RENDER_* bits set since the last call.
+    // Called with the state lock held, so it may read the app but not call
+    // back into it.
+    void (*onUpdate)(ChatApp* app, int parts, void* data);
+    // A message was added to the history, outgoing ones and notices
+    // included. The message is only valid during the call.
+    void (*onMessage)(ChatApp* app, Message* message, void* data);
+} ChatAppCallbacks;
+
+struct ChatApp {
     String name;
     String peerName;
     String peerAddr;
-    Message** messages;
-    int messageCount;
+    History history;
+    // Messages from before the session, fetched while scrolled back to them
+    Scrollback scrollback;
+    // Messages the view is scrolled back from the newest, 0 to follow new
+    // ones, and the rows it shows. Changed under the state lock.
+    size_t scroll;
+    int viewRows;
+    // Set when messages are persisted
+    MessageLog* log;
     enum {
         DISCONNECTED,
         CONNECTED,
         IDLE,
     } status;
-    String sendBuffer;
-    WINDOW* statusWindow;
-    WINDOW* messageWindow;
-    WINDOW* inputWindow;
+    Buffer outBuffer;
+    RingBuffer inBuffer;
+    int dirty;
     pthread_mutex_t stateMutex;
-    pthread_mutex_t sendMutex;
     int socketfd;
+    // Protocol version agreed on with the server
+    uint8_t version;
+    bool compress;
+    // Set once both sides agreed to compress; the writer thread owns the
+    // sending window and the receive thread the other
+    bool compressed;
+    CompressStream recvStream;
+    // Strings of the frame being handled by the receive thread
+    StringArena arena;
+    // Room messages are posted to, empty for everyone, and every room
+    // joined, joined again on a new connection. Changed under the state
+    // lock, only by the thread that sends input.
+    String room;
+    String* rooms;
+    int roomCount;
+    // Highest sequence number among the messages received, written by the
+    // receive thread. The writer thread acks it and presents it to resume
+    // from when it reconnects.
+    uint64_t lastSeq;
+    uint64_t ackedSeq;
+    // Random number sent with every ident, so the server can leave this
+    // client's own messages out of what it replays after a reconnect
+    uint64_t session;
+    // Set under the state lock from when the connection is lost until the
+    // writer thread has a new one. The receive thread parks meanwhile,
+    // waiting on reconnected for the count of connections to change.
+    bool lost;
+    bool parked;
+    int connection;
+    pthread_cond_t reconnected;
+    struct sockaddr_in serverAddr;
+    uint64_t reconnectDelay;
+    // Set when hosting; clients are tracked by the server instead of socketfd
+    ServerGroup* server;
+    int clientCount;
+    // Last input on the wall clock, for version 1 peers, and on the
+    // monotonic clock in nanoseconds; the peer's is kept on the local one
     uint32_t lastActive;
-    uint32_t peerLastActive;
+    uint64_t lastInput;
+    uint64_t peerLastInput;
+    // Round trips of our pings, or for the host the average over clients
+    LinkStats link;
     bool isServer;
-} ChatApp;
+    // Frames waiting for the writer thread when connected as a client
+    Outbox outbox;
+    // Deadlines run by the writer thread between writes
+    TimerWheel timers;
+    Timer idleTimer;
+    Timer pingTimer;
+    Timer ackTimer;
+    Timer reconnectTimer;
+    uint32_t batchWindow;
+    int batchFrames;
+    bool noDelay;
+    bool cork;
+    ServerIo serverIo;
+    int serverShards;
+    TransferSender transfers;
+    TransferReceiver downloads;
+    Buffer transferBuffer;
+    pthread_t recvThread;
+    pthread_t transferThread;
+    ChatAppCallbacks callbacks;
+    void* callbackData;
+};
 
-void chat_app_init(ChatApp* app, String name, bool isServer);
+void chat_app_init(ChatApp* app, ChatConfig* config);
 int chat_app_connect(ChatApp* app, char* address, uint16_t port);
-int chat_app_run(ChatApp* app);
+int chat_app_start(ChatApp* app);
+void chat_app_stop(ChatApp* app);
+bool chat_app_send(ChatApp* app, String* text);
+String* chat_app_message_sender(ChatApp* app, Message* message);
+void chat_app_input(ChatApp* app);
 void chat_app_render(ChatApp* app);
+void chat_app_invalidate(ChatApp* app, int parts);
+void chat_app_scroll(ChatApp* app, long delta, int rows);
+int chat_app_view(ChatApp* app, Message** rows, int maxRows);
+void chat_app_link_stats(ChatApp* app, LinkStats* stats);
 void chat_app_destroy(ChatApp* app);
 void chat_app_free(ChatApp* app);
@@ -0,0 +1,109 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        backlog.c
+// Description: This file contains the implementation for the Backlog.
+//              Messages are numbered consecutively, so the ring is indexed
+//              by sequence number and finding where a client left off takes
+//              no search.
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include "sendqueue.h"
+#include "metrics.h"
+#include "backlog.h"
+
+// Numbering starts at the wall clock in microseconds, so numbers keep
+// growing across restarts and a client resuming against a restarted server
+// is simply sent everything the new one kept
+int backlog_init(Backlog* backlog, int capacity, size_t maxBytes) {
+    backlog->frames = calloc(capacity, sizeof(EncodedFrame*));
+    if (backlog->frames == NULL)
+        return -1;
+    pthread_mutex_init(&backlog->mutex, NULL);
+    backlog->capacity = capacity;
+    backlog->bytes = 0;
+    backlog->maxBytes = maxBytes;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    backlog->first = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    backlog->next = backlog->first;
+    backlog->published = backlog->first - 1;
+    return 0;
+}
+
+void backlog_free(Backlog* backlog) {
+    for (uint64_t seq = backlog->first; seq < backlog->next; seq++)
+        encoded_frame_release(backlog->frames[seq % backlog->capacity]);
+    free(backlog->frames);
+    pthread_mutex_destroy(&backlog->mutex);
+}
+
+void backlog_lock(Backlog* backlog) {
+    metrics_lock(&backlog->mutex, METRIC_BACKLOG_LOCK_WAIT);
+}
+
+void backlog_unlock(Backlog* backlog) {
+    pthread_mutex_unlock(&backlog->mutex);
+}
+
+// Number the next message gets; with the lock held, it is the caller's
+uint64_t backlog_next(Backlog* backlog) {
+    return backlog->next;
+}
+
+// Number of the last message, the one a client that has everything acks.
+// Safe to read without the lock.
+uint64_t backlog_last(Backlog* backlog) {
+    return __atomic_load_n(&backlog->next, __ATOMIC_RELAXED) - 1;
+}
+
+// Keep a reference to the message numbered backlog_next, first dropping
+// the oldest ones past either bound, since a full ring puts the new
+// message where the oldest is. Called with the lock held.
+void backlog_append(Backlog* backlog, EncodedFrame* frame) {
+    while (backlog->next > backlog->first
+        && (backlog->next - backlog->first >= (uint64_t)backlog->capacity || backlog->bytes + frame->length > backlog->maxBytes)) {
+        EncodedFrame* oldest = backlog->frames[backlog->first++ % backlog->capacity];
+        backlog->bytes -= oldest->length;
+        encoded_frame_release(oldest);
+    }
+    backlog->frames[backlog->next % backlog->capacity] = encoded_frame_retain(frame);
+    __atomic_store_n(&backlog->next, backlog->next + 1, __ATOMIC_RELAXED);
+    backlog->bytes += frame->length;
+}
+
+// Message numbered seq, or NULL if it is not kept. The frame is only
+// borrowed while the lock is held.
+EncodedFrame* backlog_get(Backlog* backlog, uint64_t seq) {
+    if (seq < backlog->first || seq >= backlog->next)
+        return NULL;
+    return backlog->frames[seq % backlog->capacity];
+}
+
+// Wait until every message numbered before seq was handed to the inboxes.
+// Only the few threads that numbered a message since are ahead, and they
+// only have to push it, so this yields rather than sleeps.
+void backlog_wait_turn(Backlog* backlog, uint64_t seq) {
+    while (__atomic_load_n(&backlog->published, __ATOMIC_ACQUIRE) != seq - 1)
+        sched_yield();
+}
+
+// Let the message numbered after seq be handed over
+void backlog_publish(Backlog* backlog, uint64_t seq) {
+    __atomic_store_n(&backlog->published, seq, __ATOMIC_RELEASE);
+}
+
+// Take a reference to every message kept after seq, oldest first, into
+// frames, which has room for the capacity. Returns how many there were.
+// Called with the lock held.
+int backlog_since(Backlog* backlog, uint64_t seq, EncodedFrame** frames) {
+    uint64_t start = seq + 1 > backlog->first ? seq + 1 : backlog->first;
+    int count = 0;
+    for (uint64_t i = start; i < backlog->next; i++)
+        frames[count++] = encoded_frame_retain(backlog->frames[i % backlog->capacity]);
+    return count;
+}
@@ -0,0 +1,45 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        backlog.h
+// Description: This file contains the definitions for the Backlog, the
+//              server's last messages kept by sequence number so a client
+//              that lost its connection gets only what it missed. Numbers
+//              are handed out under its lock, which every shard takes to
+//              post a message, so they give one order across the server.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "sendqueue.h"
+
+typedef struct {
+    pthread_mutex_t mutex;
+    // Frames encoded in the current protocol version, each at its sequence
+    // number modulo the capacity
+    EncodedFrame** frames;
+    int capacity;
+    size_t bytes;
+    size_t maxBytes;
+    // Oldest number still kept, and the one the next message gets
+    uint64_t first;
+    uint64_t next;
+    // Last number whose message was handed to every inbox. Messages are
+    // handed over after the lock is released, each in its turn, so the
+    // inboxes still get them in number order.
+    uint64_t published;
+} Backlog;
+
+int backlog_init(Backlog* backlog, int capacity, size_t maxBytes);
+void backlog_free(Backlog* backlog);
+void backlog_lock(Backlog* backlog);
+void backlog_unlock(Backlog* backlog);
+uint64_t backlog_next(Backlog* backlog);
+uint64_t backlog_last(Backlog* backlog);
+void backlog_append(Backlog* backlog, EncodedFrame* frame);
+EncodedFrame* backlog_get(Backlog* backlog, uint64_t seq);
+void backlog_wait_turn(Backlog* backlog, uint64_t seq);
+void backlog_publish(Backlog* backlog, uint64_t seq);
+int backlog_since(Backlog* backlog, uint64_t seq, EncodedFrame** frames);
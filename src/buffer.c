@@ -0,0 +1,98 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        buffer.c
+// Description: This file contains the implementation for the Buffer
+//              utility class.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "buffer.h"
+#include "metrics.h"
+
+// Initialize an empty buffer with an initial capacity
+void buffer_init(Buffer* buffer, size_t initialSize) {
+    buffer->length = 0;
+    buffer->allocated = initialSize;
+    buffer->data = initialSize > 0 ? malloc(initialSize) : NULL;
+    if (initialSize > 0)
+        metrics_add(METRIC_ALLOC_BUFFER, 1);
+}
+
+// Release the buffer's memory
+void buffer_free(Buffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->length = 0;
+    buffer->allocated = 0;
+}
+
+// Drop the buffer's content without deallocating it
+void buffer_clear(Buffer* buffer) {
+    buffer->length = 0;
+}
+
+// Grow the buffer's capacity to fit the current length plus some additional size
+void buffer_reserve(Buffer* buffer, size_t additionalSize) {
+    size_t needed = buffer->length + additionalSize;
+    if (needed <= buffer->allocated)
+        return;
+    size_t newSize = buffer->allocated > 0 ? buffer->allocated : 64;
+    while (newSize < needed)
+        newSize *= 2;
+    buffer->data = realloc(buffer->data, newSize);
+    metrics_add(METRIC_ALLOC_BUFFER, 1);
+    buffer->allocated = newSize;
+}
+
+// Append raw bytes
+void buffer_append(Buffer* buffer, const void* data, size_t length) {
+    buffer_reserve(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+void buffer_append_uint8(Buffer* buffer, uint8_t value) {
+    buffer_reserve(buffer, 1);
+    buffer->data[buffer->length++] = value;
+}
+
+// Append a 16-bit integer in network byte order
+void buffer_append_uint16(Buffer* buffer, uint16_t value) {
+    uint16_t raw = htons(value);
+    buffer_append(buffer, &raw, 2);
+}
+
+// Append a 32-bit integer in network byte order
+void buffer_append_uint32(Buffer* buffer, uint32_t value) {
+    uint32_t raw = htonl(value);
+    buffer_append(buffer, &raw, 4);
+}
+
+// Append a 64-bit integer in network byte order
+void buffer_append_uint64(Buffer* buffer, uint64_t value) {
+    buffer_append_uint32(buffer, value >> 32);
+    buffer_append_uint32(buffer, value & 0xFFFFFFFF);
+}
+
+// Write the whole buffer to a file descriptor and clear it. A single write
+// covers the buffer in the common case; short writes are retried.
+int buffer_flush(Buffer* buffer, int fd) {
+    size_t offset = 0;
+    while (offset < buffer->length) {
+        ssize_t written = write(fd, buffer->data + offset, buffer->length - offset);
+        metrics_add(METRIC_SYSCALL_WRITE, 1);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        offset += written;
+    }
+    buffer->length = 0;
+    return 0;
+}
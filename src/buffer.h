@@ -0,0 +1,29 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        buffer.h
+// Description: This file contains the type definitions for the Buffer
+//              utility class, a growable byte buffer used to serialize
+//              frames before they are written to a socket.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint8_t* data;
+    size_t length;
+    size_t allocated;
+} Buffer;
+
+void buffer_init(Buffer* buffer, size_t initialSize);
+void buffer_free(Buffer* buffer);
+void buffer_clear(Buffer* buffer);
+void buffer_reserve(Buffer* buffer, size_t additionalSize);
+void buffer_append(Buffer* buffer, const void* data, size_t length);
+void buffer_append_uint8(Buffer* buffer, uint8_t value);
+void buffer_append_uint16(Buffer* buffer, uint16_t value);
+void buffer_append_uint32(Buffer* buffer, uint32_t value);
+void buffer_append_uint64(Buffer* buffer, uint64_t value);
+int buffer_flush(Buffer* buffer, int fd);
@@ -0,0 +1,190 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        compress.c
+// Description: This file contains the implementation for frame
+//              compression.
+
+#include <stdlib.h>
+#include <string.h>
+#include "compress.h"
+
+/*
+* Block format, a sequence of:
+* 1 byte: token, literal count in the high 4 bits and match length - 4 in
+*         the low 4 bits, each followed by extra bytes of 255 and a final
+*         byte when the field is 15
+* literal count bytes: literals
+* 2 bytes: little-endian distance back to the match
+* The last sequence has only literals and ends the block.
+*/
+#define MIN_MATCH 4
+
+void compress_stream_init(CompressStream* stream, bool compressor) {
+    stream->data = NULL;
+    stream->length = 0;
+    stream->capacity = 0;
+    stream->table = compressor ? calloc(1 << COMPRESS_HASH_BITS, sizeof(uint32_t)) : NULL;
+}
+
+void compress_stream_free(CompressStream* stream) {
+    free(stream->data);
+    free(stream->table);
+    stream->data = NULL;
+    stream->table = NULL;
+}
+
+// Largest output a block of the given size can compress to
+size_t compress_bound(size_t length) {
+    return length + length / 255 + 16;
+}
+
+// Make room for a block after the window, dropping history the window no
+// longer reaches
+static void compress_stream_reserve(CompressStream* stream, size_t length) {
+    if (stream->length + length > stream->capacity && stream->length > COMPRESS_WINDOW) {
+        size_t shift = stream->length - COMPRESS_WINDOW;
+        memmove(stream->data, stream->data + shift, COMPRESS_WINDOW);
+        stream->length = COMPRESS_WINDOW;
+        if (stream->table != NULL) {
+            for (size_t i = 0; i < 1 << COMPRESS_HASH_BITS; i++)
+                stream->table[i] = stream->table[i] > shift ? stream->table[i] - shift : 0;
+        }
+    }
+    if (stream->length + length > stream->capacity) {
+        // Room for a few blocks so the window is not moved on every one
+        stream->capacity = 4 * COMPRESS_WINDOW + length;
+        stream->data = realloc(stream->data, stream->capacity);
+    }
+}
+
+static uint32_t read_uint32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, 4);
+    return value;
+}
+
+static uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - COMPRESS_HASH_BITS);
+}
+
+static uint8_t* write_length(uint8_t* output, size_t length) {
+    for (; length >= 255; length -= 255)
+        *output++ = 255;
+    *output++ = length;
+    return output;
+}
+
+static uint8_t* write_sequence(uint8_t* output, const uint8_t* literals, size_t literalCount, size_t distance, size_t matchLength) {
+    size_t matchCode = matchLength > 0 ? matchLength - MIN_MATCH : 0;
+    *output++ = (literalCount < 15 ? literalCount : 15) << 4 | (matchCode < 15 ? matchCode : 15);
+    if (literalCount >= 15)
+        output = write_length(output, literalCount - 15);
+    memcpy(output, literals, literalCount);
+    output += literalCount;
+    if (matchLength > 0) {
+        *output++ = distance & 0xFF;
+        *output++ = distance >> 8;
+        if (matchCode >= 15)
+            output = write_length(output, matchCode - 15);
+    }
+    return output;
+}
+
+// Compress a block into output, which must hold compress_bound(length)
+// bytes, and return the compressed size. With keep set, matches may reach
+// into earlier kept blocks and the block is added to the window; without
+// it the block stands alone and can be decompressed by anyone.
+size_t compress_block(CompressStream* stream, bool keep, const uint8_t* input, size_t length, uint8_t* output) {
+    compress_stream_reserve(stream, length);
+    uint8_t* data = stream->data;
+    memcpy(data + stream->length, input, length);
+    size_t start = stream->length, end = start + length;
+    size_t lowest = keep ? 0 : start;
+
+    uint8_t* out = output;
+    size_t anchor = start, position = start;
+    while (position + MIN_MATCH < end) {
+        uint32_t sequence = read_uint32(data + position);
+        uint32_t* slot = &stream->table[hash(sequence)];
+        size_t candidate = *slot;
+        *slot = position + 1;
+        // Entries can be stale, so the bytes are always compared
+        if (candidate == 0 || candidate - 1 < lowest || candidate - 1 >= position
+            || position - (candidate - 1) > COMPRESS_WINDOW || read_uint32(data + candidate - 1) != sequence) {
+            // Step faster through data that does not compress
+            position += 1 + ((position - anchor) >> 6);
+            continue;
+        }
+        size_t match = candidate - 1;
+        size_t matchLength = MIN_MATCH;
+        while (position + matchLength < end && data[match + matchLength] == data[position + matchLength])
+            matchLength++;
+        out = write_sequence(out, data + anchor, position - anchor, position - match, matchLength);
+        position += matchLength;
+        anchor = position;
+    }
+    out = write_sequence(out, data + anchor, end - anchor, 0, 0);
+    if (keep)
+        stream->length = end;
+    return out - output;
+}
+
+static bool read_length(const uint8_t** input, const uint8_t* end, size_t* length) {
+    uint8_t byte;
+    do {
+        if (*input >= end)
+            return false;
+        byte = *(*input)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Decompress a block that inflates to rawLength bytes. Returns the bytes,
+// valid until the next block, or NULL if the block is malformed. keep must
+// match the flag it was compressed with.
+const uint8_t* decompress_block(CompressStream* stream, bool keep, const uint8_t* input, size_t length, size_t rawLength) {
+    compress_stream_reserve(stream, rawLength);
+    uint8_t* start = stream->data + stream->length;
+    uint8_t* lowest = keep ? stream->data : start;
+    uint8_t* out = start;
+    uint8_t* outEnd = start + rawLength;
+    const uint8_t* end = input + length;
+
+    while (input < end) {
+        uint8_t token = *input++;
+        size_t literalCount = token >> 4;
+        if (literalCount == 15 && !read_length(&input, end, &literalCount))
+            return NULL;
+        if ((size_t)(end - input) < literalCount || (size_t)(outEnd - out) < literalCount)
+            return NULL;
+        memcpy(out, input, literalCount);
+        input += literalCount;
+        out += literalCount;
+        if (input == end)
+            break;
+
+        if (end - input < 2)
+            return NULL;
+        size_t distance = input[0] | input[1] << 8;
+        input += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !read_length(&input, end, &matchLength))
+            return NULL;
+        matchLength += MIN_MATCH;
+        if (distance == 0 || distance > (size_t)(out - lowest) || (size_t)(outEnd - out) < matchLength)
+            return NULL;
+        // Byte by byte, since a match may overlap the bytes it produces
+        const uint8_t* match = out - distance;
+        for (size_t i = 0; i < matchLength; i++)
+            out[i] = match[i];
+        out += matchLength;
+    }
+    if (out != outEnd)
+        return NULL;
+    if (keep)
+        stream->length += rawLength;
+    return start;
+}
@@ -0,0 +1,34 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        compress.h
+// Description: This file contains the definitions for frame compression, a
+//              small LZ4-style codec. Blocks can be compressed on their own
+//              or against the bytes of earlier blocks on the same
+//              connection, which both ends keep as a sliding window.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// How far back a match may reach, the limit of its 16-bit offset
+#define COMPRESS_WINDOW 65535
+#define COMPRESS_HASH_BITS 14
+
+typedef struct {
+    // The window of earlier blocks followed by the block being processed
+    uint8_t* data;
+    size_t length;
+    size_t capacity;
+    // Last position each 4-byte sequence was seen at, plus one. Only the
+    // compressing end has one.
+    uint32_t* table;
+} CompressStream;
+
+void compress_stream_init(CompressStream* stream, bool compressor);
+void compress_stream_free(CompressStream* stream);
+size_t compress_bound(size_t length);
+size_t compress_block(CompressStream* stream, bool keep, const uint8_t* input, size_t length, uint8_t* output);
+const uint8_t* decompress_block(CompressStream* stream, bool keep, const uint8_t* input, size_t length, size_t rawLength);
@@ -0,0 +1,150 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        headless.c
+// Description: This file contains the implementation for the Headless
+//              front end. Input is only read once connected, so lines piped
+//              in before the handshake are held instead of dropped.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include "headless.h"
+
+#define HEADLESS_READ_SIZE 4096
+
+// Block the signals that stop the loop. Called before any other thread is
+// started so every thread inherits the mask.
+int headless_init(Headless* headless) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    headless->signalfd = signalfd(-1, &signals, SFD_CLOEXEC);
+    headless->wakefd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (headless->signalfd < 0 || headless->wakefd < 0) {
+        perror("headless_init");
+        return -1;
+    }
+    headless->status = -1;
+    headless->connected = false;
+    buffer_init(&headless->input, HEADLESS_READ_SIZE);
+    return 0;
+}
+
+void headless_free(Headless* headless) {
+    close(headless->signalfd);
+    close(headless->wakefd);
+    buffer_free(&headless->input);
+}
+
+// Report status changes on stderr, keeping stdout to messages
+static void headless_on_update(ChatApp* app, int parts, void* data) {
+    Headless* headless = data;
+    if (!(parts & RENDER_STATUS) || (int)app->status == headless->status)
+        return;
+    headless->status = app->status;
+    char* statusString = app->status == DISCONNECTED
+        ? "Disconnected"
+        : app->status == CONNECTED
+        ? "Connected"
+        : "Idle";
+    fprintf(stderr, "* %s%s%s\n", statusString, app->peerAddr.length > 0 ? " " : "", string_data(&app->peerAddr));
+    __atomic_store_n(&headless->connected, app->status != DISCONNECTED, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    write(headless->wakefd, &one, sizeof(one));
+}
+
+// One line per message and per attachment, flushed so pipes see it at once
+static void headless_on_message(ChatApp* app, Message* message, void* data) {
+    if (message->isOutgoing)
+        return;
+    flockfile(stdout);
+    printf("%s: %s\n", string_data(chat_app_message_sender(app, message)), string_data(&message->content));
+    for (int i = 0; i < message->attachmentCount; i++)
+        printf("Attachment: %s\n", string_data(&message->attachments[i]));
+    fflush(stdout);
+    funlockfile(stdout);
+}
+
+void headless_attach(Headless* headless, ChatApp* app) {
+    app->callbacks = (ChatAppCallbacks){
+        .onUpdate = headless_on_update,
+        .onMessage = headless_on_message,
+    };
+    app->callbackData = headless;
+}
+
+// Send every complete line in the input buffer. Returns false on "/quit".
+static bool headless_send_lines(Headless* headless, ChatApp* app) {
+    size_t start = 0;
+    char* data = (char*)headless->input.data;
+    char* newline;
+    while ((newline = memchr(data + start, '\n', headless->input.length - start)) != NULL) {
+        size_t end = newline - data;
+        *newline = '\0';
+        if (end > start && data[end - 1] == '\r')
+            data[end - 1] = '\0';
+        String text = string_new_borrowed(data + start, strlen(data + start));
+        start = end + 1;
+        if (text.length == 0)
+            continue;
+        if (strcmp(string_data(&text), "/quit") == 0)
+            return false;
+        chat_app_input(app);
+        chat_app_send(app, &text);
+    }
+    memmove(data, data + start, headless->input.length - start);
+    headless->input.length -= start;
+    return true;
+}
+
+// Relay stdin until "/quit", SIGINT or SIGTERM. Once stdin is closed the
+// app keeps running, as a relay or a bot only answering messages would.
+int headless_run(Headless* headless, ChatApp* app) {
+    bool inputOpen = true;
+    while (true) {
+        bool connected = __atomic_load_n(&headless->connected, __ATOMIC_ACQUIRE);
+        struct pollfd fds[3] = {
+            { .fd = headless->signalfd, .events = POLLIN },
+            { .fd = headless->wakefd, .events = POLLIN },
+            { .fd = inputOpen && connected ? STDIN_FILENO : -1, .events = POLLIN },
+        };
+        if (poll(fds, 3, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 1;
+        }
+        if (fds[0].revents & POLLIN)
+            return 0;
+        if (fds[1].revents & POLLIN) {
+            uint64_t count;
+            read(headless->wakefd, &count, sizeof(count));
+        }
+        if (fds[2].revents & (POLLIN | POLLHUP)) {
+            buffer_reserve(&headless->input, HEADLESS_READ_SIZE);
+            ssize_t length = read(STDIN_FILENO, headless->input.data + headless->input.length, HEADLESS_READ_SIZE);
+            if (length <= 0) {
+                // A last line without a newline is still sent
+                inputOpen = false;
+                if (headless->input.length == 0)
+                    continue;
+                buffer_append_uint8(&headless->input, '\n');
+            } else {
+                headless->input.length += length;
+            }
+            if (!headless_send_lines(headless, app))
+                return 0;
+        }
+    }
+}
@@ -0,0 +1,31 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        headless.h
+// Description: This file contains the definitions for the Headless front
+//              end, which runs the app without a terminal: lines read from
+//              stdin are sent, received messages are written to stdout.
+
+#pragma once
+#include <stdbool.h>
+#include "buffer.h"
+#include "app.h"
+
+typedef struct {
+    // Status last reported on stderr
+    int status;
+    bool connected;
+    // Written by the update callback so the input loop notices the
+    // connection coming up
+    int wakefd;
+    // SIGINT and SIGTERM, blocked in every thread and read from here
+    int signalfd;
+    // Input not yet ending in a newline
+    Buffer input;
+} Headless;
+
+int headless_init(Headless* headless);
+void headless_attach(Headless* headless, ChatApp* app);
+int headless_run(Headless* headless, ChatApp* app);
+void headless_free(Headless* headless);
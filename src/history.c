@@ -0,0 +1,163 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        history.c
+// Description: This file contains the implementation for the message
+//              History.
+
+#include <stdlib.h>
+#include <string.h>
+#include "string.h"
+#include "history.h"
+
+#define HISTORY_ALIGN(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+// Initialize an empty history that keeps roughly maxBytes of messages, or
+// everything when maxBytes is 0
+void history_init(History* history, size_t maxBytes) {
+    history->chunks = NULL;
+    history->chunkCapacity = 0;
+    history->chunkHead = 0;
+    history->chunkCount = 0;
+    history->maxChunks = maxBytes > 0 ? (maxBytes + HISTORY_CHUNK_SIZE - 1) / HISTORY_CHUNK_SIZE : 0;
+    history->end = 0;
+    history->bytes = 0;
+}
+
+void history_free(History* history) {
+    for (size_t i = 0; i < history->chunkCount; i++)
+        free(history->chunks[(history->chunkHead + i) % history->chunkCapacity]);
+    free(history->chunks);
+    history->chunks = NULL;
+    history->chunkCapacity = 0;
+    history->chunkHead = 0;
+    history->chunkCount = 0;
+    history->bytes = 0;
+}
+
+static HistoryChunk* history_chunk_at(History* history, size_t position) {
+    return history->chunks[(history->chunkHead + position) % history->chunkCapacity];
+}
+
+// Drop the oldest chunk and every message in it
+static void history_evict(History* history) {
+    HistoryChunk* chunk = history_chunk_at(history, 0);
+    history->bytes -= sizeof(HistoryChunk) + chunk->size;
+    free(chunk);
+    history->chunkHead = (history->chunkHead + 1) % history->chunkCapacity;
+    history->chunkCount--;
+}
+
+static HistoryChunk* history_add_chunk(History* history, size_t needed) {
+    if (history->maxChunks > 0 && history->chunkCount >= history->maxChunks)
+        history_evict(history);
+
+    if (history->chunkCount == history->chunkCapacity) {
+        size_t capacity = history->chunkCapacity > 0 ? history->chunkCapacity * 2 : 16;
+        HistoryChunk** chunks = malloc(capacity * sizeof(HistoryChunk*));
+        for (size_t i = 0; i < history->chunkCount; i++)
+            chunks[i] = history_chunk_at(history, i);
+        free(history->chunks);
+        history->chunks = chunks;
+        history->chunkCapacity = capacity;
+        history->chunkHead = 0;
+    }
+
+    // Oversized messages get a chunk of their own
+    size_t size = needed > HISTORY_CHUNK_SIZE ? needed : HISTORY_CHUNK_SIZE;
+    HistoryChunk* chunk = malloc(sizeof(HistoryChunk) + size);
+    chunk->first = history->end;
+    chunk->count = 0;
+    chunk->recordsEnd = 0;
+    chunk->textStart = size;
+    chunk->size = size;
+    history->chunks[(history->chunkHead + history->chunkCount) % history->chunkCapacity] = chunk;
+    history->chunkCount++;
+    history->bytes += sizeof(HistoryChunk) + size;
+    return chunk;
+}
+
+// Copy a string's bytes into the chunk's text region
+static String history_copy_string(HistoryChunk* chunk, String* string) {
+    chunk->textStart -= string->length + 1;
+    char* data = (char*)chunk->data + chunk->textStart;
+    memcpy(data, string_data(string), string->length);
+    data[string->length] = '\0';
+    return string_new_borrowed(data, string->length);
+}
+
+// Store a copy of a message. The strings it refers to are copied into the
+// history, so the caller keeps ownership of its own.
+Message* history_append(History* history, Message* message) {
+    // Message records are only ever appended at the end of the current
+    // chunk, so they are laid out back to back and can be indexed directly;
+    // the attachment array lives with the text.
+    size_t text = message->sender.length + 1 + message->content.length + 1
+        + HISTORY_ALIGN(message->attachmentCount * sizeof(String)) + sizeof(void*);
+    for (int i = 0; i < message->attachmentCount; i++)
+        text += message->attachments[i].length + 1;
+    size_t needed = sizeof(Message) + text;
+
+    HistoryChunk* chunk = history->chunkCount > 0 ? history_chunk_at(history, history->chunkCount - 1) : NULL;
+    if (chunk == NULL || chunk->textStart - chunk->recordsEnd < needed)
+        chunk = history_add_chunk(history, needed);
+
+    Message* stored = (Message*)(chunk->data + chunk->recordsEnd);
+    chunk->recordsEnd += sizeof(Message);
+
+    stored->isOutgoing = message->isOutgoing;
+    stored->attachmentCount = message->attachmentCount;
+    stored->attachments = NULL;
+    if (message->attachmentCount > 0) {
+        chunk->textStart = (chunk->textStart - message->attachmentCount * sizeof(String)) & ~(sizeof(void*) - 1);
+        stored->attachments = (String*)(chunk->data + chunk->textStart);
+        for (int i = 0; i < message->attachmentCount; i++)
+            stored->attachments[i] = history_copy_string(chunk, &message->attachments[i]);
+    }
+    stored->sender = history_copy_string(chunk, &message->sender);
+    stored->content = history_copy_string(chunk, &message->content);
+
+    chunk->count++;
+    history->end++;
+    return stored;
+}
+
+// Index of the oldest message still retained
+size_t history_first(History* history) {
+    return history->chunkCount > 0 ? history_chunk_at(history, 0)->first : history->end;
+}
+
+size_t history_end(History* history) {
+    return history->end;
+}
+
+// Look up a message by index, or NULL if it was evicted. Lookups near the
+// end, which is where the renderer reads, only touch the last chunks.
+Message* history_get(History* history, size_t index) {
+    if (index < history_first(history) || index >= history->end)
+        return NULL;
+    size_t low = 0, high = history->chunkCount;
+    while (high - low > 1) {
+        size_t middle = (low + high) / 2;
+        if (history_chunk_at(history, middle)->first <= index)
+            low = middle;
+        else
+            high = middle;
+    }
+    HistoryChunk* chunk = history_chunk_at(history, low);
+    return (Message*)chunk->data + (index - chunk->first);
+}
+
+// Fill rows with up to maxRows messages ending just before the given index,
+// oldest first. Returns the number of rows filled.
+int history_view(History* history, size_t end, Message** rows, int maxRows) {
+    size_t first = history_first(history);
+    if (end > history->end)
+        end = history->end;
+    size_t start = end - first > (size_t)maxRows ? end - maxRows : first;
+    int count = 0;
+    for (size_t index = start; index < end; index++)
+        rows[count++] = history_get(history, index);
+    return count;
+}
@@ -0,0 +1,56 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        history.h
+// Description: This file contains the definitions for the message History,
+//              which packs messages and their text into large chunks so
+//              appends do not allocate and old chunks can be dropped whole.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "string.h"
+
+#define HISTORY_CHUNK_SIZE (256 * 1024)
+
+typedef struct {
+    bool isOutgoing;
+    String sender;
+    String content;
+    String* attachments;
+    int attachmentCount;
+} Message;
+
+// Message records grow up from the start of the chunk and their text grows
+// down from the end; the chunk is full when the two meet
+typedef struct {
+    size_t first;
+    int count;
+    size_t recordsEnd;
+    size_t textStart;
+    size_t size;
+    uint8_t data[];
+} HistoryChunk;
+
+typedef struct {
+    // Ring of chunks from oldest to newest
+    HistoryChunk** chunks;
+    size_t chunkCapacity;
+    size_t chunkHead;
+    size_t chunkCount;
+    // Chunks kept before the oldest is evicted, 0 for no limit
+    size_t maxChunks;
+    // Index one past the newest message; indexes are never reused
+    size_t end;
+    size_t bytes;
+} History;
+
+void history_init(History* history, size_t maxBytes);
+void history_free(History* history);
+Message* history_append(History* history, Message* message);
+size_t history_first(History* history);
+size_t history_end(History* history);
+Message* history_get(History* history, size_t index);
+int history_view(History* history, size_t end, Message** rows, int maxRows);
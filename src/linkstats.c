@@ -0,0 +1,59 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        linkstats.c
+// Description: This file contains the implementation for LinkStats.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include "linkstats.h"
+
+// Monotonic clock in nanoseconds, the time base of ping timestamps
+uint64_t link_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void link_stats_init(LinkStats* stats) {
+    *stats = (LinkStats){ 0 };
+}
+
+// Add a round trip from a pong: when our ping was sent, the peer's clock
+// when it answered and our clock when the answer arrived. The peer is
+// assumed to answer halfway through the round trip.
+void link_stats_sample(LinkStats* stats, uint64_t sent, uint64_t peerTime, uint64_t now) {
+    if (now < sent)
+        return;
+    uint64_t rtt = now - sent;
+    double offset = (double)peerTime - ((double)sent + rtt / 2.0);
+    if (stats->samples == 0) {
+        stats->rtt = rtt;
+        stats->offset = offset;
+    } else {
+        stats->rtt += ((double)rtt - stats->rtt) * LINK_STATS_GAIN;
+        stats->jitter += (fabs((double)rtt - (double)stats->lastRtt) - stats->jitter) * LINK_STATS_JITTER_GAIN;
+        stats->offset += (offset - stats->offset) * LINK_STATS_GAIN;
+        if (now > stats->lastSample) {
+            double drift = (offset - stats->lastOffset) / (double)(now - stats->lastSample) * 1e6;
+            stats->skew = stats->samples == 1 ? drift : stats->skew + (drift - stats->skew) * LINK_STATS_GAIN;
+        }
+    }
+    stats->lastRtt = rtt;
+    stats->lastOffset = offset;
+    stats->lastSample = now;
+    stats->samples++;
+}
+
+// Describe the link for the status bar, or nothing before the first sample
+int link_stats_format(LinkStats* stats, char* text, size_t size) {
+    if (stats->samples == 0) {
+        if (size > 0)
+            text[0] = '\0';
+        return 0;
+    }
+    return snprintf(text, size, "rtt %.2fms jitter %.2fms skew %+.0fppm", stats->rtt / 1e6, stats->jitter / 1e6, stats->skew);
+}
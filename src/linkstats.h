@@ -0,0 +1,37 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        linkstats.h
+// Description: This file contains the definitions for LinkStats, smoothed
+//              round trip time, jitter and clock skew estimates for one
+//              connection, taken from ping timestamps echoed in pongs.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Weight of a new sample in the smoothed round trip time, offset and skew,
+// and in the jitter as RTP computes it
+#define LINK_STATS_GAIN (1.0 / 8)
+#define LINK_STATS_JITTER_GAIN (1.0 / 16)
+
+typedef struct {
+    // Smoothed round trip time and mean change between consecutive round
+    // trips, in nanoseconds
+    double rtt;
+    double jitter;
+    // Peer's monotonic clock minus ours, in nanoseconds, and how fast it
+    // drifts in parts per million. Only the drift is meaningful across hosts.
+    double offset;
+    double skew;
+    uint64_t lastRtt;
+    double lastOffset;
+    uint64_t lastSample;
+    uint64_t samples;
+} LinkStats;
+
+uint64_t link_now(void);
+void link_stats_init(LinkStats* stats);
+void link_stats_sample(LinkStats* stats, uint64_t sent, uint64_t peerTime, uint64_t now);
+int link_stats_format(LinkStats* stats, char* text, size_t size);
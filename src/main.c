@@ -9,18 +9,46 @@
 #include <stdbool.h>
 #include <argp.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include "string.h"
 #include "app.h"
+#include "tui.h"
+#include "headless.h"
+#include "metrics.h"
 
 const char *argp_program_version = "MyChat 0.1.0";
 const char *argp_program_bug_address = "<jll210001@utdallas.edu>";
 static char doc[] = "A simple chat application.";
 static char args_doc[] = "";
+
+// Options with no short form
+enum {
+    OPTION_NAGLE = 256,
+    OPTION_NO_CORK,
+    OPTION_HEADLESS,
+    OPTION_IO,
+    OPTION_SHARDS,
+};
+
 static struct argp_option options[] = { 
     { "address", 'a', "ADDRESS", 0, "Address to connect to" },
     { "port", 'p', "PORT", 0, "Port to connect to" },
     { "server", 's', 0, 0, "Run as server" },
     { "name", 'n', "NAME", 0, "Name to use" },
+    { "download-dir", 'd', "DIR", 0, "Directory to save received attachments to" },
+    { "history", 'H', "MB", 0, "Megabytes of message history to keep (default 64)" },
+    { "log", 'l', "DIR", 0, "Directory to persist messages to and replay them from" },
+    { "fsync", 'f', "POLICY", 0, "When to sync the message log: none, interval (default) or always" },
+    { "compress", 'z', 0, 0, "Compress frames when the other side supports it" },
+    { "batch-window", 'w', "USEC", 0, "Hold frames sent within USEC of the last write to send them together (default 0, off)" },
+    { "batch-frames", 'b', "N", 0, "Send a held batch once it reaches N frames (default 64)" },
+    { "nagle", OPTION_NAGLE, 0, 0, "Leave Nagle's algorithm on instead of setting TCP_NODELAY" },
+    { "no-cork", OPTION_NO_CORK, 0, 0, "Do not cork the socket while streaming attachments" },
+    { "metrics", 'm', "PATH", 0, "Serve metrics in the Prometheus text format on the Unix socket PATH" },
+    { "io", OPTION_IO, "BACKEND", 0, "How the server waits for sockets: epoll (default) or uring, which falls back to epoll where unsupported" },
+    { "shards", OPTION_SHARDS, "N", 0, "Run the server as N loops on their own threads sharing the port (default 1)" },
+    { "headless", OPTION_HEADLESS, 0, 0, "Run without the TUI: send lines from stdin, write messages to stdout" },
     { 0 }
 };
 
@@ -29,6 +57,19 @@ typedef struct {
     int port;
     bool server;
     char *name;
+    char *downloadDir;
+    int historyMegabytes;
+    char *logDir;
+    LogSyncPolicy logSync;
+    bool compress;
+    int batchWindow;
+    int batchFrames;
+    bool noDelay;
+    bool cork;
+    ServerIo serverIo;
+    int shards;
+    char *metricsSocket;
+    bool headless;
 } Args;
 
 static error_t parse_opt(int key, char* arg, struct argp_state *state) {
@@ -46,6 +87,59 @@ static error_t parse_opt(int key, char* arg, struct argp_state *state) {
         case 'n':
             args->name = arg;
             break;
+        case 'd':
+            args->downloadDir = arg;
+            break;
+        case 'H':
+            args->historyMegabytes = atoi(arg);
+            break;
+        case 'l':
+            args->logDir = arg;
+            break;
+        case 'f':
+            if (strcmp(arg, "none") == 0)
+                args->logSync = LOG_SYNC_NONE;
+            else if (strcmp(arg, "interval") == 0)
+                args->logSync = LOG_SYNC_INTERVAL;
+            else if (strcmp(arg, "always") == 0)
+                args->logSync = LOG_SYNC_ALWAYS;
+            else
+                argp_error(state, "Unknown sync policy %s", arg);
+            break;
+        case 'z':
+            args->compress = true;
+            break;
+        case 'w':
+            args->batchWindow = atoi(arg);
+            break;
+        case 'b':
+            args->batchFrames = atoi(arg);
+            break;
+        case 'm':
+            args->metricsSocket = arg;
+            break;
+        case OPTION_NAGLE:
+            args->noDelay = false;
+            break;
+        case OPTION_NO_CORK:
+            args->cork = false;
+            break;
+        case OPTION_IO:
+            if (strcmp(arg, "epoll") == 0)
+                args->serverIo = SERVER_IO_EPOLL;
+            else if (strcmp(arg, "uring") == 0)
+                args->serverIo = SERVER_IO_URING;
+            else
+                argp_error(state, "Unknown I/O backend %s", arg);
+            break;
+        case OPTION_SHARDS:
+            args->shards = atoi(arg);
+            if (args->shards < 1)
+                argp_error(state, "Shards must be at least 1");
+            break;
+        case OPTION_HEADLESS:
+            args->headless = true;
+            break;
         case ARGP_KEY_ARG:
             return 0;
         default:
@@ -64,7 +158,24 @@ int main(int argc, char** argv) {
         .address = "127.0.0.1",
         .port = 0,
         .server = false,
-        .name = username == NULL ? "Unknown" : username
+        .name = username == NULL ? "Unknown" : username,
+        .downloadDir = "downloads",
+        .historyMegabytes = 64,
+        .logDir = NULL,
+        .logSync = LOG_SYNC_INTERVAL,
+        .compress = false,
+        .batchWindow = 0,
+        .batchFrames = SEND_QUEUE_MAX_IOV,
+        .noDelay = true,
+        .cork = true,
+        .serverIo = SERVER_IO_EPOLL,
+        .shards = 1,
+        .metricsSocket = NULL,
+#ifdef CHAT_NO_TUI
+        .headless = true,
+#else
+        .headless = false,
+#endif
     };
 
     if ((result = argp_parse(&argp, argc, argv, 0, 0, &args)) != 0)
@@ -75,16 +186,76 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // A peer that disconnects mid-write is an error to handle, not a reason
+    // to exit
+    signal(SIGPIPE, SIG_IGN);
+
+    // Signal masks are set up before any other thread is started
+    Headless headless;
+    if (args.headless && headless_init(&headless) < 0)
+        return 1;
+    // Started before any other thread, which all leave SIGUSR1 to it
+    if (metrics_start(args.metricsSocket) < 0)
+        return 1;
+
+#ifndef CHAT_NO_TUI
+    Tui tui;
+    if (!args.headless)
+        tui_init(&tui);
+#endif
+
     ChatApp* app = malloc(sizeof(ChatApp));
-    chat_app_init(app, string_new_static(args.name), args.server);
+    ChatConfig config = {
+        .name = string_new_static(args.name),
+        .isServer = args.server,
+        .downloadDir = args.downloadDir,
+        .historyBytes = (size_t)args.historyMegabytes * 1024 * 1024,
+        .logDir = args.logDir,
+        .logSync = args.logSync,
+        .compress = args.compress,
+        .batchWindow = args.batchWindow > 0 ? args.batchWindow : 0,
+        .batchFrames = args.batchFrames,
+        .noDelay = args.noDelay,
+        .cork = args.cork,
+        .serverIo = args.serverIo,
+        .serverShards = args.shards,
+        .replayMessages = 0,
+    };
+#ifndef CHAT_NO_TUI
+    if (!args.headless)
+        config.replayMessages = tui_message_rows(&tui);
+#endif
+    chat_app_init(app, &config);
+#ifndef CHAT_NO_TUI
+    if (!args.headless)
+        tui_attach(&tui, app);
+#endif
+    if (args.headless)
+        headless_attach(&headless, app);
     chat_app_render(app);
-    if (result = chat_app_connect(app, args.address, args.port) != 0) {
+    if ((result = chat_app_connect(app, args.address, args.port)) != 0 || (result = chat_app_start(app)) != 0) {
+#ifndef CHAT_NO_TUI
+        if (!args.headless)
+            tui_free(&tui);
+#endif
         chat_app_destroy(app);
         chat_app_free(app);
         fprintf(stderr, "Failed to connect\n");
         return result;
     }
-    result = chat_app_run(app);
+
+#ifndef CHAT_NO_TUI
+    if (!args.headless) {
+        result = tui_run(&tui, app);
+        chat_app_stop(app);
+        tui_free(&tui);
+    }
+#endif
+    if (args.headless) {
+        result = headless_run(&headless, app);
+        chat_app_stop(app);
+        headless_free(&headless);
+    }
     chat_app_destroy(app);
     chat_app_free(app);
     return result;
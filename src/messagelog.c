@@ -0,0 +1,347 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        messagelog.c
+// Description: This file contains the implementation for the MessageLog.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "string.h"
+#include "buffer.h"
+#include "protocol.h"
+#include "messagelog.h"
+
+/*
+* Record format:
+* 4 bytes: frame length
+* 4 bytes: CRC-32 of the frame
+* frame length bytes: encoded message frame
+* 4 bytes: frame length again, so the log can be walked back from the end
+*/
+#define RECORD_OVERHEAD 12
+
+static uint32_t crcTable[256];
+static pthread_once_t crcOnce = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+            crc = crc & 1 ? 0xEDB88320 ^ (crc >> 1) : crc >> 1;
+        crcTable[i] = crc;
+    }
+}
+
+static uint32_t crc32(const uint8_t* data, size_t length) {
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; i++)
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t read_uint32(const uint8_t* data) {
+    uint32_t raw;
+    memcpy(&raw, data, 4);
+    return ntohl(raw);
+}
+
+// Length of the record starting at offset, or 0 if it is torn or corrupt
+static size_t record_check(const uint8_t* map, size_t size, size_t offset) {
+    if (size - offset < RECORD_OVERHEAD)
+        return 0;
+    uint32_t length = read_uint32(map + offset);
+    if (size - offset - RECORD_OVERHEAD < length)
+        return 0;
+    if (read_uint32(map + offset + 8 + length) != length)
+        return 0;
+    if (read_uint32(map + offset + 4) != crc32(map + offset + 8, length))
+        return 0;
+    return RECORD_OVERHEAD + length;
+}
+
+// Size of the segment up to the end of its last whole record. Only the
+// last record is checked unless it turns out to be damaged, which only
+// happens when a crash interrupted an append.
+static size_t segment_valid_size(const uint8_t* map, size_t size) {
+    if (size >= RECORD_OVERHEAD) {
+        uint32_t length = read_uint32(map + size - 4);
+        if (size - RECORD_OVERHEAD >= length && record_check(map, size, size - RECORD_OVERHEAD - length) > 0)
+            return size;
+    }
+    size_t offset = 0, recordSize;
+    while ((recordSize = record_check(map, size, offset)) > 0)
+        offset += recordSize;
+    return offset;
+}
+
+static void segment_path(MessageLog* log, uint32_t id, char* path, size_t size) {
+    snprintf(path, size, "%s/%08u.log", string_data(&log->directory), id);
+}
+
+static int compare_segments(const void* a, const void* b) {
+    uint32_t x = ((const LogSegment*)a)->id, y = ((const LogSegment*)b)->id;
+    return x < y ? -1 : x > y;
+}
+
+// Map every segment in the directory, oldest first, and pick the one to
+// append to
+static int message_log_load(MessageLog* log) {
+    DIR* dir = opendir(string_data(&log->directory));
+    if (dir == NULL)
+        return -1;
+    int capacity = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned id;
+        char suffix;
+        if (sscanf(entry->d_name, "%8u.lo%c", &id, &suffix) != 2 || suffix != 'g')
+            continue;
+        if (log->segmentCount == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : 8;
+            log->segments = realloc(log->segments, capacity * sizeof(LogSegment));
+        }
+        log->segments[log->segmentCount++] = (LogSegment){ .id = id, .map = NULL, .mapSize = 0, .size = 0 };
+    }
+    closedir(dir);
+    qsort(log->segments, log->segmentCount, sizeof(LogSegment), compare_segments);
+
+    for (int i = 0; i < log->segmentCount; i++) {
+        LogSegment* segment = &log->segments[i];
+        log->writeId = segment->id;
+        char path[4096];
+        segment_path(log, segment->id, path, sizeof(path));
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            if (fd >= 0)
+                close(fd);
+            continue;
+        }
+        if (st.st_size > 0) {
+            void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) {
+                segment->map = map;
+                segment->mapSize = st.st_size;
+                segment->size = segment_valid_size(map, st.st_size);
+                // Cut off a record torn by a crash so appends continue
+                // from a clean end, or append to a new segment if it
+                // cannot be cut
+                if (segment->size < (size_t)st.st_size && i == log->segmentCount - 1
+                    && truncate(path, segment->size) < 0)
+                    log->writeId = segment->id + 1;
+            }
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+// Start appending to a segment, creating it if needed
+static int message_log_open_segment(MessageLog* log, uint32_t id) {
+    char path[4096];
+    segment_path(log, id, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (log->fd >= 0) {
+        // Whatever was written to the old segment must reach the disk
+        // before the sync thread loses track of it
+        if (log->unsynced && log->policy != LOG_SYNC_NONE)
+            fdatasync(log->fd);
+        close(log->fd);
+    }
+    log->fd = fd;
+    log->writeId = id;
+    log->writeSize = st.st_size;
+    return 0;
+}
+
+// Sync the segment being appended to without holding the lock, so appends
+// are not held up by the disk. The descriptor is duplicated first since the
+// segment may be closed when the next one is started.
+static int message_log_sync_unlocked(MessageLog* log) {
+    int fd = dup(log->fd);
+    if (fd < 0)
+        return -1;
+    pthread_mutex_unlock(&log->mutex);
+    int result = fdatasync(fd);
+    close(fd);
+    pthread_mutex_lock(&log->mutex);
+    return result;
+}
+
+static void* message_log_sync_loop(void* arg) {
+    MessageLog* log = arg;
+    pthread_mutex_lock(&log->mutex);
+    while (!log->stopped) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += MESSAGE_LOG_SYNC_INTERVAL;
+        pthread_cond_timedwait(&log->cond, &log->mutex, &deadline);
+        if (log->unsynced) {
+            log->unsynced = false;
+            message_log_sync_unlocked(log);
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return NULL;
+}
+
+// Open the log in a directory, creating it if needed, and map the segments
+// already in it. Nothing needs to be released if this fails.
+int message_log_open(MessageLog* log, const char* directory, LogSyncPolicy policy) {
+    pthread_once(&crcOnce, crc_init);
+    log->directory = string_new(0);
+    string_append_static(&log->directory, (char*)directory);
+    log->segments = NULL;
+    log->segmentCount = 0;
+    log->fd = -1;
+    log->writeId = 0;
+    log->policy = policy;
+    log->unsynced = false;
+    log->stopped = false;
+    buffer_init(&log->buffer, 512);
+    pthread_mutex_init(&log->mutex, NULL);
+    pthread_cond_init(&log->cond, NULL);
+
+    if ((mkdir(directory, 0755) < 0 && errno != EEXIST) || message_log_load(log) < 0
+        || message_log_open_segment(log, log->writeId) < 0) {
+        message_log_close(log);
+        return -1;
+    }
+    if (policy == LOG_SYNC_INTERVAL)
+        pthread_create(&log->syncThread, NULL, message_log_sync_loop, log);
+    return 0;
+}
+
+// Append a message frame as one record with a single write. With
+// LOG_SYNC_ALWAYS it is on disk when this returns.
+int message_log_append(MessageLog* log, MsgFrame* frame) {
+    pthread_mutex_lock(&log->mutex);
+    Buffer* buffer = &log->buffer;
+    buffer_clear(buffer);
+    buffer_append_uint64(buffer, 0);
+    protocol_frame_encode(buffer, (Frame*)frame);
+    uint32_t length = buffer->length - 8;
+    uint32_t header[2] = { htonl(length), htonl(crc32(buffer->data + 8, length)) };
+    memcpy(buffer->data, header, 8);
+    buffer_append_uint32(buffer, length);
+
+    int result = 0;
+    if (log->writeSize > 0 && log->writeSize + buffer->length > MESSAGE_LOG_SEGMENT_SIZE)
+        result = message_log_open_segment(log, log->writeId + 1);
+    if (result == 0) {
+        size_t length = buffer->length;
+        result = buffer_flush(buffer, log->fd);
+        if (result == 0) {
+            log->writeSize += length;
+            if (log->policy == LOG_SYNC_ALWAYS)
+                result = message_log_sync_unlocked(log);
+            else
+                log->unsynced = true;
+        }
+    }
+    pthread_mutex_unlock(&log->mutex);
+    return result;
+}
+
+// Cursor just past the last record that was in the log when it was opened
+LogCursor message_log_end(MessageLog* log) {
+    LogCursor cursor = { 0, 0 };
+    if (log->segmentCount > 0) {
+        cursor.segment = log->segmentCount - 1;
+        cursor.offset = log->segments[cursor.segment].size;
+    }
+    return cursor;
+}
+
+// Step back to the previous record. Only the record's trailing length is
+// read, so walking back from the end costs nothing for older records.
+bool message_log_prev(MessageLog* log, LogCursor* cursor) {
+    while (cursor->offset == 0) {
+        if (cursor->segment == 0)
+            return false;
+        cursor->segment--;
+        cursor->offset = log->segments[cursor->segment].size;
+    }
+    const uint8_t* map = log->segments[cursor->segment].map;
+    uint32_t length = read_uint32(map + cursor->offset - 4);
+    if (cursor->offset < RECORD_OVERHEAD + (size_t)length)
+        return false;
+    cursor->offset -= RECORD_OVERHEAD + length;
+    return true;
+}
+
+// Step forward to the next record, false once the end is reached
+bool message_log_next(MessageLog* log, LogCursor* cursor) {
+    LogSegment* segment = &log->segments[cursor->segment];
+    cursor->offset += RECORD_OVERHEAD + read_uint32(segment->map + cursor->offset);
+    while (cursor->offset >= log->segments[cursor->segment].size) {
+        if (cursor->segment == log->segmentCount - 1)
+            return false;
+        cursor->segment++;
+        cursor->offset = 0;
+    }
+    return true;
+}
+
+// Decode the record at a cursor. Returns -1 if the record is corrupt.
+int message_log_read(MessageLog* log, LogCursor* cursor, MsgFrame** frame) {
+    if (cursor->segment >= log->segmentCount)
+        return -1;
+    LogSegment* segment = &log->segments[cursor->segment];
+    if (record_check(segment->map, segment->size, cursor->offset) == 0)
+        return -1;
+    uint32_t length = read_uint32(segment->map + cursor->offset);
+    Frame* decoded;
+    if (protocol_frame_decode(segment->map + cursor->offset + 8, length, &decoded) <= 0)
+        return -1;
+    if (decoded->type != FRAME_MSG) {
+        protocol_frame_free(decoded);
+        return -1;
+    }
+    *frame = (MsgFrame*)decoded;
+    return 0;
+}
+
+// Flush anything unsynced, stop the sync thread and unmap the segments
+void message_log_close(MessageLog* log) {
+    pthread_mutex_lock(&log->mutex);
+    log->stopped = true;
+    pthread_cond_signal(&log->cond);
+    pthread_mutex_unlock(&log->mutex);
+    if (log->policy == LOG_SYNC_INTERVAL && log->fd >= 0)
+        pthread_join(log->syncThread, NULL);
+
+    if (log->fd >= 0) {
+        if (log->unsynced && log->policy != LOG_SYNC_NONE)
+            fdatasync(log->fd);
+        close(log->fd);
+    }
+    for (int i = 0; i < log->segmentCount; i++) {
+        if (log->segments[i].map != NULL)
+            munmap((void*)log->segments[i].map, log->segments[i].mapSize);
+    }
+    free(log->segments);
+    string_free(&log->directory);
+    buffer_free(&log->buffer);
+    pthread_mutex_destroy(&log->mutex);
+    pthread_cond_destroy(&log->cond);
+}
@@ -0,0 +1,72 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        messagelog.h
+// Description: This file contains the definitions for the MessageLog, an
+//              append-only log of encoded message frames split into segment
+//              files. Segments are memory-mapped on open and records are
+//              only decoded when they are read.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "string.h"
+#include "buffer.h"
+#include "protocol.h"
+
+// A new segment is started once the current one would grow past this
+#define MESSAGE_LOG_SEGMENT_SIZE (64 * 1024 * 1024)
+// Seconds between syncs with LOG_SYNC_INTERVAL
+#define MESSAGE_LOG_SYNC_INTERVAL 1
+
+typedef enum {
+    // Leave flushing to the kernel
+    LOG_SYNC_NONE,
+    // Sync from a background thread every MESSAGE_LOG_SYNC_INTERVAL
+    LOG_SYNC_INTERVAL,
+    // Sync before every append returns
+    LOG_SYNC_ALWAYS,
+} LogSyncPolicy;
+
+typedef struct {
+    uint32_t id;
+    // Contents of the segment when the log was opened
+    const uint8_t* map;
+    size_t mapSize;
+    // End of the last whole record
+    size_t size;
+} LogSegment;
+
+// Position of a record in the mapped segments
+typedef struct {
+    int segment;
+    size_t offset;
+} LogCursor;
+
+typedef struct {
+    String directory;
+    LogSegment* segments;
+    int segmentCount;
+    // Segment appended to, and its size on disk
+    int fd;
+    uint32_t writeId;
+    size_t writeSize;
+    Buffer buffer;
+    LogSyncPolicy policy;
+    bool unsynced;
+    bool stopped;
+    pthread_t syncThread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} MessageLog;
+
+int message_log_open(MessageLog* log, const char* directory, LogSyncPolicy policy);
+int message_log_append(MessageLog* log, MsgFrame* frame);
+LogCursor message_log_end(MessageLog* log);
+bool message_log_prev(MessageLog* log, LogCursor* cursor);
+bool message_log_next(MessageLog* log, LogCursor* cursor);
+int message_log_read(MessageLog* log, LogCursor* cursor, MsgFrame** frame);
+void message_log_close(MessageLog* log);
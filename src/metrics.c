@@ -0,0 +1,401 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        metrics.c
+// Description: This file contains the implementation for the metrics.
+//              Threads register a shard on first use; dumps sum every
+//              shard. A background thread answers SIGUSR1, through a
+//              signalfd, and connections on the metrics socket.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+__thread MetricsShard* metricsShard = NULL;
+
+static MetricsShard* shards = NULL;
+static pthread_mutex_t shardsMutex = PTHREAD_MUTEX_INITIALIZER;
+static double gauges[METRIC_GAUGES];
+static pthread_mutex_t gaugesMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* frameTypeNames[METRICS_FRAME_TYPES] = { "ident", "msg", "ping", "pong", "data", "join", "leave", "ack", "history_request", "history_page" };
+
+static const struct {
+    MetricCounter counter;
+    const char* name;
+    const char* label;
+} counterNames[] = {
+    { METRIC_SYSCALL_RECV, "chat_syscalls_total", "call=\"recv\"" },
+    { METRIC_SYSCALL_WRITE, "chat_syscalls_total", "call=\"write\"" },
+    { METRIC_SYSCALL_WRITEV, "chat_syscalls_total", "call=\"writev\"" },
+    { METRIC_SYSCALL_SENDFILE, "chat_syscalls_total", "call=\"sendfile\"" },
+    { METRIC_SYSCALL_EPOLL_WAIT, "chat_syscalls_total", "call=\"epoll_wait\"" },
+    { METRIC_SYSCALL_URING_ENTER, "chat_syscalls_total", "call=\"io_uring_enter\"" },
+    { METRIC_ALLOC_FRAME, "chat_allocations_total", "kind=\"frame\"" },
+    { METRIC_ALLOC_ENCODED, "chat_allocations_total", "kind=\"encoded\"" },
+    { METRIC_ALLOC_BUFFER, "chat_allocations_total", "kind=\"buffer\"" },
+    { METRIC_CLIENTS_BACKED_UP, "chat_clients_dropped_total", "reason=\"backed_up\"" },
+};
+
+static const struct {
+    const char* name;
+    const char* help;
+    // Divides recorded values, nanoseconds to seconds for latencies
+    double scale;
+} histogramNames[METRIC_HISTOGRAMS] = {
+    [METRIC_RENDER_TIME] = { "chat_render_seconds", "Time spent drawing the screen.", 1e9 },
+    [METRIC_STATE_LOCK_WAIT] = { "chat_state_lock_wait_seconds", "Time spent waiting for the app state lock.", 1e9 },
+    [METRIC_SEND_QUEUE_DEPTH] = { "chat_send_queue_depth", "Frames queued when a send queue is flushed.", 1 },
+    [METRIC_BACKLOG_LOCK_WAIT] = { "chat_backlog_lock_wait_seconds", "Time spent waiting to number a message.", 1e9 },
+    [METRIC_ACK_LAG] = { "chat_ack_lag_messages", "Messages numbered since the one a client acknowledged.", 1 },
+    [METRIC_REPLAYED] = { "chat_replayed_messages", "Messages replayed to a client resuming its session.", 1 },
+};
+
+static const struct {
+    const char* name;
+    const char* help;
+} gaugeNames[METRIC_GAUGES] = {
+    [METRIC_CLIENTS] = { "chat_clients", "Clients connected to the server." },
+    [METRIC_RTT] = { "chat_rtt_seconds", "Smoothed ping round trip time." },
+    [METRIC_JITTER] = { "chat_jitter_seconds", "Mean change between consecutive round trips." },
+    [METRIC_SKEW] = { "chat_clock_skew_ppm", "Drift of the peer's clock against ours." },
+};
+
+// Register a shard for the calling thread. Shards are never freed: the app
+// runs a fixed handful of threads, and their counts outlive them.
+MetricsShard* metrics_shard_create(void) {
+    MetricsShard* shard = calloc(1, sizeof(MetricsShard));
+    pthread_mutex_lock(&shardsMutex);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&shardsMutex);
+    metricsShard = shard;
+    return shard;
+}
+
+uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int metrics_bucket(uint64_t value) {
+    if (value < (1 << METRICS_SUB_BITS))
+        return value;
+    int magnitude = 63 - __builtin_clzll(value);
+    int sub = (value >> (magnitude - METRICS_SUB_BITS)) & ((1 << METRICS_SUB_BITS) - 1);
+    return ((magnitude - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS) + sub;
+}
+
+// Largest value that falls in a bucket
+static uint64_t metrics_bucket_bound(int bucket) {
+    if (bucket < (1 << METRICS_SUB_BITS))
+        return bucket;
+    int magnitude = (bucket >> METRICS_SUB_BITS) + METRICS_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << METRICS_SUB_BITS) - 1);
+    uint64_t width = (uint64_t)1 << (magnitude - METRICS_SUB_BITS);
+    return (((1 << METRICS_SUB_BITS) + sub) << (magnitude - METRICS_SUB_BITS)) + width - 1;
+}
+
+void metrics_record(MetricHistogram histogram, uint64_t value) {
+    MetricsShard* shard = metricsShard != NULL ? metricsShard : metrics_shard_create();
+    uint64_t* bucket = &shard->buckets[histogram][metrics_bucket(value)];
+    __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&shard->sums[histogram], shard->sums[histogram] + value, __ATOMIC_RELAXED);
+}
+
+// Counters of a room on the calling thread, created on first use. Lookups
+// walk the thread's list, so rooms should keep what this returns.
+MetricsRoom* metrics_room(const char* name, size_t length) {
+    MetricsShard* shard = metricsShard != NULL ? metricsShard : metrics_shard_create();
+    if (length > PROTOCOL_MAX_ROOM_LENGTH || shard->roomCount >= METRICS_MAX_ROOMS)
+        length = 0;
+    for (MetricsRoom* room = shard->rooms; room != NULL; room = room->next) {
+        if (strlen(room->name) == length && memcmp(room->name, name, length) == 0)
+            return room;
+    }
+    MetricsRoom* room = calloc(1, sizeof(MetricsRoom));
+    memcpy(room->name, name, length);
+    // Published under the lock dumps hold while they walk the lists
+    pthread_mutex_lock(&shardsMutex);
+    room->next = shard->rooms;
+    shard->rooms = room;
+    shard->roomCount++;
+    pthread_mutex_unlock(&shardsMutex);
+    return room;
+}
+
+void metrics_set(MetricGauge gauge, double value) {
+    pthread_mutex_lock(&gaugesMutex);
+    gauges[gauge] = value;
+    pthread_mutex_unlock(&gaugesMutex);
+}
+
+// Lock a mutex and record how long it took. An uncontended lock costs a
+// trylock and records 0, so the clock is only read when a thread waits.
+void metrics_lock(pthread_mutex_t* mutex, MetricHistogram histogram) {
+    if (pthread_mutex_trylock(mutex) == 0) {
+        metrics_record(histogram, 0);
+        return;
+    }
+    uint64_t start = metrics_now();
+    pthread_mutex_lock(mutex);
+    metrics_record(histogram, metrics_now() - start);
+}
+
+static void metrics_printf(Buffer* buffer, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void metrics_printf(Buffer* buffer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    buffer_reserve(buffer, length + 1);
+    va_start(args, format);
+    vsnprintf((char*)buffer->data + buffer->length, length + 1, format, args);
+    va_end(args);
+    buffer->length += length;
+}
+
+static uint64_t metrics_sum_counter(MetricCounter counter) {
+    uint64_t total = 0;
+    for (MetricsShard* shard = shards; shard != NULL; shard = shard->next)
+        total += __atomic_load_n(&shard->counters[counter], __ATOMIC_RELAXED);
+    return total;
+}
+
+static void metrics_format_frames(Buffer* buffer, MetricCounter first, const char* name, const char* help) {
+    metrics_printf(buffer, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (int type = 0; type < METRICS_FRAME_TYPES; type++)
+        metrics_printf(buffer, "%s{type=\"%s\"} %llu\n", name, frameTypeNames[type], (unsigned long long)metrics_sum_counter(first + type));
+}
+
+// Buckets are cumulative as Prometheus expects; empty ones are left out
+static void metrics_format_histogram(Buffer* buffer, MetricHistogram histogram) {
+    const char* name = histogramNames[histogram].name;
+    double scale = histogramNames[histogram].scale;
+    metrics_printf(buffer, "# HELP %s %s\n# TYPE %s histogram\n", name, histogramNames[histogram].help, name);
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    for (int bucket = 0; bucket < METRICS_BUCKETS; bucket++) {
+        uint64_t value = 0;
+        for (MetricsShard* shard = shards; shard != NULL; shard = shard->next)
+            value += __atomic_load_n(&shard->buckets[histogram][bucket], __ATOMIC_RELAXED);
+        if (value == 0)
+            continue;
+        count += value;
+        metrics_printf(buffer, "%s_bucket{le=\"%.9g\"} %llu\n", name, metrics_bucket_bound(bucket) / scale, (unsigned long long)count);
+    }
+    for (MetricsShard* shard = shards; shard != NULL; shard = shard->next)
+        sum += __atomic_load_n(&shard->sums[histogram], __ATOMIC_RELAXED);
+    metrics_printf(buffer, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)count);
+    metrics_printf(buffer, "%s_sum %.9g\n%s_count %llu\n", name, sum / scale, name, (unsigned long long)count);
+}
+
+static void metrics_print_label(Buffer* buffer, const char* value) {
+    for (; *value != '\0'; value++) {
+        if (*value == '\n')
+            metrics_printf(buffer, "\\n");
+        else
+            metrics_printf(buffer, *value == '"' || *value == '\\' ? "\\%c" : "%c", *value);
+    }
+}
+
+static int metrics_compare_rooms(const void* a, const void* b) {
+    return strcmp((*(MetricsRoom* const*)a)->name, (*(MetricsRoom* const*)b)->name);
+}
+
+// Rooms handled by several threads are summed under one name
+static void metrics_format_rooms(Buffer* buffer) {
+    int count = 0;
+    for (MetricsShard* shard = shards; shard != NULL; shard = shard->next)
+        count += shard->roomCount;
+    if (count == 0)
+        return;
+    MetricsRoom** rooms = malloc(count * sizeof(MetricsRoom*));
+    int index = 0;
+    for (MetricsShard* shard = shards; shard != NULL; shard = shard->next) {
+        for (MetricsRoom* room = shard->rooms; room != NULL; room = room->next)
+            rooms[index++] = room;
+    }
+    qsort(rooms, count, sizeof(MetricsRoom*), metrics_compare_rooms);
+
+    static const char* names[2] = { "chat_room_messages_total", "chat_room_deliveries_total" };
+    static const char* helps[2] = { "Messages posted to a room.", "Copies of room messages queued for members." };
+    for (int metric = 0; metric < 2; metric++) {
+        metrics_printf(buffer, "# HELP %s %s\n# TYPE %s counter\n", names[metric], helps[metric], names[metric]);
+        for (int i = 0; i < count;) {
+            uint64_t total = 0;
+            int first = i;
+            for (; i < count && strcmp(rooms[i]->name, rooms[first]->name) == 0; i++)
+                total += __atomic_load_n(metric == 0 ? &rooms[i]->messages : &rooms[i]->deliveries, __ATOMIC_RELAXED);
+            metrics_printf(buffer, "%s{room=\"", names[metric]);
+            metrics_print_label(buffer, rooms[first]->name);
+            metrics_printf(buffer, "\"} %llu\n", (unsigned long long)total);
+        }
+    }
+    free(rooms);
+}
+
+// Append every metric in the Prometheus text exposition format
+void metrics_format(Buffer* buffer) {
+    pthread_mutex_lock(&shardsMutex);
+    metrics_format_frames(buffer, METRIC_FRAMES_IN, "chat_frames_in_total", "Frames received, by type.");
+    metrics_format_frames(buffer, METRIC_BYTES_IN, "chat_frame_bytes_in_total", "Bytes of frames received, by type.");
+    metrics_format_frames(buffer, METRIC_FRAMES_OUT, "chat_frames_out_total", "Frames encoded for sending, by type.");
+    metrics_format_frames(buffer, METRIC_BYTES_OUT, "chat_frame_bytes_out_total", "Bytes of frames encoded for sending, by type.");
+    const char* previous = NULL;
+    for (size_t i = 0; i < sizeof(counterNames) / sizeof(counterNames[0]); i++) {
+        if (previous == NULL || strcmp(previous, counterNames[i].name) != 0)
+            metrics_printf(buffer, "# TYPE %s counter\n", counterNames[i].name);
+        previous = counterNames[i].name;
+        metrics_printf(buffer, "%s{%s} %llu\n", counterNames[i].name, counterNames[i].label, (unsigned long long)metrics_sum_counter(counterNames[i].counter));
+    }
+    for (int histogram = 0; histogram < METRIC_HISTOGRAMS; histogram++)
+        metrics_format_histogram(buffer, histogram);
+    metrics_format_rooms(buffer);
+    pthread_mutex_unlock(&shardsMutex);
+
+    pthread_mutex_lock(&gaugesMutex);
+    for (int gauge = 0; gauge < METRIC_GAUGES; gauge++) {
+        metrics_printf(buffer, "# HELP %s %s\n# TYPE %s gauge\n%s %.9g\n", gaugeNames[gauge].name, gaugeNames[gauge].help,
+            gaugeNames[gauge].name, gaugeNames[gauge].name, gauges[gauge]);
+    }
+    pthread_mutex_unlock(&gaugesMutex);
+}
+
+static void metrics_write_all(int fd, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return;
+        data += written;
+        length -= written;
+    }
+}
+
+// Write a snapshot next to where the app was started
+static void metrics_dump_file(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "mychat-%d.prom", (int)getpid());
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    Buffer buffer;
+    buffer_init(&buffer, 16 * 1024);
+    metrics_format(&buffer);
+    metrics_write_all(fd, buffer.data, buffer.length);
+    buffer_free(&buffer);
+    close(fd);
+}
+
+// Answer one connection on the metrics socket. Scrapers that send an HTTP
+// request, like curl --unix-socket, get an HTTP response; anything else gets
+// the bare text.
+static void metrics_serve_client(int clientfd) {
+    struct timeval timeout = { 0, 100000 };
+    setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    char request[512];
+    ssize_t received = recv(clientfd, request, sizeof(request), 0);
+    bool http = received >= 4 && memcmp(request, "GET ", 4) == 0;
+
+    Buffer body;
+    buffer_init(&body, 16 * 1024);
+    metrics_format(&body);
+    if (http) {
+        char header[128];
+        int length = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body.length);
+        metrics_write_all(clientfd, (uint8_t*)header, length);
+    }
+    metrics_write_all(clientfd, body.data, body.length);
+    buffer_free(&body);
+    close(clientfd);
+}
+
+typedef struct {
+    int signalfd;
+    int listenfd;
+} MetricsServer;
+
+static void* metrics_loop(void* arg) {
+    MetricsServer* server = arg;
+    struct pollfd fds[2] = {
+        { .fd = server->signalfd, .events = POLLIN },
+        { .fd = server->listenfd, .events = POLLIN },
+    };
+    while (true) {
+        if (poll(fds, server->listenfd >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return NULL;
+        }
+        if (fds[0].revents & POLLIN) {
+            struct signalfd_siginfo info;
+            if (read(server->signalfd, &info, sizeof(info)) == sizeof(info))
+                metrics_dump_file();
+        }
+        if (server->listenfd >= 0 && (fds[1].revents & POLLIN)) {
+            int clientfd = accept4(server->listenfd, NULL, NULL, SOCK_CLOEXEC);
+            if (clientfd >= 0)
+                metrics_serve_client(clientfd);
+        }
+    }
+    return NULL;
+}
+
+// Start answering SIGUSR1 with a dump to mychat-PID.prom, and serve the
+// metrics on a Unix socket when a path is given. Must run before any other
+// thread is created: SIGUSR1 is blocked here so every later thread inherits
+// the mask and only the signalfd sees it.
+int metrics_start(const char* socketPath) {
+    static MetricsServer server;
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    server.signalfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    server.listenfd = -1;
+    if (server.signalfd < 0) {
+        perror("signalfd");
+        return -1;
+    }
+
+    if (socketPath != NULL) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Metrics socket path too long\n");
+            return -1;
+        }
+        strcpy(addr.sun_path, socketPath);
+        unlink(socketPath);
+        server.listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (server.listenfd < 0 || bind(server.listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(server.listenfd, 16) < 0) {
+            perror("metrics socket");
+            return -1;
+        }
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, metrics_loop, &server) != 0) {
+        perror("pthread_create");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,123 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        metrics.h
+// Description: This file contains the definitions for the metrics: counters
+//              and log-linear latency histograms kept per thread so the hot
+//              path never contends, gauges, and a dump in the Prometheus
+//              text format on SIGUSR1 or through a Unix socket.
+
+#pragma once
+#include <stdint.h>
+#include <pthread.h>
+#include "buffer.h"
+#include "protocol.h"
+
+#define METRICS_FRAME_TYPES PROTOCOL_FRAME_TYPES
+// Histogram buckets: values below 16 get one each, larger ones 16 per power
+// of two, so any value is within about 6% of its bucket's bounds
+#define METRICS_SUB_BITS 4
+#define METRICS_BUCKETS ((64 - METRICS_SUB_BITS + 1) << METRICS_SUB_BITS)
+// Rooms each thread counts under their own name; the rest share the
+// empty one, so a flood of short-lived rooms cannot blow up the dump
+#define METRICS_MAX_ROOMS 256
+
+typedef enum {
+    // One counter per frame type for each of these four
+    METRIC_FRAMES_IN = 0,
+    METRIC_FRAMES_OUT = METRIC_FRAMES_IN + METRICS_FRAME_TYPES,
+    METRIC_BYTES_IN = METRIC_FRAMES_OUT + METRICS_FRAME_TYPES,
+    METRIC_BYTES_OUT = METRIC_BYTES_IN + METRICS_FRAME_TYPES,
+    METRIC_SYSCALL_RECV = METRIC_BYTES_OUT + METRICS_FRAME_TYPES,
+    METRIC_SYSCALL_WRITE,
+    METRIC_SYSCALL_WRITEV,
+    METRIC_SYSCALL_SENDFILE,
+    METRIC_SYSCALL_EPOLL_WAIT,
+    METRIC_SYSCALL_URING_ENTER,
+    METRIC_ALLOC_FRAME,
+    METRIC_ALLOC_ENCODED,
+    METRIC_ALLOC_BUFFER,
+    METRIC_CLIENTS_BACKED_UP,
+    METRIC_COUNTERS,
+} MetricCounter;
+
+typedef enum {
+    // Nanoseconds
+    METRIC_RENDER_TIME,
+    METRIC_STATE_LOCK_WAIT,
+    // Frames queued when a send queue is flushed
+    METRIC_SEND_QUEUE_DEPTH,
+    // Nanoseconds
+    METRIC_BACKLOG_LOCK_WAIT,
+    // Messages
+    METRIC_ACK_LAG,
+    METRIC_REPLAYED,
+    METRIC_HISTOGRAMS,
+} MetricHistogram;
+
+typedef enum {
+    METRIC_CLIENTS,
+    METRIC_RTT,
+    METRIC_JITTER,
+    METRIC_SKEW,
+    METRIC_GAUGES,
+} MetricGauge;
+
+// Traffic of one room on one thread. Kept when the room empties, so its
+// counts never go backwards and a room that comes back picks them up again.
+typedef struct MetricsRoom {
+    char name[PROTOCOL_MAX_ROOM_LENGTH + 1];
+    // Messages posted to the room, and copies of them queued for members
+    uint64_t messages;
+    uint64_t deliveries;
+    struct MetricsRoom* next;
+} MetricsRoom;
+
+// Written only by its own thread; other threads read it while dumping
+typedef struct MetricsShard {
+    uint64_t counters[METRIC_COUNTERS];
+    uint64_t buckets[METRIC_HISTOGRAMS][METRICS_BUCKETS];
+    uint64_t sums[METRIC_HISTOGRAMS];
+    MetricsRoom* rooms;
+    int roomCount;
+    struct MetricsShard* next;
+} MetricsShard;
+
+extern __thread MetricsShard* metricsShard;
+
+MetricsShard* metrics_shard_create(void);
+
+// Plain loads and stores: each counter has a single writer, and relaxed
+// atomics only keep readers from seeing torn values
+static inline void metrics_add(MetricCounter counter, uint64_t value) {
+    MetricsShard* shard = metricsShard != NULL ? metricsShard : metrics_shard_create();
+    __atomic_store_n(&shard->counters[counter], shard->counters[counter] + value, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_frame_in(uint8_t type, uint64_t bytes) {
+    if (type < METRICS_FRAME_TYPES) {
+        metrics_add(METRIC_FRAMES_IN + type, 1);
+        metrics_add(METRIC_BYTES_IN + type, bytes);
+    }
+}
+
+static inline void metrics_frame_out(uint8_t type, uint64_t bytes) {
+    if (type < METRICS_FRAME_TYPES) {
+        metrics_add(METRIC_FRAMES_OUT + type, 1);
+        metrics_add(METRIC_BYTES_OUT + type, bytes);
+    }
+}
+
+static inline void metrics_room_add(MetricsRoom* room, uint64_t messages, uint64_t deliveries) {
+    __atomic_store_n(&room->messages, room->messages + messages, __ATOMIC_RELAXED);
+    __atomic_store_n(&room->deliveries, room->deliveries + deliveries, __ATOMIC_RELAXED);
+}
+
+MetricsRoom* metrics_room(const char* name, size_t length);
+uint64_t metrics_now(void);
+void metrics_record(MetricHistogram histogram, uint64_t value);
+void metrics_set(MetricGauge gauge, double value);
+void metrics_lock(pthread_mutex_t* mutex, MetricHistogram histogram);
+void metrics_format(Buffer* buffer);
+int metrics_start(const char* socketPath);
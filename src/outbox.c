@@ -0,0 +1,160 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        outbox.c
+// Description: This file contains the implementation for the Outbox. The
+//              queue is an intrusive linked list where producers only
+//              exchange the head pointer, so pushing never waits on another
+//              producer or on the writer.
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "sendqueue.h"
+#include "outbox.h"
+
+int outbox_init(Outbox* outbox, size_t highWater) {
+    outbox->stub.next = NULL;
+    outbox->stub.frame = NULL;
+    outbox->head = &outbox->stub;
+    outbox->tail = &outbox->stub;
+    outbox->bytes = 0;
+    outbox->highWater = highWater;
+    outbox->sleeping = false;
+    outbox->closed = false;
+    outbox->eventfd = eventfd(0, EFD_CLOEXEC);
+    return outbox->eventfd < 0 ? -1 : 0;
+}
+
+void outbox_free(Outbox* outbox) {
+    EncodedFrame* frame;
+    while ((frame = outbox_pop(outbox)) != NULL)
+        encoded_frame_release(frame);
+    close(outbox->eventfd);
+}
+
+static void outbox_link(Outbox* outbox, OutboxNode* node) {
+    node->next = NULL;
+    OutboxNode* previous = __atomic_exchange_n(&outbox->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+// Queue a frame for the writer, which takes its own reference. Returns
+// false without queueing it when the writer is already a high-water mark
+// behind, so a slow peer pushes back on producers instead of growing the
+// queue without bound. A single frame is always accepted into an empty
+// outbox.
+bool outbox_push(Outbox* outbox, EncodedFrame* frame) {
+    size_t queued = __atomic_load_n(&outbox->bytes, __ATOMIC_RELAXED);
+    if (queued > 0 && queued + frame->length > outbox->highWater)
+        return false;
+    __atomic_add_fetch(&outbox->bytes, frame->length, __ATOMIC_RELAXED);
+
+    OutboxNode* node = malloc(sizeof(OutboxNode));
+    node->frame = encoded_frame_retain(frame);
+    outbox_link(outbox, node);
+
+    if (__atomic_load_n(&outbox->sleeping, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&outbox->sleeping, false, __ATOMIC_SEQ_CST))
+        outbox_wake(outbox);
+    return true;
+}
+
+// Take the oldest frame, or NULL if there is none. Only the writer may
+// call this. The caller owns the returned reference and reports the bytes
+// with outbox_sent once they are written.
+EncodedFrame* outbox_pop(Outbox* outbox) {
+    OutboxNode* tail = outbox->tail;
+    OutboxNode* next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (tail == &outbox->stub) {
+        if (next == NULL)
+            return NULL;
+        outbox->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next == NULL) {
+        // The tail is the last node; a producer may be halfway through
+        // linking a new one, in which case it is picked up next time
+        if (tail != __atomic_load_n(&outbox->head, __ATOMIC_ACQUIRE))
+            return NULL;
+        // Put the stub back behind the last node so it can be taken
+        outbox_link(outbox, &outbox->stub);
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        if (next == NULL)
+            return NULL;
+    }
+    outbox->tail = next;
+    EncodedFrame* frame = tail->frame;
+    free(tail);
+    return frame;
+}
+
+void outbox_sent(Outbox* outbox, size_t bytes) {
+    __atomic_sub_fetch(&outbox->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static bool outbox_pending(Outbox* outbox) {
+    return outbox->tail != &outbox->stub || __atomic_load_n(&outbox->head, __ATOMIC_SEQ_CST) != &outbox->stub;
+}
+
+// Sleep until a frame is pushed, outbox_wake is called or the timeout
+// passes; a negative timeout never passes. Returns false once the outbox is
+// closed.
+bool outbox_wait_for(Outbox* outbox, long timeoutMicros) {
+    __atomic_store_n(&outbox->sleeping, true, __ATOMIC_SEQ_CST);
+    if (!outbox_pending(outbox) && !__atomic_load_n(&outbox->closed, __ATOMIC_ACQUIRE)) {
+        uint64_t value;
+        struct pollfd ready = { .fd = outbox->eventfd, .events = POLLIN };
+        struct timespec timeout = { timeoutMicros / 1000000, timeoutMicros % 1000000 * 1000 };
+        if (timeoutMicros < 0 || ppoll(&ready, 1, &timeout, NULL) > 0)
+            while (read(outbox->eventfd, &value, sizeof(value)) < 0 && errno == EINTR);
+    }
+    __atomic_store_n(&outbox->sleeping, false, __ATOMIC_SEQ_CST);
+    return !__atomic_load_n(&outbox->closed, __ATOMIC_ACQUIRE);
+}
+
+// Sleep until outbox_wake is called or the timeout passes, however many
+// frames are queued, for a writer with nowhere to send them yet. Returns
+// false once the outbox is closed.
+bool outbox_pause_for(Outbox* outbox, long timeoutMicros) {
+    if (!__atomic_load_n(&outbox->closed, __ATOMIC_ACQUIRE)) {
+        uint64_t value;
+        struct pollfd ready = { .fd = outbox->eventfd, .events = POLLIN };
+        struct timespec timeout = { timeoutMicros / 1000000, timeoutMicros % 1000000 * 1000 };
+        if (ppoll(&ready, 1, timeoutMicros < 0 ? NULL : &timeout, NULL) > 0)
+            while (read(outbox->eventfd, &value, sizeof(value)) < 0 && errno == EINTR);
+    }
+    return !__atomic_load_n(&outbox->closed, __ATOMIC_ACQUIRE);
+}
+
+bool outbox_wait(Outbox* outbox) {
+    return outbox_wait_for(outbox, -1);
+}
+
+// For a consumer that waits on the eventfd in an event loop of its own:
+// announce it is about to wait, so producers signal it. Returns false when
+// frames are already queued and it should not block.
+bool outbox_sleep(Outbox* outbox) {
+    __atomic_store_n(&outbox->sleeping, true, __ATOMIC_SEQ_CST);
+    return !outbox_pending(outbox);
+}
+
+void outbox_awake(Outbox* outbox) {
+    __atomic_store_n(&outbox->sleeping, false, __ATOMIC_SEQ_CST);
+}
+
+// Wake the writer so it looks for work other than queued frames
+void outbox_wake(Outbox* outbox) {
+    uint64_t value = 1;
+    write(outbox->eventfd, &value, sizeof(value));
+}
+
+void outbox_close(Outbox* outbox) {
+    __atomic_store_n(&outbox->closed, true, __ATOMIC_RELEASE);
+    outbox_wake(outbox);
+}
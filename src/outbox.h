@@ -0,0 +1,48 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        outbox.h
+// Description: This file contains the definitions for the Outbox, a
+//              lock-free queue of encoded frames that any thread can push
+//              to and a single writer thread drains to the socket.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "sendqueue.h"
+
+// Frames are refused once this many bytes are waiting to be written
+#define OUTBOX_HIGH_WATER (1024 * 1024)
+
+typedef struct OutboxNode {
+    struct OutboxNode* next;
+    EncodedFrame* frame;
+} OutboxNode;
+
+typedef struct {
+    // Producers swap themselves in at the head; the writer pops at the tail
+    OutboxNode* head;
+    OutboxNode* tail;
+    OutboxNode stub;
+    // Bytes pushed but not yet written
+    size_t bytes;
+    size_t highWater;
+    // Signalled when a frame is pushed while the writer sleeps
+    int eventfd;
+    bool sleeping;
+    bool closed;
+} Outbox;
+
+int outbox_init(Outbox* outbox, size_t highWater);
+void outbox_free(Outbox* outbox);
+bool outbox_push(Outbox* outbox, EncodedFrame* frame);
+EncodedFrame* outbox_pop(Outbox* outbox);
+void outbox_sent(Outbox* outbox, size_t bytes);
+bool outbox_wait(Outbox* outbox);
+bool outbox_wait_for(Outbox* outbox, long timeoutMicros);
+bool outbox_pause_for(Outbox* outbox, long timeoutMicros);
+bool outbox_sleep(Outbox* outbox);
+void outbox_awake(Outbox* outbox);
+void outbox_wake(Outbox* outbox);
+void outbox_close(Outbox* outbox);
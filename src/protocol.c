@@ -6,235 +6,1036 @@
 // Description: This file contains the implementation for the chat protocol.
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include "string.h"
+#include "buffer.h"
+#include "ringbuffer.h"
 #include "protocol.h"
+#include "metrics.h"
 
-static int read_uint32(int socket, uint32_t* value) {
+// Bounds-checked reader over a contiguous region of received bytes. Strings
+// are copied into the arena when there is one.
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+    StringArena* arena;
+} Cursor;
+
+static bool cursor_has(Cursor* cursor, size_t length) {
+    return cursor->length - cursor->offset >= length;
+}
+
+static uint8_t cursor_uint8(Cursor* cursor) {
+    return cursor->data[cursor->offset++];
+}
+
+static uint16_t cursor_uint16(Cursor* cursor) {
+    uint16_t raw;
+    memcpy(&raw, cursor->data + cursor->offset, 2);
+    cursor->offset += 2;
+    return ntohs(raw);
+}
+
+static uint32_t cursor_uint32(Cursor* cursor) {
     uint32_t raw;
-    if (read(socket, &raw, 4) != 4)
-        return -1;
-    *value = ntohl(raw);
-    return 0;
+    memcpy(&raw, cursor->data + cursor->offset, 4);
+    cursor->offset += 4;
+    return ntohl(raw);
 }
 
-static int write_uint32(int socket, uint32_t value) {
-    uint32_t raw = htonl(value);
-    if (write(socket, &raw, 4) != 4)
-        return -1;
-    return 0;
+static uint64_t cursor_uint64(Cursor* cursor) {
+    uint64_t high = cursor_uint32(cursor);
+    return high << 32 | cursor_uint32(cursor);
 }
 
-static int write_uint16(int socket, uint16_t value) {
-    uint16_t raw = htons(value);
-    if (write(socket, &raw, 2) != 2)
-        return -1;
-    return 0;
+static String cursor_string(Cursor* cursor, size_t length) {
+    const char* bytes = (const char*)cursor->data + cursor->offset;
+    cursor->offset += length;
+    if (cursor->arena != NULL)
+        return string_new_arena(cursor->arena, bytes, length);
+    String string = string_new(length);
+    memcpy(string_data(&string), bytes, length);
+    string_data(&string)[length] = '\0';
+    string.length = length;
+    return string;
 }
 
-static int read_uint16(int socket, uint16_t* value) {
-    uint16_t raw;
-    if (read(socket, &raw, 2) != 2)
-        return -1;
-    *value = ntohs(raw);
-    return 0;
+// Free lists of frames and attachment arrays released on a thread, reused
+// by the next frames it allocates. Lists are typed by frame and by the
+// power of two attachment arrays are rounded up to.
+typedef struct PoolEntry {
+    struct PoolEntry* next;
+} PoolEntry;
+
+typedef struct {
+    PoolEntry* head;
+    int count;
+} PoolList;
+
+typedef struct {
+    PoolList frames[PROTOCOL_FRAME_TYPES];
+    PoolList attachments[PROTOCOL_POOL_CLASSES];
+    bool registered;
+} FramePool;
+
+static __thread FramePool pool;
+static pthread_key_t poolKey;
+static pthread_once_t poolOnce = PTHREAD_ONCE_INIT;
+static uint64_t poolAllocations = 0;
+
+static const size_t frameSizes[PROTOCOL_FRAME_TYPES] = {
+    [FRAME_IDENT] = sizeof(IdentFrame),
+    [FRAME_MSG] = sizeof(MsgFrame),
+    [FRAME_PING] = sizeof(PingFrame),
+    [FRAME_PONG] = sizeof(PongFrame),
+    [FRAME_DATA] = sizeof(DataFrame),
+    [FRAME_JOIN] = sizeof(RoomFrame),
+    [FRAME_LEAVE] = sizeof(RoomFrame),
+    [FRAME_ACK] = sizeof(AckFrame),
+    [FRAME_HISTORY_REQUEST] = sizeof(HistoryRequestFrame),
+    [FRAME_HISTORY_PAGE] = sizeof(HistoryPageFrame),
+};
+
+static void pool_list_clear(PoolList* list) {
+    while (list->head != NULL) {
+        PoolEntry* next = list->head->next;
+        free(list->head);
+        list->head = next;
+    }
+    list->count = 0;
+}
+
+// Give a finished thread's cached memory back
+static void pool_destroy(void* data) {
+    FramePool* threadPool = data;
+    for (int i = 0; i < PROTOCOL_FRAME_TYPES; i++)
+        pool_list_clear(&threadPool->frames[i]);
+    for (int i = 0; i < PROTOCOL_POOL_CLASSES; i++)
+        pool_list_clear(&threadPool->attachments[i]);
+}
+
+static void pool_create_key(void) {
+    pthread_key_create(&poolKey, pool_destroy);
+}
+
+static void* pool_take(PoolList* list, size_t size) {
+    PoolEntry* entry = list->head;
+    if (entry != NULL) {
+        list->head = entry->next;
+        list->count--;
+        return entry;
+    }
+    if (!pool.registered) {
+        pthread_once(&poolOnce, pool_create_key);
+        pthread_setspecific(poolKey, &pool);
+        pool.registered = true;
+    }
+    __atomic_add_fetch(&poolAllocations, 1, __ATOMIC_RELAXED);
+    metrics_add(METRIC_ALLOC_FRAME, 1);
+    return malloc(size);
+}
+
+// Keep memory for reuse, up to a limit so a thread that frees frames
+// another thread allocated does not hoard them
+static void pool_put(PoolList* list, void* data) {
+    if (list->count >= PROTOCOL_POOL_LIMIT) {
+        free(data);
+        return;
+    }
+    PoolEntry* entry = data;
+    entry->next = list->head;
+    list->head = entry;
+    list->count++;
+}
+
+static Frame* frame_alloc(FrameType type) {
+    Frame* frame = pool_take(&pool.frames[type], frameSizes[type]);
+    frame->type = type;
+    return frame;
+}
+
+static int attachment_class(uint8_t count) {
+    int class = 0;
+    while (1 << class < count)
+        class++;
+    return class;
+}
+
+// Allocate a message's attachment arrays in one block from the pool. Frames
+// passed to protocol_frame_free must get their arrays from here.
+void protocol_frame_attachments(MsgFrame* frame, uint8_t count) {
+    frame->attachmentCount = count;
+    if (count == 0) {
+        frame->attachmentNames = NULL;
+        frame->attachmentSizes = NULL;
+        frame->attachmentIds = NULL;
+        return;
+    }
+    int class = attachment_class(count);
+    size_t capacity = 1 << class;
+    uint8_t* block = pool_take(&pool.attachments[class], capacity * (sizeof(String) + sizeof(uint64_t) + sizeof(uint32_t)));
+    frame->attachmentNames = (String*)block;
+    frame->attachmentSizes = (uint64_t*)(block + capacity * sizeof(String));
+    frame->attachmentIds = (uint32_t*)(block + capacity * (sizeof(String) + sizeof(uint64_t)));
+}
+
+// Number of times frames or attachment arrays had to be allocated rather
+// than reused, across every thread
+uint64_t protocol_frame_allocations(void) {
+    return __atomic_load_n(&poolAllocations, __ATOMIC_RELAXED);
 }
 
 Frame* protocol_frame_new(FrameType type) {
-    Frame* frame;
-    switch (type) {
+    if (type >= PROTOCOL_FRAME_TYPES)
+        return NULL;
+    Frame* frame = frame_alloc(type);
+    if (type == FRAME_IDENT) {
+        ((IdentFrame*)frame)->version = PROTOCOL_VERSION;
+        ((IdentFrame*)frame)->capabilities = 0;
+        ((IdentFrame*)frame)->seq = 0;
+        ((IdentFrame*)frame)->session = 0;
+        ((IdentFrame*)frame)->rooms = 0;
+    } else if (type == FRAME_MSG) {
+        ((MsgFrame*)frame)->sender = string_new_static("");
+        ((MsgFrame*)frame)->content = string_new_static("");
+        ((MsgFrame*)frame)->room = string_new_static("");
+        ((MsgFrame*)frame)->seq = 0;
+        protocol_frame_attachments((MsgFrame*)frame, 0);
+    } else if (type == FRAME_JOIN || type == FRAME_LEAVE) {
+        ((RoomFrame*)frame)->room = string_new_static("");
+    } else if (type == FRAME_ACK) {
+        ((AckFrame*)frame)->seq = 0;
+    } else if (type == FRAME_HISTORY_REQUEST) {
+        ((HistoryRequestFrame*)frame)->before = 0;
+        ((HistoryRequestFrame*)frame)->count = 0;
+    } else if (type == FRAME_HISTORY_PAGE) {
+        ((HistoryPageFrame*)frame)->before = 0;
+        ((HistoryPageFrame*)frame)->count = 0;
+        ((HistoryPageFrame*)frame)->messages = NULL;
+    }
+    return frame;
+}
+
+static void encode_ident_body(Buffer* buffer, IdentFrame* frame);
+static void encode_msg_body(Buffer* buffer, MsgFrame* frame, bool extended);
+static void encode_room_body(Buffer* buffer, RoomFrame* frame);
+
+/*
+* Version 2 frames start with a header giving their size:
+* 1 byte: frame type
+* 4 bytes: length of the rest of the frame
+* followed by the same fields as in version 1. Version 1 frames are just the
+* type and the fields.
+*/
+
+// Encode a frame for a peer speaking the given protocol version. Ident
+// frames always use the version 1 layout, since they are how the version is
+// agreed on. Returns -1 for frames the version cannot carry.
+int protocol_frame_encode_version(Buffer* buffer, Frame* frame, uint8_t version) {
+    if (!protocol_frame_fits(frame, version))
+        return -1;
+    if (frame->type == FRAME_DATA) {
+        DataFrame* dataFrame = (DataFrame*)frame;
+        protocol_frame_encode_data_header(buffer, version, dataFrame->transferId, dataFrame->length);
+        buffer_append(buffer, dataFrame->data, dataFrame->length);
+        return 0;
+    }
+
+    bool framed = version >= 2 && frame->type != FRAME_IDENT;
+    buffer_append_uint8(buffer, frame->type);
+    size_t lengthOffset = buffer->length;
+    if (framed)
+        buffer_append_uint32(buffer, 0);
+    switch (frame->type) {
         case FRAME_IDENT:
-            frame = malloc(sizeof(IdentFrame));
-            frame->type = FRAME_IDENT;
+            encode_ident_body(buffer, (IdentFrame*)frame);
             break;
         case FRAME_MSG:
-            frame = malloc(sizeof(MsgFrame));
-            frame->type = FRAME_MSG;
+            encode_msg_body(buffer, (MsgFrame*)frame, framed);
             break;
-        case FRAME_PING:
-            frame = malloc(sizeof(PingFrame));
-            frame->type = FRAME_PING;
+        case FRAME_JOIN:
+        case FRAME_LEAVE:
+            encode_room_body(buffer, (RoomFrame*)frame);
+            break;
+        case FRAME_ACK:
+            buffer_append_uint64(buffer, ((AckFrame*)frame)->seq);
             break;
+        case FRAME_HISTORY_REQUEST:
+            buffer_append_uint64(buffer, ((HistoryRequestFrame*)frame)->before);
+            buffer_append_uint16(buffer, ((HistoryRequestFrame*)frame)->count);
+            break;
+        case FRAME_HISTORY_PAGE: {
+            HistoryPageFrame* pageFrame = (HistoryPageFrame*)frame;
+            buffer_append_uint64(buffer, pageFrame->before);
+            buffer_append_uint16(buffer, pageFrame->count);
+            for (uint16_t i = 0; i < pageFrame->count; i++)
+                protocol_frame_encode_version(buffer, (Frame*)pageFrame->messages[i], version);
+            break;
+        }
+        case FRAME_PING:
         case FRAME_PONG:
-            frame = malloc(sizeof(PongFrame));
-            frame->type = FRAME_PONG;
+            buffer_append_uint32(buffer, ((PingFrame*)frame)->lastActive);
+            if (framed) {
+                buffer_append_uint32(buffer, ((PingFrame*)frame)->idle);
+                buffer_append_uint64(buffer, ((PingFrame*)frame)->sent);
+                buffer_append_uint64(buffer, ((PingFrame*)frame)->echo);
+            }
             break;
         default:
-            return NULL;
+            break;
     }
-    return frame;
+    if (framed) {
+        uint32_t length = htonl(buffer->length - lengthOffset - 4);
+        memcpy(buffer->data + lengthOffset, &length, 4);
+    }
+    return 0;
 }
 
-int protocol_frame_write(int socket, Frame* frame) {
-    switch (frame->type) {
+// Whether a frame can be sent to a peer on the given version. Version 1
+// has none of the frame types added with attachment transfers and after,
+// and only 32-bit attachment sizes.
+bool protocol_frame_fits(Frame* frame, uint8_t version) {
+    if (frame->type >= PROTOCOL_FRAME_TYPES)
+        return false;
+    if (version >= 2)
+        return true;
+    if (frame->type >= FRAME_DATA)
+        return false;
+    if (frame->type == FRAME_MSG) {
+        MsgFrame* msgFrame = (MsgFrame*)frame;
+        for (uint8_t i = 0; i < msgFrame->attachmentCount; i++) {
+            if (msgFrame->attachmentSizes[i] > UINT32_MAX)
+                return false;
+        }
+    }
+    return true;
+}
+
+int protocol_frame_encode(Buffer* buffer, Frame* frame) {
+    return protocol_frame_encode_version(buffer, frame, PROTOCOL_VERSION);
+}
+
+// Serialize the frame into the connection's output buffer and send it with a
+// single write, so each frame costs one syscall and goes out as one segment.
+int protocol_frame_write_version(int socket, Buffer* buffer, Frame* frame, uint8_t version) {
+    buffer_clear(buffer);
+    if (protocol_frame_encode_version(buffer, frame, version) < 0)
+        return -1;
+    return buffer_flush(buffer, socket);
+}
+
+int protocol_frame_write(int socket, Buffer* buffer, Frame* frame) {
+    return protocol_frame_write_version(socket, buffer, frame, PROTOCOL_VERSION);
+}
+
+static int decode_ident(const uint8_t* data, size_t length, StringArena* arena, IdentFrame** frame);
+static int decode_msg(const uint8_t* data, size_t length, StringArena* arena, bool extended, MsgFrame** frame);
+static int decode_room(const uint8_t* data, size_t length, StringArena* arena, FrameType type, RoomFrame** frame);
+static int decode_ping(const uint8_t* data, size_t length, FrameType type, bool timed, PingFrame** frame);
+static int decode_ack(const uint8_t* data, size_t length, AckFrame** frame);
+static int decode_history_request(const uint8_t* data, size_t length, HistoryRequestFrame** frame);
+static int decode_history_page(const uint8_t* data, size_t length, StringArena* arena, HistoryPageFrame** frame);
+
+// Decode a version 1 frame, whose size is only known once every field has
+// been parsed
+static int protocol_frame_decode_v1(const uint8_t* data, size_t length, StringArena* arena, Frame** frame) {
+    int result;
+    switch (data[0]) {
         case FRAME_IDENT:
-            return protocol_frame_write_ident(socket, (IdentFrame*)frame);
+            result = decode_ident(data + 1, length - 1, arena, (IdentFrame**)frame);
+            break;
         case FRAME_MSG:
-            return protocol_frame_write_msg(socket, (MsgFrame*)frame);
+            result = decode_msg(data + 1, length - 1, arena, false, (MsgFrame**)frame);
+            break;
         case FRAME_PING:
-            return protocol_frame_write_ping(socket, (PingFrame*)frame);
+            result = protocol_frame_decode_ping(data + 1, length - 1, (PingFrame**)frame);
+            break;
         case FRAME_PONG:
-            return protocol_frame_write_pong(socket, (PongFrame*)frame);
+            result = protocol_frame_decode_pong(data + 1, length - 1, (PongFrame**)frame);
+            break;
         default:
             return -1;
     }
+    return result > 0 ? result + 1 : result;
 }
 
-int protocol_frame_read(int socket, Frame** frame) {
-    uint8_t type;
-    if (read(socket, &type, 1) != 1)
+// Size of the frame at the start of a region, 0 if the region holds only
+// part of it and -1 if it can never fit in a receive buffer. Version 2
+// frames are measured from their header alone.
+int protocol_frame_size(const uint8_t* data, size_t length, uint8_t version) {
+    if (length < 1)
+        return 0;
+    if (version < 2 || data[0] == FRAME_IDENT) {
+        Frame* frame;
+        int result = protocol_frame_decode_v1(data, length, NULL, &frame);
+        if (result > 0)
+            protocol_frame_free(frame);
+        return result;
+    }
+    if (length < PROTOCOL_HEADER_SIZE)
+        return 0;
+    uint32_t bodyLength;
+    memcpy(&bodyLength, data + 1, 4);
+    bodyLength = ntohl(bodyLength);
+    if (bodyLength > PROTOCOL_READ_BUFFER_SIZE - PROTOCOL_HEADER_SIZE)
         return -1;
+    return length - PROTOCOL_HEADER_SIZE >= bodyLength ? (int)(PROTOCOL_HEADER_SIZE + bodyLength) : 0;
+}
+
+// Decode one frame from the start of a contiguous region. Returns the number
+// of bytes the frame occupies, 0 if the region holds only part of a frame
+// and -1 if the bytes are not a valid frame. Version 2 frames of a type this
+// build does not know are skipped: their size is returned with the frame set
+// to NULL. Compressed frames are inflated through the connection's stream,
+// and skipped if there is none. With an arena, the frame's strings are
+// placed in it and released when it is reset rather than by
+// protocol_frame_free.
+int protocol_frame_decode_arena(const uint8_t* data, size_t length, uint8_t version, CompressStream* stream, StringArena* arena, Frame** frame) {
+    if (length < 1)
+        return 0;
+    if (version < 2 || data[0] == FRAME_IDENT)
+        return protocol_frame_decode_v1(data, length, arena, frame);
+
+    int size = protocol_frame_size(data, length, version);
+    if (size <= 0)
+        return size;
+    *frame = NULL;
+    uint8_t type = data[0];
+    const uint8_t* body = data + PROTOCOL_HEADER_SIZE;
+    size_t bodyLength = size - PROTOCOL_HEADER_SIZE;
+    if (type & PROTOCOL_COMPRESSED) {
+        if (stream == NULL)
+            return size;
+        if (bodyLength < 4)
+            return -1;
+        Cursor cursor = { body, bodyLength, 0 };
+        size_t rawLength = cursor_uint32(&cursor);
+        if (rawLength > PROTOCOL_READ_BUFFER_SIZE)
+            return -1;
+        body = decompress_block(stream, type & PROTOCOL_DICTIONARY, body + 4, bodyLength - 4, rawLength);
+        if (body == NULL)
+            return -1;
+        bodyLength = rawLength;
+        type &= ~(PROTOCOL_COMPRESSED | PROTOCOL_DICTIONARY);
+    }
+    if (type == FRAME_IDENT || type >= PROTOCOL_FRAME_TYPES)
+        return size;
+
+    // The header already guarantees the whole body is here, so a body that
+    // still looks incomplete is malformed. Bytes after the known fields are
+    // ignored, leaving room to extend a frame type.
+    int result;
     switch (type) {
-        case FRAME_IDENT:
-            return protocol_frame_read_ident(socket, (IdentFrame**)frame);
-        case FRAME_MSG: 
-            return protocol_frame_read_msg(socket, (MsgFrame**)frame);
+        case FRAME_MSG:
+            result = decode_msg(body, bodyLength, arena, true, (MsgFrame**)frame);
+            break;
         case FRAME_PING:
-            return protocol_frame_read_ping(socket, (PingFrame**)frame);
         case FRAME_PONG:
-            return protocol_frame_read_pong(socket, (PongFrame**)frame);
+            result = decode_ping(body, bodyLength, type, true, (PingFrame**)frame);
+            break;
+        case FRAME_JOIN:
+        case FRAME_LEAVE:
+            result = decode_room(body, bodyLength, arena, type, (RoomFrame**)frame);
+            break;
+        case FRAME_ACK:
+            result = decode_ack(body, bodyLength, (AckFrame**)frame);
+            break;
+        case FRAME_HISTORY_REQUEST:
+            result = decode_history_request(body, bodyLength, (HistoryRequestFrame**)frame);
+            break;
+        case FRAME_HISTORY_PAGE:
+            result = decode_history_page(body, bodyLength, arena, (HistoryPageFrame**)frame);
+            break;
         default:
+            result = protocol_frame_decode_data(body, bodyLength, (DataFrame**)frame);
+            break;
+    }
+    return result > 0 ? size : -1;
+}
+
+int protocol_frame_decode_stream(const uint8_t* data, size_t length, uint8_t version, CompressStream* stream, Frame** frame) {
+    return protocol_frame_decode_arena(data, length, version, stream, NULL, frame);
+}
+
+int protocol_frame_decode_version(const uint8_t* data, size_t length, uint8_t version, Frame** frame) {
+    return protocol_frame_decode_stream(data, length, version, NULL, frame);
+}
+
+int protocol_frame_decode(const uint8_t* data, size_t length, Frame** frame) {
+    return protocol_frame_decode_stream(data, length, PROTOCOL_VERSION, NULL, frame);
+}
+
+// Read the next frame from a socket. Frames already buffered in the ring are
+// returned without touching the socket; otherwise as much as is available is
+// received with one recv and partial frames are kept for the next call.
+int protocol_frame_read_arena(int socket, RingBuffer* ring, uint8_t version, CompressStream* stream, StringArena* arena, Frame** frame) {
+    while (true) {
+        int result = protocol_frame_decode_arena(ringbuffer_read_ptr(ring), ringbuffer_used(ring), version, stream, arena, frame);
+        if (result > 0) {
+            ringbuffer_consume(ring, result);
+            if (*frame != NULL) {
+                metrics_frame_in((*frame)->type, result);
+                return 0;
+            }
+            continue;
+        }
+        if (result < 0)
+            return -1;
+        if (ringbuffer_fill(ring, socket) <= 0)
             return -1;
     }
 }
 
+int protocol_frame_read_version(int socket, RingBuffer* ring, uint8_t version, CompressStream* stream, Frame** frame) {
+    return protocol_frame_read_arena(socket, ring, version, stream, NULL, frame);
+}
+
+int protocol_frame_read(int socket, RingBuffer* ring, Frame** frame) {
+    return protocol_frame_read_version(socket, ring, PROTOCOL_VERSION, NULL, frame);
+}
+
+// Rewrite version 2 frames for a peer on an older version. Pings and pongs
+// only lose the length header and the fields version 2 appended; messages,
+// whose fields changed, are decoded and encoded again. Frames the peer
+// would not understand are dropped.
+int protocol_frames_convert(Buffer* buffer, const uint8_t* data, size_t length, uint8_t version) {
+    size_t offset = 0;
+    while (offset < length) {
+        int size = protocol_frame_size(data + offset, length - offset, PROTOCOL_VERSION);
+        if (size <= 0)
+            return -1;
+        const uint8_t* frame = data + offset;
+        offset += size;
+        if (version >= 2 || frame[0] == FRAME_IDENT) {
+            buffer_append(buffer, frame, size);
+        } else if (frame[0] < FRAME_DATA) {
+            size_t fields = size - PROTOCOL_HEADER_SIZE;
+            if (frame[0] == FRAME_MSG) {
+                MsgFrame* message;
+                if (decode_msg(frame + PROTOCOL_HEADER_SIZE, fields, NULL, true, &message) <= 0)
+                    return -1;
+                // Messages with attachments too large to announce are left out
+                if (protocol_frame_fits((Frame*)message, version))
+                    protocol_frame_encode_version(buffer, (Frame*)message, version);
+                protocol_frame_free((Frame*)message);
+                continue;
+            }
+            if ((frame[0] == FRAME_PING || frame[0] == FRAME_PONG) && fields > 4)
+                fields = 4;
+            buffer_append_uint8(buffer, frame[0]);
+            buffer_append(buffer, frame + PROTOCOL_HEADER_SIZE, fields);
+        }
+    }
+    return 0;
+}
+
 /*
-* Ident frame format:
-* 1 byte: frame type (0)
-* 1 byte: name length
-* name length bytes: name
+* Compressed frame format, version 2 only:
+* 1 byte: frame type | PROTOCOL_COMPRESSED, plus PROTOCOL_DICTIONARY when
+*         compressed against earlier frames
+* 4 bytes: length of the rest of the frame
+* 4 bytes: length of the fields once decompressed
+* the rest: the compressed fields
 */
-int protocol_frame_write_ident(int socket, IdentFrame* frame) {
-    uint8_t type = FRAME_IDENT;
-    if (write(socket, &type, 1) != 1)
-        return -1;
-    uint8_t nameLength = frame->name.length;
-    if (write(socket, &nameLength, 1) != 1)
-        return -1;
-    if (write(socket, frame->name.data, nameLength) != nameLength)
-        return -1;
+
+// Append version 2 frames, compressing those large enough to be worth it.
+// When streaming, chat frames are compressed against the earlier ones on
+// the connection, which is what makes short repetitive messages shrink;
+// attachment chunks, often already compressed, are always compressed on
+// their own and sent as they are if that does not help. Without streaming
+// the output can be shared by any number of connections.
+int protocol_frames_compress(Buffer* buffer, const uint8_t* data, size_t length, CompressStream* stream, bool streaming) {
+    size_t offset = 0;
+    while (offset < length) {
+        int size = protocol_frame_size(data + offset, length - offset, PROTOCOL_VERSION);
+        if (size <= 0)
+            return -1;
+        const uint8_t* frame = data + offset;
+        offset += size;
+        if (frame[0] == FRAME_IDENT || frame[0] & PROTOCOL_COMPRESSED || size < PROTOCOL_COMPRESS_MIN_SIZE) {
+            buffer_append(buffer, frame, size);
+            continue;
+        }
+
+        size_t bodyLength = size - PROTOCOL_HEADER_SIZE;
+        bool keep = streaming && frame[0] != FRAME_DATA;
+        buffer_reserve(buffer, PROTOCOL_HEADER_SIZE + 4 + compress_bound(bodyLength));
+        size_t start = buffer->length;
+        size_t compressed = compress_block(stream, keep, frame + PROTOCOL_HEADER_SIZE, bodyLength, buffer->data + start + PROTOCOL_HEADER_SIZE + 4);
+        // A kept block is part of the peer's window from now on, so it has
+        // to be sent compressed even if it did not shrink
+        if (!keep && compressed + 4 >= bodyLength) {
+            buffer_append(buffer, frame, size);
+            continue;
+        }
+        buffer_append_uint8(buffer, frame[0] | PROTOCOL_COMPRESSED | (keep ? PROTOCOL_DICTIONARY : 0));
+        buffer_append_uint32(buffer, 4 + compressed);
+        buffer_append_uint32(buffer, bodyLength);
+        buffer->length += compressed;
+    }
     return 0;
 }
 
-int protocol_frame_read_ident(int socket, IdentFrame** frame) {
-    uint8_t nameLength;
-    if (read(socket, &nameLength, 1) != 1)
-        return -1;
-    *frame = malloc(sizeof(IdentFrame));
-    (*frame)->type = FRAME_IDENT;
-    (*frame)->name = string_new(nameLength);
-    if (read(socket, (*frame)->name.data, nameLength) != nameLength)
-        return -1;
-    (*frame)->name.length = nameLength;
-    return 0;
+/*
+* Ident frame format, the same in every version:
+* 1 byte: frame type (0)
+* 1 byte: name field length
+* name field length bytes:
+*   name, then a NUL byte
+*   1 byte: protocol version
+*   4 bytes: capability flags
+*   8 bytes: sequence number of the last message the sender has
+*   8 bytes: session of a client
+*   2 bytes: rooms a client joins again right after
+* A version 1 peer sends only the name and reads the rest as part of it,
+* which is harmless since the name is used as a C string.
+*/
+static void encode_ident_body(Buffer* buffer, IdentFrame* frame) {
+    uint8_t nameLength = frame->name.length < PROTOCOL_MAX_NAME_LENGTH ? frame->name.length : PROTOCOL_MAX_NAME_LENGTH;
+    buffer_reserve(buffer, 1 + nameLength + 24);
+    buffer_append_uint8(buffer, nameLength + 24);
+    buffer_append(buffer, string_data(&frame->name), nameLength);
+    buffer_append_uint8(buffer, '\0');
+    buffer_append_uint8(buffer, frame->version);
+    buffer_append_uint32(buffer, frame->capabilities);
+    buffer_append_uint64(buffer, frame->seq);
+    buffer_append_uint64(buffer, frame->session);
+    buffer_append_uint16(buffer, frame->rooms);
+}
+
+int protocol_frame_encode_ident(Buffer* buffer, IdentFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
+
+int protocol_frame_write_ident(int socket, Buffer* buffer, IdentFrame* frame) {
+    return protocol_frame_write(socket, buffer, (Frame*)frame);
+}
+
+int protocol_frame_decode_ident(const uint8_t* data, size_t length, IdentFrame** frame) {
+    return decode_ident(data, length, NULL, frame);
+}
+
+static int decode_ident(const uint8_t* data, size_t length, StringArena* arena, IdentFrame** frame) {
+    Cursor cursor = { data, length, 0, arena };
+    if (!cursor_has(&cursor, 1))
+        return 0;
+    uint8_t fieldLength = cursor_uint8(&cursor);
+    if (!cursor_has(&cursor, fieldLength))
+        return 0;
+    const uint8_t* field = cursor.data + cursor.offset;
+    const uint8_t* end = memchr(field, '\0', fieldLength);
+    size_t nameLength = end != NULL ? (size_t)(end - field) : fieldLength;
+
+    *frame = (IdentFrame*)frame_alloc(FRAME_IDENT);
+    (*frame)->name = cursor_string(&cursor, nameLength);
+    (*frame)->version = 1;
+    (*frame)->capabilities = 0;
+    (*frame)->seq = 0;
+    (*frame)->session = 0;
+    (*frame)->rooms = 0;
+    if (fieldLength - nameLength >= 6) {
+        cursor.offset++;
+        (*frame)->version = cursor_uint8(&cursor);
+        (*frame)->capabilities = cursor_uint32(&cursor);
+        if ((*frame)->version < 1)
+            (*frame)->version = 1;
+        if (fieldLength - nameLength >= 14)
+            (*frame)->seq = cursor_uint64(&cursor);
+        if (fieldLength - nameLength >= 22)
+            (*frame)->session = cursor_uint64(&cursor);
+        if (fieldLength - nameLength >= 24)
+            (*frame)->rooms = cursor_uint16(&cursor);
+    }
+    return 1 + fieldLength;
 }
 
 /*
 * Msg frame format:
 * 1 byte: frame type (1)
+* Version 2 only, since older peers take every message for the other side's:
+* 1 byte: sender name length (empty when sent by a client, filled in by
+*         the server when it relays the message)
+* sender name length bytes: sender name
+* In every version:
 * 2 bytes: content length
 * 1 byte: attachment count
 * for each attachment:
 * 1 byte: attachment name length
 * attachment name length bytes: attachment name
-* 4 bytes: attachment size
+* 4 bytes: attachment size in version 1, which cannot announce files of
+*          4 GB or more and never sends their contents; in version 2:
+* 8 bytes: attachment size
+* 4 bytes: transfer id, matched by the data frames carrying the attachment
 * content length bytes: content
+* Version 2 adds, only when the message was posted to a room or numbered:
+* 1 byte: room name length, 0 for everyone
+* room name length bytes: room name
+* 8 bytes: sequence number given by the server, left out until it has one
 */
-int protocol_frame_write_msg(int socket, MsgFrame* frame) {
-    uint8_t type = FRAME_MSG;
-    if (write(socket, &type, 1) != 1)
-        return -1;
+static void encode_msg_body(Buffer* buffer, MsgFrame* frame, bool extended) {
     uint16_t contentLength = frame->content.length;
-    int result;
-    if ((result = write_uint16(socket, contentLength)) < 0)
-        return result;
+    uint8_t senderLength = extended ? frame->sender.length : 0;
     uint8_t attachmentCount = frame->attachmentCount;
-    if (write(socket, &attachmentCount, 1) != 1)
-        return -1;
+    uint8_t roomLength = 0;
+    if (extended)
+        roomLength = frame->room.length < PROTOCOL_MAX_ROOM_LENGTH ? frame->room.length : PROTOCOL_MAX_ROOM_LENGTH;
+    bool trailer = roomLength > 0 || (extended && frame->seq != 0);
+    size_t size = (extended ? 4 : 3) + senderLength + contentLength + (trailer ? 9 + roomLength : 0);
+    for (uint8_t i = 0; i < attachmentCount; i++)
+        size += (extended ? 13 : 5) + (uint8_t)frame->attachmentNames[i].length;
+    buffer_reserve(buffer, size);
+
+    if (extended) {
+        buffer_append_uint8(buffer, senderLength);
+        buffer_append(buffer, string_data(&frame->sender), senderLength);
+    }
+    buffer_append_uint16(buffer, contentLength);
+    buffer_append_uint8(buffer, attachmentCount);
     for (uint8_t i = 0; i < attachmentCount; i++) {
         uint8_t attachmentNameLength = frame->attachmentNames[i].length;
-        if (write(socket, &attachmentNameLength, 1) != 1)
-            return -1;
-        if (write(socket, frame->attachmentNames[i].data, attachmentNameLength) != attachmentNameLength)
-            return -1;
-        if ((result = write_uint32(socket, frame->attachmentSizes[i])) < 0)
-            return result;
+        buffer_append_uint8(buffer, attachmentNameLength);
+        buffer_append(buffer, string_data(&frame->attachmentNames[i]), attachmentNameLength);
+        if (extended) {
+            buffer_append_uint64(buffer, frame->attachmentSizes[i]);
+            buffer_append_uint32(buffer, frame->attachmentIds[i]);
+        } else {
+            buffer_append_uint32(buffer, frame->attachmentSizes[i]);
+        }
+    }
+    buffer_append(buffer, string_data(&frame->content), contentLength);
+    if (trailer) {
+        buffer_append_uint8(buffer, roomLength);
+        buffer_append(buffer, string_data(&frame->room), roomLength);
+        if (frame->seq != 0)
+            buffer_append_uint64(buffer, frame->seq);
     }
-    if (write(socket, frame->content.data, contentLength) != contentLength)
-        return -1;
-    return 0;
 }
 
-#include <stdio.h>
+int protocol_frame_encode_msg(Buffer* buffer, MsgFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
 
-int protocol_frame_read_msg(int socket, MsgFrame** frame) {
-    uint16_t contentLength;
-    int result;
-    if ((result = read_uint16(socket, &contentLength)) < 0)
-        return result;
-    uint8_t attachmentCount;
-    if (read(socket, &attachmentCount, 1) != 1)
-        return -1;
-    *frame = malloc(sizeof(MsgFrame));
-    (*frame)->type = FRAME_MSG;
-    (*frame)->content = string_new(contentLength);
-    (*frame)->attachmentCount = attachmentCount;
-    (*frame)->attachmentNames = malloc(sizeof(String) * attachmentCount);
-    (*frame)->attachmentSizes = malloc(sizeof(uint32_t) * attachmentCount);
+int protocol_frame_write_msg(int socket, Buffer* buffer, MsgFrame* frame) {
+    return protocol_frame_write(socket, buffer, (Frame*)frame);
+}
+
+// Set the number of a message frame encoded in the current version with a
+// number already, in place. The number is always its last 8 bytes, so a
+// message can be encoded before it is numbered.
+void protocol_frame_number(uint8_t* data, size_t length, uint64_t seq) {
+    for (int i = 0; i < 8; i++)
+        data[length - 1 - i] = seq >> (8 * i);
+}
+
+int protocol_frame_decode_msg(const uint8_t* data, size_t length, MsgFrame** frame) {
+    return decode_msg(data, length, NULL, false, frame);
+}
+
+// Size of a message's fields through its content, laid out as in version 2
+// when extended, 0 if they are not all there
+static int measure_msg(const uint8_t* data, size_t length, bool extended) {
+    Cursor cursor = { data, length, 0 };
+    uint8_t senderLength = 0;
+    if (extended) {
+        if (!cursor_has(&cursor, 1))
+            return 0;
+        senderLength = cursor_uint8(&cursor);
+    }
+    if (!cursor_has(&cursor, senderLength + 3))
+        return 0;
+    cursor.offset += senderLength;
+    uint16_t contentLength = cursor_uint16(&cursor);
+    uint8_t attachmentCount = cursor_uint8(&cursor);
     for (uint8_t i = 0; i < attachmentCount; i++) {
-        uint8_t attachmentNameLength;
-        if (read(socket, &attachmentNameLength, 1) != 1)
-            return -1;
-        (*frame)->attachmentNames[i] = string_new(attachmentNameLength);
-        if (read(socket, (*frame)->attachmentNames[i].data, attachmentNameLength) != attachmentNameLength)
-            return -1;
-        if ((result = read_uint32(socket, &(*frame)->attachmentSizes[i])) < 0)
-            return result;
+        if (!cursor_has(&cursor, 1))
+            return 0;
+        uint8_t attachmentNameLength = cursor_uint8(&cursor);
+        size_t attachmentLength = attachmentNameLength + (extended ? 12 : 4);
+        if (!cursor_has(&cursor, attachmentLength))
+            return 0;
+        cursor.offset += attachmentLength;
     }
-    if (read(socket, (*frame)->content.data, contentLength) != contentLength)
-        return -1;
-    (*frame)->content.data[contentLength] = '\0';
-    (*frame)->content.length = contentLength;
+    if (!cursor_has(&cursor, contentLength))
+        return 0;
+    return cursor.offset + contentLength;
+}
+
+// Decode a message. The sender is only read from version 2 bodies, and so
+// are the room and sequence number, since their length is known; in
+// version 1 the next frame follows the content.
+static int decode_msg(const uint8_t* data, size_t length, StringArena* arena, bool extended, MsgFrame** frame) {
+    // Make sure the whole frame is buffered before allocating anything
+    int size = measure_msg(data, length, extended);
+    if (size <= 0)
+        return size;
+    Cursor cursor = { data, length, 0, arena };
+    *frame = (MsgFrame*)frame_alloc(FRAME_MSG);
+    (*frame)->sender = string_new_static("");
+    if (extended) {
+        uint8_t senderLength = cursor_uint8(&cursor);
+        (*frame)->sender = cursor_string(&cursor, senderLength);
+    }
+    uint16_t contentLength = cursor_uint16(&cursor);
+    uint8_t attachmentCount = cursor_uint8(&cursor);
+    protocol_frame_attachments(*frame, attachmentCount);
+    for (uint8_t i = 0; i < attachmentCount; i++) {
+        uint8_t attachmentNameLength = cursor_uint8(&cursor);
+        (*frame)->attachmentNames[i] = cursor_string(&cursor, attachmentNameLength);
+        (*frame)->attachmentSizes[i] = extended ? cursor_uint64(&cursor) : cursor_uint32(&cursor);
+        (*frame)->attachmentIds[i] = extended ? cursor_uint32(&cursor) : 0;
+    }
+    (*frame)->content = cursor_string(&cursor, contentLength);
+    (*frame)->room = string_new_static("");
+    (*frame)->seq = 0;
+    if (extended && cursor_has(&cursor, 1)) {
+        uint8_t roomLength = cursor.data[cursor.offset];
+        if (cursor_has(&cursor, 1 + roomLength)) {
+            cursor.offset++;
+            if (roomLength > 0)
+                (*frame)->room = cursor_string(&cursor, roomLength);
+            if (cursor_has(&cursor, 8))
+                (*frame)->seq = cursor_uint64(&cursor);
+        }
+    }
+    return cursor.offset;
+}
+
+/*
+* Join and leave frame format, version 2 only:
+* 1 byte: frame type (5 to join, 6 to leave)
+* 4 bytes: length of the rest of the frame
+* 1 byte: room name length
+* room name length bytes: room name
+*/
+static void encode_room_body(Buffer* buffer, RoomFrame* frame) {
+    uint8_t roomLength = frame->room.length < PROTOCOL_MAX_ROOM_LENGTH ? frame->room.length : PROTOCOL_MAX_ROOM_LENGTH;
+    buffer_reserve(buffer, 1 + roomLength);
+    buffer_append_uint8(buffer, roomLength);
+    buffer_append(buffer, string_data(&frame->room), roomLength);
+}
+
+int protocol_frame_encode_room(Buffer* buffer, RoomFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
+
+int protocol_frame_decode_room(const uint8_t* data, size_t length, FrameType type, RoomFrame** frame) {
+    return decode_room(data, length, NULL, type, frame);
+}
+
+static int decode_room(const uint8_t* data, size_t length, StringArena* arena, FrameType type, RoomFrame** frame) {
+    Cursor cursor = { data, length, 0, arena };
+    if (!cursor_has(&cursor, 1))
+        return 0;
+    uint8_t roomLength = cursor_uint8(&cursor);
+    if (!cursor_has(&cursor, roomLength))
+        return 0;
+    *frame = (RoomFrame*)frame_alloc(type);
+    (*frame)->room = cursor_string(&cursor, roomLength);
+    return cursor.offset;
+}
+
+/*
+* Ack frame format, version 2 only:
+* 1 byte: frame type (7)
+* 4 bytes: length of the rest of the frame
+* 8 bytes: sequence number of the last message received
+*/
+int protocol_frame_encode_ack(Buffer* buffer, AckFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
+
+int protocol_frame_decode_ack(const uint8_t* data, size_t length, AckFrame** frame) {
+    return decode_ack(data, length, frame);
+}
+
+static int decode_ack(const uint8_t* data, size_t length, AckFrame** frame) {
+    Cursor cursor = { data, length, 0 };
+    if (!cursor_has(&cursor, 8))
+        return 0;
+    *frame = (AckFrame*)frame_alloc(FRAME_ACK);
+    (*frame)->seq = cursor_uint64(&cursor);
+    return cursor.offset;
+}
+
+/*
+* History request frame format, version 2 only:
+* 1 byte: frame type (8)
+* 4 bytes: length of the rest of the frame
+* 8 bytes: sequence number the messages asked for come before
+* 2 bytes: most messages to send
+*/
+int protocol_frame_encode_history_request(Buffer* buffer, HistoryRequestFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
+
+int protocol_frame_decode_history_request(const uint8_t* data, size_t length, HistoryRequestFrame** frame) {
+    return decode_history_request(data, length, frame);
+}
+
+static int decode_history_request(const uint8_t* data, size_t length, HistoryRequestFrame** frame) {
+    Cursor cursor = { data, length, 0 };
+    if (!cursor_has(&cursor, 10))
+        return 0;
+    *frame = (HistoryRequestFrame*)frame_alloc(FRAME_HISTORY_REQUEST);
+    (*frame)->before = cursor_uint64(&cursor);
+    (*frame)->count = cursor_uint16(&cursor);
+    return cursor.offset;
+}
+
+/*
+* History page frame format, version 2 only:
+* 1 byte: frame type (9)
+* 4 bytes: length of the rest of the frame
+* 8 bytes: sequence number from the request
+* 2 bytes: message count
+* the messages, oldest first, each a whole version 2 msg frame
+*/
+// Encode the header and count of a page whose messages, already encoded
+// as length bytes of frames, the caller appends straight after
+int protocol_frame_encode_history_page_header(Buffer* buffer, uint64_t before, uint16_t count, size_t length) {
+    buffer_reserve(buffer, PROTOCOL_HEADER_SIZE + 10 + length);
+    buffer_append_uint8(buffer, FRAME_HISTORY_PAGE);
+    buffer_append_uint32(buffer, 10 + length);
+    buffer_append_uint64(buffer, before);
+    buffer_append_uint16(buffer, count);
     return 0;
 }
 
+int protocol_frame_decode_history_page(const uint8_t* data, size_t length, HistoryPageFrame** frame) {
+    return decode_history_page(data, length, NULL, frame);
+}
+
+static int decode_history_page(const uint8_t* data, size_t length, StringArena* arena, HistoryPageFrame** frame) {
+    Cursor cursor = { data, length, 0, arena };
+    if (!cursor_has(&cursor, 10))
+        return 0;
+    uint64_t before = cursor_uint64(&cursor);
+    uint16_t count = cursor_uint16(&cursor);
+    MsgFrame** messages = count > 0 ? malloc(count * sizeof(MsgFrame*)) : NULL;
+    // Each message is read from its header straight into decode_msg, so a
+    // page can only nest plain msg frames and never another page
+    for (uint16_t i = 0; i < count; i++) {
+        uint32_t bodyLength = 0;
+        bool valid = cursor_has(&cursor, PROTOCOL_HEADER_SIZE) && cursor_uint8(&cursor) == FRAME_MSG;
+        if (valid) {
+            bodyLength = cursor_uint32(&cursor);
+            valid = cursor_has(&cursor, bodyLength)
+                && decode_msg(data + cursor.offset, bodyLength, arena, true, &messages[i]) > 0;
+        }
+        if (!valid) {
+            while (i > 0)
+                protocol_frame_free((Frame*)messages[--i]);
+            free(messages);
+            return -1;
+        }
+        cursor.offset += bodyLength;
+    }
+    *frame = (HistoryPageFrame*)frame_alloc(FRAME_HISTORY_PAGE);
+    (*frame)->before = before;
+    (*frame)->count = count;
+    (*frame)->messages = messages;
+    return cursor.offset;
+}
+
 /*
 * Ping frame format:
 * 1 byte: frame type (2)
 * 4 bytes: last active timestamp
+* Version 2 adds:
+* 4 bytes: milliseconds since the last input
+* 8 bytes: monotonic send time in nanoseconds
+* 8 bytes: send time of the ping being answered, 0 in a ping
+*
+* Pong frames (3) have the same fields.
 */
-int protocol_frame_write_ping(int socket, PingFrame* frame) {
-    uint8_t type = FRAME_PING;
-    if (write(socket, &type, 1) != 1)
-        return -1;
-    return write_uint32(socket, frame->lastActive);
+int protocol_frame_encode_ping(Buffer* buffer, PingFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
+
+int protocol_frame_write_ping(int socket, Buffer* buffer, PingFrame* frame) {
+    return protocol_frame_write(socket, buffer, (Frame*)frame);
+}
+
+// Decode a ping or pong body. The timestamps are only read from version 2
+// bodies, and left at 0 when an older version 2 peer did not send them.
+static int decode_ping(const uint8_t* data, size_t length, FrameType type, bool timed, PingFrame** frame) {
+    Cursor cursor = { data, length, 0 };
+    if (!cursor_has(&cursor, 4))
+        return 0;
+    *frame = (PingFrame*)frame_alloc(type);
+    (*frame)->lastActive = cursor_uint32(&cursor);
+    (*frame)->idle = 0;
+    (*frame)->sent = 0;
+    (*frame)->echo = 0;
+    if (timed && cursor_has(&cursor, 20)) {
+        (*frame)->idle = cursor_uint32(&cursor);
+        (*frame)->sent = cursor_uint64(&cursor);
+        (*frame)->echo = cursor_uint64(&cursor);
+    }
+    return cursor.offset;
 }
 
-int protocol_frame_read_ping(int socket, PingFrame** frame) {
-    *frame = malloc(sizeof(PingFrame));
-    (*frame)->type = FRAME_PING;
-    return read_uint32(socket, &(*frame)->lastActive);
+int protocol_frame_decode_ping(const uint8_t* data, size_t length, PingFrame** frame) {
+    return decode_ping(data, length, FRAME_PING, false, frame);
+}
+
+int protocol_frame_encode_pong(Buffer* buffer, PongFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
+}
+
+int protocol_frame_write_pong(int socket, Buffer* buffer, PongFrame* frame) {
+    return protocol_frame_write(socket, buffer, (Frame*)frame);
+}
+
+int protocol_frame_decode_pong(const uint8_t* data, size_t length, PongFrame** frame) {
+    return decode_ping(data, length, FRAME_PONG, false, frame);
 }
 
 /*
-* Pong frame format:
-* 1 byte: frame type (3)
-* 4 bytes: last active timestamp
+* Data frame format, version 2 only:
+* 1 byte: frame type (4)
+* 4 bytes: length of the rest of the frame
+* 4 bytes: transfer id
+* 4 bytes: data length
+* data length bytes: data
 */
-int protocol_frame_write_pong(int socket, PongFrame* frame) {
-    uint8_t type = FRAME_PONG;
-    if (write(socket, &type, 1) != 1)
-        return -1;
-    return write_uint32(socket, frame->lastActive);
+// Encode everything but the payload, which the caller sends straight after
+int protocol_frame_encode_data_header(Buffer* buffer, uint8_t version, uint32_t transferId, uint32_t length) {
+    buffer_reserve(buffer, PROTOCOL_HEADER_SIZE + 8);
+    buffer_append_uint8(buffer, FRAME_DATA);
+    if (version >= 2)
+        buffer_append_uint32(buffer, 8 + length);
+    buffer_append_uint32(buffer, transferId);
+    buffer_append_uint32(buffer, length);
+    return 0;
+}
+
+int protocol_frame_encode_data(Buffer* buffer, DataFrame* frame) {
+    return protocol_frame_encode(buffer, (Frame*)frame);
 }
 
-int protocol_frame_read_pong(int socket, PongFrame** frame) {
-    *frame = malloc(sizeof(PongFrame));
-    (*frame)->type = FRAME_PONG;
-    return read_uint32(socket, &(*frame)->lastActive);
+int protocol_frame_decode_data(const uint8_t* data, size_t length, DataFrame** frame) {
+    Cursor cursor = { data, length, 0 };
+    if (!cursor_has(&cursor, 8))
+        return 0;
+    uint32_t transferId = cursor_uint32(&cursor);
+    uint32_t dataLength = cursor_uint32(&cursor);
+    if (dataLength > PROTOCOL_MAX_DATA_LENGTH)
+        return -1;
+    if (!cursor_has(&cursor, dataLength))
+        return 0;
+    *frame = (DataFrame*)frame_alloc(FRAME_DATA);
+    (*frame)->transferId = transferId;
+    (*frame)->length = dataLength;
+    (*frame)->data = data + cursor.offset;
+    return cursor.offset + dataLength;
 }
 
 void protocol_frame_free(Frame* frame) {
@@ -244,17 +1045,33 @@ void protocol_frame_free(Frame* frame) {
             break;
         case FRAME_MSG: {
             MsgFrame* msgFrame = (MsgFrame*)frame;
+            string_free(&msgFrame->sender);
             string_free(&msgFrame->content);
+            string_free(&msgFrame->room);
             for (uint8_t i = 0; i < msgFrame->attachmentCount; i++) {
                 string_free(&msgFrame->attachmentNames[i]);
             }
-            free(msgFrame->attachmentNames);
-            free(msgFrame->attachmentSizes);
+            if (msgFrame->attachmentCount > 0)
+                pool_put(&pool.attachments[attachment_class(msgFrame->attachmentCount)], msgFrame->attachmentNames);
+            break;
+        }
+        case FRAME_JOIN:
+        case FRAME_LEAVE:
+            string_free(&((RoomFrame*)frame)->room);
+            break;
+        case FRAME_HISTORY_PAGE: {
+            HistoryPageFrame* pageFrame = (HistoryPageFrame*)frame;
+            for (uint16_t i = 0; i < pageFrame->count; i++)
+                protocol_frame_free((Frame*)pageFrame->messages[i]);
+            free(pageFrame->messages);
             break;
         }
         case FRAME_PING:
         case FRAME_PONG:
+        case FRAME_DATA:
+        case FRAME_ACK:
+        case FRAME_HISTORY_REQUEST:
             break;
     }
-    free(frame);
+    pool_put(&pool.frames[frame->type], frame);
 }
@@ -6,18 +6,66 @@
 // Description: This file contains the definitions for the chat protocol.
 
 #pragma once
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include "string.h"
+#include "buffer.h"
+#include "ringbuffer.h"
+#include "compress.h"
+
+// Large enough to hold the biggest frame the protocol can describe
+#define PROTOCOL_READ_BUFFER_SIZE (256 * 1024)
+// Largest attachment chunk a data frame may carry
+#define PROTOCOL_MAX_DATA_LENGTH (128 * 1024)
+// Version spoken by this build. Peers settle on the lower of their two
+// versions when they exchange ident frames.
+#define PROTOCOL_VERSION 2
+// Type and length that start every version 2 frame
+#define PROTOCOL_HEADER_SIZE 5
+// Longest name that leaves room for the version, capabilities, sequence
+// number, session and room count in the ident frame
+#define PROTOCOL_MAX_NAME_LENGTH 231
+// Longest room name; messages without one go to every client
+#define PROTOCOL_MAX_ROOM_LENGTH 64
+
+// Capability flags exchanged in ident frames
+#define PROTOCOL_CAP_COMPRESSION 1
+
+// Set in the type byte of a version 2 frame whose fields are compressed,
+// and also the dictionary flag when it was compressed against earlier
+// frames on the connection
+#define PROTOCOL_COMPRESSED 0x80
+#define PROTOCOL_DICTIONARY 0x40
+// Frames smaller than this are sent as they are
+#define PROTOCOL_COMPRESS_MIN_SIZE 64
+
+// Freed frames of each type, and attachment arrays of each size, that a
+// thread keeps for reuse
+#define PROTOCOL_POOL_LIMIT 64
+// Attachment arrays are pooled by count rounded up to a power of two, up
+// to the 255 a message can carry
+#define PROTOCOL_POOL_CLASSES 9
 
 typedef enum {
     FRAME_IDENT = 0,
     FRAME_MSG = 1,
     FRAME_PING = 2,
     FRAME_PONG = 3,
+    // Version 2 only
+    FRAME_DATA = 4,
+    FRAME_JOIN = 5,
+    FRAME_LEAVE = 6,
+    FRAME_ACK = 7,
+    FRAME_HISTORY_REQUEST = 8,
+    FRAME_HISTORY_PAGE = 9,
 } FrameType;
 
+#define PROTOCOL_FRAME_TYPES (FRAME_HISTORY_PAGE + 1)
+// Most messages one history page may ask for
+#define PROTOCOL_MAX_PAGE_MESSAGES 256
+
 typedef struct {
     FrameType type;
 } Frame;
@@ -25,32 +73,129 @@ typedef struct {
 typedef struct {
     FrameType type;
     String name;
+    // Highest version the sender speaks, 1 for peers that predate it
+    uint8_t version;
+    uint32_t capabilities;
+    // Sequence number of the last message the sender has: from a client, the
+    // point to resume a lost session from, 0 for a new one; from the server,
+    // the last message it numbered
+    uint64_t seq;
+    // Random number a client keeps across reconnects, which tells its own
+    // messages apart when the server replays what it missed; 0 from the
+    // server and from peers that do not send one
+    uint64_t session;
+    // Rooms a client joins again in the frames right after its ident, which
+    // the server waits for before replaying what the client missed
+    uint16_t rooms;
 } IdentFrame;
 
 typedef struct {
     FrameType type;
+    String sender;
     String content;
     uint8_t attachmentCount;
     String* attachmentNames;
-    uint32_t *attachmentSizes;
+    uint64_t* attachmentSizes;
+    uint32_t* attachmentIds;
+    // Version 2 only: room the message was posted to, empty for everyone,
+    // and the number the server gave it, 0 until it has one
+    String room;
+    uint64_t seq;
 } MsgFrame;
 
+// Joining or leaving a room, sent by clients
+typedef struct {
+    FrameType type;
+    String room;
+} RoomFrame;
+
+// Sequence number of the last message a client received, all those before
+// it included
+typedef struct {
+    FrameType type;
+    uint64_t seq;
+} AckFrame;
+
+// Asks the server for up to count of the messages numbered below before
+// that the client could have received
+typedef struct {
+    FrameType type;
+    uint64_t before;
+    uint16_t count;
+} HistoryRequestFrame;
+
+// Answer to a history request with the messages found, oldest first; none
+// once there is nothing older left
+typedef struct {
+    FrameType type;
+    uint64_t before;
+    uint16_t count;
+    MsgFrame** messages;
+} HistoryPageFrame;
+
 typedef struct PingFrame_t {
     FrameType type;
+    // Wall clock second of the sender's last input, all version 1 peers get
     uint32_t lastActive;
+    // Version 2 only, 0 from older peers: milliseconds since the sender's
+    // last input, the sender's monotonic clock in nanoseconds when it was
+    // sent and, in a pong, the sent time of the ping it answers
+    uint32_t idle;
+    uint64_t sent;
+    uint64_t echo;
 } PingFrame;
 
 typedef struct PingFrame_t PongFrame;
 
+// Chunk of an attachment. The payload is not copied out of the receive
+// buffer: data stays valid only until the next frame is read.
+typedef struct {
+    FrameType type;
+    uint32_t transferId;
+    uint32_t length;
+    const uint8_t* data;
+} DataFrame;
+
 Frame* protocol_frame_new(FrameType type);
-int protocol_frame_write(int socket, Frame* frame);
-int protocol_frame_read(int socket, Frame** frame);
-int protocol_frame_write_ident(int socket, IdentFrame* frame);
-int protocol_frame_read_ident(int socket, IdentFrame** frame);
-int protocol_frame_write_msg(int socket, MsgFrame* frame);
-int protocol_frame_read_msg(int socket, MsgFrame** frame);
-int protocol_frame_write_ping(int socket, PingFrame* frame);
-int protocol_frame_read_ping(int socket, PingFrame** frame);
-int protocol_frame_write_pong(int socket, PongFrame* frame);
-int protocol_frame_read_pong(int socket, PongFrame** frame);
+void protocol_frame_attachments(MsgFrame* frame, uint8_t count);
+uint64_t protocol_frame_allocations(void);
+int protocol_frame_encode(Buffer* buffer, Frame* frame);
+int protocol_frame_encode_version(Buffer* buffer, Frame* frame, uint8_t version);
+bool protocol_frame_fits(Frame* frame, uint8_t version);
+int protocol_frame_write(int socket, Buffer* buffer, Frame* frame);
+int protocol_frame_write_version(int socket, Buffer* buffer, Frame* frame, uint8_t version);
+int protocol_frame_size(const uint8_t* data, size_t length, uint8_t version);
+int protocol_frame_decode(const uint8_t* data, size_t length, Frame** frame);
+int protocol_frame_decode_version(const uint8_t* data, size_t length, uint8_t version, Frame** frame);
+int protocol_frame_decode_stream(const uint8_t* data, size_t length, uint8_t version, CompressStream* stream, Frame** frame);
+int protocol_frame_decode_arena(const uint8_t* data, size_t length, uint8_t version, CompressStream* stream, StringArena* arena, Frame** frame);
+int protocol_frame_read(int socket, RingBuffer* ring, Frame** frame);
+int protocol_frame_read_version(int socket, RingBuffer* ring, uint8_t version, CompressStream* stream, Frame** frame);
+int protocol_frame_read_arena(int socket, RingBuffer* ring, uint8_t version, CompressStream* stream, StringArena* arena, Frame** frame);
+int protocol_frames_convert(Buffer* buffer, const uint8_t* data, size_t length, uint8_t version);
+int protocol_frames_compress(Buffer* buffer, const uint8_t* data, size_t length, CompressStream* stream, bool streaming);
+int protocol_frame_encode_ident(Buffer* buffer, IdentFrame* frame);
+int protocol_frame_write_ident(int socket, Buffer* buffer, IdentFrame* frame);
+int protocol_frame_decode_ident(const uint8_t* data, size_t length, IdentFrame** frame);
+int protocol_frame_encode_msg(Buffer* buffer, MsgFrame* frame);
+void protocol_frame_number(uint8_t* data, size_t length, uint64_t seq);
+int protocol_frame_write_msg(int socket, Buffer* buffer, MsgFrame* frame);
+int protocol_frame_decode_msg(const uint8_t* data, size_t length, MsgFrame** frame);
+int protocol_frame_encode_ping(Buffer* buffer, PingFrame* frame);
+int protocol_frame_write_ping(int socket, Buffer* buffer, PingFrame* frame);
+int protocol_frame_decode_ping(const uint8_t* data, size_t length, PingFrame** frame);
+int protocol_frame_encode_pong(Buffer* buffer, PongFrame* frame);
+int protocol_frame_write_pong(int socket, Buffer* buffer, PongFrame* frame);
+int protocol_frame_decode_pong(const uint8_t* data, size_t length, PongFrame** frame);
+int protocol_frame_encode_room(Buffer* buffer, RoomFrame* frame);
+int protocol_frame_decode_room(const uint8_t* data, size_t length, FrameType type, RoomFrame** frame);
+int protocol_frame_encode_ack(Buffer* buffer, AckFrame* frame);
+int protocol_frame_decode_ack(const uint8_t* data, size_t length, AckFrame** frame);
+int protocol_frame_encode_history_request(Buffer* buffer, HistoryRequestFrame* frame);
+int protocol_frame_decode_history_request(const uint8_t* data, size_t length, HistoryRequestFrame** frame);
+int protocol_frame_encode_history_page_header(Buffer* buffer, uint64_t before, uint16_t count, size_t length);
+int protocol_frame_decode_history_page(const uint8_t* data, size_t length, HistoryPageFrame** frame);
+int protocol_frame_encode_data_header(Buffer* buffer, uint8_t version, uint32_t transferId, uint32_t length);
+int protocol_frame_encode_data(Buffer* buffer, DataFrame* frame);
+int protocol_frame_decode_data(const uint8_t* data, size_t length, DataFrame** frame);
 void protocol_frame_free(Frame* frame);
@@ -0,0 +1,109 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        ringbuffer.c
+// Description: This file contains the implementation for the RingBuffer
+//              utility class.
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include "ringbuffer.h"
+#include "metrics.h"
+
+// Initialize a ring buffer; the capacity is rounded up to a whole number of
+// pages so it can be mirrored
+int ringbuffer_init(RingBuffer* ring, size_t capacity) {
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    capacity = (capacity + pageSize - 1) / pageSize * pageSize;
+    ring->data = NULL;
+    ring->capacity = 0;
+    ring->readPos = 0;
+    ring->writePos = 0;
+
+    int fd = memfd_create("ringbuffer", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, capacity) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Reserve twice the address space, then map the same pages into both halves
+    uint8_t* base = mmap(NULL, capacity * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, capacity * 2);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    ring->data = base;
+    ring->capacity = capacity;
+    return 0;
+}
+
+void ringbuffer_free(RingBuffer* ring) {
+    if (ring->data != NULL)
+        munmap(ring->data, ring->capacity * 2);
+    ring->data = NULL;
+    ring->capacity = 0;
+}
+
+// Number of buffered bytes waiting to be consumed
+size_t ringbuffer_used(RingBuffer* ring) {
+    return ring->writePos - ring->readPos;
+}
+
+// Number of bytes that can be received before the buffer is full
+size_t ringbuffer_available(RingBuffer* ring) {
+    return ring->capacity - ringbuffer_used(ring);
+}
+
+// Start of the buffered bytes, contiguous for ringbuffer_used() bytes
+uint8_t* ringbuffer_read_ptr(RingBuffer* ring) {
+    return ring->data + ring->readPos % ring->capacity;
+}
+
+// Start of the free space, contiguous for ringbuffer_available() bytes
+uint8_t* ringbuffer_write_ptr(RingBuffer* ring) {
+    return ring->data + ring->writePos % ring->capacity;
+}
+
+void ringbuffer_consume(RingBuffer* ring, size_t length) {
+    ring->readPos += length;
+    // Rewind both positions when drained to keep them small
+    if (ring->readPos == ring->writePos)
+        ring->readPos = ring->writePos = 0;
+}
+
+void ringbuffer_commit(RingBuffer* ring, size_t length) {
+    ring->writePos += length;
+}
+
+// Receive as much as fits with a single recv. Returns the number of bytes
+// received, 0 on end of stream and -1 on error (including EAGAIN).
+ssize_t ringbuffer_fill(RingBuffer* ring, int fd) {
+    size_t available = ringbuffer_available(ring);
+    if (available == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    ssize_t received;
+    do {
+        received = recv(fd, ringbuffer_write_ptr(ring), available, 0);
+        metrics_add(METRIC_SYSCALL_RECV, 1);
+    } while (received < 0 && errno == EINTR);
+    if (received > 0)
+        ringbuffer_commit(ring, received);
+    return received;
+}
@@ -0,0 +1,32 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        ringbuffer.h
+// Description: This file contains the type definitions for the RingBuffer
+//              utility class, a per-socket receive buffer that frames are
+//              decoded from.
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// The buffer memory is mapped twice back to back, so both the readable and
+// the writable regions are always contiguous no matter where they wrap.
+typedef struct {
+    uint8_t* data;
+    size_t capacity;
+    size_t readPos;
+    size_t writePos;
+} RingBuffer;
+
+int ringbuffer_init(RingBuffer* ring, size_t capacity);
+void ringbuffer_free(RingBuffer* ring);
+size_t ringbuffer_used(RingBuffer* ring);
+size_t ringbuffer_available(RingBuffer* ring);
+uint8_t* ringbuffer_read_ptr(RingBuffer* ring);
+uint8_t* ringbuffer_write_ptr(RingBuffer* ring);
+void ringbuffer_consume(RingBuffer* ring, size_t length);
+void ringbuffer_commit(RingBuffer* ring, size_t length);
+ssize_t ringbuffer_fill(RingBuffer* ring, int fd);
@@ -0,0 +1,235 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        rooms.c
+// Description: This file contains the implementation for the RoomIndex.
+//              Members leave by swapping the last member into their slot,
+//              and the room and set entries point at each other, so both
+//              joining and leaving are constant time however big the room.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "string.h"
+#include "protocol.h"
+#include "metrics.h"
+#include "rooms.h"
+
+#define ROOMS_INITIAL_BUCKETS 16
+
+// FNV-1a, plenty for names picked by people
+static uint32_t room_hash(String* name) {
+    uint32_t hash = 2166136261u;
+    const char* data = string_data(name);
+    for (int i = 0; i < name->length; i++)
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    return hash;
+}
+
+void room_index_init(RoomIndex* index) {
+    index->rooms = NULL;
+    index->roomCount = 0;
+    index->roomCapacity = 0;
+    index->freeIds = NULL;
+    index->freeCount = 0;
+    index->bucketCount = ROOMS_INITIAL_BUCKETS;
+    index->buckets = malloc(index->bucketCount * sizeof(int));
+    for (int i = 0; i < index->bucketCount; i++)
+        index->buckets[i] = -1;
+    index->liveCount = 0;
+}
+
+void room_index_free(RoomIndex* index) {
+    for (int id = 0; id < index->roomCount; id++) {
+        Room* room = &index->rooms[id];
+        string_free(&room->name);
+        free(room->members);
+        free(room->sets);
+    }
+    free(index->rooms);
+    free(index->freeIds);
+    free(index->buckets);
+}
+
+// Rooms are only listed while they have a name; the ids of free ones
+// have an empty name
+static void room_index_rehash(RoomIndex* index) {
+    index->bucketCount *= 2;
+    index->buckets = realloc(index->buckets, index->bucketCount * sizeof(int));
+    for (int i = 0; i < index->bucketCount; i++)
+        index->buckets[i] = -1;
+    for (int id = 0; id < index->roomCount; id++) {
+        Room* room = &index->rooms[id];
+        if (room->name.length == 0)
+            continue;
+        int* head = &index->buckets[room_hash(&room->name) & (index->bucketCount - 1)];
+        room->next = *head;
+        *head = id;
+    }
+}
+
+// The room with a name, or NULL if nobody on this server is in it. The
+// pointer is only good until the next join.
+Room* room_index_find(RoomIndex* index, String* name) {
+    int id = index->buckets[room_hash(name) & (index->bucketCount - 1)];
+    while (id >= 0) {
+        Room* room = &index->rooms[id];
+        if (room->name.length == name->length && memcmp(string_data(&room->name), string_data(name), name->length) == 0)
+            return room;
+        id = room->next;
+    }
+    return NULL;
+}
+
+static int room_index_create(RoomIndex* index, String* name) {
+    int id;
+    if (index->freeCount > 0) {
+        id = index->freeIds[--index->freeCount];
+    } else {
+        if (index->roomCount == index->roomCapacity) {
+            index->roomCapacity = index->roomCapacity > 0 ? index->roomCapacity * 2 : 16;
+            index->rooms = realloc(index->rooms, index->roomCapacity * sizeof(Room));
+            index->freeIds = realloc(index->freeIds, index->roomCapacity * sizeof(int));
+        }
+        id = index->roomCount++;
+    }
+    Room* room = &index->rooms[id];
+    room->name = string_copy(name);
+    room->members = NULL;
+    room->sets = NULL;
+    room->memberCount = 0;
+    room->memberCapacity = 0;
+    room->metrics = metrics_room(string_data(name), name->length);
+    int* head = &index->buckets[room_hash(name) & (index->bucketCount - 1)];
+    room->next = *head;
+    *head = id;
+    if (++index->liveCount > index->bucketCount)
+        room_index_rehash(index);
+    return id;
+}
+
+// Forget a room once its last member left, keeping its id for the next one
+static void room_index_destroy(RoomIndex* index, int id) {
+    Room* room = &index->rooms[id];
+    int* link = &index->buckets[room_hash(&room->name) & (index->bucketCount - 1)];
+    while (*link != id)
+        link = &index->rooms[*link].next;
+    *link = room->next;
+    string_free(&room->name);
+    room->name = string_new_static("");
+    free(room->members);
+    free(room->sets);
+    room->members = NULL;
+    room->sets = NULL;
+    index->freeIds[index->freeCount++] = id;
+    index->liveCount--;
+}
+
+// Names are what people type after /join: not empty, short enough to be
+// carried in a frame, and without control characters
+bool room_index_valid_name(String* name) {
+    if (name->length < 1 || name->length > PROTOCOL_MAX_ROOM_LENGTH)
+        return false;
+    const char* data = string_data(name);
+    for (int i = 0; i < name->length; i++) {
+        if ((uint8_t)data[i] < 0x20 || data[i] == 0x7f)
+            return false;
+    }
+    return true;
+}
+
+// Add a connection to a room, creating the room if it is new. Returns 0
+// when it joined, 1 if it already was in the room and -1 if the name is
+// not valid or the connection is in too many rooms.
+int room_index_join(RoomIndex* index, struct ChatClient* client, RoomSet* set, String* name) {
+    if (!room_index_valid_name(name))
+        return -1;
+    Room* room = room_index_find(index, name);
+    if (room != NULL && room_set_has(set, room - index->rooms))
+        return 1;
+    if (set->count == ROOMS_MAX_JOINED)
+        return -1;
+    int id = room != NULL ? room - index->rooms : room_index_create(index, name);
+    room = &index->rooms[id];
+
+    if (room->memberCount == room->memberCapacity) {
+        room->memberCapacity = room->memberCapacity > 0 ? room->memberCapacity * 2 : 8;
+        room->members = realloc(room->members, room->memberCapacity * sizeof(struct ChatClient*));
+        room->sets = realloc(room->sets, room->memberCapacity * sizeof(RoomSet*));
+    }
+    int slot = room->memberCount++;
+    room->members[slot] = client;
+    room->sets[slot] = set;
+
+    int word = id / 64;
+    if (word >= set->words) {
+        set->bits = realloc(set->bits, (word + 1) * sizeof(uint64_t));
+        memset(set->bits + set->words, 0, (word + 1 - set->words) * sizeof(uint64_t));
+        set->words = word + 1;
+    }
+    set->bits[word] |= (uint64_t)1 << (id % 64);
+    set->slots[set->count++] = (RoomSlot){ id, slot };
+    return 0;
+}
+
+// Drop the set's entry at position, filling the member's slot with the
+// room's last member
+static void room_index_remove(RoomIndex* index, RoomSet* set, int position) {
+    RoomSlot entry = set->slots[position];
+    Room* room = &index->rooms[entry.room];
+    int last = --room->memberCount;
+    if (entry.slot != last) {
+        room->members[entry.slot] = room->members[last];
+        room->sets[entry.slot] = room->sets[last];
+        RoomSet* moved = room->sets[entry.slot];
+        for (int i = 0; i < moved->count; i++) {
+            if (moved->slots[i].room == entry.room) {
+                moved->slots[i].slot = entry.slot;
+                break;
+            }
+        }
+    }
+    set->slots[position] = set->slots[--set->count];
+    set->bits[entry.room / 64] &= ~((uint64_t)1 << (entry.room % 64));
+    if (room->memberCount == 0)
+        room_index_destroy(index, entry.room);
+}
+
+// Take a connection out of a room. Returns -1 if it was not in it.
+int room_index_leave(RoomIndex* index, RoomSet* set, String* name) {
+    Room* room = room_index_find(index, name);
+    if (room == NULL)
+        return -1;
+    int id = room - index->rooms;
+    for (int i = 0; i < set->count; i++) {
+        if (set->slots[i].room == id) {
+            room_index_remove(index, set, i);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Take a connection out of every room, when it goes away
+void room_index_leave_all(RoomIndex* index, RoomSet* set) {
+    while (set->count > 0)
+        room_index_remove(index, set, set->count - 1);
+}
+
+void room_set_init(RoomSet* set) {
+    set->bits = NULL;
+    set->words = 0;
+    set->count = 0;
+}
+
+bool room_set_has(RoomSet* set, int room) {
+    return room / 64 < set->words && (set->bits[room / 64] >> (room % 64) & 1);
+}
+
+void room_set_free(RoomSet* set) {
+    free(set->bits);
+    set->bits = NULL;
+    set->words = 0;
+    set->count = 0;
+}
@@ -0,0 +1,75 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        rooms.h
+// Description: This file contains the definitions for the RoomIndex, a
+//              server's subscription index: every room maps to a packed
+//              array of its members, and every connection keeps a bitmap of
+//              the rooms it is in, so joining, leaving and finding who a
+//              message goes to never scan unrelated clients.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "string.h"
+#include "metrics.h"
+
+// Rooms one connection may be in at once, which bounds the work of leaving
+#define ROOMS_MAX_JOINED 32
+
+struct ChatClient;
+
+// Where a connection sits in the member array of one of its rooms
+typedef struct {
+    int room;
+    int slot;
+} RoomSlot;
+
+// Rooms a connection is in, as a bitmap over room ids and the slots it
+// takes in their member arrays
+typedef struct {
+    uint64_t* bits;
+    int words;
+    RoomSlot slots[ROOMS_MAX_JOINED];
+    int count;
+} RoomSet;
+
+typedef struct {
+    String name;
+    // Members packed at the front so a fan-out walks one array, and the
+    // sets pointing back at them, only touched when someone leaves
+    struct ChatClient** members;
+    RoomSet** sets;
+    int memberCount;
+    int memberCapacity;
+    // Next room in the same hash bucket, -1 at the end
+    int next;
+    MetricsRoom* metrics;
+} Room;
+
+typedef struct {
+    // Rooms by id. Ids of rooms that emptied are reused before the array
+    // grows, which keeps the connections' bitmaps short.
+    Room* rooms;
+    int roomCount;
+    int roomCapacity;
+    int* freeIds;
+    int freeCount;
+    // Heads of the hash chains, a power of two of them
+    int* buckets;
+    int bucketCount;
+    int liveCount;
+} RoomIndex;
+
+void room_index_init(RoomIndex* index);
+void room_index_free(RoomIndex* index);
+Room* room_index_find(RoomIndex* index, String* name);
+int room_index_join(RoomIndex* index, struct ChatClient* client, RoomSet* set, String* name);
+int room_index_leave(RoomIndex* index, RoomSet* set, String* name);
+void room_index_leave_all(RoomIndex* index, RoomSet* set);
+bool room_index_valid_name(String* name);
+
+void room_set_init(RoomSet* set);
+bool room_set_has(RoomSet* set, int room);
+void room_set_free(RoomSet* set);
@@ -0,0 +1,188 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        scrollback.c
+// Description: This file contains the implementation for the Scrollback.
+
+#include <stdlib.h>
+#include "string.h"
+#include "history.h"
+#include "scrollback.h"
+
+void scrollback_init(Scrollback* scrollback) {
+    scrollback->start = 0;
+    scrollback->ranges = NULL;
+    scrollback->rangeCount = 0;
+    scrollback->known = 0;
+    scrollback->complete = true;
+    for (int i = 0; i < SCROLLBACK_MAX_PAGES; i++)
+        scrollback->pages[i] = (ScrollbackPage){ .range = -1, .used = 0, .messages = NULL, .count = 0 };
+    scrollback->clock = 0;
+    scrollback->pending = -1;
+}
+
+static void scrollback_drop(ScrollbackPage* page) {
+    for (int i = 0; i < page->count; i++) {
+        Message* message = &page->messages[i];
+        string_free(&message->sender);
+        string_free(&message->content);
+        for (int j = 0; j < message->attachmentCount; j++)
+            string_free(&message->attachments[j]);
+        free(message->attachments);
+    }
+    free(page->messages);
+    page->range = -1;
+    page->messages = NULL;
+    page->count = 0;
+}
+
+void scrollback_free(Scrollback* scrollback) {
+    for (int i = 0; i < SCROLLBACK_MAX_PAGES; i++)
+        scrollback_drop(&scrollback->pages[i]);
+    free(scrollback->ranges);
+    scrollback->ranges = NULL;
+    scrollback->rangeCount = 0;
+}
+
+// Forget every page and start over for a session starting at the message
+// numbered start
+void scrollback_reset(Scrollback* scrollback, uint64_t start) {
+    scrollback_free(scrollback);
+    scrollback->start = start;
+    scrollback->known = 0;
+    scrollback->complete = start == 0;
+    scrollback->pending = -1;
+}
+
+// Stop waiting for a page that was asked for on a lost connection
+void scrollback_cancel(Scrollback* scrollback) {
+    scrollback->pending = -1;
+}
+
+size_t scrollback_known(Scrollback* scrollback) {
+    return scrollback->known;
+}
+
+bool scrollback_complete(Scrollback* scrollback) {
+    return scrollback->complete;
+}
+
+static ScrollbackPage* scrollback_find(Scrollback* scrollback, int range) {
+    for (int i = 0; i < SCROLLBACK_MAX_PAGES; i++) {
+        if (scrollback->pages[i].range == range)
+            return &scrollback->pages[i];
+    }
+    return NULL;
+}
+
+// Range holding a message, or -1 past the known ones
+static int scrollback_range_of(Scrollback* scrollback, size_t index) {
+    if (index >= scrollback->known)
+        return -1;
+    int low = 0, high = scrollback->rangeCount;
+    while (high - low > 1) {
+        int middle = (low + high) / 2;
+        if (scrollback->ranges[middle].first <= index)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+// Look up a message by how far back from the session it is, or NULL if its
+// page is not kept
+Message* scrollback_get(Scrollback* scrollback, size_t index) {
+    int range = scrollback_range_of(scrollback, index);
+    ScrollbackPage* page = range >= 0 ? scrollback_find(scrollback, range) : NULL;
+    if (page == NULL)
+        return NULL;
+    page->used = ++scrollback->clock;
+    // Pages hold their messages oldest first
+    return &page->messages[page->count - 1 - (index - scrollback->ranges[range].first)];
+}
+
+static uint64_t scrollback_next_before(Scrollback* scrollback) {
+    return scrollback->rangeCount > 0 ? scrollback->ranges[scrollback->rangeCount - 1].oldest : scrollback->start;
+}
+
+// Pick the page to ask for so messages from up to to can be shown: the
+// first one that was dropped, or the one after the known pages. Returns
+// false when none is missing or one is already on its way.
+bool scrollback_request(Scrollback* scrollback, size_t from, size_t to, uint64_t* before) {
+    if (scrollback->pending >= 0)
+        return false;
+    size_t index = from;
+    while (index < to) {
+        int range = scrollback_range_of(scrollback, index);
+        if (range < 0) {
+            if (scrollback->complete)
+                return false;
+            scrollback->pending = scrollback->rangeCount;
+            *before = scrollback_next_before(scrollback);
+            return true;
+        }
+        if (scrollback_find(scrollback, range) == NULL) {
+            scrollback->pending = range;
+            *before = scrollback->ranges[range].before;
+            return true;
+        }
+        index = scrollback->ranges[range].first + scrollback->ranges[range].count;
+    }
+    return false;
+}
+
+// Keep a copy of the page that was asked for, oldest message first, in
+// place of the one viewed least recently. oldest is the number of its
+// first message. Pages that were not asked for are ignored.
+void scrollback_add(Scrollback* scrollback, uint64_t before, uint64_t oldest, Message* messages, int count) {
+    int range = scrollback->pending;
+    if (range < 0 || before != (range < scrollback->rangeCount ? scrollback->ranges[range].before : scrollback_next_before(scrollback)))
+        return;
+    scrollback->pending = -1;
+    if (range == scrollback->rangeCount) {
+        if (count == 0) {
+            scrollback->complete = true;
+            return;
+        }
+        if ((scrollback->rangeCount & (scrollback->rangeCount - 1)) == 0)
+            scrollback->ranges = realloc(scrollback->ranges, (scrollback->rangeCount > 0 ? 2 * scrollback->rangeCount : 1) * sizeof(ScrollbackRange));
+        scrollback->ranges[scrollback->rangeCount++] = (ScrollbackRange){ before, oldest, scrollback->known, count };
+        scrollback->known += count;
+    } else if (count != scrollback->ranges[range].count) {
+        // The server no longer has all of the page, nor anything older
+        scrollback->rangeCount = range;
+        scrollback->known = scrollback->ranges[range].first;
+        scrollback->complete = true;
+        for (int i = 0; i < SCROLLBACK_MAX_PAGES; i++) {
+            if (scrollback->pages[i].range >= range)
+                scrollback_drop(&scrollback->pages[i]);
+        }
+        return;
+    }
+
+    ScrollbackPage* page = &scrollback->pages[0];
+    for (int i = 1; i < SCROLLBACK_MAX_PAGES && page->range >= 0; i++) {
+        if (scrollback->pages[i].range < 0 || scrollback->pages[i].used < page->used)
+            page = &scrollback->pages[i];
+    }
+    scrollback_drop(page);
+    page->messages = malloc(count * sizeof(Message));
+    for (int i = 0; i < count; i++) {
+        Message* message = &page->messages[i];
+        message->isOutgoing = false;
+        message->sender = string_copy(&messages[i].sender);
+        message->content = string_copy(&messages[i].content);
+        message->attachmentCount = messages[i].attachmentCount;
+        message->attachments = NULL;
+        if (message->attachmentCount > 0) {
+            message->attachments = malloc(message->attachmentCount * sizeof(String));
+            for (int j = 0; j < message->attachmentCount; j++)
+                message->attachments[j] = string_copy(&messages[i].attachments[j]);
+        }
+    }
+    page->range = range;
+    page->count = count;
+    page->used = ++scrollback->clock;
+}
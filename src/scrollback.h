@@ -0,0 +1,66 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        scrollback.h
+// Description: This file contains the definitions for the Scrollback, the
+//              messages from before the session fetched from the server in
+//              pages as the user scrolls back to them. Only the pages viewed
+//              last are kept, so memory does not grow with how far back the
+//              history goes.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "history.h"
+
+// Messages asked for at a time
+#define SCROLLBACK_PAGE_MESSAGES 64
+// Pages kept before the least recently viewed is dropped
+#define SCROLLBACK_MAX_PAGES 8
+
+// Where a page fetched once lies, so it can be asked for again after it
+// was dropped. Messages are counted back from the newest one before the
+// session, so the page holds first to first + count - 1.
+typedef struct {
+    uint64_t before;
+    uint64_t oldest;
+    size_t first;
+    int count;
+} ScrollbackRange;
+
+typedef struct {
+    // Index of the page's range, -1 for a free slot
+    int range;
+    uint64_t used;
+    Message* messages;
+    int count;
+} ScrollbackPage;
+
+typedef struct {
+    // Sequence number of the first message of the session, everything
+    // before it is fetched; 0 when there is nothing to fetch
+    uint64_t start;
+    ScrollbackRange* ranges;
+    int rangeCount;
+    // Messages in every range, and whether they reach the oldest the
+    // server has
+    size_t known;
+    bool complete;
+    ScrollbackPage pages[SCROLLBACK_MAX_PAGES];
+    uint64_t clock;
+    // Range index of the page asked for, rangeCount for the next unknown
+    // one, -1 when none is
+    int pending;
+} Scrollback;
+
+void scrollback_init(Scrollback* scrollback);
+void scrollback_free(Scrollback* scrollback);
+void scrollback_reset(Scrollback* scrollback, uint64_t start);
+void scrollback_cancel(Scrollback* scrollback);
+size_t scrollback_known(Scrollback* scrollback);
+bool scrollback_complete(Scrollback* scrollback);
+Message* scrollback_get(Scrollback* scrollback, size_t index);
+bool scrollback_request(Scrollback* scrollback, size_t from, size_t to, uint64_t* before);
+void scrollback_add(Scrollback* scrollback, uint64_t before, uint64_t oldest, Message* messages, int count);
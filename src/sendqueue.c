@@ -0,0 +1,151 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        sendqueue.c
+// Description: This file contains the implementation for EncodedFrame and
+//              SendQueue.
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include "sendqueue.h"
+#include "metrics.h"
+
+// Allocate a shared frame holding one reference, for the caller to fill in
+EncodedFrame* encoded_frame_alloc(size_t length) {
+    EncodedFrame* frame = malloc(sizeof(EncodedFrame) + length);
+    metrics_add(METRIC_ALLOC_ENCODED, 1);
+    frame->refCount = 1;
+    frame->room = NULL;
+    frame->origin = 0;
+    frame->length = length;
+    return frame;
+}
+
+// Copy an encoded frame into a new shared buffer holding one reference
+EncodedFrame* encoded_frame_new(const void* data, size_t length) {
+    EncodedFrame* frame = encoded_frame_alloc(length);
+    memcpy(frame->data, data, length);
+    return frame;
+}
+
+// Start a buffer that frames are encoded into and that then becomes an
+// EncodedFrame itself, so the encoded bytes are never copied
+void encoded_frame_begin(Buffer* buffer) {
+    buffer_init(buffer, 0);
+    buffer_reserve(buffer, sizeof(EncodedFrame) + 64);
+    buffer->length = sizeof(EncodedFrame);
+}
+
+// Take over a buffer started with encoded_frame_begin, leaving it empty
+EncodedFrame* encoded_frame_finish(Buffer* buffer) {
+    EncodedFrame* frame = (EncodedFrame*)buffer->data;
+    frame->refCount = 1;
+    frame->room = NULL;
+    frame->origin = 0;
+    frame->length = buffer->length - sizeof(EncodedFrame);
+    buffer_init(buffer, 0);
+    return frame;
+}
+
+EncodedFrame* encoded_frame_retain(EncodedFrame* frame) {
+    __atomic_add_fetch(&frame->refCount, 1, __ATOMIC_RELAXED);
+    return frame;
+}
+
+// Drop a reference, freeing the frame once the last holder is done with it
+void encoded_frame_release(EncodedFrame* frame) {
+    if (__atomic_sub_fetch(&frame->refCount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(frame->room);
+        free(frame);
+    }
+}
+
+void send_queue_init(SendQueue* queue) {
+    queue->frames = NULL;
+    queue->capacity = 0;
+    queue->head = 0;
+    queue->count = 0;
+    queue->offset = 0;
+    queue->bytes = 0;
+}
+
+void send_queue_free(SendQueue* queue) {
+    for (size_t i = 0; i < queue->count; i++)
+        encoded_frame_release(queue->frames[(queue->head + i) % queue->capacity]);
+    free(queue->frames);
+    send_queue_init(queue);
+}
+
+// Queue a frame for sending; the queue takes its own reference
+void send_queue_push(SendQueue* queue, EncodedFrame* frame) {
+    if (queue->count == queue->capacity) {
+        size_t capacity = queue->capacity > 0 ? queue->capacity * 2 : 16;
+        EncodedFrame** frames = malloc(capacity * sizeof(EncodedFrame*));
+        for (size_t i = 0; i < queue->count; i++)
+            frames[i] = queue->frames[(queue->head + i) % queue->capacity];
+        free(queue->frames);
+        queue->frames = frames;
+        queue->capacity = capacity;
+        queue->head = 0;
+    }
+    queue->frames[(queue->head + queue->count) % queue->capacity] = encoded_frame_retain(frame);
+    queue->count++;
+    queue->bytes += frame->length;
+}
+
+bool send_queue_empty(SendQueue* queue) {
+    return queue->count == 0;
+}
+
+// Point iov at the unsent bytes of up to maxCount queued frames, oldest
+// first. Returns the number of entries filled in.
+int send_queue_iov(SendQueue* queue, struct iovec* iov, int maxCount) {
+    int iovCount = 0;
+    for (size_t i = 0; i < queue->count && iovCount < maxCount; i++) {
+        EncodedFrame* frame = queue->frames[(queue->head + i) % queue->capacity];
+        size_t skip = i == 0 ? queue->offset : 0;
+        iov[iovCount].iov_base = frame->data + skip;
+        iov[iovCount].iov_len = frame->length - skip;
+        iovCount++;
+    }
+    return iovCount;
+}
+
+// Mark written bytes as sent, releasing every frame that went out completely
+void send_queue_advance(SendQueue* queue, size_t written) {
+    queue->bytes -= written;
+    size_t remaining = written + queue->offset;
+    while (queue->count > 0) {
+        EncodedFrame* frame = queue->frames[queue->head];
+        if (remaining < frame->length)
+            break;
+        remaining -= frame->length;
+        encoded_frame_release(frame);
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+    }
+    queue->offset = remaining;
+}
+
+// Write queued frames with writev until the queue is empty or the socket
+// would block. Returns 1 when drained, 0 when data is left and -1 on error.
+int send_queue_flush(SendQueue* queue, int fd) {
+    metrics_record(METRIC_SEND_QUEUE_DEPTH, queue->count);
+    while (queue->count > 0) {
+        struct iovec iov[SEND_QUEUE_MAX_IOV];
+        int iovCount = send_queue_iov(queue, iov, SEND_QUEUE_MAX_IOV);
+        ssize_t written = writev(fd, iov, iovCount);
+        metrics_add(METRIC_SYSCALL_WRITEV, 1);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        send_queue_advance(queue, written);
+    }
+    queue->offset = 0;
+    return 1;
+}
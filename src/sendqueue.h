@@ -0,0 +1,55 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        sendqueue.h
+// Description: This file contains the definitions for EncodedFrame, an
+//              immutable reference-counted frame shared by every recipient
+//              of a broadcast, and SendQueue, the per-connection queue of
+//              such frames that is drained with writev.
+
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "buffer.h"
+
+#define SEND_QUEUE_MAX_IOV 64
+
+typedef struct {
+    int refCount;
+    // Room the frame is addressed to when handed between server loops,
+    // NULL for every client; owned by the frame
+    char* room;
+    // Session of the client that posted a message kept in the backlog, 0
+    // when it has none
+    uint64_t origin;
+    size_t length;
+    uint8_t data[];
+} EncodedFrame;
+
+EncodedFrame* encoded_frame_alloc(size_t length);
+EncodedFrame* encoded_frame_new(const void* data, size_t length);
+void encoded_frame_begin(Buffer* buffer);
+EncodedFrame* encoded_frame_finish(Buffer* buffer);
+EncodedFrame* encoded_frame_retain(EncodedFrame* frame);
+void encoded_frame_release(EncodedFrame* frame);
+
+typedef struct {
+    EncodedFrame** frames;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    // Bytes of the head frame that have already been written
+    size_t offset;
+    size_t bytes;
+} SendQueue;
+
+void send_queue_init(SendQueue* queue);
+void send_queue_free(SendQueue* queue);
+void send_queue_push(SendQueue* queue, EncodedFrame* frame);
+bool send_queue_empty(SendQueue* queue);
+int send_queue_iov(SendQueue* queue, struct iovec* iov, int maxCount);
+void send_queue_advance(SendQueue* queue, size_t written);
+int send_queue_flush(SendQueue* queue, int fd);
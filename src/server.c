@@ -0,0 +1,1275 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        server.c
+// Description: This file contains the implementation for the ChatServer.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "string.h"
+#include "buffer.h"
+#include "ringbuffer.h"
+#include "sendqueue.h"
+#include "protocol.h"
+#include "server.h"
+#include "metrics.h"
+#include "uring.h"
+#include "outbox.h"
+#include "rooms.h"
+#include "backlog.h"
+
+// io_uring completions are told apart by the low bits of their user data;
+// the rest points at the client, or at the server for the listening socket
+// and the eventfd of its inbox
+enum {
+    URING_OP_RECV,
+    URING_OP_SEND,
+    URING_OP_ACCEPT,
+    URING_OP_WAKE,
+    URING_OP_MASK = 3,
+};
+
+// Milliseconds since the host last typed, as sent in pings and pongs
+static uint32_t server_idle_millis(ChatServer* server, uint64_t now) {
+    uint64_t lastInput = __atomic_load_n(&server->lastInput, __ATOMIC_RELAXED);
+    uint64_t idle = now > lastInput ? (now - lastInput) / 1000000 : 0;
+    return idle < UINT32_MAX ? idle : UINT32_MAX;
+}
+
+static void client_free(ChatClient* client) {
+    close(client->socketfd);
+    string_free(&client->name);
+    string_free(&client->addr);
+    ringbuffer_free(&client->inBuffer);
+    compress_stream_free(&client->recvStream);
+    send_queue_free(&client->sendQueue);
+    for (int i = 0; i < client->relayCount; i++)
+        string_free(&client->relays[i].room);
+    free(client->relays);
+    room_set_free(&client->rooms);
+    free(client->sends);
+    free(client);
+}
+
+static void client_set_events(ChatServer* server, ChatClient* client, bool wantsWrite) {
+    if (client->wantsWrite == wantsWrite)
+        return;
+    struct epoll_event event = {
+        .events = EPOLLIN | (wantsWrite ? EPOLLOUT : 0),
+        .data.ptr = client,
+    };
+    epoll_ctl(server->epollfd, EPOLL_CTL_MOD, client->socketfd, &event);
+    client->wantsWrite = wantsWrite;
+}
+
+// Submit the client's queued frames as a chain of linked sends. Sockets
+// are blocking on io_uring and MSG_WAITALL makes each send all or nothing, so
+// the chain only breaks when the connection does.
+static void client_submit_sends(ChatServer* server, ChatClient* client) {
+    if (client->sends == NULL)
+        client->sends = malloc(sizeof(UringSends));
+    UringSends* sends = client->sends;
+    metrics_record(METRIC_SEND_QUEUE_DEPTH, client->sendQueue.count);
+    int iovCount = send_queue_iov(&client->sendQueue, sends->iov, SERVER_SEND_LINKS * SEND_QUEUE_MAX_IOV);
+    sends->count = 0;
+    sends->completed = 0;
+    sends->remaining = 0;
+    struct io_uring_sqe* previous = NULL;
+    for (int first = 0; first < iovCount; first += SEND_QUEUE_MAX_IOV) {
+        struct io_uring_sqe* sqe = uring_get_sqe(&server->uring);
+        if (sqe == NULL) {
+            client->closed = true;
+            break;
+        }
+        struct msghdr* header = &sends->headers[sends->count++];
+        memset(header, 0, sizeof(*header));
+        header->msg_iov = &sends->iov[first];
+        header->msg_iovlen = iovCount - first < SEND_QUEUE_MAX_IOV ? iovCount - first : SEND_QUEUE_MAX_IOV;
+        for (size_t i = 0; i < header->msg_iovlen; i++)
+            sends->remaining += header->msg_iov[i].iov_len;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = client->socketfd;
+        sqe->addr = (uint64_t)(uintptr_t)header;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        sqe->user_data = (uint64_t)(uintptr_t)client | URING_OP_SEND;
+        if (previous != NULL)
+            previous->flags |= IOSQE_IO_LINK;
+        previous = sqe;
+    }
+    client->inflight += sends->count;
+    client->wantsWrite = sends->count > 0;
+}
+
+// Write as much of the client's queued frames as the socket accepts
+static void client_flush(ChatServer* server, ChatClient* client) {
+    if (server->io == SERVER_IO_URING) {
+        client_submit_sends(server, client);
+        return;
+    }
+    int result = send_queue_flush(&client->sendQueue, client->socketfd);
+    if (result < 0)
+        client->closed = true;
+    client_set_events(server, client, result == 0);
+}
+
+// Have a client written at the end of the current pass of the loop, unless
+// it is already waiting for the socket
+static void client_queue_flush(ChatServer* server, ChatClient* client) {
+    if (client->wantsWrite || client->flushQueued)
+        return;
+    if (server->flushCount == server->flushCapacity) {
+        server->flushCapacity = server->flushCapacity > 0 ? server->flushCapacity * 2 : 16;
+        server->flushes = realloc(server->flushes, server->flushCapacity * sizeof(ChatClient*));
+    }
+    server->flushes[server->flushCount++] = client;
+    client->flushQueued = true;
+}
+
+// Queue a shared frame for a client. It is written at the end of the
+// current pass of the loop, together with anything else queued by then. A
+// client that stopped reading is dropped once too much is queued for it,
+// rather than holding frames for it without bound; pings it still sends
+// would otherwise keep it alive. It resumes from the backlog if it comes
+// back.
+static void client_send(ChatServer* server, ChatClient* client, EncodedFrame* frame) {
+    if (client->closed)
+        return;
+    if (client->sendQueue.bytes + frame->length > SERVER_CLIENT_HIGH_WATER) {
+        client->closed = true;
+        metrics_add(METRIC_CLIENTS_BACKED_UP, 1);
+        return;
+    }
+    send_queue_push(&client->sendQueue, frame);
+    client_queue_flush(server, client);
+}
+
+// Write out everything queued during this pass of the loop
+static void server_flush_clients(ChatServer* server) {
+    for (int i = 0; i < server->flushCount; i++) {
+        ChatClient* client = server->flushes[i];
+        client->flushQueued = false;
+        if (!client->closed && !client->wantsWrite)
+            client_flush(server, client);
+    }
+    server->flushCount = 0;
+}
+
+// Index of the encoding a client receives frames in
+static int client_encoding(ChatClient* client) {
+    return client->version + (client->compressed ? PROTOCOL_VERSION + 1 : 0);
+}
+
+// Compress already encoded frames for clients that negotiated it
+static EncodedFrame* server_compress(ChatServer* server, const uint8_t* data, size_t length) {
+    buffer_clear(&server->compressed);
+    protocol_frames_compress(&server->compressed, data, length, &server->compressor, false);
+    return encoded_frame_new(server->compressed.data, server->compressed.length);
+}
+
+// Encode a frame for one protocol version. A data frame's payload is copied
+// straight into the shared buffer, once.
+static EncodedFrame* server_encode_frame(ChatServer* server, Frame* frame, uint8_t version, bool compressed) {
+    buffer_clear(&server->scratch);
+    if (frame->type != FRAME_DATA) {
+        protocol_frame_encode_version(&server->scratch, frame, version);
+        metrics_frame_out(frame->type, server->scratch.length);
+        if (compressed)
+            return server_compress(server, server->scratch.data, server->scratch.length);
+        return encoded_frame_new(server->scratch.data, server->scratch.length);
+    }
+    DataFrame* dataFrame = (DataFrame*)frame;
+    protocol_frame_encode_data_header(&server->scratch, version, dataFrame->transferId, dataFrame->length);
+    metrics_frame_out(FRAME_DATA, server->scratch.length + dataFrame->length);
+    EncodedFrame* encoded = encoded_frame_alloc(server->scratch.length + dataFrame->length);
+    memcpy(encoded->data, server->scratch.data, server->scratch.length);
+    memcpy(encoded->data + server->scratch.length, dataFrame->data, dataFrame->length);
+    if (compressed) {
+        EncodedFrame* raw = encoded;
+        encoded = server_compress(server, raw->data, raw->length);
+        encoded_frame_release(raw);
+    }
+    return encoded;
+}
+
+// Encode a frame for a single recipient
+static void client_send_frame(ChatServer* server, ChatClient* client, Frame* frame) {
+    EncodedFrame* encoded = server_encode_frame(server, frame, client->version, client->compressed);
+    client_send(server, client, encoded);
+    encoded_frame_release(encoded);
+}
+
+// The shard a server's shared state lives on: the first, or the server
+// itself when it runs alone
+static ChatServer* server_owner(ChatServer* server) {
+    return server->shards != NULL ? &server->shards[0] : server;
+}
+
+static void server_update_clients(ChatServer* server, int delta) {
+    metrics_set(METRIC_CLIENTS, __atomic_add_fetch(&server_owner(server)->connectedCount, delta, __ATOMIC_RELAXED));
+}
+
+// Hand a frame encoded in the current version to every shard's inbox but
+// this one, or every shard's when called from outside the loops
+static void server_push_shards(ChatServer* server, ChatServer* except, EncodedFrame* frame) {
+    if (server->shards == NULL) {
+        outbox_push(&server->inbox, frame);
+        return;
+    }
+    for (int i = 0; i < server->shardCount; i++) {
+        if (&server->shards[i] != except)
+            outbox_push(&server->shards[i].inbox, frame);
+    }
+}
+
+// Address a frame handed to other loops to the members of a room
+static void server_address(EncodedFrame* encoded, String* room) {
+    if (room != NULL && room->length > 0 && encoded->room == NULL)
+        encoded->room = strndup(string_data(room), room->length);
+}
+
+static void server_release_encodings(EncodedFrame** encoded) {
+    for (int encoding = 0; encoding < SERVER_ENCODINGS; encoding++) {
+        if (encoded[encoding] != NULL)
+            encoded_frame_release(encoded[encoding]);
+    }
+}
+
+// Queue a frame on every identified client except the origin, or only on
+// the members of a room when one is given. It is encoded once per encoding
+// in use, kept in encoded for the caller to release, and each recipient
+// only takes a reference, so the cost per recipient is a pointer push
+// rather than a copy of the frame.
+static void server_fan_out(ChatServer* server, ChatClient* origin, Frame* frame, String* room, EncodedFrame** encoded) {
+    ChatClient** recipients = server->clients;
+    int recipientCount = server->clientCount;
+    Room* target = NULL;
+    if (room != NULL && room->length > 0) {
+        target = room_index_find(&server->rooms, room);
+        recipients = target != NULL ? target->members : NULL;
+        recipientCount = target != NULL ? target->memberCount : 0;
+    }
+    int delivered = 0;
+    for (int i = 0; i < recipientCount; i++) {
+        ChatClient* client = recipients[i];
+        if (client == origin || !client->identified || !protocol_frame_fits(frame, client->version))
+            continue;
+        int encoding = client_encoding(client);
+        if (encoded[encoding] == NULL)
+            encoded[encoding] = server_encode_frame(server, frame, client->version, client->compressed);
+        client_send(server, client, encoded[encoding]);
+        delivered++;
+    }
+    if (target != NULL && frame->type == FRAME_MSG)
+        metrics_room_add(target->metrics, 1, delivered);
+}
+
+static int server_take_inbox(ChatServer* server);
+static void server_deliver_inbox(ChatServer* server, int count);
+static void server_deliver(ChatServer* server, EncodedFrame** frames, int count, ChatClient** recipients, int recipientCount);
+
+// Number a message encoded in the current version with room for its number,
+// and keep it for clients resuming a lost session. Only this is done under
+// the backlog's lock; the caller then hands it to the inboxes in its turn.
+static uint64_t server_number(ChatServer* server, EncodedFrame* encoded) {
+    Backlog* backlog = &server_owner(server)->backlog;
+    backlog_lock(backlog);
+    uint64_t seq = backlog_next(backlog);
+    protocol_frame_number(encoded->data, encoded->length, seq);
+    backlog_append(backlog, encoded);
+    backlog_unlock(backlog);
+    return seq;
+}
+
+// Number a message from a client, keep it for clients resuming a lost
+// session and deliver it. It is encoded before it is numbered and reaches
+// the other shards' inboxes in its turn, once every message numbered
+// before it has, so every inbox holds messages in number order. What this
+// shard's inbox holds by then was numbered earlier and is delivered first,
+// which keeps the order for clients here too.
+static void server_post(ChatServer* server, ChatClient* origin, MsgFrame* frame) {
+    EncodedFrame* encoded[SERVER_ENCODINGS] = { NULL };
+    Backlog* backlog = &server_owner(server)->backlog;
+    // Any number leaves room for one in the encoding
+    frame->seq = UINT64_MAX;
+    encoded[PROTOCOL_VERSION] = server_encode_frame(server, (Frame*)frame, PROTOCOL_VERSION, false);
+    server_address(encoded[PROTOCOL_VERSION], &frame->room);
+    encoded[PROTOCOL_VERSION]->origin = origin != NULL ? origin->session : 0;
+    frame->seq = server_number(server, encoded[PROTOCOL_VERSION]);
+    backlog_wait_turn(backlog, frame->seq);
+    int pending = server_take_inbox(server);
+    if (server->shards != NULL)
+        server_push_shards(server, server, encoded[PROTOCOL_VERSION]);
+    backlog_publish(backlog, frame->seq);
+    server_deliver_inbox(server, pending);
+    server_fan_out(server, origin, (Frame*)frame, &frame->room, encoded);
+    server_release_encodings(encoded);
+}
+
+// Whether a message kept in the backlog went to a client, which is only
+// the case for room messages if it is in the room
+static bool server_client_sees(ChatServer* server, ChatClient* client, EncodedFrame* frame) {
+    if (frame->room == NULL)
+        return true;
+    String name = string_new_borrowed(frame->room, strlen(frame->room));
+    Room* room = room_index_find(&server->rooms, &name);
+    return room != NULL && room_set_has(&client->rooms, room - server->rooms.rooms);
+}
+
+// Send a client resuming a lost session the messages it missed that the
+// backlog still has, those for everyone and for the rooms it is back in,
+// except its own: it showed those when it sent them, and never learns
+// their numbers to skip them. Later ones may also still be on their way
+// through the inbox; the client drops whatever it already has.
+static void server_replay(ChatServer* server, ChatClient* client) {
+    Backlog* backlog = &server_owner(server)->backlog;
+    EncodedFrame** frames = malloc(backlog->capacity * sizeof(EncodedFrame*));
+    backlog_lock(backlog);
+    int count = backlog_since(backlog, client->resumeSeq, frames);
+    backlog_unlock(backlog);
+    client->resumeSeq = 0;
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        bool own = client->session != 0 && frames[i]->origin == client->session;
+        if (!own && server_client_sees(server, client, frames[i]))
+            frames[kept++] = frames[i];
+        else
+            encoded_frame_release(frames[i]);
+    }
+    metrics_record(METRIC_REPLAYED, kept);
+    server_deliver(server, frames, kept, &client, 1);
+    for (int i = 0; i < kept; i++)
+        encoded_frame_release(frames[i]);
+    free(frames);
+}
+
+// Answer a history request with the newest messages before the one asked
+// for that the client could see, as one page. Messages older than the
+// backlog are gone, so the page comes back empty once they are reached.
+static void server_send_history(ChatServer* server, ChatClient* client, HistoryRequestFrame* request) {
+    int max = request->count < PROTOCOL_MAX_PAGE_MESSAGES ? request->count : PROTOCOL_MAX_PAGE_MESSAGES;
+    EncodedFrame* frames[PROTOCOL_MAX_PAGE_MESSAGES];
+    int count = 0;
+    size_t length = 0;
+    Backlog* backlog = &server_owner(server)->backlog;
+    backlog_lock(backlog);
+    uint64_t next = backlog_next(backlog);
+    for (uint64_t seq = request->before < next ? request->before : next; count < max; ) {
+        EncodedFrame* frame = backlog_get(backlog, --seq);
+        if (frame == NULL || length + frame->length > SERVER_HISTORY_PAGE_BYTES)
+            break;
+        if (server_client_sees(server, client, frame)) {
+            frames[count++] = encoded_frame_retain(frame);
+            length += frame->length;
+        }
+    }
+    backlog_unlock(backlog);
+
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    protocol_frame_encode_history_page_header(&buffer, request->before, count, length);
+    for (int i = count - 1; i >= 0; i--) {
+        buffer_append(&buffer, frames[i]->data, frames[i]->length);
+        encoded_frame_release(frames[i]);
+    }
+    EncodedFrame* page = encoded_frame_finish(&buffer);
+    metrics_frame_out(FRAME_HISTORY_PAGE, page->length);
+    server_deliver(server, &page, 1, &client, 1);
+    encoded_frame_release(page);
+}
+
+// Drop a client that went quiet, or wait out the rest of the timeout from
+// when it was last heard
+static void client_timeout(Timer* timer, void* data) {
+    ChatClient* client = data;
+    ChatServer* server = client->server;
+    uint64_t deadline = client->lastHeard + SERVER_CLIENT_TIMEOUT * 1000;
+    if (deadline > server->now)
+        timer_wheel_schedule(&server->timers, timer, deadline);
+    else
+        client->closed = true;
+}
+
+// Keep receiving into provided buffers until the connection ends. The
+// receive stays armed across completions, so one submission serves many
+// reads.
+static void client_arm_recv(ChatServer* server, ChatClient* client) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&server->uring);
+    if (sqe == NULL) {
+        client->closed = true;
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->socketfd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = server->recvBuffers.group;
+    sqe->user_data = (uint64_t)(uintptr_t)client | URING_OP_RECV;
+    client->inflight++;
+}
+
+// Set up a client for an accepted socket and start watching it
+static void server_add_client(ChatServer* server, int socketfd, struct sockaddr_in* clientAddr) {
+    if (server->noDelay) {
+        int enable = 1;
+        setsockopt(socketfd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+    }
+
+    ChatClient* client = malloc(sizeof(ChatClient));
+    client->server = server;
+    client->socketfd = socketfd;
+    client->name = string_new_static("");
+    client->addr = string_new(24);
+    client->identified = false;
+    client->version = 1;
+    client->compressed = false;
+    compress_stream_init(&client->recvStream, false);
+    client->lastActive = 0;
+    link_stats_init(&client->link);
+    client->lastHeard = server->now;
+    timer_init(&client->timeout, client_timeout, client);
+    client->wantsWrite = false;
+    client->inflight = 0;
+    client->detached = false;
+    client->sends = NULL;
+    client->flushQueued = false;
+    client->closed = false;
+    send_queue_init(&client->sendQueue);
+    client->relays = NULL;
+    client->relayCount = 0;
+    room_set_init(&client->rooms);
+    client->acked = 0;
+    client->resumeSeq = 0;
+    client->rejoins = 0;
+    client->session = 0;
+    if (ringbuffer_init(&client->inBuffer, PROTOCOL_READ_BUFFER_SIZE) < 0) {
+        client_free(client);
+        return;
+    }
+
+    char* addrString;
+    if (asprintf(&addrString, "%s:%hu", inet_ntoa(clientAddr->sin_addr), ntohs(clientAddr->sin_port)) != -1) {
+        string_append_static(&client->addr, addrString);
+        free(addrString);
+    }
+
+    if (server->io == SERVER_IO_URING) {
+        client_arm_recv(server, client);
+        if (client->closed) {
+            client_free(client);
+            return;
+        }
+    } else {
+        struct epoll_event event = {
+            .events = EPOLLIN,
+            .data.ptr = client,
+        };
+        if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, socketfd, &event) < 0) {
+            client_free(client);
+            return;
+        }
+    }
+
+    if (server->clientCount == server->clientCapacity) {
+        server->clientCapacity = server->clientCapacity > 0 ? server->clientCapacity * 2 : 16;
+        server->clients = realloc(server->clients, server->clientCapacity * sizeof(ChatClient*));
+    }
+    client->index = server->clientCount;
+    server->clients[server->clientCount++] = client;
+    server_update_clients(server, 1);
+    timer_wheel_schedule(&server->timers, &client->timeout, server->now + SERVER_CLIENT_TIMEOUT * 1000);
+}
+
+static void server_accept(ChatServer* server) {
+    while (true) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrSize = sizeof(clientAddr);
+        int socketfd = accept4(server->listenfd, (struct sockaddr*)&clientAddr, &clientAddrSize, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socketfd < 0) {
+            if (errno == EINTR)
+                continue;
+            // EAGAIN once the backlog is drained; anything else is retried
+            // on the next readiness notification
+            return;
+        }
+        server_add_client(server, socketfd, &clientAddr);
+    }
+}
+
+static void server_remove_client(ChatServer* server, ChatClient* client) {
+    if (server->io == SERVER_IO_EPOLL)
+        epoll_ctl(server->epollfd, EPOLL_CTL_DEL, client->socketfd, NULL);
+    timer_wheel_cancel(&server->timers, &client->timeout);
+    if (client->identified && server->callbacks.onLeave != NULL)
+        server->callbacks.onLeave(server, client, server->callbackData);
+    room_index_leave_all(&server->rooms, &client->rooms);
+
+    // Swap the last client into the freed slot
+    ChatClient* last = server->clients[--server->clientCount];
+    server_update_clients(server, -1);
+    last->index = client->index;
+    server->clients[client->index] = last;
+
+    // Operations still in flight on io_uring end once the socket is shut
+    // down, and the last of them frees the client
+    if (client->inflight > 0) {
+        shutdown(client->socketfd, SHUT_RDWR);
+        client->detached = true;
+        server->detachedCount++;
+    } else {
+        client_free(client);
+    }
+}
+
+// Forward an attachment chunk under its server-wide transfer id
+static void server_relay_data(ChatServer* server, ChatClient* client, DataFrame* frame) {
+    int index = -1;
+    for (int i = 0; i < client->relayCount; i++) {
+        if (client->relays[i].clientId == frame->transferId) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0)
+        return;
+
+    RelayTransfer* relay = &client->relays[index];
+    frame->transferId = relay->serverId;
+    EncodedFrame* encoded[SERVER_ENCODINGS] = { NULL };
+    server_fan_out(server, client, (Frame*)frame, &relay->room, encoded);
+    // Chunks are not numbered, so they go to the other shards without
+    // waiting on the backlog
+    if (server->shards != NULL) {
+        if (encoded[PROTOCOL_VERSION] == NULL)
+            encoded[PROTOCOL_VERSION] = server_encode_frame(server, (Frame*)frame, PROTOCOL_VERSION, false);
+        server_address(encoded[PROTOCOL_VERSION], &relay->room);
+        server_push_shards(server, server, encoded[PROTOCOL_VERSION]);
+    }
+    server_release_encodings(encoded);
+
+    if (server->callbacks.onData != NULL)
+        server->callbacks.onData(server, client, frame, server->callbackData);
+
+    relay->remaining -= frame->length < relay->remaining ? frame->length : relay->remaining;
+    if (relay->remaining == 0) {
+        string_free(&relay->room);
+        client->relays[index] = client->relays[--client->relayCount];
+    }
+}
+
+static void server_handle_frame(ChatServer* server, ChatClient* client, Frame* frame) {
+    switch (frame->type) {
+        case FRAME_IDENT: {
+            IdentFrame* identFrame = (IdentFrame*)frame;
+            string_free(&client->name);
+            client->name = string_copy(&identFrame->name);
+
+            // Everything after the ident frames is in the lower of the two
+            // versions; the client switches once it reads the response
+            IdentFrame response = {
+                .type = FRAME_IDENT,
+                .name = server->name,
+                .version = PROTOCOL_VERSION,
+                .capabilities = server->compress ? PROTOCOL_CAP_COMPRESSION : 0,
+                .seq = backlog_last(&server_owner(server)->backlog),
+            };
+            client_send_frame(server, client, (Frame*)&response);
+            client->version = identFrame->version < PROTOCOL_VERSION ? identFrame->version : PROTOCOL_VERSION;
+            client->compressed = server->compress && client->version >= 2 && (identFrame->capabilities & PROTOCOL_CAP_COMPRESSION);
+            client->resumeSeq = client->version >= 2 ? identFrame->seq : 0;
+            client->session = client->version >= 2 ? identFrame->session : 0;
+            client->rejoins = client->resumeSeq != 0 ? identFrame->rooms : 0;
+
+            if (!client->identified) {
+                client->identified = true;
+                if (server->callbacks.onJoin != NULL)
+                    server->callbacks.onJoin(server, client, server->callbackData);
+            }
+            break;
+        }
+        case FRAME_MSG: {
+            MsgFrame* msgFrame = (MsgFrame*)frame;
+            if (!client->identified)
+                break;
+            // Attribute the message to its origin and encode it once for all
+            // recipients. The name is only borrowed for as long as the frame
+            // is handled.
+            string_free(&msgFrame->sender);
+            msgFrame->sender = string_view(&client->name);
+            // Only members may post to a room
+            if (msgFrame->room.length > 0) {
+                Room* room = room_index_find(&server->rooms, &msgFrame->room);
+                if (room == NULL || !room_set_has(&client->rooms, room - server->rooms.rooms))
+                    break;
+            }
+            // Version 1 clients announce attachments but cannot send them
+            for (uint8_t i = 0; i < msgFrame->attachmentCount; i++) {
+                uint32_t serverId = chat_server_next_transfer_id(server);
+                if (client->version >= 2 && msgFrame->attachmentSizes[i] > 0) {
+                    client->relays = realloc(client->relays, (client->relayCount + 1) * sizeof(RelayTransfer));
+                    client->relays[client->relayCount++] = (RelayTransfer){
+                        .clientId = msgFrame->attachmentIds[i],
+                        .serverId = serverId,
+                        .remaining = msgFrame->attachmentSizes[i],
+                        .room = string_copy(&msgFrame->room),
+                    };
+                }
+                msgFrame->attachmentIds[i] = serverId;
+            }
+            server_post(server, client, msgFrame);
+            if (server->callbacks.onMessage != NULL)
+                server->callbacks.onMessage(server, client, msgFrame, server->callbackData);
+            break;
+        }
+        case FRAME_PING: {
+            uint64_t now = link_now();
+            PongFrame pongFrame = {
+                .type = FRAME_PONG,
+                .lastActive = server->lastActive,
+                .idle = server_idle_millis(server, now),
+                .sent = now,
+                .echo = ((PingFrame*)frame)->sent,
+            };
+            client_send_frame(server, client, (Frame*)&pongFrame);
+            break;
+        }
+        case FRAME_PONG: {
+            PongFrame* pongFrame = (PongFrame*)frame;
+            client->lastActive = pongFrame->lastActive;
+            if (pongFrame->echo != 0)
+                link_stats_sample(&client->link, pongFrame->echo, pongFrame->sent, link_now());
+            break;
+        }
+        case FRAME_DATA:
+            server_relay_data(server, client, (DataFrame*)frame);
+            break;
+        case FRAME_JOIN:
+            if (client->identified)
+                room_index_join(&server->rooms, client, &client->rooms, &((RoomFrame*)frame)->room);
+            break;
+        case FRAME_LEAVE:
+            if (client->identified)
+                room_index_leave(&server->rooms, &client->rooms, &((RoomFrame*)frame)->room);
+            break;
+        case FRAME_HISTORY_REQUEST:
+            if (client->identified)
+                server_send_history(server, client, (HistoryRequestFrame*)frame);
+            break;
+        case FRAME_HISTORY_PAGE:
+            // Only sent by the server
+            break;
+        case FRAME_ACK: {
+            uint64_t seq = ((AckFrame*)frame)->seq;
+            if (seq > client->acked) {
+                client->acked = seq;
+                uint64_t last = backlog_last(&server_owner(server)->backlog);
+                metrics_record(METRIC_ACK_LAG, last > seq ? last - seq : 0);
+            }
+            break;
+        }
+    }
+}
+
+// Handle every complete frame that is buffered, skipping frame types this
+// build does not know
+static void server_decode_client(ChatServer* server, ChatClient* client) {
+    client->lastHeard = server->now;
+    while (!client->closed) {
+        Frame* frame;
+        int result = protocol_frame_decode_arena(ringbuffer_read_ptr(&client->inBuffer), ringbuffer_used(&client->inBuffer), client->version, &client->recvStream, &server->arena, &frame);
+        if (result < 0) {
+            client->closed = true;
+            break;
+        }
+        if (result == 0)
+            break;
+        ringbuffer_consume(&client->inBuffer, result);
+        if (frame == NULL)
+            continue;
+        metrics_frame_in(frame->type, result);
+        // A resuming client sends the joins it announced right after its
+        // ident, which may take more than one read to arrive. The replay
+        // waits for the last of them, or for any other frame, which means
+        // the client sent fewer.
+        if (client->resumeSeq != 0 && frame->type != FRAME_JOIN)
+            server_replay(server, client);
+        server_handle_frame(server, client, frame);
+        if (frame->type == FRAME_JOIN && client->rejoins > 0)
+            client->rejoins--;
+        if (client->resumeSeq != 0 && client->rejoins == 0)
+            server_replay(server, client);
+        protocol_frame_free(frame);
+    }
+    string_arena_reset(&server->arena);
+}
+
+static void server_read_client(ChatServer* server, ChatClient* client) {
+    ssize_t received = ringbuffer_fill(&client->inBuffer, client->socketfd);
+    if (received == 0 || (received < 0 && errno != EAGAIN)) {
+        client->closed = true;
+        return;
+    }
+    server_decode_client(server, client);
+}
+
+// Queue a batch of frames encoded in the current version on every
+// identified recipient. Clients on the current version share them as they
+// are; the rest get the whole batch rewritten once per encoding.
+static void server_deliver(ChatServer* server, EncodedFrame** frames, int count, ChatClient** recipients, int recipientCount) {
+    EncodedFrame* encoded[SERVER_ENCODINGS] = { NULL };
+    bool joined = false;
+    for (int i = 0; i < recipientCount; i++) {
+        ChatClient* client = recipients[i];
+        if (!client->identified)
+            continue;
+        int encoding = client_encoding(client);
+        if (encoding == PROTOCOL_VERSION) {
+            for (int j = 0; j < count; j++)
+                client_send(server, client, frames[j]);
+            continue;
+        }
+        if (encoded[encoding] == NULL) {
+            if (!joined) {
+                buffer_clear(&server->scratch);
+                for (int j = 0; j < count; j++)
+                    buffer_append(&server->scratch, frames[j]->data, frames[j]->length);
+                joined = true;
+            }
+            if (client->compressed) {
+                encoded[encoding] = server_compress(server, server->scratch.data, server->scratch.length);
+            } else {
+                Buffer converted;
+                buffer_init(&converted, server->scratch.length);
+                protocol_frames_convert(&converted, server->scratch.data, server->scratch.length, client->version);
+                encoded[encoding] = encoded_frame_new(converted.data, converted.length);
+                buffer_free(&converted);
+            }
+        }
+        client_send(server, client, encoded[encoding]);
+    }
+    for (int encoding = 0; encoding < SERVER_ENCODINGS; encoding++) {
+        if (encoded[encoding] != NULL)
+            encoded_frame_release(encoded[encoding]);
+    }
+}
+
+// Take the frames handed over by the host and the other shards, without
+// delivering them yet. Returns how many there were.
+static int server_take_inbox(ChatServer* server) {
+    int count = 0;
+    EncodedFrame* frame;
+    while ((frame = outbox_pop(&server->inbox)) != NULL) {
+        if (count == server->inboxCapacity) {
+            server->inboxCapacity = server->inboxCapacity > 0 ? server->inboxCapacity * 2 : 64;
+            server->inboxFrames = realloc(server->inboxFrames, server->inboxCapacity * sizeof(EncodedFrame*));
+        }
+        server->inboxFrames[count++] = frame;
+    }
+    return count;
+}
+
+// Deliver the frames taken from the inbox. Frames for a room only go to
+// its members on this shard. They are split into runs of frames with the
+// same recipients, delivered in order, so every client still gets its
+// frames in the order they were pushed.
+static void server_deliver_inbox(ChatServer* server, int count) {
+    int start = 0;
+    while (start < count) {
+        char* room = server->inboxFrames[start]->room;
+        int end = start + 1;
+        int messages = server->inboxFrames[start]->data[0] == FRAME_MSG;
+        while (end < count && (room == NULL
+            ? server->inboxFrames[end]->room == NULL
+            : server->inboxFrames[end]->room != NULL && strcmp(server->inboxFrames[end]->room, room) == 0)) {
+            messages += server->inboxFrames[end]->data[0] == FRAME_MSG;
+            end++;
+        }
+        if (room == NULL) {
+            server_deliver(server, server->inboxFrames + start, end - start, server->clients, server->clientCount);
+        } else {
+            String name = string_new_borrowed(room, strlen(room));
+            Room* target = room_index_find(&server->rooms, &name);
+            if (target != NULL) {
+                server_deliver(server, server->inboxFrames + start, end - start, target->members, target->memberCount);
+                metrics_room_add(target->metrics, 0, (uint64_t)messages * target->memberCount);
+            }
+        }
+        start = end;
+    }
+    for (int j = 0; j < count; j++) {
+        outbox_sent(&server->inbox, server->inboxFrames[j]->length);
+        encoded_frame_release(server->inboxFrames[j]);
+    }
+}
+
+static void server_drain_inbox(ChatServer* server) {
+    server_deliver_inbox(server, server_take_inbox(server));
+}
+
+// Clear the inbox's eventfd after it woke the loop
+static void server_wake(ChatServer* server) {
+    uint64_t count;
+    if (read(server->inbox.eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("read");
+}
+
+// Average the round trip estimates of the clients measured so far
+static void server_link_summary(ChatServer* server, LinkStats* summary) {
+    link_stats_init(summary);
+    for (int i = 0; i < server->clientCount; i++) {
+        LinkStats* link = &server->clients[i]->link;
+        if (link->samples == 0)
+            continue;
+        summary->rtt += link->rtt;
+        summary->jitter += link->jitter;
+        summary->skew += link->skew;
+        summary->samples++;
+    }
+    if (summary->samples > 0) {
+        summary->rtt /= summary->samples;
+        summary->jitter /= summary->samples;
+        summary->skew /= summary->samples;
+    }
+}
+
+// Ping every client at once so they share one encoding, report the round
+// trips the last pings measured, then reschedule
+static void server_ping_clients(Timer* timer, void* data) {
+    ChatServer* server = data;
+    uint64_t now = link_now();
+    PingFrame pingFrame = {
+        .type = FRAME_PING,
+        .lastActive = server->lastActive,
+        .idle = server_idle_millis(server, now),
+        .sent = now,
+    };
+    EncodedFrame* encoded[SERVER_ENCODINGS] = { NULL };
+    server_fan_out(server, NULL, (Frame*)&pingFrame, NULL, encoded);
+    server_release_encodings(encoded);
+    if (server->callbacks.onLinkStats != NULL) {
+        LinkStats summary;
+        server_link_summary(server, &summary);
+        server->callbacks.onLinkStats(server, &summary, server->callbackData);
+    }
+    timer_wheel_schedule(&server->timers, timer, timer->deadline + SERVER_PING_INTERVAL * 1000);
+}
+
+// Accept connections until the listening socket fails. Accepted sockets
+// are left blocking so their sends wait for the whole chain to go out.
+static void server_arm_accept(ChatServer* server) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&server->uring);
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server->listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (uint64_t)(uintptr_t)server | URING_OP_ACCEPT;
+}
+
+// Watch the eventfd of the inbox other threads hand frames to
+static void server_arm_wake(ChatServer* server) {
+    struct io_uring_sqe* sqe = uring_get_sqe(&server->uring);
+    if (sqe == NULL)
+        return;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = server->inbox.eventfd;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->user_data = (uint64_t)(uintptr_t)server | URING_OP_WAKE;
+}
+
+static void server_complete_accept(ChatServer* server, struct io_uring_cqe* cqe) {
+    if (cqe->res >= 0) {
+        struct sockaddr_in clientAddr;
+        socklen_t clientAddrSize = sizeof(clientAddr);
+        memset(&clientAddr, 0, sizeof(clientAddr));
+        getpeername(cqe->res, (struct sockaddr*)&clientAddr, &clientAddrSize);
+        server_add_client(server, cqe->res, &clientAddr);
+    }
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        server_arm_accept(server);
+}
+
+// Copy what arrived out of the provided buffer, which goes straight back to
+// the kernel, then decode as with epoll
+static void server_complete_recv(ChatServer* server, ChatClient* client, struct io_uring_cqe* cqe) {
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    if (!more)
+        client->inflight--;
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (cqe->res > 0 && !client->closed && !client->detached) {
+            if ((size_t)cqe->res > ringbuffer_available(&client->inBuffer)) {
+                client->closed = true;
+            } else {
+                memcpy(ringbuffer_write_ptr(&client->inBuffer), uring_buffer(&server->recvBuffers, id), cqe->res);
+                ringbuffer_commit(&client->inBuffer, cqe->res);
+            }
+        }
+        uring_buffer_return(&server->recvBuffers, id);
+    }
+    if (client->detached || client->closed)
+        return;
+    // Out of buffers is the only failure the receive survives
+    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS)) {
+        client->closed = true;
+        return;
+    }
+    if (cqe->res > 0)
+        server_decode_client(server, client);
+    if (!more && !client->closed)
+        client_arm_recv(server, client);
+}
+
+// Release what a send wrote. Once the whole chain has completed, either the
+// client is dropped or whatever was queued meanwhile goes out next.
+static void server_complete_send(ChatServer* server, ChatClient* client, struct io_uring_cqe* cqe) {
+    UringSends* sends = client->sends;
+    client->inflight--;
+    if (cqe->res > 0) {
+        send_queue_advance(&client->sendQueue, cqe->res);
+        sends->remaining -= cqe->res;
+    }
+    if (++sends->completed < sends->count || client->detached)
+        return;
+    client->wantsWrite = false;
+    if (sends->remaining > 0)
+        client->closed = true;
+    else if (!send_queue_empty(&client->sendQueue))
+        client_queue_flush(server, client);
+}
+
+static void server_complete(ChatServer* server, struct io_uring_cqe* cqe) {
+    int op = cqe->user_data & URING_OP_MASK;
+    void* ptr = (void*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+    if (op == URING_OP_ACCEPT) {
+        server_complete_accept(server, cqe);
+    } else if (op == URING_OP_WAKE) {
+        server_wake(server);
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            server_arm_wake(server);
+    } else {
+        ChatClient* client = ptr;
+        if (op == URING_OP_RECV)
+            server_complete_recv(server, client, cqe);
+        else
+            server_complete_send(server, client, cqe);
+        if (client->detached && client->inflight == 0) {
+            server->detachedCount--;
+            client_free(client);
+        }
+    }
+}
+
+// Set up the rings for the io_uring loop; fails on kernels without io_uring
+// or older than 5.19, which lack provided buffer rings and multishot
+// receives
+static int server_uring_init(ChatServer* server) {
+    if (uring_init(&server->uring, SERVER_URING_ENTRIES) < 0)
+        return -1;
+    if (uring_buffers_init(&server->uring, &server->recvBuffers, 0, SERVER_RECV_BUFFERS, SERVER_RECV_BUFFER_SIZE) < 0) {
+        uring_free(&server->uring);
+        return -1;
+    }
+    return 0;
+}
+
+static void server_uring_free(ChatServer* server) {
+    uring_buffers_free(&server->uring, &server->recvBuffers);
+    uring_free(&server->uring);
+}
+
+// Listen on port, or an ephemeral one when it is 0. Shards of one server
+// set reusePort so the kernel spreads connections over their listeners.
+int chat_server_init(ChatServer* server, String name, uint16_t port, bool reusePort) {
+    server->name = name;
+    server->clients = NULL;
+    server->clientCount = 0;
+    server->clientCapacity = 0;
+    server->lastActive = time(NULL);
+    server->lastInput = link_now();
+    server->nextTransferId = 0;
+    // Set until stopped, so a stop that comes before the loop starts holds
+    server->running = true;
+    server->callbacks = (ChatServerCallbacks){ 0 };
+    server->callbackData = NULL;
+    server->epollfd = -1;
+    server->io = SERVER_IO_EPOLL;
+    server->detachedCount = 0;
+    server->inboxFrames = NULL;
+    server->inboxCapacity = 0;
+    server->shards = NULL;
+    server->shardCount = 1;
+    server->connectedCount = 0;
+    room_index_init(&server->rooms);
+    if (backlog_init(&server->backlog, SERVER_BACKLOG_MESSAGES, SERVER_BACKLOG_BYTES) < 0) {
+        perror("backlog");
+        return 1;
+    }
+    buffer_init(&server->scratch, 512);
+    server->compress = false;
+    server->flushes = NULL;
+    server->flushCount = 0;
+    server->flushCapacity = 0;
+    server->noDelay = false;
+    string_arena_init(&server->arena);
+    server->now = timer_now();
+    timer_wheel_init(&server->timers, server->now);
+    timer_init(&server->pingTimer, server_ping_clients, server);
+    compress_stream_init(&server->compressor, true);
+    buffer_init(&server->compressed, 0);
+    // Nothing limits the inbox: frames relayed between shards are never
+    // dropped, and a slow client only holds up its own send queue
+    if (outbox_init(&server->inbox, SIZE_MAX) < 0) {
+        perror("eventfd");
+        return 1;
+    }
+    fcntl(server->inbox.eventfd, F_SETFL, O_NONBLOCK);
+
+    server->listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->listenfd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    int enable = 1;
+    setsockopt(server->listenfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (reusePort && setsockopt(server->listenfd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        perror("SO_REUSEPORT");
+        return 1;
+    }
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr = {
+            .s_addr = INADDR_ANY
+        }
+    };
+
+    if (bind(server->listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    if (listen(server->listenfd, SOMAXCONN) < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    // Report the actual port when an ephemeral one was requested
+    socklen_t addrSize = sizeof(addr);
+    getsockname(server->listenfd, (struct sockaddr*)&addr, &addrSize);
+    server->port = ntohs(addr.sin_port);
+
+    server->epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (server->epollfd < 0) {
+        perror("epoll");
+        return 1;
+    }
+
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &server->listenfd };
+    epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->listenfd, &event);
+    event.data.ptr = &server->inbox;
+    epoll_ctl(server->epollfd, EPOLL_CTL_ADD, server->inbox.eventfd, &event);
+    return 0;
+}
+
+// Clients are only removed at the end of a pass so the array stays stable
+// while events and fan-outs are being processed
+static void server_end_pass(ChatServer* server) {
+    server_drain_inbox(server);
+    timer_wheel_advance(&server->timers, server->now);
+    server_flush_clients(server);
+    for (int i = server->clientCount - 1; i >= 0; i--) {
+        if (server->clients[i]->closed)
+            server_remove_client(server, server->clients[i]);
+    }
+}
+
+static int server_run_epoll(ChatServer* server) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (__atomic_load_n(&server->running, __ATOMIC_ACQUIRE)) {
+        int timeout = timer_wheel_timeout(&server->timers, server->now);
+        if (!outbox_sleep(&server->inbox))
+            timeout = 0;
+        int eventCount = epoll_wait(server->epollfd, events, SERVER_MAX_EVENTS, timeout);
+        metrics_add(METRIC_SYSCALL_EPOLL_WAIT, 1);
+        outbox_awake(&server->inbox);
+        server->now = timer_now();
+        if (eventCount < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return 1;
+        }
+
+        for (int i = 0; i < eventCount; i++) {
+            void* ptr = events[i].data.ptr;
+            if (ptr == &server->listenfd) {
+                server_accept(server);
+            } else if (ptr == &server->inbox) {
+                server_wake(server);
+            } else {
+                ChatClient* client = ptr;
+                if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    client->closed = true;
+                if (!client->closed && (events[i].events & EPOLLOUT))
+                    client_flush(server, client);
+                if (!client->closed && (events[i].events & EPOLLIN))
+                    server_read_client(server, client);
+            }
+        }
+        server_end_pass(server);
+    }
+    return 0;
+}
+
+static bool server_uring_busy(ChatServer* server) {
+    if (server->detachedCount > 0)
+        return true;
+    for (int i = 0; i < server->clientCount; i++) {
+        if (server->clients[i]->inflight > 0)
+            return true;
+    }
+    return false;
+}
+
+// Each pass submits what the last one queued and waits in the same call
+static int server_run_uring(ChatServer* server) {
+    server_arm_accept(server);
+    server_arm_wake(server);
+    while (__atomic_load_n(&server->running, __ATOMIC_ACQUIRE)) {
+        long timeout = timer_wheel_timeout(&server->timers, server->now);
+        if (!outbox_sleep(&server->inbox))
+            timeout = 0;
+        int result = uring_submit(&server->uring, 1, timeout);
+        outbox_awake(&server->inbox);
+        if (result < 0) {
+            perror("io_uring_enter");
+            return 1;
+        }
+        server->now = timer_now();
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&server->uring)) != NULL) {
+            struct io_uring_cqe completion = *cqe;
+            uring_cqe_seen(&server->uring);
+            server_complete(server, &completion);
+        }
+        server_end_pass(server);
+    }
+
+    // Shut every connection down and wait out their operations, so none
+    // still points into a client when it is freed
+    for (int i = 0; i < server->clientCount; i++)
+        shutdown(server->clients[i]->socketfd, SHUT_RDWR);
+    uint64_t deadline = timer_now() + 1000;
+    while (server_uring_busy(server) && timer_now() < deadline) {
+        if (uring_submit(&server->uring, 1, 100) < 0)
+            break;
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek_cqe(&server->uring)) != NULL) {
+            struct io_uring_cqe completion = *cqe;
+            uring_cqe_seen(&server->uring);
+            server_complete(server, &completion);
+        }
+    }
+    return 0;
+}
+
+int chat_server_run(ChatServer* server) {
+    if (server->io == SERVER_IO_URING && server_uring_init(server) < 0) {
+        perror("io_uring, falling back to epoll");
+        server->io = SERVER_IO_EPOLL;
+    }
+    server->now = timer_now();
+    timer_wheel_schedule(&server->timers, &server->pingTimer, server->now + SERVER_PING_INTERVAL * 1000);
+    return server->io == SERVER_IO_URING ? server_run_uring(server) : server_run_epoll(server);
+}
+
+void chat_server_stop(ChatServer* server) {
+    __atomic_store_n(&server->running, false, __ATOMIC_RELEASE);
+    outbox_wake(&server->inbox);
+}
+
+// Queue frames from the host, already encoded in the current protocol
+// version, for every client on every shard. Safe to call from any thread.
+// Attachment chunks go out this way even when announced in a room; clients
+// that never got the announcement drop them as an unknown transfer.
+void chat_server_broadcast_bytes(ChatServer* server, const uint8_t* data, size_t length) {
+    EncodedFrame* encoded = encoded_frame_new(data, length);
+    server_push_shards(server, NULL, encoded);
+    encoded_frame_release(encoded);
+}
+
+// Queue a frame from the host for every client on every shard, or for the
+// members of its room if it is a message posted to one. Messages are
+// numbered like the clients', which sets their seq. Safe to call from any
+// thread.
+void chat_server_broadcast(ChatServer* server, Frame* frame) {
+    bool numbered = frame->type == FRAME_MSG;
+    if (numbered)
+        ((MsgFrame*)frame)->seq = UINT64_MAX;
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    protocol_frame_encode(&buffer, frame);
+    EncodedFrame* encoded = encoded_frame_finish(&buffer);
+    metrics_frame_out(frame->type, encoded->length);
+    if (numbered && ((MsgFrame*)frame)->room.length > 0) {
+        MsgFrame* msgFrame = (MsgFrame*)frame;
+        server_address(encoded, &msgFrame->room);
+        metrics_room_add(metrics_room(string_data(&msgFrame->room), msgFrame->room.length), 1, 0);
+    }
+    if (numbered) {
+        Backlog* backlog = &server_owner(server)->backlog;
+        uint64_t seq = server_number(server, encoded);
+        ((MsgFrame*)frame)->seq = seq;
+        backlog_wait_turn(backlog, seq);
+        server_push_shards(server, NULL, encoded);
+        backlog_publish(backlog, seq);
+    } else {
+        server_push_shards(server, NULL, encoded);
+    }
+    encoded_frame_release(encoded);
+}
+
+// Allocate a transfer id that is unique across every client and the host
+uint32_t chat_server_next_transfer_id(ChatServer* server) {
+    return __atomic_fetch_add(&server_owner(server)->nextTransferId, 1, __ATOMIC_RELAXED);
+}
+
+void chat_server_free(ChatServer* server) {
+    if (server->io == SERVER_IO_URING)
+        server_uring_free(server);
+    for (int i = 0; i < server->clientCount; i++)
+        client_free(server->clients[i]);
+    free(server->clients);
+    room_index_free(&server->rooms);
+    backlog_free(&server->backlog);
+    free(server->flushes);
+    string_arena_free(&server->arena);
+    if (server->listenfd >= 0)
+        close(server->listenfd);
+    if (server->epollfd >= 0)
+        close(server->epollfd);
+    outbox_free(&server->inbox);
+    free(server->inboxFrames);
+    buffer_free(&server->scratch);
+    compress_stream_free(&server->compressor);
+    buffer_free(&server->compressed);
+}
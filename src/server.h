@@ -0,0 +1,204 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        server.h
+// Description: This file contains the definitions for the ChatServer, a
+//              single-threaded event loop hosting many clients at once, on
+//              epoll or io_uring. Several can share a port as the shards of
+//              one server, each on its own thread.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "string.h"
+#include "buffer.h"
+#include "ringbuffer.h"
+#include "sendqueue.h"
+#include "protocol.h"
+#include "timerwheel.h"
+#include "linkstats.h"
+#include "uring.h"
+#include "outbox.h"
+#include "rooms.h"
+#include "backlog.h"
+
+#define SERVER_MAX_EVENTS 256
+#define SERVER_PING_INTERVAL 2
+// Clients not heard from for this many seconds, pongs included, are dropped
+#define SERVER_CLIENT_TIMEOUT 15
+// Clients with this many bytes queued that they have not read are dropped,
+// well above a full replay of the backlog
+#define SERVER_CLIENT_HIGH_WATER (16 * 1024 * 1024)
+// io_uring submission entries, and the provided buffers receives land in
+#define SERVER_URING_ENTRIES 4096
+#define SERVER_RECV_BUFFERS 1024
+#define SERVER_RECV_BUFFER_SIZE 4096
+// Sends linked into one chain per client, each with up to SEND_QUEUE_MAX_IOV
+// frames
+#define SERVER_SEND_LINKS 4
+// Each frame is encoded at most once per protocol version, compressed or not
+#define SERVER_ENCODINGS (2 * (PROTOCOL_VERSION + 1))
+// Messages kept for clients resuming a lost session, by count and by bytes
+#define SERVER_BACKLOG_MESSAGES 4096
+#define SERVER_BACKLOG_BYTES (4 * 1024 * 1024)
+// Most bytes of messages sent in one history page, well inside a client's
+// receive buffer
+#define SERVER_HISTORY_PAGE_BYTES (PROTOCOL_READ_BUFFER_SIZE / 2)
+
+// Attachment being relayed from a client, with the id it was given on the
+// server so transfers from different clients never collide
+typedef struct {
+    uint32_t clientId;
+    uint32_t serverId;
+    uint64_t remaining;
+    // Room the announcing message went to, whose members get the data too
+    String room;
+} RelayTransfer;
+
+typedef struct ChatServer ChatServer;
+
+// How the loop waits for sockets. io_uring falls back to epoll when the
+// kernel does not support it.
+typedef enum {
+    SERVER_IO_EPOLL,
+    SERVER_IO_URING,
+} ServerIo;
+
+// A chain of linked sends in flight on io_uring. The kernel reads the
+// headers and iovecs until the last send completes.
+typedef struct {
+    struct msghdr headers[SERVER_SEND_LINKS];
+    struct iovec iov[SERVER_SEND_LINKS * SEND_QUEUE_MAX_IOV];
+    int count;
+    int completed;
+    // Bytes of the chain not reported sent yet
+    size_t remaining;
+} UringSends;
+
+typedef struct ChatClient {
+    ChatServer* server;
+    int socketfd;
+    int index;
+    String name;
+    String addr;
+    bool identified;
+    // Protocol version agreed on in the ident exchange
+    uint8_t version;
+    // Whether frames are compressed in both directions, and the window for
+    // the frames the client compressed against earlier ones
+    bool compressed;
+    CompressStream recvStream;
+    uint32_t lastActive;
+    // Round trips of the server's pings to this client
+    LinkStats link;
+    // Loop time of the last read, checked when the timeout expires rather
+    // than rescheduling it on every read
+    uint64_t lastHeard;
+    Timer timeout;
+    RingBuffer inBuffer;
+    SendQueue sendQueue;
+    RelayTransfer* relays;
+    int relayCount;
+    // Rooms joined, on the server's index
+    RoomSet rooms;
+    // Last message the client acked, and where it asked to resume a lost
+    // session from until that is replayed, once the joins it announced in
+    // its ident have put it back in its rooms
+    uint64_t acked;
+    uint64_t resumeSeq;
+    int rejoins;
+    // Session from the client's ident, kept across its reconnects
+    uint64_t session;
+    // Waiting for the socket to drain: EPOLLOUT is on, or on io_uring a
+    // chain of sends is in flight
+    bool wantsWrite;
+    // io_uring operations not completed yet, and the sends, allocated on
+    // first use. A removed client is freed once the last one completes.
+    int inflight;
+    bool detached;
+    UringSends* sends;
+    // Set while the client is on the server's list to flush
+    bool flushQueued;
+    bool closed;
+} ChatClient;
+
+// Hooks for the host application, called on the thread of the shard the
+// client is on
+typedef struct {
+    void (*onJoin)(ChatServer* server, ChatClient* client, void* data);
+    void (*onLeave)(ChatServer* server, ChatClient* client, void* data);
+    void (*onMessage)(ChatServer* server, ChatClient* client, MsgFrame* frame, void* data);
+    void (*onData)(ChatServer* server, ChatClient* client, DataFrame* frame, void* data);
+    // Round trips averaged over the clients, after each round of pings
+    void (*onLinkStats)(ChatServer* server, LinkStats* summary, void* data);
+} ChatServerCallbacks;
+
+struct ChatServer {
+    String name;
+    int listenfd;
+    int epollfd;
+    ServerIo io;
+    Uring uring;
+    UringBuffers recvBuffers;
+    // Removed clients waiting for their io_uring operations to complete
+    int detachedCount;
+    uint16_t port;
+    ChatClient** clients;
+    int clientCount;
+    int clientCapacity;
+    // Frames from the host and the other shards, encoded in the current
+    // protocol version. Its eventfd also wakes the loop to stop.
+    Outbox inbox;
+    EncodedFrame** inboxFrames;
+    int inboxCapacity;
+    // Every shard of the server, this one included, or NULL when it runs
+    // alone. Messages from clients are handed to the others' inboxes.
+    ChatServer* shards;
+    int shardCount;
+    // Clients across all shards, kept on the first
+    int connectedCount;
+    // Rooms the clients on this shard are in. Each shard has its own, and
+    // room messages from other shards are matched to it by name.
+    RoomIndex rooms;
+    // Messages numbered across every shard, kept on the first
+    Backlog backlog;
+    Buffer scratch;
+    // Offer compression to clients that support it. Frames are compressed
+    // on their own so one encoding is shared by every recipient.
+    bool compress;
+    CompressStream compressor;
+    Buffer compressed;
+    // Clients with frames queued during this pass of the loop. They are
+    // written once at the end, so a burst of frames leaves in one writev.
+    ChatClient** flushes;
+    int flushCount;
+    int flushCapacity;
+    // Disable Nagle's algorithm on accepted sockets
+    bool noDelay;
+    // Strings of the frames being handled, released after each read
+    StringArena arena;
+    // Pings and client timeouts, and the time the loop last woke up in
+    // milliseconds
+    TimerWheel timers;
+    Timer pingTimer;
+    uint64_t now;
+    // Host's last input, on the wall clock for version 1 clients and the
+    // monotonic clock in nanoseconds for the others
+    uint32_t lastActive;
+    uint64_t lastInput;
+    uint32_t nextTransferId;
+    bool running;
+    ChatServerCallbacks callbacks;
+    void* callbackData;
+};
+
+int chat_server_init(ChatServer* server, String name, uint16_t port, bool reusePort);
+int chat_server_run(ChatServer* server);
+void chat_server_stop(ChatServer* server);
+void chat_server_broadcast(ChatServer* server, Frame* frame);
+void chat_server_broadcast_bytes(ChatServer* server, const uint8_t* data, size_t length);
+uint32_t chat_server_next_transfer_id(ChatServer* server);
+void chat_server_free(ChatServer* server);
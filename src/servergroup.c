@@ -0,0 +1,254 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        servergroup.c
+// Description: This file contains the implementation for the ServerGroup.
+
+#define _GNU_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "string.h"
+#include "buffer.h"
+#include "protocol.h"
+#include "sendqueue.h"
+#include "outbox.h"
+#include "server.h"
+#include "servergroup.h"
+#include "linkstats.h"
+
+// What a shard tells the host, queued as an encoded frame whose first byte
+// is the kind
+typedef enum {
+    GROUP_EVENT_JOIN,
+    GROUP_EVENT_LEAVE,
+    // Followed by the message frame in the current protocol version
+    GROUP_EVENT_MESSAGE,
+    // Followed by the data frame
+    GROUP_EVENT_DATA,
+    // Followed by the shard's index and its summary
+    GROUP_EVENT_LINK_STATS,
+} GroupEventType;
+
+static void server_group_push(ServerGroup* group, Buffer* buffer) {
+    EncodedFrame* event = encoded_frame_finish(buffer);
+    outbox_push(&group->events, event);
+    encoded_frame_release(event);
+}
+
+static void server_group_push_name(ServerGroup* group, GroupEventType type, String* name) {
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    buffer_append_uint8(&buffer, type);
+    buffer_append(&buffer, string_data(name), name->length);
+    server_group_push(group, &buffer);
+}
+
+static void server_group_push_frame(ServerGroup* group, GroupEventType type, Frame* frame) {
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    buffer_append_uint8(&buffer, type);
+    protocol_frame_encode(&buffer, frame);
+    server_group_push(group, &buffer);
+}
+
+static void server_group_on_join(ChatServer* server, ChatClient* client, void* data) {
+    server_group_push_name(data, GROUP_EVENT_JOIN, &client->name);
+}
+
+static void server_group_on_leave(ChatServer* server, ChatClient* client, void* data) {
+    server_group_push_name(data, GROUP_EVENT_LEAVE, &client->name);
+}
+
+static void server_group_on_message(ChatServer* server, ChatClient* client, MsgFrame* frame, void* data) {
+    server_group_push_frame(data, GROUP_EVENT_MESSAGE, (Frame*)frame);
+}
+
+static void server_group_on_data(ChatServer* server, ChatClient* client, DataFrame* frame, void* data) {
+    server_group_push_frame(data, GROUP_EVENT_DATA, (Frame*)frame);
+}
+
+static void server_group_on_link_stats(ChatServer* server, LinkStats* summary, void* data) {
+    ServerGroup* group = data;
+    uint32_t index = server - group->shards;
+    Buffer buffer;
+    encoded_frame_begin(&buffer);
+    buffer_append_uint8(&buffer, GROUP_EVENT_LINK_STATS);
+    buffer_append(&buffer, &index, sizeof(index));
+    buffer_append(&buffer, summary, sizeof(LinkStats));
+    server_group_push(group, &buffer);
+}
+
+// Average the shards' summaries, weighted by the clients each measured
+static void server_group_link_stats(ServerGroup* group, uint32_t index, LinkStats* summary) {
+    group->links[index] = *summary;
+    LinkStats combined;
+    link_stats_init(&combined);
+    for (int i = 0; i < group->shardCount; i++) {
+        LinkStats* link = &group->links[i];
+        combined.rtt += link->rtt * link->samples;
+        combined.jitter += link->jitter * link->samples;
+        combined.skew += link->skew * link->samples;
+        combined.samples += link->samples;
+    }
+    if (combined.samples > 0) {
+        combined.rtt /= combined.samples;
+        combined.jitter /= combined.samples;
+        combined.skew /= combined.samples;
+    }
+    if (group->callbacks.onLinkStats != NULL)
+        group->callbacks.onLinkStats(group, &combined, group->callbackData);
+}
+
+static void server_group_dispatch(ServerGroup* group, EncodedFrame* event) {
+    ServerGroupCallbacks* callbacks = &group->callbacks;
+    const uint8_t* payload = event->data + 1;
+    size_t length = event->length - 1;
+    switch (event->data[0]) {
+        case GROUP_EVENT_JOIN:
+        case GROUP_EVENT_LEAVE: {
+            String name = string_new_borrowed((char*)payload, length);
+            void (*hook)(ServerGroup*, String*, void*) = event->data[0] == GROUP_EVENT_JOIN ? callbacks->onJoin : callbacks->onLeave;
+            if (hook != NULL)
+                hook(group, &name, group->callbackData);
+            break;
+        }
+        case GROUP_EVENT_MESSAGE:
+        case GROUP_EVENT_DATA: {
+            Frame* frame;
+            if (protocol_frame_decode(payload, length, &frame) <= 0 || frame == NULL)
+                break;
+            if (frame->type == FRAME_MSG && callbacks->onMessage != NULL)
+                callbacks->onMessage(group, (MsgFrame*)frame, group->callbackData);
+            else if (frame->type == FRAME_DATA && callbacks->onData != NULL)
+                callbacks->onData(group, (DataFrame*)frame, group->callbackData);
+            protocol_frame_free(frame);
+            break;
+        }
+        case GROUP_EVENT_LINK_STATS: {
+            uint32_t index;
+            LinkStats summary;
+            memcpy(&index, payload, sizeof(index));
+            memcpy(&summary, payload + sizeof(index), sizeof(LinkStats));
+            server_group_link_stats(group, index, &summary);
+            break;
+        }
+    }
+}
+
+// Call the host's hooks for every event the shards queue, in the order
+// they were queued, until the group is stopped
+static void* server_group_dispatch_loop(void* arg) {
+    ServerGroup* group = arg;
+    bool open;
+    do {
+        open = outbox_wait(&group->events);
+        EncodedFrame* event;
+        while ((event = outbox_pop(&group->events)) != NULL) {
+            server_group_dispatch(group, event);
+            outbox_sent(&group->events, event->length);
+            encoded_frame_release(event);
+        }
+    } while (open);
+    return NULL;
+}
+
+// Set up shardCount shards listening on port, or on one ephemeral port
+// picked by the first when it is 0. The host's callbacks and the options of
+// each shard are set before server_group_start.
+int server_group_init(ServerGroup* group, String name, uint16_t port, int shardCount) {
+    group->shardCount = shardCount > 0 ? shardCount : 1;
+    group->shards = calloc(group->shardCount, sizeof(ChatServer));
+    group->threads = calloc(group->shardCount, sizeof(pthread_t));
+    group->links = calloc(group->shardCount, sizeof(LinkStats));
+    group->callbacks = (ServerGroupCallbacks){ 0 };
+    group->callbackData = NULL;
+    if (outbox_init(&group->events, SERVER_GROUP_EVENTS_HIGH_WATER) != 0) {
+        group->shardCount = 0;
+        return 1;
+    }
+
+    bool sharded = group->shardCount > 1;
+    for (int i = 0; i < group->shardCount; i++) {
+        ChatServer* shard = &group->shards[i];
+        if (chat_server_init(shard, name, port, sharded) != 0) {
+            // Only the shards set up so far are freed
+            group->shardCount = i + 1;
+            return 1;
+        }
+        port = shard->port;
+        link_stats_init(&group->links[i]);
+        shard->callbacks = (ChatServerCallbacks){
+            .onJoin = server_group_on_join,
+            .onLeave = server_group_on_leave,
+            .onMessage = server_group_on_message,
+            .onData = server_group_on_data,
+            .onLinkStats = server_group_on_link_stats,
+        };
+        shard->callbackData = group;
+        if (sharded) {
+            shard->shards = group->shards;
+            shard->shardCount = group->shardCount;
+        }
+    }
+    group->port = port;
+    return 0;
+}
+
+// Run every shard on a thread of its own, and the host's hooks on another
+int server_group_start(ServerGroup* group) {
+    if (pthread_create(&group->dispatchThread, NULL, server_group_dispatch_loop, group) != 0) {
+        perror("pthread_create");
+        return 1;
+    }
+    for (int i = 0; i < group->shardCount; i++) {
+        if (pthread_create(&group->threads[i], NULL, (void* (*)(void*))chat_server_run, &group->shards[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Stop every shard and wait for them, so none is still handing frames to
+// the others when they are freed, then for the host's hooks to catch up
+void server_group_stop(ServerGroup* group) {
+    for (int i = 0; i < group->shardCount; i++)
+        chat_server_stop(&group->shards[i]);
+    for (int i = 0; i < group->shardCount; i++)
+        pthread_join(group->threads[i], NULL);
+    outbox_close(&group->events);
+    pthread_join(group->dispatchThread, NULL);
+}
+
+void server_group_broadcast(ServerGroup* group, Frame* frame) {
+    chat_server_broadcast(&group->shards[0], frame);
+}
+
+void server_group_broadcast_bytes(ServerGroup* group, const uint8_t* data, size_t length) {
+    chat_server_broadcast_bytes(&group->shards[0], data, length);
+}
+
+uint32_t server_group_next_transfer_id(ServerGroup* group) {
+    return chat_server_next_transfer_id(&group->shards[0]);
+}
+
+// Record the host's last input, sent to clients in pings and pongs
+void server_group_input(ServerGroup* group, uint32_t lastActive, uint64_t lastInput) {
+    for (int i = 0; i < group->shardCount; i++) {
+        group->shards[i].lastActive = lastActive;
+        __atomic_store_n(&group->shards[i].lastInput, lastInput, __ATOMIC_RELAXED);
+    }
+}
+
+void server_group_free(ServerGroup* group) {
+    for (int i = 0; i < group->shardCount; i++)
+        chat_server_free(&group->shards[i]);
+    free(group->shards);
+    free(group->threads);
+    free(group->links);
+    outbox_free(&group->events);
+}
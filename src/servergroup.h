@@ -0,0 +1,63 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        servergroup.h
+// Description: This file contains the definitions for the ServerGroup, a
+//              server split into shards that each run their own loop on
+//              their own thread, with their own listener on the shared
+//              port, clients and pools. Shards reach each other only
+//              through their lock-free inboxes, and the host through a
+//              queue of events.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "string.h"
+#include "server.h"
+#include "outbox.h"
+#include "linkstats.h"
+
+// Events from the shards are dropped once this many bytes wait for the
+// host, so a host that cannot keep up loses them rather than holding up
+// every client
+#define SERVER_GROUP_EVENTS_HIGH_WATER (64 * 1024 * 1024)
+
+typedef struct ServerGroup ServerGroup;
+
+// Hooks for the host application. They are called one at a time on the
+// group's dispatch thread, never on a shard, so drawing and writing
+// downloads do not stall the loops. Nothing is borrowed from the shards:
+// a message's sender is the name of the client that posted it.
+typedef struct {
+    void (*onJoin)(ServerGroup* group, String* name, void* data);
+    void (*onLeave)(ServerGroup* group, String* name, void* data);
+    void (*onMessage)(ServerGroup* group, MsgFrame* frame, void* data);
+    void (*onData)(ServerGroup* group, DataFrame* frame, void* data);
+    // Round trips averaged over every shard's clients
+    void (*onLinkStats)(ServerGroup* group, LinkStats* summary, void* data);
+} ServerGroupCallbacks;
+
+struct ServerGroup {
+    ChatServer* shards;
+    int shardCount;
+    pthread_t* threads;
+    uint16_t port;
+    ServerGroupCallbacks callbacks;
+    void* callbackData;
+    // Events the shards queued for the host, drained by the dispatch thread
+    Outbox events;
+    pthread_t dispatchThread;
+    // Last round trip summary of each shard, combined for the host
+    LinkStats* links;
+};
+
+int server_group_init(ServerGroup* group, String name, uint16_t port, int shardCount);
+int server_group_start(ServerGroup* group);
+void server_group_stop(ServerGroup* group);
+void server_group_broadcast(ServerGroup* group, Frame* frame);
+void server_group_broadcast_bytes(ServerGroup* group, const uint8_t* data, size_t length);
+uint32_t server_group_next_transfer_id(ServerGroup* group);
+void server_group_input(ServerGroup* group, uint32_t lastActive, uint64_t lastInput);
+void server_group_free(ServerGroup* group);
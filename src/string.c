@@ -8,7 +8,6 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
 #include "string.h"
 
 // Instantiate a string with an intial capacity
@@ -25,65 +24,116 @@ String string_new_static(char* data) {
     return string;
 }
 
+// Wrap terminated bytes owned by something else, which must outlive the string
+String string_new_borrowed(char* data, int length) {
+    String string;
+    string.length = length;
+    string.allocated = 0;
+    string.text.pointer = data;
+    return string;
+}
+
+// Copy bytes into an arena. The string is released with the arena rather
+// than with string_free.
+String string_new_arena(StringArena* arena, const char* data, int length) {
+    size_t size = length + 1;
+    StringArenaBlock* block = arena->blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t blockSize = size > STRING_ARENA_BLOCK_SIZE ? size : STRING_ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(StringArenaBlock) + blockSize);
+        block->used = 0;
+        block->size = blockSize;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+    char* bytes = block->data + block->used;
+    block->used += size;
+    memcpy(bytes, data, length);
+    bytes[length] = '\0';
+    return string_new_borrowed(bytes, length);
+}
+
 // Initialize an existing string struct
 void string_init(String* string, int initialSize) {
+    int size = (initialSize > 0 ? initialSize : 0) + 1;
     string->length = 0;
-    string->allocated = (initialSize > 0 ? initialSize : 0) + 1;
-    string->data = malloc(string->allocated);
-    string->data[0] = '\0';
+    if (size <= STRING_INLINE_SIZE) {
+        string->allocated = STRING_INLINE;
+        string->text.bytes[0] = '\0';
+    } else {
+        string->allocated = size;
+        string->text.pointer = malloc(size);
+        string->text.pointer[0] = '\0';
+    }
 }
 
-
 // Initialize an existing string struct with static data
 void string_init_static(String* string, char* data) {
-    string->data = data;
-    string->length = strlen(data);
-    string->allocated = 0;
+    *string = string_new_borrowed(data, strlen(data));
 }
 
-// Grow a string's capacity to fit the current size plus some additional size
+// Grow a string's capacity to fit the current size plus some additional
+// size. Borrowed bytes are copied into storage the string owns first.
 void string_grow(String* string, int additionalSize) {
     int newSize = string->length + additionalSize + 1;
-    if (newSize > string->allocated) {
+    int capacity = string->allocated == STRING_INLINE ? STRING_INLINE_SIZE : string->allocated;
+    if (newSize <= capacity)
+        return;
+
+    if (string->allocated > 0) {
         // Allocate to smallest power of 2 which fits the needed buffer size
-        int oldSize = string->allocated;
-        string->allocated = (int)pow(2, ceil(log2(newSize)));
-        if (oldSize > 0)
-            string->data = realloc(string->data, string->allocated);
-        else
-            string->data = malloc(string->allocated);
+        string->allocated = 1 << (32 - __builtin_clz(newSize - 1));
+        string->text.pointer = realloc(string->text.pointer, string->allocated);
+        return;
+    }
+    char* old = string_data(string);
+    if (newSize <= STRING_INLINE_SIZE) {
+        // Only a borrowed string can get here; its bytes are elsewhere
+        memmove(string->text.bytes, old, string->length);
+        string->text.bytes[string->length] = '\0';
+        string->allocated = STRING_INLINE;
+        return;
     }
+    int size = 1 << (32 - __builtin_clz(newSize - 1));
+    char* data = malloc(size);
+    memcpy(data, old, string->length);
+    data[string->length] = '\0';
+    string->text.pointer = data;
+    string->allocated = size;
 }
 
 // Append a char* to the current string buffer
 void string_append_static(String* string, char* data) {
     int length = strlen(data);
     string_grow(string, length);
-    memcpy(string->data + string->length, data, length);
+    char* bytes = string_data(string);
+    memcpy(bytes + string->length, data, length);
     string->length += length;
-    string->data[string->length] = '\0';
+    bytes[string->length] = '\0';
 }
 
 // Append another string instance
 void string_append(String* string, String* other) {
     string_grow(string, other->length);
-    memcpy(string->data + string->length, other->data, other->length);
+    char* bytes = string_data(string);
+    memcpy(bytes + string->length, string_data(other), other->length);
     string->length += other->length;
-    string->data[string->length] = '\0';
+    bytes[string->length] = '\0';
 }
 
 // Append a single char
 void string_append_char(String* string, char c) {
     string_grow(string, 1);
-    string->data[string->length] = c;
+    char* bytes = string_data(string);
+    bytes[string->length] = c;
     string->length++;
-    string->data[string->length] = '\0';
+    bytes[string->length] = '\0';
 }
 
-// Free the allocated buffer if this string is not static
+// Free the allocated buffer if this string owns one
 void string_free(String* string) {
     if (string->allocated > 0) {
-        free(string->data);
+        free(string->text.pointer);
     }
 }
 
@@ -91,20 +141,74 @@ void string_free(String* string) {
 void string_pop_char(String* string) {
     if (string->length > 0) {
         string->length--;
-        string->data[string->length] = '\0';
+        string_data(string)[string->length] = '\0';
     }
 }
 
-// Empty string content without deallocating buffer
+// Empty string content without deallocating buffer. A borrowed string
+// lets go of its bytes instead of writing to them.
 void string_clear(String* string) {
     string->length = 0;
-    string->data[0] = '\0';
+    if (string->allocated == 0)
+        string->allocated = STRING_INLINE;
+    string_data(string)[0] = '\0';
 }
 
-// Copy the current string into a new instance
+// Copy the current string into a new instance, inline when it fits
 String string_copy(String* string) {
-    String copy = string_new(string->length);
-    string_append(&copy, string);
+    String copy;
+    copy.length = string->length;
+    char* data;
+    if (string->length < STRING_INLINE_SIZE) {
+        copy.allocated = STRING_INLINE;
+        data = copy.text.bytes;
+    } else {
+        copy.allocated = string->length + 1;
+        data = copy.text.pointer = malloc(copy.allocated);
+    }
+    memcpy(data, string_data(string), string->length);
+    data[string->length] = '\0';
     return copy;
 }
 
+// Move a string's contents out, leaving it empty. Whoever receives them
+// frees them; nothing is copied or allocated.
+String string_take(String* string) {
+    String taken = *string;
+    string->length = 0;
+    string->allocated = STRING_INLINE;
+    string->text.bytes[0] = '\0';
+    return taken;
+}
+
+// Borrow a string's bytes without copying them. The view is never freed
+// and must not outlive the string or its next change.
+String string_view(String* string) {
+    return string_new_borrowed(string_data(string), string->length);
+}
+
+void string_arena_init(StringArena* arena) {
+    arena->blocks = NULL;
+}
+
+// Release every string in the arena at once, keeping the newest block for
+// the strings that follow
+void string_arena_reset(StringArena* arena) {
+    StringArenaBlock* block = arena->blocks;
+    if (block == NULL)
+        return;
+    StringArenaBlock* older = block->next;
+    while (older != NULL) {
+        StringArenaBlock* next = older->next;
+        free(older);
+        older = next;
+    }
+    block->next = NULL;
+    block->used = 0;
+}
+
+void string_arena_free(StringArena* arena) {
+    string_arena_reset(arena);
+    free(arena->blocks);
+    arena->blocks = NULL;
+}
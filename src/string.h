@@ -4,18 +4,52 @@
 // Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
 // File:        string.h
 // Description: This file contains the type definitions for the String
-//              utility class.
+//              utility class. Short strings are stored inline, longer ones
+//              on the heap, and strings may also borrow bytes owned by
+//              something else, such as a StringArena.
 
 #pragma once
+#include <stddef.h>
+
+// Strings up to this size, terminator included, need no allocation
+#define STRING_INLINE_SIZE 16
+// Value of allocated for a string stored inline
+#define STRING_INLINE -1
+
+#define STRING_ARENA_BLOCK_SIZE 4096
 
 typedef struct {
-    char* data;
     int length;
+    // Capacity of the heap buffer, STRING_INLINE, or 0 when the bytes are
+    // borrowed and never freed through the string
     int allocated;
+    union {
+        char* pointer;
+        char bytes[STRING_INLINE_SIZE];
+    } text;
 } String;
 
+typedef struct StringArenaBlock {
+    struct StringArenaBlock* next;
+    size_t used;
+    size_t size;
+    char data[];
+} StringArenaBlock;
+
+// Bump allocator for strings that are all released together
+typedef struct {
+    StringArenaBlock* blocks;
+} StringArena;
+
+// The string's bytes, always followed by a terminator
+static inline char* string_data(String* string) {
+    return string->allocated == STRING_INLINE ? string->text.bytes : string->text.pointer;
+}
+
 String string_new(int initialSize);
 String string_new_static(char* data);
+String string_new_borrowed(char* data, int length);
+String string_new_arena(StringArena* arena, const char* data, int length);
 void string_init(String* string, int initialSize);
 void string_init_static(String* string, char* data);
 void string_grow(String* string, int additionalSize);
@@ -26,3 +60,9 @@ void string_free(String* string);
 void string_pop_char(String* string);
 void string_clear(String* string);
 String string_copy(String* string);
+String string_take(String* string);
+String string_view(String* string);
+
+void string_arena_init(StringArena* arena);
+void string_arena_reset(StringArena* arena);
+void string_arena_free(StringArena* arena);
@@ -0,0 +1,189 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        timerwheel.c
+// Description: This file contains the implementation for the TimerWheel.
+//              Timers are placed in the level whose slots are just coarse
+//              enough to hold their deadline, and moved down a level each
+//              time the level below wraps around.
+
+#define _GNU_SOURCE 1
+#include <stddef.h>
+#include <time.h>
+#include "timerwheel.h"
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+
+// Monotonic clock in milliseconds, the time base of every wheel
+uint64_t timer_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void timer_init(Timer* timer, TimerCallback callback, void* data) {
+    timer->next = NULL;
+    timer->link = NULL;
+    timer->deadline = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+bool timer_pending(Timer* timer) {
+    return timer->link != NULL;
+}
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now) {
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+            wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] = 0;
+    }
+    wheel->current = now;
+    wheel->count = 0;
+}
+
+// Link a timer into the slot covering its deadline, relative to the tick
+// about to expire
+static void timer_wheel_place(TimerWheel* wheel, Timer* timer) {
+    uint64_t delta = timer->deadline - wheel->current;
+    uint64_t when = timer->deadline;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1)) != 0)
+        level++;
+    // Past the top level's range: park it in the last slot of the rotation
+    if (delta >> (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS) != 0)
+        when = wheel->current + ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+    int slot = (when >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+
+    Timer** head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (timer->next != NULL)
+        timer->next->link = &timer->next;
+    timer->link = head;
+    *head = timer;
+    wheel->occupied[level] |= (uint64_t)1 << slot;
+}
+
+// Schedule a timer, or move it if it was already scheduled. Deadlines that
+// already passed expire on the next advance.
+void timer_wheel_schedule(TimerWheel* wheel, Timer* timer, uint64_t deadline) {
+    if (timer->link != NULL)
+        timer_wheel_cancel(wheel, timer);
+    timer->deadline = deadline > wheel->current ? deadline : wheel->current;
+    timer_wheel_place(wheel, timer);
+    wheel->count++;
+}
+
+void timer_wheel_cancel(TimerWheel* wheel, Timer* timer) {
+    if (timer->link == NULL)
+        return;
+    *timer->link = timer->next;
+    if (timer->next != NULL) {
+        timer->next->link = timer->link;
+    } else if (timer->link >= &wheel->slots[0][0] && timer->link < &wheel->slots[0][0] + TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOTS && *timer->link == NULL) {
+        // Last timer of its slot
+        ptrdiff_t index = timer->link - &wheel->slots[0][0];
+        wheel->occupied[index / TIMER_WHEEL_SLOTS] &= ~((uint64_t)1 << (index % TIMER_WHEEL_SLOTS));
+    }
+    timer->next = NULL;
+    timer->link = NULL;
+    wheel->count--;
+}
+
+// Move a slot's timers down to the levels their deadlines now fall in
+static void timer_wheel_cascade(TimerWheel* wheel, int level, int slot) {
+    Timer* timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~((uint64_t)1 << slot);
+    while (timer != NULL) {
+        Timer* next = timer->next;
+        timer_wheel_place(wheel, timer);
+        timer = next;
+    }
+}
+
+// Expire one tick's timers. The list is detached first, so callbacks can
+// reschedule their own timer or cancel others still waiting in it.
+static int timer_wheel_expire(TimerWheel* wheel, int slot) {
+    Timer* expired = wheel->slots[0][slot];
+    wheel->slots[0][slot] = NULL;
+    wheel->occupied[0] &= ~((uint64_t)1 << slot);
+    expired->link = &expired;
+    wheel->current++;
+
+    int count = 0;
+    Timer* timer;
+    while ((timer = expired) != NULL) {
+        expired = timer->next;
+        if (expired != NULL)
+            expired->link = &expired;
+        timer->next = NULL;
+        timer->link = NULL;
+        wheel->count--;
+        count++;
+        timer->callback(timer, timer->data);
+    }
+    return count;
+}
+
+// Run the callbacks of every timer due by now and return how many ran
+int timer_wheel_advance(TimerWheel* wheel, uint64_t now) {
+    int count = 0;
+    while (wheel->current <= now) {
+        int slot = wheel->current & TIMER_WHEEL_MASK;
+        if (slot == 0) {
+            // Highest level wrapping at this tick first, since its timers
+            // may land in slots of lower levels cascading now too
+            int top = 1;
+            while (top < TIMER_WHEEL_LEVELS - 1 && ((wheel->current >> (TIMER_WHEEL_BITS * top)) & TIMER_WHEEL_MASK) == 0)
+                top++;
+            for (int level = top; level > 0; level--)
+                timer_wheel_cascade(wheel, level, (wheel->current >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        }
+        if (wheel->occupied[0] & ((uint64_t)1 << slot))
+            count += timer_wheel_expire(wheel, slot);
+        else
+            wheel->current++;
+
+        // Skip to the next occupied slot or the end of this rotation
+        slot = wheel->current & TIMER_WHEEL_MASK;
+        if (slot != 0 && wheel->current <= now) {
+            uint64_t ahead = wheel->occupied[0] >> slot;
+            uint64_t skip = ahead != 0 ? (uint64_t)__builtin_ctzll(ahead) : (uint64_t)(TIMER_WHEEL_SLOTS - slot);
+            if (skip > now + 1 - wheel->current)
+                skip = now + 1 - wheel->current;
+            wheel->current += skip;
+        }
+    }
+    return count;
+}
+
+// Milliseconds an event loop can sleep before the next advance has work:
+// either a timer expires or a slot cascades. -1 when nothing is scheduled.
+long timer_wheel_timeout(TimerWheel* wheel, uint64_t now) {
+    if (wheel->count == 0)
+        return -1;
+    uint64_t wake = UINT64_MAX;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        if (occupied == 0)
+            continue;
+        int shift = TIMER_WHEEL_BITS * level;
+        uint64_t position = wheel->current >> shift;
+        int slot = position & TIMER_WHEEL_MASK;
+        uint64_t rotated = slot == 0 ? occupied : (occupied >> slot) | (occupied << (TIMER_WHEEL_SLOTS - slot));
+        // The current slot of a higher level was already cascaded unless
+        // the wheel sits exactly at its start: it holds a full rotation out
+        uint64_t offset;
+        if (level > 0 && (wheel->current & (((uint64_t)1 << shift) - 1)) != 0 && (rotated & 1))
+            offset = (rotated & ~(uint64_t)1) != 0 ? (uint64_t)__builtin_ctzll(rotated & ~(uint64_t)1) : TIMER_WHEEL_SLOTS;
+        else
+            offset = __builtin_ctzll(rotated);
+        uint64_t tick = (position + offset) << shift;
+        if (tick < wake)
+            wake = tick;
+    }
+    return wake > now ? (long)(wake - now) : 0;
+}
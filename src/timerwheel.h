@@ -0,0 +1,52 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        timerwheel.h
+// Description: This file contains the definitions for the TimerWheel, a
+//              hierarchical timing wheel with millisecond ticks that event
+//              loops use for pings, idle checks and other deadlines.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Each level has 64 slots, each 64 times as long as the level below: ticks
+// of 1ms, 64ms, ~4s and ~4.4min, so deadlines up to ~4.7h are placed
+// directly. Later ones are parked in the top level until they come closer.
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+
+typedef struct Timer Timer;
+typedef void (*TimerCallback)(Timer* timer, void* data);
+
+// Embedded in the object it times; the wheel never allocates
+struct Timer {
+    Timer* next;
+    // Link pointing at this timer, NULL while it is not scheduled
+    Timer** link;
+    uint64_t deadline;
+    TimerCallback callback;
+    void* data;
+};
+
+typedef struct {
+    Timer* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    // Bit per non-empty slot, to skip empty stretches of the wheel
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    // Next tick to expire, in milliseconds
+    uint64_t current;
+    int count;
+} TimerWheel;
+
+uint64_t timer_now(void);
+
+void timer_init(Timer* timer, TimerCallback callback, void* data);
+bool timer_pending(Timer* timer);
+
+void timer_wheel_init(TimerWheel* wheel, uint64_t now);
+void timer_wheel_schedule(TimerWheel* wheel, Timer* timer, uint64_t deadline);
+void timer_wheel_cancel(TimerWheel* wheel, Timer* timer);
+int timer_wheel_advance(TimerWheel* wheel, uint64_t now);
+long timer_wheel_timeout(TimerWheel* wheel, uint64_t now);
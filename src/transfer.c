@@ -0,0 +1,273 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        transfer.c
+// Description: This file contains the implementation for attachment
+//              transfers.
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include "string.h"
+#include "buffer.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "transfer.h"
+
+void transfer_sender_init(TransferSender* sender) {
+    sender->transfers = NULL;
+    sender->count = 0;
+    sender->capacity = 0;
+    sender->nextId = 0;
+    sender->stopped = false;
+    pthread_mutex_init(&sender->mutex, NULL);
+    pthread_cond_init(&sender->cond, NULL);
+    buffer_init(&sender->header, 16);
+}
+
+// Open a file for sending and assign it a transfer id. The transfer is not
+// streamed until it is queued, so the message announcing it can go first.
+int transfer_sender_open(TransferSender* sender, const char* path, OutgoingTransfer* transfer) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return -1;
+    }
+    transfer->id = __atomic_fetch_add(&sender->nextId, 1, __ATOMIC_RELAXED);
+    transfer->fd = fd;
+    transfer->size = st.st_size;
+    transfer->offset = 0;
+    return 0;
+}
+
+// Add a transfer to the back of the queue
+void transfer_sender_queue(TransferSender* sender, OutgoingTransfer* transfer) {
+    pthread_mutex_lock(&sender->mutex);
+    if (sender->count == sender->capacity) {
+        sender->capacity = sender->capacity > 0 ? sender->capacity * 2 : 4;
+        sender->transfers = realloc(sender->transfers, sender->capacity * sizeof(OutgoingTransfer));
+    }
+    sender->transfers[sender->count++] = *transfer;
+    pthread_cond_signal(&sender->cond);
+    pthread_mutex_unlock(&sender->mutex);
+}
+
+// Take the transfer at the front of the queue, waiting for one if needed.
+// Requeueing it after each chunk round-robins between concurrent transfers.
+// Returns false once the sender is stopped.
+bool transfer_sender_next(TransferSender* sender, OutgoingTransfer* transfer) {
+    pthread_mutex_lock(&sender->mutex);
+    while (sender->count == 0 && !sender->stopped)
+        pthread_cond_wait(&sender->cond, &sender->mutex);
+    bool stopped = sender->stopped;
+    if (!stopped) {
+        *transfer = sender->transfers[0];
+        sender->count--;
+        memmove(sender->transfers, sender->transfers + 1, sender->count * sizeof(OutgoingTransfer));
+    }
+    pthread_mutex_unlock(&sender->mutex);
+    return !stopped;
+}
+
+// Take the transfer at the front of the queue without waiting. Returns false
+// if none is queued.
+bool transfer_sender_poll(TransferSender* sender, OutgoingTransfer* transfer) {
+    pthread_mutex_lock(&sender->mutex);
+    bool found = sender->count > 0 && !sender->stopped;
+    if (found) {
+        *transfer = sender->transfers[0];
+        sender->count--;
+        memmove(sender->transfers, sender->transfers + 1, sender->count * sizeof(OutgoingTransfer));
+    }
+    pthread_mutex_unlock(&sender->mutex);
+    return found;
+}
+
+void transfer_sender_stop(TransferSender* sender) {
+    pthread_mutex_lock(&sender->mutex);
+    sender->stopped = true;
+    pthread_cond_broadcast(&sender->cond);
+    pthread_mutex_unlock(&sender->mutex);
+}
+
+void transfer_sender_free(TransferSender* sender) {
+    for (int i = 0; i < sender->count; i++)
+        transfer_close(&sender->transfers[i]);
+    free(sender->transfers);
+    pthread_mutex_destroy(&sender->mutex);
+    pthread_cond_destroy(&sender->cond);
+    buffer_free(&sender->header);
+}
+
+void transfer_close(OutgoingTransfer* transfer) {
+    if (transfer->fd >= 0)
+        close(transfer->fd);
+    transfer->fd = -1;
+}
+
+// Send the next chunk of a transfer as a data frame. Only the frame header
+// passes through userspace; the payload goes from the page cache to the
+// socket with sendfile.
+int transfer_send_chunk(int socket, Buffer* header, uint8_t version, OutgoingTransfer* transfer) {
+    uint64_t remaining = transfer->size - transfer->offset;
+    uint32_t length = remaining < TRANSFER_CHUNK_SIZE ? remaining : TRANSFER_CHUNK_SIZE;
+
+    buffer_clear(header);
+    protocol_frame_encode_data_header(header, version, transfer->id, length);
+    metrics_frame_out(FRAME_DATA, header->length + length);
+    if (send(socket, header->data, header->length, MSG_MORE) != (ssize_t)header->length)
+        return -1;
+
+    uint64_t end = transfer->offset + length;
+    while (transfer->offset < end) {
+        off_t offset = transfer->offset;
+        ssize_t sent = sendfile(socket, transfer->fd, &offset, end - transfer->offset);
+        metrics_add(METRIC_SYSCALL_SENDFILE, 1);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (sent == 0) {
+            // The file shrank after it was announced; pad the chunk with
+            // zeros so the stream stays framed
+            static const uint8_t zeros[4096];
+            while (transfer->offset < end) {
+                size_t padding = end - transfer->offset < sizeof(zeros) ? end - transfer->offset : sizeof(zeros);
+                ssize_t written = write(socket, zeros, padding);
+                if (written < 0)
+                    return -1;
+                transfer->offset += written;
+            }
+            break;
+        }
+        transfer->offset += sent;
+    }
+    return 0;
+}
+
+// Read the next chunk of a transfer into a complete data frame. Used when
+// the same chunk is fanned out to many sockets and cannot be sendfile'd.
+int transfer_read_chunk(Buffer* buffer, uint8_t version, OutgoingTransfer* transfer) {
+    uint64_t remaining = transfer->size - transfer->offset;
+    uint32_t length = remaining < TRANSFER_CHUNK_SIZE ? remaining : TRANSFER_CHUNK_SIZE;
+
+    buffer_clear(buffer);
+    buffer_reserve(buffer, PROTOCOL_HEADER_SIZE + 8 + length);
+    protocol_frame_encode_data_header(buffer, version, transfer->id, length);
+    metrics_frame_out(FRAME_DATA, buffer->length + length);
+    uint8_t* data = buffer->data + buffer->length;
+    size_t filled = 0;
+    while (filled < length) {
+        ssize_t result = pread(transfer->fd, data + filled, length - filled, transfer->offset + filled);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (result == 0) {
+            memset(data + filled, 0, length - filled);
+            break;
+        }
+        filled += result;
+    }
+    buffer->length += length;
+    transfer->offset += length;
+    return 0;
+}
+
+void transfer_receiver_init(TransferReceiver* receiver, String directory) {
+    receiver->transfers = NULL;
+    receiver->count = 0;
+    receiver->capacity = 0;
+    receiver->directory = directory;
+}
+
+// Start receiving an attachment announced by a message. The file is created
+// in the download directory under the attachment's base name, and its path
+// is returned so the message can show where it was saved.
+int transfer_receiver_begin(TransferReceiver* receiver, uint32_t id, String* name, uint64_t size, String* path) {
+    // Never let a peer choose a path outside the download directory
+    char* baseName = strrchr(string_data(name), '/');
+    baseName = baseName != NULL ? baseName + 1 : string_data(name);
+    if (baseName[0] == '\0' || strcmp(baseName, ".") == 0 || strcmp(baseName, "..") == 0)
+        baseName = "attachment";
+
+    *path = string_new(receiver->directory.length + strlen(baseName) + 1);
+    string_append(path, &receiver->directory);
+    string_append_char(path, '/');
+    string_append_static(path, baseName);
+
+    if (mkdir(string_data(&receiver->directory), 0755) < 0 && errno != EEXIST)
+        return -1;
+    int fd = open(string_data(path), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    if (receiver->count == receiver->capacity) {
+        receiver->capacity = receiver->capacity > 0 ? receiver->capacity * 2 : 4;
+        receiver->transfers = realloc(receiver->transfers, receiver->capacity * sizeof(IncomingTransfer));
+    }
+    receiver->transfers[receiver->count++] = (IncomingTransfer){
+        .id = id,
+        .fd = fd,
+        .remaining = size,
+    };
+    return 0;
+}
+
+// Write a received chunk straight from the receive buffer to its file
+int transfer_receiver_write(TransferReceiver* receiver, DataFrame* frame) {
+    int index = -1;
+    for (int i = 0; i < receiver->count; i++) {
+        if (receiver->transfers[i].id == frame->transferId) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0)
+        return -1;
+
+    IncomingTransfer* transfer = &receiver->transfers[index];
+    uint32_t length = frame->length < transfer->remaining ? frame->length : transfer->remaining;
+    size_t offset = 0;
+    while (offset < length) {
+        ssize_t written = write(transfer->fd, frame->data + offset, length - offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        offset += written;
+    }
+    transfer->remaining -= length;
+
+    if (offset < length || transfer->remaining == 0) {
+        close(transfer->fd);
+        receiver->transfers[index] = receiver->transfers[--receiver->count];
+    }
+    return offset < length ? -1 : 0;
+}
+
+void transfer_receiver_free(TransferReceiver* receiver) {
+    for (int i = 0; i < receiver->count; i++)
+        close(receiver->transfers[i].fd);
+    free(receiver->transfers);
+    receiver->transfers = NULL;
+    receiver->count = 0;
+}
@@ -0,0 +1,68 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        transfer.h
+// Description: This file contains the definitions for attachment transfers.
+//              Outgoing files are streamed from disk in data frames with
+//              sendfile; incoming data frames are written to a download
+//              directory.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "string.h"
+#include "buffer.h"
+#include "protocol.h"
+
+// Data frames are kept small enough that chat frames queued behind a
+// transfer only wait for one chunk
+#define TRANSFER_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+    uint32_t id;
+    int fd;
+    uint64_t size;
+    uint64_t offset;
+} OutgoingTransfer;
+
+typedef struct {
+    OutgoingTransfer* transfers;
+    int count;
+    int capacity;
+    uint32_t nextId;
+    bool stopped;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Buffer header;
+} TransferSender;
+
+typedef struct {
+    uint32_t id;
+    int fd;
+    uint64_t remaining;
+} IncomingTransfer;
+
+typedef struct {
+    IncomingTransfer* transfers;
+    int count;
+    int capacity;
+    String directory;
+} TransferReceiver;
+
+void transfer_sender_init(TransferSender* sender);
+int transfer_sender_open(TransferSender* sender, const char* path, OutgoingTransfer* transfer);
+void transfer_sender_queue(TransferSender* sender, OutgoingTransfer* transfer);
+bool transfer_sender_next(TransferSender* sender, OutgoingTransfer* transfer);
+bool transfer_sender_poll(TransferSender* sender, OutgoingTransfer* transfer);
+void transfer_sender_stop(TransferSender* sender);
+void transfer_sender_free(TransferSender* sender);
+int transfer_send_chunk(int socket, Buffer* header, uint8_t version, OutgoingTransfer* transfer);
+int transfer_read_chunk(Buffer* buffer, uint8_t version, OutgoingTransfer* transfer);
+void transfer_close(OutgoingTransfer* transfer);
+
+void transfer_receiver_init(TransferReceiver* receiver, String directory);
+int transfer_receiver_begin(TransferReceiver* receiver, uint32_t id, String* name, uint64_t size, String* path);
+int transfer_receiver_write(TransferReceiver* receiver, DataFrame* frame);
+void transfer_receiver_free(TransferReceiver* receiver);
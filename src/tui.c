@@ -0,0 +1,210 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        tui.c
+// Description: This file contains the implementation for the Tui, which
+//              draws the app's state from its update callback and feeds
+//              keyboard input back to it.
+
+#include "tui.h"
+#ifndef CHAT_NO_TUI
+#include <stdbool.h>
+#include <string.h>
+#include "metrics.h"
+
+void tui_init(Tui* tui) {
+    initscr();
+
+    start_color();
+    // status text green background
+    init_pair(1, COLOR_BLACK, COLOR_GREEN);
+    // status text red background
+    init_pair(2, COLOR_BLACK, COLOR_RED);
+    // status text yellow background
+    init_pair(3, COLOR_BLACK, COLOR_YELLOW);
+
+    tui->statusWindow = newwin(1, 0, 0, 0);
+    tui->messageWindow = newwin(LINES - 2, 0, 1, 0);
+    tui->inputWindow = newwin(1, 0, LINES - 1, 0);
+    string_init(&tui->sendBuffer, 0);
+    tui->renderedMessage = 0;
+
+    scrollok(tui->messageWindow, TRUE);
+    // Page keys come as single codes, and ESC on its own is told apart
+    // from them quickly
+    keypad(tui->inputWindow, TRUE);
+    set_escdelay(TUI_ESC_DELAY);
+    wrefresh(tui->statusWindow);
+    wrefresh(tui->messageWindow);
+    wrefresh(tui->inputWindow);
+}
+
+// Messages that fit in the message window, replayed from the log
+int tui_message_rows(Tui* tui) {
+    return getmaxy(tui->messageWindow);
+}
+
+// Messages a view scrolled back shows, the last row staying empty as it
+// does below new messages
+static int tui_view_rows(Tui* tui) {
+    int rows = getmaxy(tui->messageWindow) - 1;
+    return rows > 0 ? rows : 1;
+}
+
+void tui_free(Tui* tui) {
+    delwin(tui->statusWindow);
+    delwin(tui->messageWindow);
+    delwin(tui->inputWindow);
+    endwin();
+    string_free(&tui->sendBuffer);
+}
+
+static void tui_render_status(Tui* tui, ChatApp* app) {
+    werase(tui->statusWindow);
+    switch (app->status) {
+        case DISCONNECTED:
+            wbkgd(tui->statusWindow, COLOR_PAIR(2));
+            break;
+        case CONNECTED:
+            wbkgd(tui->statusWindow, COLOR_PAIR(1));
+            break;
+        case IDLE:
+            wbkgd(tui->statusWindow, COLOR_PAIR(3));
+            break;
+    }
+
+    char* statusString = app->status == DISCONNECTED
+        ? "Disconnected"
+        : app->status == CONNECTED
+        ? "Connected" 
+        : "Idle";
+    char linkString[64] = "";
+    if (app->status != DISCONNECTED && app->link.samples > 0) {
+        linkString[0] = ' ';
+        linkString[1] = ' ';
+        link_stats_format(&app->link, linkString + 2, sizeof(linkString) - 2);
+    }
+
+    int padding = COLS - strlen(statusString) - strlen(linkString) - app->peerAddr.length;
+    wprintw(tui->statusWindow, "%s%s", statusString, linkString);
+    for (int i = 0; i < padding; i++) wprintw(tui->statusWindow, " ");
+    wprintw(tui->statusWindow, "%s\n", string_data(&app->peerAddr));
+    wnoutrefresh(tui->statusWindow);
+}
+
+static void tui_render_message(Tui* tui, ChatApp* app, Message* message) {
+    wprintw(tui->messageWindow, "%s: %s\n", string_data(chat_app_message_sender(app, message)), string_data(&message->content));
+    for (int j = 0; j < message->attachmentCount; j++)
+        wprintw(tui->messageWindow, "Attachment: %s\n", string_data(&message->attachments[j]));
+}
+
+// Append messages that arrived since the last render. The window scrolls on
+// its own, so history that is already on screen is never redrawn; a full
+// redraw only replays as many messages as can be visible.
+static void tui_render_messages(Tui* tui, ChatApp* app, bool redraw) {
+    size_t end = history_end(&app->history);
+    int height = getmaxy(tui->messageWindow);
+    // A view scrolled back stays put as messages arrive, so it is only
+    // drawn again when it moves or a page of older messages comes in
+    if (app->scroll > 0) {
+        if (redraw) {
+            werase(tui->messageWindow);
+            Message* rows[tui_view_rows(tui)];
+            int count = chat_app_view(app, rows, tui_view_rows(tui));
+            for (int i = 0; i < count; i++)
+                tui_render_message(tui, app, rows[i]);
+            wnoutrefresh(tui->messageWindow);
+        }
+        tui->renderedMessage = end;
+        return;
+    }
+    // Messages evicted or scrolled past before they were drawn are skipped
+    if (redraw || end - tui->renderedMessage > (size_t)height) {
+        werase(tui->messageWindow);
+    } else if (tui->renderedMessage == end) {
+        return;
+    } else {
+        height = end - tui->renderedMessage;
+    }
+    Message* rows[height > 0 ? height : 1];
+    int count = history_view(&app->history, end, rows, height);
+    for (int i = 0; i < count; i++)
+        tui_render_message(tui, app, rows[i]);
+    tui->renderedMessage = end;
+    wnoutrefresh(tui->messageWindow);
+}
+
+static void tui_render_input(Tui* tui) {
+    werase(tui->inputWindow);
+    if (tui->sendBuffer.length > COLS - 2) {
+        wprintw(tui->inputWindow, "..%s", string_data(&tui->sendBuffer) + tui->sendBuffer.length - (COLS - 4));
+    } else {
+        wprintw(tui->inputWindow, "> %s", string_data(&tui->sendBuffer));
+    }
+}
+
+// Redraw only what changed since the last render. Called by the app with
+// its state locked.
+static void tui_on_update(ChatApp* app, int parts, void* data) {
+    Tui* tui = data;
+    if (parts & RENDER_STATUS)
+        tui_render_status(tui, app);
+    tui_render_messages(tui, app, parts & RENDER_MESSAGES);
+    if (parts & RENDER_INPUT)
+        tui_render_input(tui);
+    // Refreshed last so the cursor ends up in the input line
+    wnoutrefresh(tui->inputWindow);
+    doupdate();
+}
+
+void tui_attach(Tui* tui, ChatApp* app) {
+    app->callbacks = (ChatAppCallbacks){
+        .onUpdate = tui_on_update,
+    };
+    app->callbackData = tui;
+}
+
+// Lay the windows out again after the terminal was resized
+static void tui_resize(Tui* tui, ChatApp* app) {
+    metrics_lock(&app->stateMutex, METRIC_STATE_LOCK_WAIT);
+    wresize(tui->statusWindow, 1, COLS);
+    wresize(tui->messageWindow, LINES - 2, COLS);
+    wresize(tui->inputWindow, 1, COLS);
+    mvwin(tui->inputWindow, LINES - 1, 0);
+    pthread_mutex_unlock(&app->stateMutex);
+    chat_app_invalidate(app, RENDER_ALL);
+}
+
+// Read keys until ESC
+int tui_run(Tui* tui, ChatApp* app) {
+    while (true) {
+        chat_app_render(app);
+        int ch = wgetch(tui->inputWindow);
+        chat_app_input(app);
+        chat_app_invalidate(app, RENDER_INPUT);
+        if (ch == 27) // ESC
+            break;
+        else if (ch == KEY_RESIZE)
+            tui_resize(tui, app);
+        else if (ch == 10) { // ENTER
+            if (app->status == DISCONNECTED)
+                continue;
+            // Keep the text in the input line if it could not be sent
+            if (chat_app_send(app, &tui->sendBuffer))
+                string_clear(&tui->sendBuffer);
+        } else if (ch == 127 || ch == KEY_BACKSPACE) {
+            if (tui->sendBuffer.length > 0)
+                string_pop_char(&tui->sendBuffer);
+        } else if (ch == KEY_PPAGE || ch == KEY_NPAGE) {
+            // Keep one message of the last page in view
+            int rows = tui_view_rows(tui);
+            long page = rows > 1 ? rows - 1 : 1;
+            chat_app_scroll(app, ch == KEY_PPAGE ? page : -page, rows);
+        } else if (ch < KEY_MIN) {
+            string_append_char(&tui->sendBuffer, ch);
+        }
+    }
+    return 0;
+}
+#endif
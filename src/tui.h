@@ -0,0 +1,34 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        tui.h
+// Description: This file contains the definitions for the Tui, the ncurses
+//              front end. Builds with CHAT_NO_TUI defined leave it out and
+//              do not link ncurses.
+
+#pragma once
+#ifndef CHAT_NO_TUI
+#include <ncurses.h>
+#include "string.h"
+#include "app.h"
+
+// Milliseconds to wait after ESC for the rest of a key's sequence
+#define TUI_ESC_DELAY 50
+
+typedef struct {
+    WINDOW* statusWindow;
+    WINDOW* messageWindow;
+    WINDOW* inputWindow;
+    String sendBuffer;
+    // History index one past the last message drawn; anything after it is
+    // appended on render
+    size_t renderedMessage;
+} Tui;
+
+void tui_init(Tui* tui);
+int tui_message_rows(Tui* tui);
+void tui_attach(Tui* tui, ChatApp* app);
+int tui_run(Tui* tui, ChatApp* app);
+void tui_free(Tui* tui);
+#endif
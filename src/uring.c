@@ -0,0 +1,198 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        uring.c
+// Description: This file contains the implementation for the Uring. There
+//              is no liburing dependency: the rings are set up and entered
+//              with raw system calls, so kernels without io_uring simply
+//              fail uring_init and callers fall back to epoll.
+
+#define _GNU_SOURCE 1
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+#include "metrics.h"
+
+static int uring_setup(unsigned entries, struct io_uring_params* params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned waitCount, unsigned flags, void* arg, size_t argSize) {
+    return syscall(__NR_io_uring_enter, fd, submit, waitCount, flags, arg, argSize);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+// Returns -1 with errno set when the kernel has no io_uring, or lacks the
+// features the caller relies on: a single ring mapping and timed waits
+int uring_init(Uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    memset(ring, 0, sizeof(Uring));
+    ring->fd = uring_setup(entries, &params);
+    if (ring->fd < 0)
+        return -1;
+    ring->features = params.features;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        close(ring->fd);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqRingSize = sqSize > cqSize ? sqSize : cqSize;
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRing == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->cqRing = ring->sqRing;
+    ring->cqRingSize = 0;
+    ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+        close(ring->fd);
+        return -1;
+    }
+
+    uint8_t* sq = ring->sqRing;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqEntries = params.sq_entries;
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqLocalTail = *ring->sqTail;
+    uint8_t* cq = ring->cqRing;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+void uring_free(Uring* ring) {
+    munmap(ring->sqes, ring->sqEntries * sizeof(struct io_uring_sqe));
+    munmap(ring->sqRing, ring->sqRingSize);
+    close(ring->fd);
+}
+
+// Publish the entries handed out so far and enter the kernel to submit
+// them, waiting for up to waitCount completions for at most timeoutMillis,
+// or without limit when it is negative
+int uring_submit(Uring* ring, unsigned waitCount, long timeoutMillis) {
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    // Anything the kernel has not consumed yet, including entries left
+    // over when an earlier call failed
+    unsigned submit = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec timeout = {
+        .tv_sec = timeoutMillis / 1000,
+        .tv_nsec = timeoutMillis % 1000 * 1000000,
+    };
+    struct io_uring_getevents_arg arg = {
+        .sigmask = 0,
+        .sigmask_sz = _NSIG / 8,
+        .ts = timeoutMillis >= 0 ? (uint64_t)(uintptr_t)&timeout : 0,
+    };
+    unsigned flags = IORING_ENTER_EXT_ARG | (waitCount > 0 ? IORING_ENTER_GETEVENTS : 0);
+    int result;
+    do {
+        result = uring_enter(ring->fd, submit, waitCount, flags, &arg, sizeof(arg));
+        metrics_add(METRIC_SYSCALL_URING_ENTER, 1);
+    } while (result < 0 && errno == EINTR && submit == 0);
+    // A timeout with nothing completed is not an error, and neither is a
+    // full completion ring: the caller reaps it before submitting again
+    if (result < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY))
+        return 0;
+    return result;
+}
+
+// Next free submission entry, cleared. Entries are only submitted by
+// uring_submit, unless the ring fills up first.
+struct io_uring_sqe* uring_get_sqe(Uring* ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqLocalTail - head >= ring->sqEntries) {
+        uring_submit(ring, 0, -1);
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (ring->sqLocalTail - head >= ring->sqEntries)
+            return NULL;
+    }
+    unsigned index = ring->sqLocalTail & ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sqArray[index] = index;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+// Oldest unread completion, or NULL when there is none
+struct io_uring_cqe* uring_peek_cqe(Uring* ring) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cqMask];
+}
+
+void uring_cqe_seen(Uring* ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+// Register count buffers of size bytes under group. count must be a power
+// of two. Needs Linux 5.19; fails with EINVAL on older kernels.
+int uring_buffers_init(Uring* ring, UringBuffers* buffers, uint16_t group, unsigned count, unsigned size) {
+    buffers->ringSize = count * sizeof(struct io_uring_buf);
+    buffers->ring = mmap(NULL, buffers->ringSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers->ring == MAP_FAILED)
+        return -1;
+    buffers->buffers = malloc((size_t)count * size);
+    buffers->count = count;
+    buffers->size = size;
+    buffers->group = group;
+    buffers->tail = 0;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)buffers->ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(buffers->ring, buffers->ringSize);
+        free(buffers->buffers);
+        return -1;
+    }
+    for (unsigned id = 0; id < count; id++)
+        uring_buffer_return(buffers, id);
+    return 0;
+}
+
+void uring_buffers_free(Uring* ring, UringBuffers* buffers) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = buffers->group;
+    uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(buffers->ring, buffers->ringSize);
+    free(buffers->buffers);
+}
+
+uint8_t* uring_buffer(UringBuffers* buffers, unsigned id) {
+    return buffers->buffers + (size_t)id * buffers->size;
+}
+
+// Hand a buffer back to the kernel for the next receive
+void uring_buffer_return(UringBuffers* buffers, unsigned id) {
+    struct io_uring_buf* entry = &buffers->ring->bufs[buffers->tail & (buffers->count - 1)];
+    entry->addr = (uint64_t)(uintptr_t)uring_buffer(buffers, id);
+    entry->len = buffers->size;
+    entry->bid = id;
+    buffers->tail++;
+    __atomic_store_n(&buffers->ring->tail, buffers->tail, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,62 @@
+// Class:       CS 4390 - Computer Networks
+// Assignment:  Chat Application Project
+// Author:      Juan Llamas
+// Build:       gcc -std=c99 -lncurses -lm -lpthread *.c -o chat
+// File:        uring.h
+// Description: This file contains the definitions for the Uring, a thin
+//              wrapper over the io_uring system calls: the mapped submission
+//              and completion rings, and rings of provided receive buffers
+//              the kernel picks from as data arrives.
+
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+typedef struct {
+    int fd;
+    unsigned features;
+    // Submission ring, shared with the kernel
+    void* sqRing;
+    size_t sqRingSize;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    // Entries handed out, published to the kernel by uring_submit
+    unsigned sqLocalTail;
+    // Completion ring, in the same mapping when the kernel supports it
+    void* cqRing;
+    size_t cqRingSize;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+} Uring;
+
+// Buffers the kernel fills for receives that ask for buffer selection. The
+// id of the buffer used comes back in the completion's flags, and the
+// buffer goes back to the kernel once its data has been consumed.
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    size_t ringSize;
+    uint8_t* buffers;
+    unsigned count;
+    unsigned size;
+    uint16_t group;
+    uint16_t tail;
+} UringBuffers;
+
+int uring_init(Uring* ring, unsigned entries);
+void uring_free(Uring* ring);
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+int uring_submit(Uring* ring, unsigned waitCount, long timeoutMillis);
+struct io_uring_cqe* uring_peek_cqe(Uring* ring);
+void uring_cqe_seen(Uring* ring);
+
+int uring_buffers_init(Uring* ring, UringBuffers* buffers, uint16_t group, unsigned count, unsigned size);
+void uring_buffers_free(Uring* ring, UringBuffers* buffers);
+uint8_t* uring_buffer(UringBuffers* buffers, unsigned id);
+void uring_buffer_return(UringBuffers* buffers, unsigned id);